@@ -154,6 +154,25 @@ CREATE OR REPLACE FUNCTION set_prob(
   RETURNS void AS
   'provsql','set_prob' LANGUAGE C PARALLEL RESTRICTED;
 
+/**
+ * @brief Write the probabilities a relation lists, in bulk
+ *
+ * Reads @p token_att and @p prob_att from every row of @p tbl and
+ * writes each probability under the rules of @c set_prob, sending them
+ * to the circuit store in batches rather than one round trip per token.
+ * Rows with a NULL token or probability are skipped.
+ *
+ * @param tbl the relation to read, a provenance-tracked table or any
+ *        other relation pairing tokens with probabilities
+ * @param prob_att the column holding the probabilities
+ * @param token_att the column holding the tokens
+ * @return the number of probabilities written or already held
+ */
+CREATE OR REPLACE FUNCTION set_prob_from(
+  tbl regclass, prob_att text, token_att text DEFAULT 'provsql')
+  RETURNS bigint AS
+  'provsql','set_prob_from' LANGUAGE C;
+
 /**
  * @brief Report whether a probability has been written on a gate
  *
@@ -1105,7 +1124,7 @@ CREATE OR REPLACE FUNCTION get_ancestors(relid OID)
  *
  * Two jobs:
  *
- *  1. Fill @c NEW.provsql with a fresh @c uuid_generate_v4 leaf when
+ *  1. Fill @c NEW.provsql with a fresh random (version 4) leaf when
  *     the user did not supply one (a column DEFAULT would not do here:
  *     it fires before the trigger sees the row, so we could not tell
  *     "user omitted the column" from "user supplied a value").
@@ -1118,62 +1137,37 @@ CREATE OR REPLACE FUNCTION get_ancestors(relid OID)
  *     independence can no longer be assumed.  The exception is a
  *     leaf @c provsql.replace_input / @c replace_block minted in
  *     this transaction: that one *is* an independent fresh leaf, so
- *     the kind survives and the maintained mappings follow the
- *     token to its replacement.
+ *     the kind survives and the table's mappings follow the token to
+ *     its replacement.
+ *
+ * Rows that got a fresh leaf are also what the table's maintained
+ * mappings are extended with, once per statement, by
+ * @c provenance_mapping_maintain.  Written in C: it fires for every
+ * row of every bulk load into a tracked table, and caches the
+ * table's @c provenance_mapping_registry entries rather than
+ * querying them for each row.
  */
 CREATE OR REPLACE FUNCTION provenance_guard()
-  RETURNS TRIGGER AS $$
-DECLARE
-  _m RECORD;
-BEGIN
-  IF TG_OP = 'INSERT' THEN
-    IF NEW.provsql IS NULL THEN
-      -- A genuine insert: mint a fresh atomic input variable. This is the
-      -- one place a new input token is born, so it is also where any
-      -- maintained mapping on this table is extended (keyed to that token).
-      -- Data-modification re-insertions (INSERT ... SELECT * FROM OLD_TABLE)
-      -- carry a supplied provsql and take the ELSE branch, so they are
-      -- correctly skipped: the validity stays keyed to the original input,
-      -- which is exactly the child a later monus/update gate wraps.
-      NEW.provsql := public.uuid_generate_v4();
-      FOR _m IN SELECT mapping, attribute
-                  FROM provsql.provenance_mapping_registry
-                 WHERE source = TG_RELID AND maintained
-      LOOP
-        EXECUTE format(
-          'INSERT INTO %s(value, provenance) SELECT ($1).%I, $2',
-          _m.mapping::regclass, _m.attribute)
-          USING NEW, NEW.provsql;
-      END LOOP;
-    ELSE
-      PERFORM provsql.set_table_info(TG_RELID, 'opaque');
-    END IF;
-  ELSIF TG_OP = 'UPDATE' THEN
-    IF NEW.provsql IS DISTINCT FROM OLD.provsql THEN
-      IF provsql.is_fresh_leaf(NEW.provsql) THEN
-        -- A replacement leaf minted by provsql.replace_input /
-        -- replace_block in this transaction: an independent fresh leaf by
-        -- construction, so the table's kind survives.  Carry the
-        -- maintained mappings over from the token it replaces, the same
-        -- job the INSERT branch does for a new row.
-        FOR _m IN SELECT mapping, attribute
-                    FROM provsql.provenance_mapping_registry WHERE source = TG_RELID
-        LOOP
-          EXECUTE format(
-            'INSERT INTO %1$s(value, provenance) '
-            'SELECT value, $2 FROM %1$s WHERE provenance = $1',
-            _m.mapping::regclass)
-            USING OLD.provsql, NEW.provsql;
-        END LOOP;
-      ELSE
-        PERFORM provsql.set_table_info(TG_RELID, 'opaque');
-      END IF;
-    END IF;
-  END IF;
-  RETURN NEW;
-END;
-$$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public
-   SECURITY DEFINER;
+  RETURNS TRIGGER AS
+  'provsql','provenance_guard' LANGUAGE C
+  SET search_path=provsql,pg_temp,public SECURITY DEFINER;
+
+/**
+ * @brief Statement triggers extending a table's maintained mappings
+ *
+ * Installed by @c create_provenance_mapping on the source of a
+ * maintained mapping, twice: as @c provenance_mapping_begin
+ * (BEFORE INSERT FOR EACH STATEMENT) it opens a frame in which
+ * @c provenance_guard notes the tokens it mints; as
+ * @c provenance_mapping_maintain (AFTER INSERT FOR EACH STATEMENT,
+ * with the transition table @c provsql_new_rows) it appends the
+ * statement's new rows to every maintained mapping of the table, in
+ * one @c INSERT ... @c SELECT per mapping.
+ */
+CREATE OR REPLACE FUNCTION provenance_mapping_maintain()
+  RETURNS TRIGGER AS
+  'provsql','provenance_mapping_maintain' LANGUAGE C
+  SET search_path=provsql,pg_temp,public SECURITY DEFINER;
 
 /**
  * @brief Enable provenance tracking on an existing table
@@ -1257,6 +1251,8 @@ BEGIN
     EXECUTE format('DROP TRIGGER provenance_guard on %s', _tbl);
   EXCEPTION WHEN undefined_object THEN
   END;
+  EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_begin ON %s', _tbl);
+  EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_maintain ON %s', _tbl);
   EXECUTE format('ALTER TABLE %s DROP COLUMN provsql', _tbl);
   BEGIN
     EXECUTE format('DROP TRIGGER add_gate on %s', _tbl);
@@ -1271,6 +1267,20 @@ BEGIN
 END
 $$ LANGUAGE plpgsql;
 
+/**
+ * @brief Create the gates of a table being repaired by @c repair_key
+ *
+ * Reads the tokens staged in the table's @c provsql_temp column in one
+ * scan, grouped in blocks by the columns of @p block_key (all of the
+ * table when empty), and creates, per block, an input gate for its key
+ * and, per row, a mulinput gate over it recording the row's position in
+ * the block and the block's size.
+ *
+ * @return the number of rows given a mulinput gate
+ */
+CREATE OR REPLACE FUNCTION repair_key_gates(_tbl regclass, block_key int2[])
+  RETURNS bigint AS 'provsql','repair_key_gates' LANGUAGE C;
+
 /**
  * @brief Set up provenance for a table with duplicate key values
  *
@@ -1289,8 +1299,6 @@ CREATE OR REPLACE FUNCTION repair_key(_tbl regclass, key_att text)
   RETURNS void AS
 $$
 DECLARE
-  r RECORD;
-  rows_query TEXT;
   block_key_cols INT2[];
 BEGIN
   -- Resolve the (possibly comma-separated) key_att text into the
@@ -1319,69 +1327,20 @@ BEGIN
   -- Same column shape as add_provenance: no UNIQUE, no DEFAULT past
   -- the initial backfill (the guard trigger added after the rename
   -- takes over both jobs once the column has been renamed to its
-  -- final name).  The DEFAULT is kept here only so the second pass
-  -- below can read provsql_temp from the user-visible rows
+  -- final name).  The DEFAULT is kept here only so the gate-building
+  -- pass below can read provsql_temp from the user-visible rows
   -- without a separate UPDATE.
   EXECUTE format('ALTER TABLE %s ADD COLUMN provsql_temp UUID DEFAULT public.uuid_generate_v4()', _tbl);
 
-  -- Build a per-group mapping (key columns + a fresh key_token + the
-  -- group size) once, then use it for both the create_gate(key_token,
-  -- 'input') first pass and the per-row mulinput second pass.  Going
-  -- through a temp table avoids re-running uuid_generate_v4() (which
-  -- would produce different UUIDs the second time).  USING (%1$s) on
-  -- the second pass handles the multi-column case uniformly.
-  -- ON COMMIT DROP plus the explicit DROP TABLE at the end of this
-  -- function leave the temp table cleaned up across transactions and
-  -- across repeated calls in the same transaction.
-  IF key_att = '' THEN
-    EXECUTE format(
-      'CREATE TEMP TABLE provsql_repair_key_tmp ON COMMIT DROP AS
-         SELECT public.uuid_generate_v4() AS provsql_key_token,
-                COUNT(*) AS provsql_group_size
-           FROM %s', _tbl);
-    rows_query := format(
-      'SELECT t.provsql_temp,
-              k.provsql_key_token AS key_token,
-              ROW_NUMBER() OVER (ORDER BY t.ctid) AS within_group,
-              k.provsql_group_size AS group_size
-         FROM %s t CROSS JOIN provsql_repair_key_tmp k', _tbl);
-  ELSE
-    EXECUTE format(
-      'CREATE TEMP TABLE provsql_repair_key_tmp ON COMMIT DROP AS
-         SELECT %1$s,
-                public.uuid_generate_v4() AS provsql_key_token,
-                COUNT(*) AS provsql_group_size
-           FROM %2$s
-       GROUP BY %1$s', key_att, _tbl);
-    rows_query := format(
-      'SELECT t.provsql_temp,
-              k.provsql_key_token AS key_token,
-              ROW_NUMBER() OVER (PARTITION BY k.provsql_key_token
-                                 ORDER BY t.ctid) AS within_group,
-              k.provsql_group_size AS group_size
-         FROM %2$s t
-         JOIN provsql_repair_key_tmp k USING (%1$s)', key_att, _tbl);
-  END IF;
-
-  -- Pass 1: one input gate per group key.
-  FOR r IN SELECT provsql_key_token FROM provsql_repair_key_tmp LOOP
-    PERFORM provsql.create_gate(r.provsql_key_token, 'input');
-  END LOOP;
-
-  -- Pass 2: per row, attach a mulinput gate to its group's key token.
-  -- The block size goes in info2 rather than the uniform 1/size going
-  -- in the probability: a repaired row's probability is the user's to
-  -- write (the documented "repair_key then set_prob(provenance(), p)"
-  -- pattern), and probabilities are written once.  A row nobody gives
-  -- a probability evaluates at 1/size all the same -- see
-  -- MMappedCircuit::getProb.
-  FOR r IN EXECUTE rows_query LOOP
-    PERFORM provsql.create_gate(r.provsql_temp, 'mulinput', ARRAY[r.key_token]);
-    PERFORM provsql.set_infos(r.provsql_temp, r.within_group::int,
-                              r.group_size::int);
-  END LOOP;
-
-  DROP TABLE provsql_repair_key_tmp;
+  -- One scan of the table, in C: every block's key gets an input
+  -- gate, and every row a mulinput gate over it, with its position in
+  -- the block in info1 and the block size in info2 rather than the
+  -- uniform 1/size in the probability: a repaired row's probability
+  -- is the user's to write (the documented "repair_key then
+  -- set_prob(provenance(), p)" pattern), and probabilities are written
+  -- once.  A row nobody gives a probability evaluates at 1/size all
+  -- the same -- see MMappedCircuit::getProb.
+  PERFORM provsql.repair_key_gates(_tbl, block_key_cols);
 
   EXECUTE format('ALTER TABLE %s ALTER COLUMN provsql_temp DROP DEFAULT', _tbl);
   EXECUTE format('ALTER TABLE %s RENAME COLUMN provsql_temp TO provsql', _tbl);
@@ -1415,6 +1374,7 @@ CREATE OR REPLACE FUNCTION cleanup_table_info()
 $$
 DECLARE
   r RECORD;
+  m RECORD;
 BEGIN
   FOR r IN
     SELECT objid FROM pg_event_trigger_dropped_objects()
@@ -1422,8 +1382,23 @@ BEGIN
   LOOP
     PERFORM provsql.remove_table_info(r.objid);
     -- Forget any maintained mapping whose source or mapping table is gone.
-    DELETE FROM provsql.provenance_mapping_registry
-     WHERE source = r.objid OR mapping = r.objid;
+    FOR m IN
+      DELETE FROM provsql.provenance_mapping_registry
+       WHERE source = r.objid OR mapping = r.objid
+      RETURNING source, maintained
+    LOOP
+      -- A source that survives its last maintained mapping no longer
+      -- needs the statement triggers that extend it.
+      IF m.maintained
+         AND EXISTS (SELECT 1 FROM pg_class WHERE oid = m.source)
+         AND NOT EXISTS (SELECT 1 FROM provsql.provenance_mapping_registry
+                          WHERE source = m.source AND maintained) THEN
+        EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_begin ON %s',
+                       m.source::regclass);
+        EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_maintain ON %s',
+                       m.source::regclass);
+      END IF;
+    END LOOP;
   END LOOP;
 END
 $$ LANGUAGE plpgsql;
@@ -1460,6 +1435,14 @@ ALTER TABLE provsql.provenance_mapping_registry
 CREATE INDEX IF NOT EXISTS provenance_mapping_registry_source_idx
   ON provsql.provenance_mapping_registry(source);
 
+-- provenance_guard caches each table's entries; invalidate them with the
+-- source table's relcache entry whenever the registry changes.
+DROP TRIGGER IF EXISTS provenance_mapping_registry_invalidate
+  ON provsql.provenance_mapping_registry;
+CREATE TRIGGER provenance_mapping_registry_invalidate
+  AFTER INSERT OR UPDATE OR DELETE ON provsql.provenance_mapping_registry
+  FOR EACH ROW EXECUTE PROCEDURE provsql.table_info_invalidate('source');
+
 /**
  * @brief Create a provenance mapping table from an attribute
  *
@@ -1534,6 +1517,25 @@ BEGIN
     ON CONFLICT (mapping)
       DO UPDATE SET source = EXCLUDED.source, attribute = EXCLUDED.attribute,
                     maintained = EXCLUDED.maintained;
+  -- The maintained mappings of a table are extended once per statement,
+  -- from its transition table (see provenance_mapping_maintain).  A
+  -- foreign table cannot have one; provenance_guard then extends them
+  -- row by row.
+  IF maintained
+     AND (SELECT relkind FROM pg_class WHERE oid = oldtbl) <> 'f'
+     AND NOT EXISTS (SELECT 1 FROM pg_trigger
+                      WHERE tgrelid = oldtbl
+                        AND tgname = 'provenance_mapping_maintain') THEN
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_begin BEFORE INSERT ON %s '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      oldtbl);
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_maintain AFTER INSERT ON %s '
+      'REFERENCING NEW TABLE AS provsql_new_rows '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      oldtbl);
+  END IF;
 END
 $$ LANGUAGE plpgsql;
 
@@ -1604,56 +1606,15 @@ $$ LANGUAGE SQL IMMUTABLE PARALLEL SAFE;
  * recipe, so a hit is always a deliberate plant; the ordinary
  * order-dependent recipe is used otherwise, so ordinary
  * times gates (and their formula rendering) are untouched.
+ *
+ * Implemented in C (@c provsql_mmap.c), as are @c provenance_plus and
+ * @c provenance_monus: they run once per row of every rewritten query.
+ * The tokens are the @c uuid_generate_v5 values of the same textual
+ * recipes, computed without building the text.
  */
 CREATE OR REPLACE FUNCTION provenance_times(VARIADIC tokens uuid[])
   RETURNS UUID AS
-$$
-DECLARE
-  times_token uuid;
-  filtered_tokens uuid[];
-  canonical uuid;
-BEGIN
-  -- A NULL element reads as the ⊗-neutral 1: it is the token slot of an
-  -- untracked source (a join against an untracked table), which is
-  -- certain.  Contrast provenance_plus / provenance_monus, where NULL
-  -- reads as the ⊕- / ⊖-right-neutral 0: each combinator maps NULL to
-  -- its own neutral element.  Nothing may therefore hand a NULL to ⊗
-  -- meaning "false"; a comparison with a NULL operand goes through
-  -- provenance_cmp, which returns gate_zero for it.
-  SELECT array_agg(t) FROM unnest(tokens) t WHERE t IS NOT NULL AND t <> gate_one() INTO filtered_tokens;
-
-  -- Dispatch on the FILTERED count: a single survivor short-circuits
-  -- to that token directly (no useless single-child times gate); zero
-  -- survivors collapse to the identity. Using array_length(tokens, 1)
-  -- here would miss the [one, cmp] → [cmp] case, leaving the cmp wrapped
-  -- in a one-child times when its only sibling was gate_one().
-  CASE coalesce(array_length(filtered_tokens, 1), 0)
-    WHEN 0 THEN
-      times_token:=gate_one();
-    WHEN 1 THEN
-      times_token:=filtered_tokens[1];
-    ELSE
-      -- Computed separately from the filtering aggregate above: an
-      -- ORDER BY aggregate there would make the planner feed *both*
-      -- aggregates sorted input, scrambling the stored children order.
-      SELECT uuid_generate_v5(uuid_ns_provsql(),
-                              concat('times-canonical', array_agg(t ORDER BY t)))
-      FROM unnest(filtered_tokens) t
-      INTO canonical;
-      IF get_gate_type(canonical) = 'times' THEN
-        -- A deliberate pre-creation at the canonical address: same
-        -- children, same product.
-        times_token := canonical;
-      ELSE
-        times_token := uuid_generate_v5(uuid_ns_provsql(),concat('times',filtered_tokens));
-
-        PERFORM create_gate(times_token, 'times', ARRAY_AGG(t)) FROM UNNEST(filtered_tokens) AS t WHERE t IS NOT NULL;
-      END IF;
-  END CASE;
-
-  RETURN times_token;
-END
-$$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public SECURITY DEFINER PARALLEL SAFE IMMUTABLE;
+  'provsql','provenance_times' LANGUAGE C PARALLEL SAFE IMMUTABLE;
 
 /**
  * @brief Create a monus (difference) gate from two provenance tokens
@@ -1663,39 +1624,7 @@ $$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public SECURITY DEFINER PARA
  */
 CREATE OR REPLACE FUNCTION provenance_monus(token1 UUID, token2 UUID)
   RETURNS UUID AS
-$$
-DECLARE
-  monus_token uuid;
-BEGIN
-  IF token1 IS NULL THEN
-    RAISE EXCEPTION USING MESSAGE='provenance_monus is called with first argument NULL';
-  END IF;
-
-  IF token2 IS NULL THEN
-    -- The ⊖-right-neutral 0: a NULL second argument is the no-match case
-    -- of the difference operator's LEFT OUTER JOIN (nothing to subtract),
-    -- so X ⊖ NULL = X ⊖ 0 = X.  Note this is NOT the NULL ≡ 1 reading of
-    -- provenance_times; each combinator maps NULL to its own neutral.
-    RETURN token1;
-  END IF;
-
-  IF token1 = token2 THEN
-    -- X-X=0
-    monus_token:=gate_zero();
-  ELSIF token1 = gate_zero() THEN
-    -- 0-X=0
-    monus_token:=gate_zero();
-  ELSIF token2 = gate_zero() THEN
-    -- X-0=X
-    monus_token:=token1;
-  ELSE
-    monus_token:=uuid_generate_v5(uuid_ns_provsql(),concat('monus',token1,token2));
-    PERFORM create_gate(monus_token, 'monus', ARRAY[token1::uuid, token2::uuid]);
-  END IF;
-
-  RETURN monus_token;
-END
-$$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public SECURITY DEFINER PARALLEL SAFE IMMUTABLE;
+  'provsql','provenance_monus' LANGUAGE C PARALLEL SAFE IMMUTABLE;
 
 /**
  * @brief Create a project gate for where-provenance tracking
@@ -1750,8 +1679,9 @@ $$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public SECURITY DEFINER PARA
 /**
  * @brief Create a plus (sum) gate from an array of provenance tokens
  *
- * Filters out NULL and zero-gates; returns gate_zero() if all tokens
- * are trivial, or a single token if only one remains.  Before creating
+ * Filters out NULL and zero-gates; returns a single token if only one
+ * remains, and otherwise a plus gate (childless, at @c uuid5('plus'), when
+ * every token was trivial -- it evaluates to zero).  Before creating
  * a gate, probes the *canonical* address of the multiset -- a dedicated
  * v5 recipe namespace over the sorted tokens (plus is commutative), in
  * which this function never creates anything, so a gate found there is
@@ -1765,60 +1695,15 @@ $$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public SECURITY DEFINER PARA
  */
 CREATE OR REPLACE FUNCTION provenance_plus(tokens uuid[])
   RETURNS UUID AS
-$$
-DECLARE
-  c INTEGER;
-  plus_token uuid;
-  filtered_tokens uuid[];
-  canonical uuid;
-BEGIN
-  -- A NULL element reads as the ⊕-neutral 0: it stands for a row absent
-  -- from the disjunction (a null-padded antijoin row whose token array
-  -- slot is NULL), not for an untracked source.  Contrast provenance_times,
-  -- where NULL reads as the ⊗-neutral 1 (untracked source): each
-  -- combinator maps NULL to its own neutral element.
-  SELECT array_agg(t) FROM unnest(tokens) t
-  WHERE t IS NOT NULL AND t <> gate_zero()
-  INTO filtered_tokens;
-
-  c:=array_length(filtered_tokens, 1);
-
-  IF c = 0 THEN
-    plus_token := gate_zero();
-  ELSIF c = 1 THEN
-    plus_token := filtered_tokens[1];
-  ELSE
-    -- Computed separately from the filtering aggregate above: an ORDER
-    -- BY aggregate there would make the planner feed *both* aggregates
-    -- sorted input, scrambling the stored (aggregation-order) children.
-    SELECT uuid_generate_v5(uuid_ns_provsql(),
-                            concat('plus-canonical', array_agg(t ORDER BY t)))
-    FROM unnest(filtered_tokens) t
-    INTO canonical;
-    IF get_gate_type(canonical) = 'plus' THEN
-      -- A deliberate pre-creation at the canonical address: same
-      -- children, same sum.
-      plus_token := canonical;
-    ELSE
-      plus_token := uuid_generate_v5(
-        uuid_ns_provsql(),
-        concat('plus', filtered_tokens));
-
-      PERFORM create_gate(plus_token, 'plus', filtered_tokens);
-    END IF;
-  END IF;
-
-  RETURN plus_token;
-END
-$$ LANGUAGE plpgsql STRICT SET search_path=provsql,pg_temp,public SECURITY DEFINER PARALLEL SAFE IMMUTABLE;
+  'provsql','provenance_plus' LANGUAGE C STRICT PARALLEL SAFE IMMUTABLE;
 
 /**
  * @brief Driver for provenance over recursive queries (WITH RECURSIVE).
  *
  * Invoked by the planner hook (@c lower_recursive_cte in @c provsql.c) when it
  * lowers a recursive CTE whose body touches provenance-tracked relations.  The
- * hook deparses the CTE body to SQL and calls this function, which runs naive
- * bottom-up (fixpoint) evaluation: each round re-evaluates the body
+ * hook deparses the CTE body to SQL and calls this function, which runs
+ * bottom-up (fixpoint) evaluation: each round evaluates the body
  * @c base @c UNION @c recursive over a tracked working table until the
  * provenance tokens stop changing.  Every round goes through ProvSQL's normal
  * rewriting, so the recursive join yields @c times gates, the untracked base
@@ -1827,11 +1712,27 @@ $$ LANGUAGE plpgsql STRICT SET search_path=provsql,pg_temp,public SECURITY DEFIN
  * is left in a tracked temp table named @p work_name, which the hook then scans
  * in place of the CTE.
  *
- * The working tables (@p work_name and a scratch @c _new) are created once and
- * reused across rounds (TRUNCATE + INSERT), so the round count never
- * accumulates relation locks.  Because content-addressed gate UUIDs make
+ * The working tables (@p work_name and the scratch @c _new, @c _delta and
+ * @c _affected) are created once and reused across rounds, so the round count
+ * never accumulates relation locks.  Because content-addressed gate UUIDs make
  * structurally identical sub-circuits share, the fixpoint test is an exact
- * relational @c EXCEPT and the circuit stays the shared (polynomial) form.
+ * comparison of tokens and the circuit stays the shared (polynomial) form.
+ *
+ * Given the two terms of the body on their own (@p base_sql and
+ * @p recursive_sql), evaluation is semi-naive.  A tuple's token can only
+ * change in a round if a token it was derived from changed in the previous
+ * one -- the base term's never do after the first round -- so after that
+ * round only the tuples the recursive term derives from the previous round's
+ * delta (the tuples whose token changed) are re-derived, and only those whose
+ * token then differs make the next delta.  Each is re-derived from the whole
+ * working table through both terms, each restricted to the affected tuples by
+ * a semi-join, so it gets the derivations a naive round would merge, in the
+ * same (base first) order; the working table holds, round after round, what
+ * naive evaluation would, and the round count and the fixpoint are the same.
+ * Finding the affected tuples runs the recursive term over the delta in place
+ * of the working table, with provenance off.  Tuples are matched by equality,
+ * so a tuple with a @c NULL column falls back to naive rounds, as does a call
+ * without the two terms.
  *
  * Scope: UNION (set) recursion.  On *acyclic* input the structural fixpoint is
  * reached and the resulting circuit is the universal provenance, sound for any
@@ -1856,13 +1757,18 @@ $$ LANGUAGE plpgsql STRICT SET search_path=provsql,pg_temp,public SECURITY DEFIN
  * @param colnames   comma-separated user columns, e.g. @c 'node'
  * @param coldef     column definitions for the working table, e.g. @c 'node integer'
  * @param max_iter   safety bound on fixpoint rounds (non-termination guard)
+ * @param base_sql   the base (non-recursive) term of @p body_sql, e.g. @c 'SELECT 1'
+ * @param recursive_sql the recursive term of @p body_sql, e.g.
+ *                   @c 'SELECT e.dst FROM edge e JOIN reach r ON e.src=r.node'
  */
 CREATE OR REPLACE FUNCTION eval_recursive(
   body_sql  text,
   work_name text,
   colnames  text,
   coldef    text,
-  max_iter  int DEFAULT 1000)
+  max_iter  int DEFAULT 1000,
+  base_sql  text DEFAULT NULL,
+  recursive_sql text DEFAULT NULL)
   RETURNS void AS
 $$
 DECLARE
@@ -1884,14 +1790,47 @@ DECLARE
       IN ('absorptive', 'boolean');
   truncated boolean := false; -- exited at the value fixpoint (cyclic data)
   ntuples   int := NULL;    -- the bound above, set once the tuple set stabilises
+  -- Semi-naive bookkeeping (see the function comment).  It matches tuples
+  -- by equality, so a tuple with a NULL column sends the evaluation down
+  -- the naive path for good.
+  seminaive boolean := base_sql IS NOT NULL AND recursive_sql IS NOT NULL;
+  has_null  boolean;
+  was_active text := coalesce(current_setting('provsql.active', true), 'on');
+  keys_eq   text;           -- w.c1 = d.c1 AND ... over the user columns
+  -- The body restricted to the affected tuples: both terms, each
+  -- semi-joined with _affected on the whole tuple.
+  rederive_sql text := format(
+    'SELECT %1$s FROM (%2$s) AS _b(%1$s) WHERE (%1$s) IN (SELECT * FROM _affected) '
+    || 'UNION SELECT %1$s FROM (%3$s) AS _r(%1$s) WHERE (%1$s) IN (SELECT * FROM _affected)',
+    colnames, base_sql, recursive_sql);
 BEGIN
   EXECUTE format('DROP TABLE IF EXISTS %I', work_name);
   DROP TABLE IF EXISTS _new;
+  DROP TABLE IF EXISTS _delta;
+  DROP TABLE IF EXISTS _affected;
 
-  -- Tracked working table (carries provsql), initially empty, plus a scratch
-  -- table of the same shape; both reused across rounds.
+  -- Tracked working table (carries provsql), initially empty, plus scratch
+  -- tables: _new for a round's output, _delta for the tuples whose token it
+  -- changed, _affected for the tuples those can reach.  All are reused
+  -- across rounds.
   EXECUTE format('CREATE TEMP TABLE %I (%s, provsql uuid)', work_name, coldef);
   EXECUTE format('CREATE TEMP TABLE _new (LIKE %I)', work_name);
+  EXECUTE format('CREATE TEMP TABLE _delta (LIKE %I)', work_name);
+  EXECUTE format('CREATE TEMP TABLE _affected (%s)', coldef);
+  -- The working table is looked up by tuple every round: the delta is
+  -- matched against it, and the body's recursive join probes it.
+  BEGIN
+    EXECUTE format('CREATE INDEX ON %I (%s)', work_name, colnames);
+  EXCEPTION WHEN OTHERS THEN
+    NULL; -- a column type without a btree opclass: do without
+  END;
+
+  SELECT string_agg(format('w.%1$s = d.%1$s', quote_ident(a.attname)), ' AND '
+                    ORDER BY a.attnum)
+    INTO keys_eq
+    FROM pg_attribute a
+   WHERE a.attrelid = to_regclass('_affected') AND a.attnum > 0
+     AND NOT a.attisdropped;
 
   LOOP
     iters := iters + 1;
@@ -1901,36 +1840,110 @@ BEGIN
       RAISE EXCEPTION 'eval_recursive: no fixpoint after % rounds (cyclic data?)', max_iter;
     END IF;
 
-    -- One round of naive evaluation: re-run the CTE body over the current
-    -- working table.  INSERT targets a tracked table, so ProvSQL fills provsql.
-    -- Take the row count from the INSERT itself (counting _new directly would be
-    -- an aggregate over a provenance-tracked table -> an agg_token).
-    EXECUTE 'TRUNCATE _new';
-    EXECUTE format('INSERT INTO _new(%s) %s', colnames, body_sql);
-    GET DIAGNOSTICS new_count = ROW_COUNT;
+    IF iters = 1 OR NOT seminaive THEN
+      -- One round of naive evaluation: re-run the CTE body over the current
+      -- working table.  INSERT targets a tracked table, so ProvSQL fills
+      -- provsql.  Take the row count from the INSERT itself (counting _new
+      -- directly would be an aggregate over a provenance-tracked table -> an
+      -- agg_token).
+      EXECUTE 'TRUNCATE _new';
+      EXECUTE format('INSERT INTO _new(%s) %s', colnames, body_sql);
+      GET DIAGNOSTICS new_count = ROW_COUNT;
+
+      -- Exact structural fixpoint test (content-addressed tokens => set equality).
+      EXECUTE format(
+        'SELECT EXISTS((TABLE _new EXCEPT TABLE %1$I) UNION ALL (TABLE %1$I EXCEPT TABLE _new))',
+        work_name) INTO changed;
 
-    -- Exact structural fixpoint test (content-addressed tokens => set equality).
-    EXECUTE format(
-      'SELECT EXISTS((TABLE _new EXCEPT TABLE %1$I) UNION ALL (TABLE %1$I EXCEPT TABLE _new))',
-      work_name) INTO changed;
+      -- In an absorptive class, learn the round bound from the tuple-set
+      -- fixpoint (the set always stabilises after finitely many rounds, even on
+      -- cyclic data).
+      IF absorptive_mode AND ntuples IS NULL THEN
+        EXECUTE format(
+          'SELECT NOT EXISTS('
+          || '(SELECT %2$s FROM _new EXCEPT SELECT %2$s FROM %1$I) UNION ALL '
+          || '(SELECT %2$s FROM %1$I EXCEPT SELECT %2$s FROM _new))',
+          work_name, colnames) INTO set_stable;
+        IF set_stable THEN
+          ntuples := new_count;
+        END IF;
+      END IF;
 
-    -- In an absorptive class, learn the round bound from the tuple-set
-    -- fixpoint (the set always stabilises after finitely many rounds, even on
-    -- cyclic data).
-    IF absorptive_mode AND ntuples IS NULL THEN
+      -- Copy _new into the working table (tracked -> tracked carries the tokens).
+      EXECUTE format('TRUNCATE %I', work_name);
+      EXECUTE format('INSERT INTO %1$I(%2$s) SELECT %2$s FROM _new', work_name, colnames);
+
+      -- The first round's tuples are all new: they seed the delta.
+      IF seminaive THEN
+        PERFORM set_config('provsql.active', 'off', true);
+        EXECUTE 'SELECT EXISTS(SELECT 1 FROM _new WHERE NOT (_new IS NOT NULL))'
+          INTO has_null;
+        IF has_null THEN
+          seminaive := false;
+        ELSE
+          EXECUTE 'TRUNCATE _delta';
+          EXECUTE 'INSERT INTO _delta TABLE _new';
+        END IF;
+        PERFORM set_config('provsql.active', was_active, true);
+      END IF;
+    ELSE
+      -- One round of semi-naive evaluation.  Bookkeeping runs as plain SQL,
+      -- with provenance tracking off: it copies tokens, it does not make any.
+      PERFORM set_config('provsql.active', 'off', true);
+
+      -- Which tuples can a changed token reach?  The recursive term over
+      -- the delta alone, standing in for the working table under its name.
+      EXECUTE 'TRUNCATE _affected';
+      EXECUTE format('ALTER TABLE %I RENAME TO _provsql_work_all', work_name);
+      EXECUTE format('ALTER TABLE _delta RENAME TO %I', work_name);
+      EXECUTE format('INSERT INTO _affected SELECT DISTINCT * FROM (%s) AS _r',
+                     recursive_sql);
+      EXECUTE format('ALTER TABLE %I RENAME TO _delta', work_name);
+      EXECUTE format('ALTER TABLE _provsql_work_all RENAME TO %I', work_name);
+
+      EXECUTE 'SELECT EXISTS(SELECT 1 FROM _affected WHERE NOT (_affected IS NOT NULL))'
+        INTO has_null;
+      IF has_null THEN
+        -- Replay this round naively, and every later one.
+        PERFORM set_config('provsql.active', was_active, true);
+        seminaive := false;
+        iters := iters - 1;
+        CONTINUE;
+      END IF;
+
+      -- Re-derive those tuples, and those only, from the whole working
+      -- table, with provenance, as a naive round would.
+      PERFORM set_config('provsql.active', was_active, true);
+      EXECUTE 'TRUNCATE _new';
+      EXECUTE format('INSERT INTO _new(%s) %s', colnames, rederive_sql);
+      PERFORM set_config('provsql.active', 'off', true);
+
+      -- The new delta: re-derived tuples whose token is not the one the
+      -- working table holds for them.  Every other tuple keeps the token a
+      -- naive round would have recomputed, so this is the fixpoint test.
+      EXECUTE 'TRUNCATE _delta';
       EXECUTE format(
-        'SELECT NOT EXISTS('
-        || '(SELECT %2$s FROM _new EXCEPT SELECT %2$s FROM %1$I) UNION ALL '
-        || '(SELECT %2$s FROM %1$I EXCEPT SELECT %2$s FROM _new))',
-        work_name, colnames) INTO set_stable;
-      IF set_stable THEN
-        ntuples := new_count;
+        'INSERT INTO _delta SELECT d.* FROM _new d LEFT JOIN %I w '
+        || 'ON %s AND w.provsql = d.provsql WHERE w.provsql IS NULL',
+        work_name, keys_eq);
+      GET DIAGNOSTICS new_count = ROW_COUNT;
+      changed := new_count > 0;
+
+      IF absorptive_mode AND ntuples IS NULL THEN
+        EXECUTE format(
+          'SELECT NOT EXISTS(SELECT 1 FROM _delta d WHERE NOT EXISTS('
+          || 'SELECT 1 FROM %I w WHERE %s))',
+          work_name, keys_eq) INTO set_stable;
+        IF set_stable THEN
+          EXECUTE format('SELECT count(*) FROM %I', work_name) INTO ntuples;
+        END IF;
       END IF;
-    END IF;
 
-    -- Copy _new into the working table (tracked -> tracked carries the tokens).
-    EXECUTE format('TRUNCATE %I', work_name);
-    EXECUTE format('INSERT INTO %1$I(%2$s) SELECT %2$s FROM _new', work_name, colnames);
+      -- Fold the delta into the working table.
+      EXECUTE format('DELETE FROM %I w USING _delta d WHERE %s', work_name, keys_eq);
+      EXECUTE format('INSERT INTO %I TABLE _delta', work_name);
+      PERFORM set_config('provsql.active', was_active, true);
+    END IF;
 
     -- Structural fixpoint: done (acyclic / fully converged) -- sound for any
     -- semiring.
@@ -2151,7 +2164,9 @@ RETURNS anyelement AS
  *
  * Recursively walks the provenance circuit and evaluates each gate
  * using the provided semiring operations. This is the generic version
- * that accepts semiring operations as function references.
+ * that accepts semiring operations as function references; the C
+ * version below falls back to it for the semirings it cannot call
+ * natively.
  *
  * @param token provenance token to evaluate
  * @param token2value mapping table from tokens to semiring values
@@ -2286,8 +2301,12 @@ $$ LANGUAGE plpgsql PARALLEL SAFE STABLE;
 /**
  * @brief Evaluate provenance over a user-defined semiring (C version)
  *
- * Optimized C implementation of provenance_evaluate. Infers the
- * value type from element_one. Monus and delta functions are optional.
+ * Native implementation of provenance_evaluate. Infers the value type
+ * from element_one. Loads the circuit once, evaluates every gate once,
+ * and calls the plus and times aggregates through their transition and
+ * final functions; semirings whose operations cannot be called that
+ * way (e.g., aggregates with an internal state) are evaluated by the
+ * PL/pgSQL version. Monus and delta functions are optional.
  *
  * @param token provenance token to evaluate
  * @param token2value mapping table from tokens to semiring values
@@ -7265,6 +7284,25 @@ CREATE OR REPLACE FUNCTION probability(
   RETURNS DOUBLE PRECISION AS
   'provsql','probability_evaluate' LANGUAGE C STABLE;
 
+/**
+ * @brief Probabilities of many provenance tokens, in one call
+ *
+ * Returns, at each position of @p tokens, what
+ * @c probability_evaluate(token) would return for the token there
+ * (@c NULL for a @c NULL token).  The circuits of all the tokens are
+ * loaded together, and tokens sharing sub-circuits are evaluated over a
+ * single compiled d-DNNF instead of one per token, which makes
+ * @c probability_evaluate_all(array_agg(provenance())) much cheaper than
+ * calling @c probability_evaluate on every row of a result whose
+ * lineages overlap.  Only the default method is available.
+ *
+ * @param tokens provenance tokens to evaluate
+ */
+CREATE OR REPLACE FUNCTION probability_evaluate_all(
+  tokens UUID[])
+  RETURNS DOUBLE PRECISION[] AS
+  'provsql','probability_evaluate_all' LANGUAGE C STABLE;
+
 /**
  * @brief Probability of a Boolean event over random variables.
  *
@@ -10434,6 +10472,9 @@ CREATE OR REPLACE VIEW tools AS
  * @param argtpl        command template; placeholders @c {in} / @c {out}
  *                      (and @c {binary} / @c {tmpdir} / @c {pivotAC}).  When
  *                      it omits @c {binary}, the executable is prepended.
+ *                      @c {stdin} / @c {stdout} in place of @c {in} /
+ *                      @c {out} drive the tool through pipes instead of
+ *                      temp files.
  * @param argtpl_circuit command used when the @c 'circuit-bcs12' input is
  *                      selected (a BC-S1.2 circuit rather than a CNF); only a
  *                      tool accepting that input needs it
@@ -21,13 +21,27 @@
 --
 --   * repair_key records a block's size in info2 rather than writing the
 --     uniform 1/size as a probability, so the documented "repair_key
---     then set_prob(provenance(), p)" is still a first write.
+--     then set_prob(provenance(), p)" is still a first write.  Its
+--     gates are built in C, from one scan of the table.
 --
 -- Plus the store-maintenance surface -- check_store() and
 -- circuit_cleanup() -- and, on PostgreSQL 14+, transaction-level data
 -- modification: one update gate per transaction, update_provenance.xid
 -- and .tx_token, undo() at either granularity, and commit-time validity.
 --
+-- provenance_times, provenance_plus and provenance_monus are now C
+-- functions, minting the same tokens as the PL/pgSQL versions did.
+-- probability_evaluate_all evaluates an array of tokens in one call.
+-- provenance_guard is a C function too, and maintained provenance
+-- mappings are extended once per statement rather than once per row.
+-- set_prob_from writes the probabilities a relation lists, in batches.
+-- eval_recursive re-derives, each round, only the tuples the previous
+-- round's changed tokens reach.
+--
+-- The UUID -> gate mapping file changes layout (version 2).  The mmap
+-- worker rewrites an existing one the first time it starts under the new
+-- library, in one pass over the table; nothing here needs to run.
+--
 -- Existing rows of provenance_mapping_registry are back-filled with
 -- maintained = true: before this release, a row was only inserted for a
 -- mapping created with maintained => true.
@@ -170,63 +184,28 @@ BEGIN
     ON CONFLICT (mapping)
       DO UPDATE SET source = EXCLUDED.source, attribute = EXCLUDED.attribute,
                     maintained = EXCLUDED.maintained;
+  -- The maintained mappings of a table are extended once per statement,
+  -- from its transition table (see provenance_mapping_maintain).  A
+  -- foreign table cannot have one; provenance_guard then extends them
+  -- row by row.
+  IF maintained
+     AND (SELECT relkind FROM pg_class WHERE oid = oldtbl) <> 'f'
+     AND NOT EXISTS (SELECT 1 FROM pg_trigger
+                      WHERE tgrelid = oldtbl
+                        AND tgname = 'provenance_mapping_maintain') THEN
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_begin BEFORE INSERT ON %s '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      oldtbl);
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_maintain AFTER INSERT ON %s '
+      'REFERENCING NEW TABLE AS provsql_new_rows '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      oldtbl);
+  END IF;
 END
 $$ LANGUAGE plpgsql;
 
-CREATE OR REPLACE FUNCTION provenance_guard()
-  RETURNS TRIGGER AS $$
-DECLARE
-  _m RECORD;
-BEGIN
-  IF TG_OP = 'INSERT' THEN
-    IF NEW.provsql IS NULL THEN
-      -- A genuine insert: mint a fresh atomic input variable. This is the
-      -- one place a new input token is born, so it is also where any
-      -- maintained mapping on this table is extended (keyed to that token).
-      -- Data-modification re-insertions (INSERT ... SELECT * FROM OLD_TABLE)
-      -- carry a supplied provsql and take the ELSE branch, so they are
-      -- correctly skipped: the validity stays keyed to the original input,
-      -- which is exactly the child a later monus/update gate wraps.
-      NEW.provsql := public.uuid_generate_v4();
-      FOR _m IN SELECT mapping, attribute
-                  FROM provsql.provenance_mapping_registry
-                 WHERE source = TG_RELID AND maintained
-      LOOP
-        EXECUTE format(
-          'INSERT INTO %s(value, provenance) SELECT ($1).%I, $2',
-          _m.mapping::regclass, _m.attribute)
-          USING NEW, NEW.provsql;
-      END LOOP;
-    ELSE
-      PERFORM provsql.set_table_info(TG_RELID, 'opaque');
-    END IF;
-  ELSIF TG_OP = 'UPDATE' THEN
-    IF NEW.provsql IS DISTINCT FROM OLD.provsql THEN
-      IF provsql.is_fresh_leaf(NEW.provsql) THEN
-        -- A replacement leaf minted by provsql.replace_input /
-        -- replace_block in this transaction: an independent fresh leaf by
-        -- construction, so the table's kind survives.  Carry the
-        -- maintained mappings over from the token it replaces, the same
-        -- job the INSERT branch does for a new row.
-        FOR _m IN SELECT mapping, attribute
-                    FROM provsql.provenance_mapping_registry WHERE source = TG_RELID
-        LOOP
-          EXECUTE format(
-            'INSERT INTO %1$s(value, provenance) '
-            'SELECT value, $2 FROM %1$s WHERE provenance = $1',
-            _m.mapping::regclass)
-            USING OLD.provsql, NEW.provsql;
-        END LOOP;
-      ELSE
-        PERFORM provsql.set_table_info(TG_RELID, 'opaque');
-      END IF;
-    END IF;
-  END IF;
-  RETURN NEW;
-END;
-$$ LANGUAGE plpgsql SET search_path=provsql,pg_temp,public
-   SECURITY DEFINER;
-
 -- ----------------------------------------------------------------------
 -- 4. Write-once probabilities, and how one changes.
 -- ----------------------------------------------------------------------
@@ -366,12 +345,13 @@ BEGIN
 END
 $$ LANGUAGE plpgsql;
 
+CREATE OR REPLACE FUNCTION repair_key_gates(_tbl regclass, block_key int2[])
+  RETURNS bigint AS 'provsql','repair_key_gates' LANGUAGE C;
+
 CREATE OR REPLACE FUNCTION repair_key(_tbl regclass, key_att text)
   RETURNS void AS
 $$
 DECLARE
-  r RECORD;
-  rows_query TEXT;
   block_key_cols INT2[];
 BEGIN
   -- Resolve the (possibly comma-separated) key_att text into the
@@ -400,69 +380,20 @@ BEGIN
   -- Same column shape as add_provenance: no UNIQUE, no DEFAULT past
   -- the initial backfill (the guard trigger added after the rename
   -- takes over both jobs once the column has been renamed to its
-  -- final name).  The DEFAULT is kept here only so the second pass
-  -- below can read provsql_temp from the user-visible rows
+  -- final name).  The DEFAULT is kept here only so the gate-building
+  -- pass below can read provsql_temp from the user-visible rows
   -- without a separate UPDATE.
   EXECUTE format('ALTER TABLE %s ADD COLUMN provsql_temp UUID DEFAULT public.uuid_generate_v4()', _tbl);
 
-  -- Build a per-group mapping (key columns + a fresh key_token + the
-  -- group size) once, then use it for both the create_gate(key_token,
-  -- 'input') first pass and the per-row mulinput second pass.  Going
-  -- through a temp table avoids re-running uuid_generate_v4() (which
-  -- would produce different UUIDs the second time).  USING (%1$s) on
-  -- the second pass handles the multi-column case uniformly.
-  -- ON COMMIT DROP plus the explicit DROP TABLE at the end of this
-  -- function leave the temp table cleaned up across transactions and
-  -- across repeated calls in the same transaction.
-  IF key_att = '' THEN
-    EXECUTE format(
-      'CREATE TEMP TABLE provsql_repair_key_tmp ON COMMIT DROP AS
-         SELECT public.uuid_generate_v4() AS provsql_key_token,
-                COUNT(*) AS provsql_group_size
-           FROM %s', _tbl);
-    rows_query := format(
-      'SELECT t.provsql_temp,
-              k.provsql_key_token AS key_token,
-              ROW_NUMBER() OVER (ORDER BY t.ctid) AS within_group,
-              k.provsql_group_size AS group_size
-         FROM %s t CROSS JOIN provsql_repair_key_tmp k', _tbl);
-  ELSE
-    EXECUTE format(
-      'CREATE TEMP TABLE provsql_repair_key_tmp ON COMMIT DROP AS
-         SELECT %1$s,
-                public.uuid_generate_v4() AS provsql_key_token,
-                COUNT(*) AS provsql_group_size
-           FROM %2$s
-       GROUP BY %1$s', key_att, _tbl);
-    rows_query := format(
-      'SELECT t.provsql_temp,
-              k.provsql_key_token AS key_token,
-              ROW_NUMBER() OVER (PARTITION BY k.provsql_key_token
-                                 ORDER BY t.ctid) AS within_group,
-              k.provsql_group_size AS group_size
-         FROM %2$s t
-         JOIN provsql_repair_key_tmp k USING (%1$s)', key_att, _tbl);
-  END IF;
-
-  -- Pass 1: one input gate per group key.
-  FOR r IN SELECT provsql_key_token FROM provsql_repair_key_tmp LOOP
-    PERFORM provsql.create_gate(r.provsql_key_token, 'input');
-  END LOOP;
-
-  -- Pass 2: per row, attach a mulinput gate to its group's key token.
-  -- The block size goes in info2 rather than the uniform 1/size going
-  -- in the probability: a repaired row's probability is the user's to
-  -- write (the documented "repair_key then set_prob(provenance(), p)"
-  -- pattern), and probabilities are written once.  A row nobody gives
-  -- a probability evaluates at 1/size all the same -- see
-  -- MMappedCircuit::getProb.
-  FOR r IN EXECUTE rows_query LOOP
-    PERFORM provsql.create_gate(r.provsql_temp, 'mulinput', ARRAY[r.key_token]);
-    PERFORM provsql.set_infos(r.provsql_temp, r.within_group::int,
-                              r.group_size::int);
-  END LOOP;
-
-  DROP TABLE provsql_repair_key_tmp;
+  -- One scan of the table, in C: every block's key gets an input
+  -- gate, and every row a mulinput gate over it, with its position in
+  -- the block in info1 and the block size in info2 rather than the
+  -- uniform 1/size in the probability: a repaired row's probability
+  -- is the user's to write (the documented "repair_key then
+  -- set_prob(provenance(), p)" pattern), and probabilities are written
+  -- once.  A row nobody gives a probability evaluates at 1/size all
+  -- the same -- see MMappedCircuit::getProb.
+  PERFORM provsql.repair_key_gates(_tbl, block_key_cols);
 
   EXECUTE format('ALTER TABLE %s ALTER COLUMN provsql_temp DROP DEFAULT', _tbl);
   EXECUTE format('ALTER TABLE %s RENAME COLUMN provsql_temp TO provsql', _tbl);
@@ -976,7 +907,382 @@ $sql$;
 END $do$;
 
 -- ----------------------------------------------------------------------
--- 7. The C side caches the OID of each enum value per session; a backend
+-- 7. The per-row semiring combinators move from PL/pgSQL to C.  They
+--    mint the same tokens, so the circuits already in the store keep
+--    resolving; only the per-call cost changes.
+-- ----------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION provenance_times(VARIADIC tokens uuid[])
+  RETURNS UUID AS
+  'provsql','provenance_times' LANGUAGE C PARALLEL SAFE IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION provenance_monus(token1 UUID, token2 UUID)
+  RETURNS UUID AS
+  'provsql','provenance_monus' LANGUAGE C PARALLEL SAFE IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION provenance_plus(tokens uuid[])
+  RETURNS UUID AS
+  'provsql','provenance_plus' LANGUAGE C STRICT PARALLEL SAFE IMMUTABLE;
+
+-- ----------------------------------------------------------------------
+-- 8. Probabilities of many tokens in one call, over one loaded circuit.
+-- ----------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION probability_evaluate_all(
+  tokens UUID[])
+  RETURNS DOUBLE PRECISION[] AS
+  'provsql','probability_evaluate_all' LANGUAGE C STABLE;
+
+-- ----------------------------------------------------------------------
+-- 9. provenance_guard moves to C and caches each table's registry
+--    entries, which a trigger on the registry invalidates.  Maintained
+--    mappings are extended once per statement, from its transition
+--    table, by provenance_mapping_maintain.
+-- ----------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION provenance_guard()
+  RETURNS TRIGGER AS
+  'provsql','provenance_guard' LANGUAGE C
+  SET search_path=provsql,pg_temp,public SECURITY DEFINER;
+
+CREATE OR REPLACE FUNCTION provenance_mapping_maintain()
+  RETURNS TRIGGER AS
+  'provsql','provenance_mapping_maintain' LANGUAGE C
+  SET search_path=provsql,pg_temp,public SECURITY DEFINER;
+
+DROP TRIGGER IF EXISTS provenance_mapping_registry_invalidate
+  ON provsql.provenance_mapping_registry;
+CREATE TRIGGER provenance_mapping_registry_invalidate
+  AFTER INSERT OR UPDATE OR DELETE ON provsql.provenance_mapping_registry
+  FOR EACH ROW EXECUTE PROCEDURE provsql.table_info_invalidate('source');
+
+CREATE OR REPLACE FUNCTION remove_provenance(_tbl regclass)
+  RETURNS void AS
+$$
+DECLARE
+BEGIN
+  PERFORM provsql.remove_table_info(_tbl::oid);
+  -- Idempotence, mirroring add_provenance: removing provenance from a
+  -- table that does not have it is a NOTICE-and-no-op, so setup scripts
+  -- and notebook cells can be re-run freely.  The metadata strip above
+  -- still runs, so a table left half-tracked is cleaned up.
+  IF NOT EXISTS (
+    SELECT 1 FROM pg_attribute
+    WHERE attrelid = _tbl AND attname = 'provsql' AND NOT attisdropped
+  ) THEN
+    RAISE NOTICE 'table % does not have provenance tracking', _tbl;
+    RETURN;
+  END IF;
+  -- Drop the BEFORE INSERT/UPDATE guard first: it has a column
+  -- dependency on provsql (via the OF provsql clause), so the
+  -- subsequent DROP COLUMN would otherwise raise.
+  BEGIN
+    EXECUTE format('DROP TRIGGER provenance_guard on %s', _tbl);
+  EXCEPTION WHEN undefined_object THEN
+  END;
+  EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_begin ON %s', _tbl);
+  EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_maintain ON %s', _tbl);
+  EXECUTE format('ALTER TABLE %s DROP COLUMN provsql', _tbl);
+  BEGIN
+    EXECUTE format('DROP TRIGGER add_gate on %s', _tbl);
+  EXCEPTION WHEN undefined_object THEN
+  END;
+  BEGIN
+    EXECUTE format('DROP TRIGGER insert_statement on %s', _tbl);
+    EXECUTE format('DROP TRIGGER update_statement on %s', _tbl);
+    EXECUTE format('DROP TRIGGER delete_statement on %s', _tbl);
+  EXCEPTION WHEN undefined_object THEN
+  END;
+END
+$$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION cleanup_table_info()
+  RETURNS event_trigger AS
+$$
+DECLARE
+  r RECORD;
+  m RECORD;
+BEGIN
+  FOR r IN
+    SELECT objid FROM pg_event_trigger_dropped_objects()
+     WHERE object_type IN ('table', 'foreign table', 'materialized view')
+  LOOP
+    PERFORM provsql.remove_table_info(r.objid);
+    -- Forget any maintained mapping whose source or mapping table is gone.
+    FOR m IN
+      DELETE FROM provsql.provenance_mapping_registry
+       WHERE source = r.objid OR mapping = r.objid
+      RETURNING source, maintained
+    LOOP
+      -- A source that survives its last maintained mapping no longer
+      -- needs the statement triggers that extend it.
+      IF m.maintained
+         AND EXISTS (SELECT 1 FROM pg_class WHERE oid = m.source)
+         AND NOT EXISTS (SELECT 1 FROM provsql.provenance_mapping_registry
+                          WHERE source = m.source AND maintained) THEN
+        EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_begin ON %s',
+                       m.source::regclass);
+        EXECUTE format('DROP TRIGGER IF EXISTS provenance_mapping_maintain ON %s',
+                       m.source::regclass);
+      END IF;
+    END LOOP;
+  END LOOP;
+END
+$$ LANGUAGE plpgsql;
+
+-- Sources of existing maintained mappings get their statement triggers.
+DO $do$
+DECLARE
+  s RECORD;
+BEGIN
+  FOR s IN
+    SELECT DISTINCT r.source
+      FROM provsql.provenance_mapping_registry r
+      JOIN pg_class c ON c.oid = r.source
+     WHERE r.maintained AND c.relkind <> 'f'
+       AND NOT EXISTS (SELECT 1 FROM pg_trigger
+                        WHERE tgrelid = r.source
+                          AND tgname = 'provenance_mapping_maintain')
+  LOOP
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_begin BEFORE INSERT ON %s '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      s.source::regclass);
+    EXECUTE format(
+      'CREATE TRIGGER provenance_mapping_maintain AFTER INSERT ON %s '
+      'REFERENCING NEW TABLE AS provsql_new_rows '
+      'FOR EACH STATEMENT EXECUTE PROCEDURE provsql.provenance_mapping_maintain()',
+      s.source::regclass);
+  END LOOP;
+END $do$;
+
+-- ----------------------------------------------------------------------
+-- 10. Probabilities from a relation, written in batches.
+-- ----------------------------------------------------------------------
+
+CREATE OR REPLACE FUNCTION set_prob_from(
+  tbl regclass, prob_att text, token_att text DEFAULT 'provsql')
+  RETURNS bigint AS
+  'provsql','set_prob_from' LANGUAGE C;
+
+-- ----------------------------------------------------------------------
+-- 11. Recursive queries are evaluated semi-naively.
+-- ----------------------------------------------------------------------
+
+-- Now takes the two terms of the body on their own: a new signature.
+DROP FUNCTION IF EXISTS eval_recursive(text, text, text, text, integer);
+
+CREATE OR REPLACE FUNCTION eval_recursive(
+  body_sql  text,
+  work_name text,
+  colnames  text,
+  coldef    text,
+  max_iter  int DEFAULT 1000,
+  base_sql  text DEFAULT NULL,
+  recursive_sql text DEFAULT NULL)
+  RETURNS void AS
+$$
+DECLARE
+  changed   boolean;        -- circuit changed structurally this round
+  set_stable boolean;       -- user-column tuple set unchanged this round
+  iters     int := 0;
+  new_count int;            -- rows in _new this round (INSERT ROW_COUNT)
+  -- Under an absorptive semiring the provenance *value* converges on cyclic
+  -- data even though the circuit keeps growing structurally.  A minimal
+  -- derivation cannot repeat a tuple, so it has depth <= (number of derivable
+  -- tuples); after that many naive rounds the value equals the least fixpoint,
+  -- and the surplus (longer, cyclic) derivations are absorbed at evaluation
+  -- time.  We learn that bound from the tuple-set fixpoint, stop there, and
+  -- mark the resulting tokens with the 'absorptive' assumption so evaluation
+  -- under a non-absorptive semiring refuses rather than silently returning a
+  -- truncated value.
+  absorptive_mode boolean :=
+    coalesce(current_setting('provsql.provenance', true), 'semiring')
+      IN ('absorptive', 'boolean');
+  truncated boolean := false; -- exited at the value fixpoint (cyclic data)
+  ntuples   int := NULL;    -- the bound above, set once the tuple set stabilises
+  -- Semi-naive bookkeeping (see the function comment).  It matches tuples
+  -- by equality, so a tuple with a NULL column sends the evaluation down
+  -- the naive path for good.
+  seminaive boolean := base_sql IS NOT NULL AND recursive_sql IS NOT NULL;
+  has_null  boolean;
+  was_active text := coalesce(current_setting('provsql.active', true), 'on');
+  keys_eq   text;           -- w.c1 = d.c1 AND ... over the user columns
+  -- The body restricted to the affected tuples: both terms, each
+  -- semi-joined with _affected on the whole tuple.
+  rederive_sql text := format(
+    'SELECT %1$s FROM (%2$s) AS _b(%1$s) WHERE (%1$s) IN (SELECT * FROM _affected) '
+    || 'UNION SELECT %1$s FROM (%3$s) AS _r(%1$s) WHERE (%1$s) IN (SELECT * FROM _affected)',
+    colnames, base_sql, recursive_sql);
+BEGIN
+  EXECUTE format('DROP TABLE IF EXISTS %I', work_name);
+  DROP TABLE IF EXISTS _new;
+  DROP TABLE IF EXISTS _delta;
+  DROP TABLE IF EXISTS _affected;
+
+  -- Tracked working table (carries provsql), initially empty, plus scratch
+  -- tables: _new for a round's output, _delta for the tuples whose token it
+  -- changed, _affected for the tuples those can reach.  All are reused
+  -- across rounds.
+  EXECUTE format('CREATE TEMP TABLE %I (%s, provsql uuid)', work_name, coldef);
+  EXECUTE format('CREATE TEMP TABLE _new (LIKE %I)', work_name);
+  EXECUTE format('CREATE TEMP TABLE _delta (LIKE %I)', work_name);
+  EXECUTE format('CREATE TEMP TABLE _affected (%s)', coldef);
+  -- The working table is looked up by tuple every round: the delta is
+  -- matched against it, and the body's recursive join probes it.
+  BEGIN
+    EXECUTE format('CREATE INDEX ON %I (%s)', work_name, colnames);
+  EXCEPTION WHEN OTHERS THEN
+    NULL; -- a column type without a btree opclass: do without
+  END;
+
+  SELECT string_agg(format('w.%1$s = d.%1$s', quote_ident(a.attname)), ' AND '
+                    ORDER BY a.attnum)
+    INTO keys_eq
+    FROM pg_attribute a
+   WHERE a.attrelid = to_regclass('_affected') AND a.attnum > 0
+     AND NOT a.attisdropped;
+
+  LOOP
+    iters := iters + 1;
+    -- Hard safety bound (also catches genuinely unbounded recursion, e.g. an
+    -- unbounded counter, where even the tuple set never stabilises).
+    IF iters > max_iter THEN
+      RAISE EXCEPTION 'eval_recursive: no fixpoint after % rounds (cyclic data?)', max_iter;
+    END IF;
+
+    IF iters = 1 OR NOT seminaive THEN
+      -- One round of naive evaluation: re-run the CTE body over the current
+      -- working table.  INSERT targets a tracked table, so ProvSQL fills
+      -- provsql.  Take the row count from the INSERT itself (counting _new
+      -- directly would be an aggregate over a provenance-tracked table -> an
+      -- agg_token).
+      EXECUTE 'TRUNCATE _new';
+      EXECUTE format('INSERT INTO _new(%s) %s', colnames, body_sql);
+      GET DIAGNOSTICS new_count = ROW_COUNT;
+
+      -- Exact structural fixpoint test (content-addressed tokens => set equality).
+      EXECUTE format(
+        'SELECT EXISTS((TABLE _new EXCEPT TABLE %1$I) UNION ALL (TABLE %1$I EXCEPT TABLE _new))',
+        work_name) INTO changed;
+
+      -- In an absorptive class, learn the round bound from the tuple-set
+      -- fixpoint (the set always stabilises after finitely many rounds, even on
+      -- cyclic data).
+      IF absorptive_mode AND ntuples IS NULL THEN
+        EXECUTE format(
+          'SELECT NOT EXISTS('
+          || '(SELECT %2$s FROM _new EXCEPT SELECT %2$s FROM %1$I) UNION ALL '
+          || '(SELECT %2$s FROM %1$I EXCEPT SELECT %2$s FROM _new))',
+          work_name, colnames) INTO set_stable;
+        IF set_stable THEN
+          ntuples := new_count;
+        END IF;
+      END IF;
+
+      -- Copy _new into the working table (tracked -> tracked carries the tokens).
+      EXECUTE format('TRUNCATE %I', work_name);
+      EXECUTE format('INSERT INTO %1$I(%2$s) SELECT %2$s FROM _new', work_name, colnames);
+
+      -- The first round's tuples are all new: they seed the delta.
+      IF seminaive THEN
+        PERFORM set_config('provsql.active', 'off', true);
+        EXECUTE 'SELECT EXISTS(SELECT 1 FROM _new WHERE NOT (_new IS NOT NULL))'
+          INTO has_null;
+        IF has_null THEN
+          seminaive := false;
+        ELSE
+          EXECUTE 'TRUNCATE _delta';
+          EXECUTE 'INSERT INTO _delta TABLE _new';
+        END IF;
+        PERFORM set_config('provsql.active', was_active, true);
+      END IF;
+    ELSE
+      -- One round of semi-naive evaluation.  Bookkeeping runs as plain SQL,
+      -- with provenance tracking off: it copies tokens, it does not make any.
+      PERFORM set_config('provsql.active', 'off', true);
+
+      -- Which tuples can a changed token reach?  The recursive term over
+      -- the delta alone, standing in for the working table under its name.
+      EXECUTE 'TRUNCATE _affected';
+      EXECUTE format('ALTER TABLE %I RENAME TO _provsql_work_all', work_name);
+      EXECUTE format('ALTER TABLE _delta RENAME TO %I', work_name);
+      EXECUTE format('INSERT INTO _affected SELECT DISTINCT * FROM (%s) AS _r',
+                     recursive_sql);
+      EXECUTE format('ALTER TABLE %I RENAME TO _delta', work_name);
+      EXECUTE format('ALTER TABLE _provsql_work_all RENAME TO %I', work_name);
+
+      EXECUTE 'SELECT EXISTS(SELECT 1 FROM _affected WHERE NOT (_affected IS NOT NULL))'
+        INTO has_null;
+      IF has_null THEN
+        -- Replay this round naively, and every later one.
+        PERFORM set_config('provsql.active', was_active, true);
+        seminaive := false;
+        iters := iters - 1;
+        CONTINUE;
+      END IF;
+
+      -- Re-derive those tuples, and those only, from the whole working
+      -- table, with provenance, as a naive round would.
+      PERFORM set_config('provsql.active', was_active, true);
+      EXECUTE 'TRUNCATE _new';
+      EXECUTE format('INSERT INTO _new(%s) %s', colnames, rederive_sql);
+      PERFORM set_config('provsql.active', 'off', true);
+
+      -- The new delta: re-derived tuples whose token is not the one the
+      -- working table holds for them.  Every other tuple keeps the token a
+      -- naive round would have recomputed, so this is the fixpoint test.
+      EXECUTE 'TRUNCATE _delta';
+      EXECUTE format(
+        'INSERT INTO _delta SELECT d.* FROM _new d LEFT JOIN %I w '
+        || 'ON %s AND w.provsql = d.provsql WHERE w.provsql IS NULL',
+        work_name, keys_eq);
+      GET DIAGNOSTICS new_count = ROW_COUNT;
+      changed := new_count > 0;
+
+      IF absorptive_mode AND ntuples IS NULL THEN
+        EXECUTE format(
+          'SELECT NOT EXISTS(SELECT 1 FROM _delta d WHERE NOT EXISTS('
+          || 'SELECT 1 FROM %I w WHERE %s))',
+          work_name, keys_eq) INTO set_stable;
+        IF set_stable THEN
+          EXECUTE format('SELECT count(*) FROM %I', work_name) INTO ntuples;
+        END IF;
+      END IF;
+
+      -- Fold the delta into the working table.
+      EXECUTE format('DELETE FROM %I w USING _delta d WHERE %s', work_name, keys_eq);
+      EXECUTE format('INSERT INTO %I TABLE _delta', work_name);
+      PERFORM set_config('provsql.active', was_active, true);
+    END IF;
+
+    -- Structural fixpoint: done (acyclic / fully converged) -- sound for any
+    -- semiring.
+    EXIT WHEN NOT changed;
+
+    -- Absorptive class on cyclic data: once the value-fixpoint bound is
+    -- reached (plus one confirming round, so that acyclic circuits whose
+    -- token depth lags the tuple-set saturation still exit through the
+    -- structural test above, untagged) we stop, even though the circuit
+    -- is not structurally stable.
+    IF absorptive_mode AND ntuples IS NOT NULL AND iters >= ntuples + 1 THEN
+      truncated := true;
+      EXIT;
+    END IF;
+  END LOOP;
+
+  -- Tokens of a truncated (cyclic) fixpoint are sound only under absorptive
+  -- evaluation: record that in the circuit itself.
+  IF truncated THEN
+    EXECUTE format(
+      'UPDATE %I SET provsql = provsql.provenance_assume(provsql, ''absorptive'')',
+      work_name);
+  END IF;
+END
+$$ LANGUAGE plpgsql SET client_min_messages = warning;
+
+-- ----------------------------------------------------------------------
+-- 12. The C side caches the OID of each enum value per session; a backend
 --    warmed under the previous version would not know the two values
 --    added in section 1.
 -- ----------------------------------------------------------------------
@@ -0,0 +1,318 @@
+/**
+ * @file BitParallelSampler.cpp
+ * @brief Implementation of the 64-worlds-per-word Monte Carlo sampler.
+ */
+#include "BitParallelSampler.h"
+#include "ParallelSampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+
+#ifdef TDKC
+constexpr bool provsql_interrupted = false;
+#else
+#include "GenericCircuit.h"
+
+extern "C" {
+#include "provsql_utils.h"
+}
+#endif
+
+namespace provsql {
+
+namespace {
+
+/** @brief Worlds per sampled word. */
+constexpr unsigned long WORLDS = 64;
+
+/** @brief Worlds per block handed to a thread (and per random stream). */
+constexpr unsigned long BLOCK = 64 * WORLDS;
+
+/** @brief Index of a gate not reached yet, in @c build's gate index. */
+constexpr uint32_t UNSEEN = std::numeric_limits<uint32_t>::max();
+
+/** @brief Index of a gate reached but not emitted yet. */
+constexpr uint32_t PENDING = UNSEEN - 1;
+
+/** @brief Position of the @p k-th (from 1) set bit of @p w, from the lowest. */
+unsigned nthSetBit(uint64_t w, unsigned long k)
+{
+  while(--k)
+    w &= w - 1;
+  return __builtin_ctzll(w);
+}
+
+}  // namespace
+
+template<class C, class Classify>
+bool BitParallelSampler::build(const C &c, gate_t root, Classify classify)
+{
+  std::vector<uint32_t> index(c.getNbGates(), UNSEEN);
+
+  struct Frame {
+    gate_t g;
+    Op op;
+    size_t next;  ///< Next wire to descend into
+  };
+  std::vector<Frame> stack;
+
+  auto reach = [&](gate_t g) {
+    std::optional<Op> op = classify(g);
+    if(!op)
+      return false;
+    index[static_cast<size_t>(g)] = PENDING;
+    stack.push_back({g, *op, 0});
+    return true;
+  };
+
+  if(!reach(root))
+    return false;
+
+  while(!stack.empty()) {
+    Frame &f = stack.back();
+    const auto &wires = c.getWires(f.g);
+    const bool leaf = f.op == Op::INPUT || f.op == Op::FALSE || f.op == Op::TRUE;
+
+    if(!leaf && f.next < wires.size()) {
+      gate_t w = wires[f.next++];
+      if(index[static_cast<size_t>(w)] == UNSEEN && !reach(w))
+        return false;
+      continue;
+    }
+
+    const uint32_t id = nodes_.size();
+    const uint32_t first = args_.size();
+    if(!leaf)
+      for(gate_t w : wires)
+        args_.push_back(index[static_cast<size_t>(w)]);
+    nodes_.push_back({f.op, first, static_cast<uint32_t>(args_.size() - first)});
+
+    if(f.op == Op::INPUT) {
+      const double p = c.getProb(f.g);
+      const uint64_t q = p > 0. && p < 1. ? static_cast<uint64_t>(std::ldexp(p, 64)) : 0;
+      inputs_.push_back({id, q, p >= 1.});
+    }
+
+    index[static_cast<size_t>(f.g)] = id;
+    stack.pop_back();
+  }
+
+  return true;
+}
+
+BitParallelSampler::BitParallelSampler(const BooleanCircuit &c, gate_t root)
+{
+  build(c, root, [&](gate_t g) -> std::optional<Op> {
+    switch(c.getGateType(g)) {
+    case BooleanGate::IN:
+      return Op::INPUT;
+    case BooleanGate::AND:
+      return Op::AND;
+    case BooleanGate::OR:
+      return Op::OR;
+    case BooleanGate::NOT:
+      return Op::NOT;
+    case BooleanGate::MULIN:
+    case BooleanGate::MULVAR:
+      throw CircuitException("Monte-Carlo sampling not implemented on multivalued inputs");
+    case BooleanGate::UNDETERMINED:
+      break;
+    }
+    throw CircuitException("Incorrect gate type");
+  });
+}
+
+#ifndef TDKC
+std::optional<BitParallelSampler> BitParallelSampler::fromGeneric(
+  const GenericCircuit &gc, gate_t root)
+{
+  BitParallelSampler s;
+  // Gates of the wrong arity are left to the per-world Sampler too, which
+  // reports them.
+  bool ok = s.build(gc, root, [&](gate_t g) -> std::optional<Op> {
+    const auto n = gc.getWires(g).size();
+    switch(gc.getGateType(g)) {
+    case gate_input:
+    case gate_update:
+      return Op::INPUT;
+    case gate_plus:
+      return Op::OR;
+    case gate_times:
+      return Op::AND;
+    case gate_monus:
+      if(n == 2)
+        return Op::ANDNOT;
+      break;
+    case gate_zero:
+      return Op::FALSE;
+    case gate_one:
+      return Op::TRUE;
+    case gate_delta:
+    case gate_assumed:
+    case gate_annotation:
+      if(n == 1)
+        return Op::COPY;
+      break;
+    default:
+      break;
+    }
+    return std::nullopt;
+  });
+  if(!ok)
+    return std::nullopt;
+  return s;
+}
+#endif
+
+uint64_t BitParallelSampler::sample(std::mt19937_64 &rng,
+                                    std::vector<uint64_t> &value) const
+{
+  for(const Input &in : inputs_) {
+    // World i is true iff its uniform draw, revealed a bit per word from
+    // the most significant, is below q: the first bit where the two differ
+    // decides it, so each word decides half the undecided worlds.  Worlds
+    // equal to q on every bit are not below it.
+    uint64_t m = 0;
+    if(in.always)
+      m = ~uint64_t{0};
+    else
+      for(uint64_t undecided = ~uint64_t{0}, bit = uint64_t{1} << 63;
+          undecided && bit && (in.q & (bit | (bit - 1))); bit >>= 1) {
+        const uint64_t r = rng();
+        if(in.q & bit) {
+          m |= undecided & ~r;
+          undecided &= r;
+        } else
+          undecided &= ~r;
+      }
+    value[in.node] = m;
+  }
+
+  const uint32_t *args = args_.data();
+  uint64_t *v = value.data();
+  for(size_t i = 0; i < nodes_.size(); ++i) {
+    const Node &n = nodes_[i];
+    const uint32_t *a = args + n.first;
+    uint64_t r = 0;
+    switch(n.op) {
+    case Op::INPUT:
+      continue;
+    case Op::AND:
+      r = ~uint64_t{0};
+      for(uint32_t j = 0; j < n.nb; ++j)
+        r &= v[a[j]];
+      break;
+    case Op::OR:
+      r = 0;
+      for(uint32_t j = 0; j < n.nb; ++j)
+        r |= v[a[j]];
+      break;
+    case Op::NOT:
+      r = ~v[a[0]];
+      break;
+    case Op::ANDNOT:
+      r = v[a[0]] & ~v[a[1]];
+      break;
+    case Op::FALSE:
+      r = 0;
+      break;
+    case Op::TRUE:
+      r = ~uint64_t{0};
+      break;
+    case Op::COPY:
+      r = v[a[0]];
+      break;
+    }
+    v[i] = r;
+  }
+
+  return v[nodes_.size() - 1];
+}
+
+unsigned long BitParallelSampler::countBlock(uint64_t key, unsigned long b,
+                                             unsigned long n,
+                                             std::vector<uint64_t> &value) const
+{
+  std::mt19937_64 rng = streamRng(key, b);
+  unsigned long success = 0;
+  for(unsigned long done = 0; done < n; done += WORLDS) {
+    uint64_t w = sample(rng, value);
+    if(n - done < WORLDS)
+      w &= (uint64_t{1} << (n - done)) - 1;
+    success += __builtin_popcountll(w);
+  }
+  return success;
+}
+
+double BitParallelSampler::monteCarlo(unsigned long samples, uint64_t key) const
+{
+  if(samples == 0)
+    return 0.;
+
+  const unsigned threads = samplerThreads();
+  std::vector<std::vector<uint64_t> > value(threads, std::vector<uint64_t>(size()));
+  std::vector<unsigned long> success(threads, 0), done(threads, 0);
+
+  const unsigned long nblocks = (samples + BLOCK - 1) / BLOCK;
+  const bool complete = forEachBlock(nblocks, [&](unsigned long b, unsigned t) {
+    const unsigned long n = std::min(BLOCK, samples - b * BLOCK);
+    success[t] += countBlock(key, b, n, value[t]);
+    done[t] += n;
+  });
+
+  if(!complete) {
+    unsigned long total = 0;
+    for(auto d : done)
+      total += d;
+    throw CircuitException("Interrupted after "+std::to_string(total)+" samples");
+  }
+
+  unsigned long total = 0;
+  for(auto s : success)
+    total += s;
+  return total*1./samples;
+}
+
+double BitParallelSampler::stoppingRule(unsigned long threshold,
+                                        unsigned long max_samples,
+                                        uint64_t key,
+                                        unsigned long &samples_used,
+                                        bool &reached_target) const
+{
+  samples_used = 0;
+  reached_target = false;
+  if(max_samples == 0)
+    return 0.;
+
+  std::vector<std::vector<uint64_t> > value(samplerThreads(),
+                                            std::vector<uint64_t>(size()));
+  unsigned long success;
+  bool interrupted;
+  reached_target = stopAtThreshold(
+    threshold, max_samples, BLOCK,
+    [&](unsigned long b, unsigned long n, unsigned t) {
+      return countBlock(key, b, n, value[t]);
+    },
+    [&](unsigned long b, unsigned long k, unsigned t) {
+      std::mt19937_64 rng = streamRng(key, b);
+      for(unsigned long done = 0;; done += WORLDS) {
+        const uint64_t w = sample(rng, value[t]);
+        const unsigned long c = __builtin_popcountll(w);
+        if(c >= k)
+          return done + nthSetBit(w, k);
+        k -= c;
+      }
+    },
+    samples_used, success, interrupted);
+
+  if(interrupted)
+    throw CircuitException("Interrupted after "+std::to_string(samples_used)+" samples");
+  if(reached_target)
+    return static_cast<double>(threshold) / static_cast<double>(samples_used);
+  return static_cast<double>(success) / static_cast<double>(max_samples);
+}
+
+}  // namespace provsql
@@ -0,0 +1,167 @@
+/**
+ * @file BitParallelSampler.h
+ * @brief Monte Carlo over a Boolean circuit, 64 worlds at a time.
+ *
+ * A @c BitParallelSampler flattens the part of a circuit reachable from
+ * a root into an array of gates in topological order, then samples
+ * worlds in batches of 64: every input gets a 64-bit word whose bit @c i
+ * says whether it is true in world @c i, and one pass over the array
+ * evaluates AND / OR / NOT / monus with word-wide bitwise operations.
+ * The number of worlds satisfying the root is a popcount.
+ *
+ * This replaces, for the Boolean fragment, the per-world loops of
+ * @c BooleanCircuit::monteCarlo (a set of the true inputs, rebuilt per
+ * world, and a recursive walk) and of the RV-aware @c Sampler (hash-map
+ * memo caches reset per world): both draw and test one world at a time,
+ * and spend most of it on allocation and hashing.  Circuits with gates
+ * outside the fragment -- comparisons, random variables, aggregates,
+ * multivalued inputs -- keep the per-world samplers.
+ *
+ * An input's word compares 64 uniform draws with its probability at
+ * once, one bit position per random word from the most significant: a
+ * world is decided at the first position where its draw and the
+ * probability differ, so every word decides half of the undecided
+ * worlds, and all 64 are decided after about eight words -- an eighth
+ * of a draw per world, against one draw per world (and per reached
+ * input) before, with no loss of precision.
+ */
+#ifndef PROVSQL_BIT_PARALLEL_SAMPLER_H
+#define PROVSQL_BIT_PARALLEL_SAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "BooleanCircuit.h"
+
+class GenericCircuit;
+
+namespace provsql {
+
+/**
+ * @brief Flattened Boolean circuit evaluated on 64 sampled worlds at once.
+ */
+class BitParallelSampler {
+public:
+/**
+ * @brief Flatten the sub-circuit of @p c reachable from @p root.
+ *
+ * @throws CircuitException if a multivalued input (@c MULIN /
+ *         @c MULVAR) or an undetermined gate is reachable.
+ */
+BitParallelSampler(const BooleanCircuit &c, gate_t root);
+
+/**
+ * @brief Flatten the sub-circuit of @p gc reachable from @p root, if it
+ *        is Boolean.
+ *
+ * The Boolean fragment is what @c Sampler::evalBool reads as such:
+ * inputs and updates, @c plus / @c times / @c monus, @c zero / @c one,
+ * and the transparent @c delta / @c assumed / @c annotation wrappers.
+ * @return @c std::nullopt when any other gate is reachable; the caller
+ *         then samples through the RV-aware @c Sampler.
+ *
+ * Not available in the standalone @c tdkc build, which has no
+ * @c GenericCircuit.
+ */
+static std::optional<BitParallelSampler> fromGeneric(const GenericCircuit &gc,
+                                                     gate_t root);
+
+/**
+ * @brief Draw 64 worlds and evaluate the root in each.
+ *
+ * @param value  Scratch, one word per flattened gate (see @c size());
+ *               one per thread sampling concurrently.
+ * @return Bit @c i set iff the root is true in world @c i.
+ */
+uint64_t sample(std::mt19937_64 &rng, std::vector<uint64_t> &value) const;
+
+/** @brief Number of flattened gates. */
+std::size_t size() const { return nodes_.size(); }
+
+/**
+ * @brief Fraction of @p samples worlds in which the root is true.
+ *
+ * Worlds are drawn in blocks, spread over @c provsql.sampler_threads
+ * threads, from the streams of the run keyed @p key (see
+ * @c ParallelSampler.h); the estimate depends on @p key only.
+ * @throws CircuitException when interrupted.
+ */
+double monteCarlo(unsigned long samples, uint64_t key) const;
+
+/**
+ * @brief The Dagum-Karp-Luby-Ross stopping rule of @c monteCarloRVStopping,
+ *        over blocks of worlds.
+ *
+ * Stops at the very world at which the success count reaches the
+ * threshold, not at the end of its word or block, so @p samples_used and
+ * the estimate are those of a world-at-a-time run over the same worlds,
+ * whatever the number of threads.
+ * @param threshold       Success count to reach (@c ceil(Y1)).
+ * @param max_samples     Hard cap on the number of worlds.
+ * @param key             Key of the run's streams.
+ * @param samples_used    Output: worlds used.
+ * @param reached_target  Output: whether @p threshold was reached.
+ * @return                Successes over @p samples_used.
+ * @throws CircuitException when interrupted.
+ */
+double stoppingRule(unsigned long threshold, unsigned long max_samples,
+                    uint64_t key, unsigned long &samples_used,
+                    bool &reached_target) const;
+
+/** @brief Operation of a flattened gate. */
+enum class Op : uint8_t {
+  INPUT,   ///< Drawn, not computed
+  AND,     ///< Conjunction of the arguments (true if none)
+  OR,      ///< Disjunction of the arguments (false if none)
+  NOT,     ///< Negation of the one argument
+  ANDNOT,  ///< First argument and not the second (@c monus)
+  FALSE,   ///< Constant false
+  TRUE,    ///< Constant true
+  COPY     ///< The one argument
+};
+
+private:
+BitParallelSampler() = default;
+
+/** @brief A flattened gate; its arguments are @c args_[first, first+nb). */
+struct Node {
+  Op op;          ///< What to compute
+  uint32_t first; ///< First argument in @c args_
+  uint32_t nb;    ///< Number of arguments
+};
+
+/** @brief An input gate, with its probability as a binary expansion. */
+struct Input {
+  uint32_t node;  ///< Index in @c nodes_
+  uint64_t q;     ///< Probability times 2^64
+  bool always;    ///< Probability 1 (which @c q cannot hold)
+};
+
+/**
+ * @brief Flatten from @p root, in post-order along the wires.
+ *
+ * Inputs are numbered, and drawn, in the order the walk first meets
+ * them, so a pinned seed gives the same worlds whatever the gate
+ * numbering.
+ * @param op  @c op(g) is the @c Op of @p g, or @c std::nullopt if
+ *            @p g is outside the fragment.
+ * @return    @c false if a gate outside the fragment was reached.
+ */
+template<class C, class Classify>
+bool build(const C &c, gate_t root, Classify op);
+
+std::vector<Node> nodes_;      ///< Gates, arguments first; the root last
+std::vector<uint32_t> args_;   ///< Arguments of all nodes
+std::vector<Input> inputs_;    ///< The @c INPUT nodes
+
+/** @brief Successes among the first @p n worlds of block @p b. */
+unsigned long countBlock(uint64_t key, unsigned long b, unsigned long n,
+                         std::vector<uint64_t> &value) const;
+};
+
+}  // namespace provsql
+
+#endif  // PROVSQL_BIT_PARALLEL_SAMPLER_H
@@ -30,7 +30,9 @@ extern "C" {
 
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
@@ -38,18 +40,23 @@ extern "C" {
 #include <random>
 #include <vector>
 #include <stack>
+#include <limits>
 #include <functional>
 #include <algorithm>
+#include <optional>
 
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 
+#include "BitParallelSampler.h"
+#include "ParallelSampler.h"
 #include "dDNNFTreeDecompositionBuilder.h"
 #include "external_tool.h"
 // The tool registry drives external-tool selection and invocation, all of
 // which lives in #ifndef TDKC blocks (tdkc invokes no external tool), so the
 // registry is needed only in the extension build.
 #ifndef TDKC
+#include "CompiledCircuitCache.h"
 #include "ToolRegistry.h"
 #include "kcmcp_client.h"
 #endif
@@ -58,7 +65,6 @@ extern "C" {
 #ifdef TDKC
 constexpr bool provsql_interrupted = false;
 constexpr int provsql_verbose = 0;
-constexpr int provsql_monte_carlo_seed = -1;
 // makeDD's final fallback uses this GUC in the extension build; the
 // standalone tdkc tool has no GUC layer, so default it to "d4".
 constexpr const char *provsql_fallback_compiler = "d4";
@@ -319,76 +325,16 @@ std::string BooleanCircuit::exportCircuit(gate_t root) const
   return ss.str();
 }
 
-bool BooleanCircuit::evaluate(gate_t g, const std::unordered_set<gate_t> &sampled) const
-{
-  check_stack_depth(); // recurses on wires; guard deep circuits (see GenericCircuit::evaluate)
-  bool disjunction=false;
-
-  switch(getGateType(g)) {
-  case BooleanGate::IN:
-    return sampled.find(g)!=sampled.end();
-  case BooleanGate::MULIN:
-  case BooleanGate::MULVAR:
-    throw CircuitException("Monte-Carlo sampling not implemented on multivalued inputs");
-  case BooleanGate::NOT:
-    return !evaluate(*(getWires(g).begin()), sampled);
-  case BooleanGate::AND:
-    disjunction = false;
-    break;
-  case BooleanGate::OR:
-    disjunction = true;
-    break;
-  case BooleanGate::UNDETERMINED:
-    throw CircuitException("Incorrect gate type");
-  }
-
-  for(auto s: getWires(g)) {
-    bool e = evaluate(s, sampled);
-    if(disjunction && e)
-      return true;
-    if(!disjunction && !e)
-      return false;
-  }
-
-  if(disjunction)
-    return false;
-  else
-    return true;
-}
-
 double BooleanCircuit::monteCarlo(gate_t g, unsigned samples) const
 {
-  // Seed mt19937_64 from the provsql.monte_carlo_seed GUC: -1 (the
-  // default) means non-deterministic via std::random_device, any other
-  // value (including 0) is a literal seed so regression tests can pin
-  // sampling for reproducibility.
-  std::mt19937_64 rng;
-  if(provsql_monte_carlo_seed != -1) {
-    rng.seed(static_cast<uint64_t>(provsql_monte_carlo_seed));
-  } else {
-    std::random_device rd;
-    rng.seed((static_cast<uint64_t>(rd()) << 32) | rd());
-  }
-  std::uniform_real_distribution<double> uniform01(0.0, 1.0);
-
-  auto success{0u};
-
-  for(unsigned i=0; i<samples; ++i) {
-    std::unordered_set<gate_t> sampled;
-    for(auto in: inputs) {
-      if(uniform01(rng) < getProb(in)) {
-        sampled.insert(in);
-      }
-    }
-
-    if(evaluate(g, sampled))
-      ++success;
-
-    if(provsql_interrupted)
-      throw CircuitException("Interrupted after "+std::to_string(i+1)+" samples");
-  }
-
-  return success*1./samples;
+  // The run is keyed by the provsql.monte_carlo_seed GUC: -1 (the default)
+  // means non-deterministic via std::random_device, any other value
+  // (including 0) pins the estimate, whatever provsql.sampler_threads is, so
+  // regression tests can pin sampling for reproducibility.  64 worlds per
+  // pass over the flattened circuit; only the inputs reachable from g are
+  // drawn.
+  provsql::BitParallelSampler sampler(*this, g);
+  return sampler.monteCarlo(samples, provsql::samplingKey());
 }
 
 bool BooleanCircuit::dnfShape(
@@ -519,19 +465,9 @@ KarpLubyState karpLubyState(
   return st;
 }
 
-/// Seed mt19937_64 from provsql.monte_carlo_seed exactly as monteCarlo, so a
-/// pinned seed makes the estimate reproducible for the regression tests.
-std::mt19937_64 karpLubySeededRNG()
-{
-  std::mt19937_64 rng;
-  if(provsql_monte_carlo_seed != -1) {
-    rng.seed(static_cast<uint64_t>(provsql_monte_carlo_seed));
-  } else {
-    std::random_device rd;
-    rng.seed((static_cast<uint64_t>(rd()) << 32) | rd());
-  }
-  return rng;
-}
+/// Karp-Luby rounds per block handed to a sampler thread (and per random
+/// stream, see ParallelSampler.h).
+constexpr unsigned long kKarpLubyBlock = 1024;
 
 /// Draw a clause index with probability @c p_i / S using the prefix sums.
 size_t karpLubyDrawClause(const KarpLubyState &st,
@@ -595,24 +531,34 @@ double BooleanCircuit::karpLuby(
   if(st.S<=0.)
     return 0.;
 
-  std::mt19937_64 rng = karpLubySeededRNG();
-  std::uniform_real_distribution<double> u01(0.0, 1.0);
-  std::unordered_set<gate_t> trueLeaves;
+  // Rounds are drawn in blocks, each from its own stream of the run keyed by
+  // provsql.monte_carlo_seed, and spread over provsql.sampler_threads
+  // threads; the estimate depends on the key only.
+  const uint64_t key = provsql::samplingKey();
+  std::vector<std::unordered_set<gate_t> > trueLeaves(provsql::samplerThreads());
 
   // Fewer rounds than clauses: too few to stratify (every clause needs at
   // least one sample for its per-clause acceptance rate to be defined), so
   // fall back to the unstratified categorical-draw estimator -- S times the
   // overall acceptance ratio, still unbiased for any budget.
   if(samples < m) {
-    unsigned long accepts = 0;
-    for(unsigned long s=0; s<samples; ++s) {
-      size_t i = karpLubyDrawClause(st, rng, u01);
-      if(karpLubyCovers(*this, supports, st, i, rng, u01, trueLeaves))
-        ++accepts;
-      if(provsql_interrupted)
-        throw CircuitException("Interrupted after "+std::to_string(s+1)+" samples");
-    }
-    return st.S * accepts / static_cast<double>(samples);
+    const unsigned long nblocks = (samples + kKarpLubyBlock - 1) / kKarpLubyBlock;
+    std::vector<unsigned long> accepts(nblocks, 0);
+    if(!provsql::forEachBlock(nblocks, [&](unsigned long b, unsigned t) {
+      std::mt19937_64 rng = provsql::streamRng(key, b);
+      std::uniform_real_distribution<double> u01(0.0, 1.0);
+      const unsigned long n = std::min(kKarpLubyBlock, samples - b * kKarpLubyBlock);
+      for(unsigned long s=0; s<n; ++s) {
+        size_t i = karpLubyDrawClause(st, rng, u01);
+        if(karpLubyCovers(*this, supports, st, i, rng, u01, trueLeaves[t]))
+          ++accepts[b];
+      }
+    }))
+      throw CircuitException("Interrupted");
+    unsigned long total = 0;
+    for(auto a: accepts)
+      total += a;
+    return st.S * total / static_cast<double>(samples);
   }
 
   // Stratified allocation: n_i = 1 + proportional share of (samples - m) by
@@ -643,18 +589,33 @@ double BooleanCircuit::karpLuby(
       ++n[idx[k]];
   }
 
+  // Each clause's rounds, cut into blocks.
+  struct Block {
+    size_t clause;
+    unsigned long rounds;
+  };
+  std::vector<Block> blocks;
+  for(size_t i=0; i<m; ++i)
+    for(unsigned long k=0; k<n[i]; k+=kKarpLubyBlock)
+      blocks.push_back({i, std::min(kKarpLubyBlock, n[i]-k)});
+
+  std::vector<unsigned long> accepts(blocks.size(), 0);
+  if(!provsql::forEachBlock(blocks.size(), [&](unsigned long b, unsigned t) {
+    std::mt19937_64 rng = provsql::streamRng(key, b);
+    std::uniform_real_distribution<double> u01(0.0, 1.0);
+    for(unsigned long k=0; k<blocks[b].rounds; ++k)
+      if(karpLubyCovers(*this, supports, st, blocks[b].clause, rng, u01, trueLeaves[t]))
+        ++accepts[b];
+  }))
+    throw CircuitException("Interrupted");
+
+  std::vector<unsigned long> clause_accepts(m, 0);
+  for(size_t b=0; b<blocks.size(); ++b)
+    clause_accepts[blocks[b].clause] += accepts[b];
+
   double est = 0.;
-  for(size_t i=0; i<m; ++i) {
-    unsigned long accepts = 0;
-    for(unsigned long k=0; k<n[i]; ++k) {
-      if(karpLubyCovers(*this, supports, st, i, rng, u01, trueLeaves))
-        ++accepts;
-      if(provsql_interrupted)
-        throw CircuitException("Interrupted while sampling clause "
-                               +std::to_string(i));
-    }
-    est += st.p[i] * static_cast<double>(accepts) / static_cast<double>(n[i]);
-  }
+  for(size_t i=0; i<m; ++i)
+    est += st.p[i] * static_cast<double>(clause_accepts[i]) / static_cast<double>(n[i]);
   return est;
 }
 
@@ -686,29 +647,49 @@ double BooleanCircuit::karpLubyStopping(
   const double Y  = 4.0 * (e - 2.0) * log(2.0/delta) / (eps*eps);
   const double Y1 = 1.0 + (1.0 + eps) * Y;
 
-  std::mt19937_64 rng = karpLubySeededRNG();
-  std::uniform_real_distribution<double> u01(0.0, 1.0);
-  std::unordered_set<gate_t> trueLeaves;
-
-  unsigned long accepts = 0;
-  for(unsigned long s=0; s<max_samples; ++s) {
+  // Blocks of rounds from the streams of the run keyed by
+  // provsql.monte_carlo_seed, counted on provsql.sampler_threads threads and
+  // merged in block order: the stopping round, hence the estimate, is that of
+  // drawing the blocks one after the other.  An integer accept count reaches
+  // Y1 exactly when it reaches ceil(Y1).
+  const uint64_t key = provsql::samplingKey();
+  std::vector<std::unordered_set<gate_t> > trueLeaves(provsql::samplerThreads());
+  auto trial = [&](std::mt19937_64 &rng, std::uniform_real_distribution<double> &u01,
+                   unsigned t) {
     size_t i = karpLubyDrawClause(st, rng, u01);
-    if(karpLubyCovers(*this, supports, st, i, rng, u01, trueLeaves)) {
-      ++accepts;
-      if(static_cast<double>(accepts) >= Y1) {
-        samples_used = s + 1;
-        reached_target = true;
-        return st.S * Y1 / static_cast<double>(samples_used);
-      }
-    }
-    if(provsql_interrupted)
-      throw CircuitException("Interrupted after "+std::to_string(s+1)+" samples");
-  }
+    return karpLubyCovers(*this, supports, st, i, rng, u01, trueLeaves[t]);
+  };
+
+  unsigned long accepts;
+  bool interrupted;
+  reached_target = provsql::stopAtThreshold(
+    static_cast<unsigned long>(ceil(Y1)), max_samples, kKarpLubyBlock,
+    [&](unsigned long b, unsigned long n, unsigned t) {
+      std::mt19937_64 rng = provsql::streamRng(key, b);
+      std::uniform_real_distribution<double> u01(0.0, 1.0);
+      unsigned long c = 0;
+      for(unsigned long s=0; s<n; ++s)
+        c += trial(rng, u01, t);
+      return c;
+    },
+    [&](unsigned long b, unsigned long k, unsigned t) {
+      std::mt19937_64 rng = provsql::streamRng(key, b);
+      std::uniform_real_distribution<double> u01(0.0, 1.0);
+      unsigned long s = 0;
+      while(!(trial(rng, u01, t) && --k == 0))
+        ++s;
+      return s;
+    },
+    samples_used, accepts, interrupted);
+
+  if(interrupted)
+    throw CircuitException("Interrupted after "+std::to_string(samples_used)+" samples");
+  if(reached_target)
+    return st.S * Y1 / static_cast<double>(samples_used);
 
   // Cap reached before the threshold: the (eps,delta) target is not met, so
   // return the plain unbiased S*accepts/N estimate over the spent budget (the
   // caller reports the weaker guarantee actually achieved).
-  samples_used = max_samples;
   return st.S * static_cast<double>(accepts) / static_cast<double>(max_samples);
 }
 
@@ -826,6 +807,21 @@ void BooleanCircuit::dnfBounds(
   upper = (U > 1.) ? 1. : U;
 }
 
+namespace {
+
+/** @brief Input words of the six inputs enumerated within a 64-bit word:
+ *  bit @c L of word @c j is bit @c j of world (lane) @c L. */
+constexpr uint64_t kLanePattern[6] = {
+  0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+  0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+};
+
+/** @brief Gray-code bits whose world weights are tabulated; the weight of
+ *  the higher bits is recomputed when one of them flips. */
+constexpr unsigned kPossibleWorldsTableBits = 16;
+
+}  // namespace
+
 double BooleanCircuit::possibleWorlds(gate_t g) const
 {
   /* Enumerate only the inputs reachable from g.  An input the root does
@@ -834,90 +830,270 @@ double BooleanCircuit::possibleWorlds(gate_t g) const
    * the circuit object routinely carries gates the evaluated root no
    * longer reaches (e.g. a categorical mulinput block whose comparison
    * the analytic pre-pass collapsed to a single Bernoulli), which would
-   * otherwise inflate the enumeration exponentially for nothing. */
-  std::set<gate_t> rinputs;
+   * otherwise inflate the enumeration exponentially for nothing.
+   *
+   * The reachable gates are flattened in post-order and hold one 64-bit
+   * word each: six inputs are spread over the bits of the word, so one
+   * evaluation covers 64 worlds, and the others are enumerated in Gray-code
+   * order.  Each step flips one input, and only the gates above it whose
+   * arguments changed are recomputed, in topological order. */
+  enum class Op : uint8_t { IN, AND, OR, NOT };
+  std::vector<Op> op;
+  std::vector<uint32_t> first{0}, args;
+  std::vector<gate_t> in_gate;
+  std::vector<uint32_t> in_node;
   {
-    std::unordered_set<gate_t> seen;
-    std::stack<gate_t> stk;
-    stk.push(g);
+    constexpr uint32_t unseen = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> index(getNbGates(), unseen);
+    std::vector<std::pair<gate_t, size_t> > stk{{g, 0}};
+    index[static_cast<size_t>(g)] = unseen - 1;
     while(!stk.empty()) {
-      gate_t u = stk.top(); stk.pop();
-      if(!seen.insert(u).second) continue;
-      if(getGateType(u) == BooleanGate::IN) rinputs.insert(u);
-      for(gate_t w: getWires(u)) stk.push(w);
+      auto &[u, next] = stk.back();
+      const auto &w = getWires(u);
+      const bool leaf = getGateType(u) == BooleanGate::IN;
+      if(!leaf && next < w.size()) {
+        gate_t c = w[next++];
+        if(index[static_cast<size_t>(c)] == unseen) {
+          index[static_cast<size_t>(c)] = unseen - 1;
+          stk.push_back({c, 0});
+        }
+        continue;
+      }
+      switch(getGateType(u)) {
+      case BooleanGate::IN:
+        op.push_back(Op::IN);
+        in_gate.push_back(u);
+        in_node.push_back(op.size() - 1);
+        break;
+      case BooleanGate::AND:
+        op.push_back(Op::AND);
+        break;
+      case BooleanGate::OR:
+        op.push_back(Op::OR);
+        break;
+      case BooleanGate::NOT:
+        op.push_back(Op::NOT);
+        break;
+      case BooleanGate::MULIN:
+      case BooleanGate::MULVAR:
+        throw CircuitException("Possible-worlds enumeration not implemented on multivalued inputs");
+      case BooleanGate::UNDETERMINED:
+        throw CircuitException("Incorrect gate type");
+      }
+      if(!leaf)
+        for(gate_t c : w)
+          args.push_back(index[static_cast<size_t>(c)]);
+      first.push_back(args.size());
+      index[static_cast<size_t>(u)] = op.size() - 1;
+      stk.pop_back();
+    }
+  }
+  const uint32_t n = op.size(), root = n - 1;
+
+  std::vector<uint32_t> pfirst(n + 1, 0), parents(args.size());
+  for(uint32_t a : args)
+    ++pfirst[a + 1];
+  for(uint32_t i = 0; i < n; ++i)
+    pfirst[i + 1] += pfirst[i];
+  {
+    std::vector<uint32_t> fill(pfirst.begin(), pfirst.end() - 1);
+    for(uint32_t i = 0; i < n; ++i)
+      for(uint32_t j = first[i]; j < first[i + 1]; ++j)
+        parents[fill[args[j]]++] = i;
+  }
+
+  std::vector<uint64_t> v(n, 0);
+  auto compute = [&](uint32_t i) {
+    uint64_t r = 0;
+    switch(op[i]) {
+    case Op::IN:
+      return v[i];
+    case Op::AND:
+      r = ~uint64_t{0};
+      for(uint32_t j = first[i]; j < first[i + 1]; ++j)
+        r &= v[args[j]];
+      break;
+    case Op::OR:
+      for(uint32_t j = first[i]; j < first[i + 1]; ++j)
+        r |= v[args[j]];
+      break;
+    case Op::NOT:
+      r = ~v[args[first[i]]];
+      break;
+    }
+    return r;
+  };
+
+  // Inputs of probability 0 or 1 are constants, not enumerated.  Of the
+  // others, those with the most gates above them go to the word bits, and
+  // the rest are ordered by cone size, the smallest on the Gray-code bit
+  // that flips most often.
+  std::vector<std::pair<uint32_t, double> > vars;  // (node, probability)
+  {
+    struct Var { uint32_t node; double p; size_t cone; };
+    std::vector<Var> order;
+    std::vector<uint32_t> mark(n, 0), todo;
+    for(size_t k = 0; k < in_node.size(); ++k) {
+      const double p = getProb(in_gate[k]);
+      if(p <= 0. || p >= 1.) {
+        v[in_node[k]] = p >= 1. ? ~uint64_t{0} : 0;
+        continue;
+      }
+      size_t size = 0;
+      todo.assign(1, in_node[k]);
+      while(!todo.empty()) {
+        uint32_t u = todo.back(); todo.pop_back();
+        for(uint32_t j = pfirst[u]; j < pfirst[u + 1]; ++j)
+          if(mark[parents[j]] != k + 1) {
+            mark[parents[j]] = k + 1;
+            ++size;
+            todo.push_back(parents[j]);
+          }
+      }
+      order.push_back({in_node[k], p, size});
     }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Var &a, const Var &b) { return a.cone > b.cone; });
+    std::stable_sort(order.begin() + std::min<size_t>(6, order.size()), order.end(),
+                     [](const Var &a, const Var &b) { return a.cone < b.cone; });
+    for(const Var &x : order)
+      vars.push_back({x.node, x.p});
   }
 
-  if(rinputs.size()>=8*sizeof(unsigned long long))
+  if(vars.size() >= 8*sizeof(unsigned long long))
     throw CircuitException("Too many possible worlds to iterate over");
 
-  unsigned long long nb=(1ULL<<rinputs.size());
-  double totalp=0.;
+  const unsigned lanes = std::min<size_t>(6, vars.size());
+  const unsigned nh = vars.size() - lanes;
 
-  for(unsigned long long i=0; i < nb; ++i) {
-    std::unordered_set<gate_t> s;
-    double p = 1;
+  // laneSum(w) = sum of the weights of the worlds (lanes) set in w, a byte
+  // at a time; lanes past 2^lanes have weight 0.
+  std::vector<double> lane_weight(64, 0.);
+  for(unsigned l = 0; l < (1u << lanes); ++l) {
+    double p = 1.;
+    for(unsigned j = 0; j < lanes; ++j)
+      p *= (l >> j & 1) ? vars[j].second : 1. - vars[j].second;
+    lane_weight[l] = p;
+  }
+  std::vector<double> byte_sum(8 * 256, 0.);
+  for(unsigned k = 0; k < 8; ++k)
+    for(unsigned b = 1; b < 256; ++b)
+      byte_sum[k*256 + b] = byte_sum[k*256 + (b & (b - 1))]
+                            + lane_weight[8*k + __builtin_ctz(b)];
+  auto laneSum = [&](uint64_t w) {
+    double s = 0.;
+    for(unsigned k = 0; k < 8; ++k)
+      s += byte_sum[k*256 + ((w >> (8*k)) & 255)];
+    return s;
+  };
 
-    unsigned j=0;
-    for(gate_t in : rinputs) {
-      if(i & (1ULL << j)) {
-        s.insert(in);
-        p*=getProb(in);
-      } else {
-        p*=1-getProb(in);
+  // Weight of the Gray-code state: a table over its low bits, times the
+  // product over its high bits, recomputed when a high bit flips.
+  const unsigned nl = std::min(nh, kPossibleWorldsTableBits);
+  std::vector<double> low_weight{1.};
+  for(unsigned j = 0; j < nl; ++j) {
+    const double p = vars[lanes + j].second;
+    std::vector<double> next(low_weight.size() * 2);
+    for(size_t m = 0; m < low_weight.size(); ++m) {
+      next[m] = low_weight[m] * (1. - p);
+      next[m | (size_t{1} << j)] = low_weight[m] * p;
+    }
+    low_weight.swap(next);
+  }
+  unsigned long long state = 0;
+  auto highWeight = [&]() {
+    double p = 1.;
+    for(unsigned j = nl; j < nh; ++j)
+      p *= (state >> j & 1) ? vars[lanes + j].second : 1. - vars[lanes + j].second;
+    return p;
+  };
+
+  for(unsigned j = 0; j < lanes; ++j)
+    v[vars[j].first] = kLanePattern[j];
+  for(uint32_t i = 0; i < n; ++i)
+    v[i] = compute(i);
+
+  // Gates to recompute, as a bitmap scanned upwards: parents come after
+  // their arguments, so every gate is recomputed at most once per step,
+  // after all of its changed arguments.
+  std::vector<uint64_t> dirty((n + 63) / 64, 0);
+  size_t nb_dirty = 0;
+  auto markParents = [&](uint32_t u) {
+    for(uint32_t j = pfirst[u]; j < pfirst[u + 1]; ++j) {
+      uint64_t &w = dirty[parents[j] / 64];
+      const uint64_t b = uint64_t{1} << (parents[j] % 64);
+      if(!(w & b)) {
+        w |= b;
+        ++nb_dirty;
       }
-      ++j;
     }
+  };
+  const unsigned long long low_mask = (1ULL << nl) - 1;
 
-    if(evaluate(g, s))
-      totalp+=p;
+  double high = highWeight(), block = 0., totalp = 0.;
+  const unsigned long long steps = 1ULL << nh;
+  for(unsigned long long s = 0;; ) {
+    block += low_weight[state & low_mask] * laneSum(v[root]);
 
-    if(provsql_interrupted)
+    if(++s == steps)
+      break;
+
+    const unsigned bit = __builtin_ctzll(s);
+    if(bit >= nl) {
+      totalp += high * block;
+      block = 0.;
+    }
+    state ^= 1ULL << bit;
+    if(bit >= nl)
+      high = highWeight();
+
+    const uint32_t x = vars[lanes + bit].first;
+    v[x] = ~v[x];
+    markParents(x);
+    for(size_t wi = x / 64; nb_dirty; ) {
+      if(!dirty[wi]) {
+        ++wi;
+        continue;
+      }
+      const uint32_t u = wi * 64 + __builtin_ctzll(dirty[wi]);
+      dirty[wi] &= dirty[wi] - 1;
+      --nb_dirty;
+      const uint64_t r = compute(u);
+      if(r != v[u]) {
+        v[u] = r;
+        markParents(u);
+      }
+    }
+
+    if((s & 0xFFF) == 0 && provsql_interrupted)
       throw CircuitException("Interrupted");
   }
+  totalp += high * block;
 
   return totalp;
 }
 
 std::string BooleanCircuit::TseytinCNF(gate_t g, bool display_prob, bool mapping) const {
-  std::vector<std::vector<int> > clauses;
+  std::ostringstream oss;
+  writeTseytinCNF(oss, g, display_prob, mapping);
+  return oss.str();
+}
 
-  // Tseytin transformation
+void BooleanCircuit::writeTseytinCNF(std::ostream &out, gate_t g,
+                                     bool display_prob, bool mapping) const {
+  // The problem line comes first, so count the clauses before writing
+  // any: one per wire plus one per AND/OR gate, two per NOT gate, and the
+  // unit clause asserting the root.
+  size_t nb_clauses = 1;
   for(gate_t i{0}; i<gates.size(); ++i) {
     switch(getGateType(i)) {
     case BooleanGate::AND:
-    {
-      int id{static_cast<int>(i)+1};
-      std::vector<int> c = {id};
-      for(auto s: getWires(i)) {
-        clauses.push_back({-id, static_cast<int>(s)+1});
-        c.push_back(-static_cast<int>(s)-1);
-      }
-      clauses.push_back(c);
-      break;
-    }
-
     case BooleanGate::OR:
-    {
-      int id{static_cast<int>(i)+1};
-      std::vector<int> c = {-id};
-      for(auto s: getWires(i)) {
-        clauses.push_back({id, -static_cast<int>(s)-1});
-        c.push_back(static_cast<int>(s)+1);
-      }
-      clauses.push_back(c);
-    }
-    break;
-
+      nb_clauses += getWires(i).size()+1;
+      break;
     case BooleanGate::NOT:
-    {
-      int id=static_cast<int>(i)+1;
-      auto s=*getWires(i).begin();
-      clauses.push_back({-id,-static_cast<int>(s)-1});
-      clauses.push_back({id,static_cast<int>(s)+1});
+      nb_clauses += 2;
       break;
-    }
-
     case BooleanGate::MULIN:
       throw CircuitException("Multivalued inputs should have been removed by then.");
     case BooleanGate::MULVAR:
@@ -926,34 +1102,67 @@ std::string BooleanCircuit::TseytinCNF(gate_t g, bool display_prob, bool mapping
       ;
     }
   }
-  clauses.push_back({(int)g+1});
 
-  std::ostringstream oss;
   // Optional self-documenting mapping, emitted as DIMACS comments
   // before the problem line so a saved CNF records which provenance
   // input each variable stands for. Comments are ignored by every
   // model counter / compiler, so the file stays valid DIMACS.
   if(mapping) {
     for(const auto &m : tseytinVariableMapping()) {
-      oss << "c input " << m.variable << " "
+      out << "c input " << m.variable << " "
           << (m.uuid.empty() ? "?" : m.uuid) << " "
           << m.probability << "\n";
     }
   }
-  oss << "p cnf " << gates.size() << " " << clauses.size() << "\n";
-  for(unsigned i=0; i<clauses.size(); ++i) {
-    for(int x : clauses[i]) {
-      oss << x << " ";
+  out << "p cnf " << gates.size() << " " << nb_clauses << "\n";
+
+  // Tseytin transformation, written clause by clause rather than
+  // collected first: the CNF of a large circuit goes straight to its
+  // consumer (a file, a tool's pipe).
+  for(gate_t i{0}; i<gates.size(); ++i) {
+    const int id{static_cast<int>(i)+1};
+    switch(getGateType(i)) {
+    case BooleanGate::AND:
+      for(auto s: getWires(i))
+        out << -id << " " << static_cast<int>(s)+1 << " 0\n";
+      out << id << " ";
+      for(auto s: getWires(i))
+        out << -static_cast<int>(s)-1 << " ";
+      out << "0\n";
+      break;
+
+    case BooleanGate::OR:
+      for(auto s: getWires(i))
+        out << id << " " << -static_cast<int>(s)-1 << " 0\n";
+      out << -id << " ";
+      for(auto s: getWires(i))
+        out << static_cast<int>(s)+1 << " ";
+      out << "0\n";
+      break;
+
+    case BooleanGate::NOT:
+    {
+      auto s=*getWires(i).begin();
+      out << -id << " " << -static_cast<int>(s)-1 << " 0\n";
+      out << id << " " << static_cast<int>(s)+1 << " 0\n";
+      break;
+    }
+
+    case BooleanGate::MULIN:
+    case BooleanGate::MULVAR:
+    case BooleanGate::IN:
+    case BooleanGate::UNDETERMINED:
+      ;
     }
-    oss << "0\n";
   }
+  out << static_cast<int>(g)+1 << " 0\n";
+
   if(display_prob) {
     for(gate_t in: inputs) {
-      oss << "w " << (static_cast<std::underlying_type<gate_t>::type>(in)+1) << " " << getProb(in) << "\n";
-      oss << "w -" << (static_cast<std::underlying_type<gate_t>::type>(in)+1) << " " << (1. - getProb(in)) << "\n";
+      out << "w " << (static_cast<std::underlying_type<gate_t>::type>(in)+1) << " " << getProb(in) << "\n";
+      out << "w -" << (static_cast<std::underlying_type<gate_t>::type>(in)+1) << " " << (1. - getProb(in)) << "\n";
     }
   }
-  return oss.str();
 }
 
 std::vector<BooleanCircuit::CNFInputMapping>
@@ -1056,7 +1265,7 @@ std::string BooleanCircuit::BCS12(gate_t g, std::vector<gate_t> &inputOrder) con
 // ---------------------------------------------------------------------------
 #ifndef TDKC
 
-// Parse a Panini (KCBox) DD output file into a d-DNNF: this is the
+// Parse a Panini (KCBox) DD output into a d-DNNF: this is the
 // `panini-dd` output parser, selected by compilation() for the panini-*
 // records (which run the generic compile path -- write a Tseytin CNF, run the
 // record's argtpl -- and differ only in this parse-back).  Panini emits its
@@ -1064,11 +1273,7 @@ std::string BooleanCircuit::BCS12(gate_t g, std::vector<gate_t> &inputOrder) con
 // conjunctions; decision nodes), not the c2d/d4 NNF the `nnf` parser reads.
 // R2-D2 and CCDD emit "K" (kernelize) nodes that break decomposability, so
 // ProvSQL does not register the variants that produce them.
-dDNNF BooleanCircuit::parsePaniniDD(const std::string &outfilename) const {
-  std::ifstream ifs(outfilename.c_str());
-  if (!ifs)
-    throw CircuitException("Cannot open Panini output: " + outfilename);
-
+dDNNF BooleanCircuit::parsePaniniDD(std::istream &ifs) const {
   // Skip Panini's preamble ("Variable order: ...", "Maximum variable: ...",
   // "Number of nodes: ...") and stop at the first data line, which always
   // starts with "0:".
@@ -1190,8 +1395,6 @@ dDNNF BooleanCircuit::parsePaniniDD(const std::string &outfilename) const {
     id_to_gate.push_back(this_gate);
   } while (std::getline(ifs, line));
 
-  ifs.close();
-
   if (id_to_gate.empty())
     throw CircuitException("Panini output produced no nodes");
 
@@ -1274,11 +1477,20 @@ dDNNF BooleanCircuit::compilation(gate_t g, std::string compiler,
   if(resolved)
     *resolved = compiler; // the validated tool actually used (CLI or KCMCP)
 
+  // The same compiler already compiled this very circuit, in this session
+  // or another: read its d-DNNF back (CompiledCircuitCache.h).
+  const provsql::CompiledCircuitKey key(*this, g,
+                                        "compilation:"+compiler+":"+compiler_binary);
+  if(auto cached = key.get())
+    return std::move(*cached);
+
   // KCMCP backend: compile over a warm socket server instead of spawning a
   // CLI tool.  The problem is sent as a native BC-S1.2 circuit when the record
   // advertises that input, else as a Tseytin CNF; the RESULT's d-DNNF text is
   // parsed by the same parseDDNNF() the CLI path uses.  Any failure (connect,
   // protocol, server ERROR) raises, so makeDD's fallback can try another tool.
+  // A server offering the binary ddnnf-bin format answers in it instead,
+  // read by parseBinaryDDNNF() without tokenising.
   if(rec->kind == "kcmcp") {
     std::vector<gate_t> inputOrder;
     std::string content;
@@ -1305,9 +1517,13 @@ dDNNF BooleanCircuit::compilation(gate_t g, std::string compiler,
               "KCMCP tool '"+compiler+"' has no endpoint (managed server not "
               "running, or provsql.kcmcp_server unset)");
     try {
-      std::string nnf = provsql::kcmcp_compile(endpoint, input_format, content);
-      std::istringstream iss(nnf);
-      return parseDDNNF(iss, inputOrder);
+      bool binary = false;
+      std::string dd = provsql::kcmcp_compile(endpoint, input_format, content,
+                                              binary);
+      if(binary)
+        return key.put(parseBinaryDDNNF(dd, inputOrder));
+      std::istringstream iss(dd);
+      return key.put(parseDDNNF(iss, inputOrder));
     } catch(const CircuitException &) {
       throw;
     } catch(const std::exception &e) {
@@ -1335,26 +1551,22 @@ dDNNF BooleanCircuit::compilation(gate_t g, std::string compiler,
   // In circuit mode, inputOrder[v-1] is the IN gate for d4 variable v
   // (1-based); empty in CNF mode.
   std::vector<gate_t> inputOrder;
-  std::string content;
+  std::string circuit;
   if(circuit_input) {
     try {
-      content = BCS12(g, inputOrder);
+      circuit = BCS12(g, inputOrder);
     } catch(const CircuitException &) {
       // A gate shape BC-S1.2 cannot express: fall back to the CNF path.
       circuit_input = false;
       inputOrder.clear();
     }
   }
-  if(!circuit_input)
-    content = TseytinCNF(g, false);
-  {
-    std::ofstream ofs(filename);
-    ofs << content;
-  }
-
-  if(provsql_verbose>=20) {
-    provsql_notice("Tseytin circuit in %s", filename.c_str());
-  }
+  auto writeInput = [&](std::ostream &os) {
+    if(circuit_input)
+      os << circuit;
+    else
+      writeTseytinCNF(os, g, false);
+  };
 
   // The command line is the registry argtpl with {in}/{out} (and {binary})
   // substituted -- so a newly-registered compiler runs with its own
@@ -1362,53 +1574,209 @@ dDNNF BooleanCircuit::compilation(gate_t g, std::string compiler,
   // in use, the record's argtpl_circuit is used instead (it pairs with the
   // circuit input written above and the circuit-mode variable resolution in
   // the parse-back).
-  std::string cmdline;
-  if(circuit_input)
-    cmdline = provsql::expandCommandTemplate(rec->argtpl_circuit,
-                                             compiler_binary, filename, outfilename);
-  else
-    cmdline = rec->buildCommand(filename, outfilename, compiler_binary);
+  const std::string &tpl = circuit_input ? rec->argtpl_circuit : rec->argtpl;
+  std::string cmdline = provsql::expandCommandTemplate(tpl, compiler_binary,
+                                                       filename, outfilename);
+
+  // A template reading {stdin} gets its problem streamed into a pipe as it
+  // is generated, and one writing {stdout} has its d-DNNF parsed from a
+  // pipe as it is produced: no temp file on either side.
+  const bool via_stdin = provsql::templateReadsStdin(tpl);
+  const bool via_stdout = provsql::templateWritesStdout(tpl);
+  if(!via_stdin) {
+    std::ofstream ofs(filename);
+    writeInput(ofs);
+    if(provsql_verbose>=20) {
+      provsql_notice("Tseytin circuit in %s", filename.c_str());
+    }
+  }
 
-  int retvalue=run_external_tool(cmdline);
+  // Read the result back with the parser the record advertises.  Panini's DD
+  // format has its own reader; everything else is the tolerant NNF parser.
+  auto parse = [&](std::istream &is) {
+    return rec->parser == "panini-dd" ? parsePaniniDD(is)
+                                      : parseDDNNF(is, inputOrder);
+  };
 
-  // run_external_tool runs the compiler in its own process group and
-  // raises any pending cancel/terminate itself (after killing the child),
-  // so a statement_timeout / pg_cancel_backend surfaces as 57014 here
-  // rather than being masked by the "killed by signal" throw.
-  //
-  // (An older d4 CLI without `-dDNNF` is not handled as a compiled-in
-  // special case: a deployment using it can register a tool with the
-  // appropriate argtpl, e.g. register_tool('d4-old', argtpl => '{in} -out={out}', ...).)
-  CHECK_FOR_INTERRUPTS();
+  std::optional<dDNNF> dnnf;
+  int retvalue;
+  if(via_stdin || via_stdout) {
+    try {
+      ExternalToolProcess tool(cmdline, via_stdin, via_stdout);
+      if(via_stdin) {
+        writeInput(tool.in());
+        tool.closeInput();
+      }
+      if(via_stdout) {
+        try {
+          dnnf = parse(tool.out());
+        } catch(const CircuitException &) {
+          // Output cut short by a failing tool: report its status instead.
+          if(!tool.wait())
+            throw;
+        }
+      }
+      retvalue = tool.wait();
+    } catch(const std::runtime_error &) {
+      // A tool stopped for a pending cancel/terminate: raise it.
+      CHECK_FOR_INTERRUPTS();
+      throw;
+    }
+  } else {
+    retvalue=run_external_tool(cmdline);
+
+    // run_external_tool runs the compiler in its own process group and
+    // raises any pending cancel/terminate itself (after killing the child),
+    // so a statement_timeout / pg_cancel_backend surfaces as 57014 here
+    // rather than being masked by the "killed by signal" throw.
+    //
+    // (An older d4 CLI without `-dDNNF` is not handled as a compiled-in
+    // special case: a deployment using it can register a tool with the
+    // appropriate argtpl, e.g. register_tool('d4-old', argtpl => '{in} -out={out}', ...).)
+    CHECK_FOR_INTERRUPTS();
+  }
 
   if(retvalue)
     throw CircuitException(format_external_tool_status(retvalue, compiler));
 
-  // Read the result back with the parser the record advertises.  Panini's DD
-  // format has its own reader; everything else is the tolerant NNF parser.
-  if(rec->parser == "panini-dd")
-    return parsePaniniDD(outfilename);
-
-  std::ifstream ifs(outfilename.c_str());
-  dDNNF dnnf = parseDDNNF(ifs, inputOrder);
-  ifs.close();
+  if(!via_stdout) {
+    std::ifstream ifs(outfilename.c_str());
+    if(rec->parser == "panini-dd" && !ifs)
+      throw CircuitException("Cannot open Panini output: " + outfilename);
+    dnnf = parse(ifs);
+    ifs.close();
 
-  if(provsql_verbose>=20) {
-    tmp.keep();
-    provsql_notice("Compiled d-DNNF in %s", outfilename.c_str());
+    if(provsql_verbose>=20) {
+      tmp.keep();
+      provsql_notice("Compiled d-DNNF in %s", outfilename.c_str());
+    }
   }
 
-  return dnnf;
+  return key.put(std::move(*dnnf));
 }
 
+namespace {
+
+// Line-by-line tokenizer over an NNF stream, for parseDDNNF.  The stream's
+// buffer is read in large chunks into one buffer of our own, and lines and
+// tokens are handed out as views into it: parsing a d-DNNF of millions of
+// lines allocates nothing per line or per token (where getline, a
+// stringstream and a std::string per token would).  The buffer only grows
+// for a line longer than it.
+class NNFTokenizer {
+  std::streambuf *src;
+  std::vector<char> buf;
+  size_t start=0;           // First unconsumed byte of buf
+  size_t end=0;             // One past the last byte read into buf
+  size_t scanned=0;         // Bytes from start known to hold no newline
+  bool at_eof=false;
+  const char *bol=nullptr;  // Start of the current line
+  const char *pos=nullptr;  // Next unread character of the current line
+  const char *eol=nullptr;  // End of the current line
+
+  static bool space(char c) {
+    return c==' ' || c=='\t' || c=='\r';
+  }
+
+public:
+  explicit NNFTokenizer(std::istream &in) : src(in.rdbuf()), buf(1<<16) {
+  }
+
+  // Move to the next line; false at the end of the stream.
+  bool nextLine() {
+    for(;;) {
+      const char *nl = static_cast<const char *>(
+        memchr(buf.data()+start+scanned, '\n', end-start-scanned));
+      if(nl || at_eof) {
+        if(!nl && start==end)
+          return false;
+        bol = pos = buf.data()+start;
+        eol = nl ? nl : buf.data()+end;
+        start = nl ? static_cast<size_t>(nl-buf.data())+1 : end;
+        scanned = 0;
+        return true;
+      }
+      scanned = end-start;
+      if(start>0) {
+        memmove(buf.data(), buf.data()+start, end-start);
+        end -= start;
+        start = 0;
+      }
+      if(end==buf.size())
+        buf.resize(2*buf.size());
+      const std::streamsize n = src->sgetn(buf.data()+end, buf.size()-end);
+      if(n<=0)
+        at_eof = true;
+      else
+        end += n;
+    }
+  }
+
+  // Read the current line again from its start.
+  void rewind() {
+    pos = bol;
+  }
+
+  // Whether the current line holds nothing but blanks.
+  bool blank() const {
+    const char *p = pos;
+    while(p<eol && space(*p))
+      ++p;
+    return p==eol;
+  }
+
+  // Next token of the current line; false at its end.
+  bool token(std::string_view &t) {
+    while(pos<eol && space(*pos))
+      ++pos;
+    if(pos==eol)
+      return false;
+    const char *b = pos;
+    while(pos<eol && !space(*pos))
+      ++pos;
+    t = std::string_view(b, pos-b);
+    return true;
+  }
+
+  // Next token of the current line as an integer; false at the end of
+  // the line or on a token that is not one (as `ss >> i` would stop).
+  bool integer(long &v) {
+    const char *save = pos;
+    std::string_view t;
+    if(token(t) && toInteger(t, v))
+      return true;
+    pos = save;
+    return false;
+  }
+
+  // Token @p t as an integer, if it is one.
+  static bool toInteger(std::string_view t, long &v) {
+    size_t k = 0;
+    const bool negative = !t.empty() && t[0]=='-';
+    if(negative || (!t.empty() && t[0]=='+'))
+      ++k;
+    if(k==t.size())
+      return false;
+    long r = 0;
+    for(; k<t.size(); ++k) {
+      if(t[k]<'0' || t[k]>'9' || r > (std::numeric_limits<long>::max()-9)/10)
+        return false;
+      r = 10*r+(t[k]-'0');
+    }
+    v = negative ? -r : r;
+    return true;
+  }
+};
+
+}  // anonymous namespace
+
 // Parse a c2d/d4 NNF stream into a dDNNF over this circuit's input gates.
 // Shared by the CLI compilation() path and the KCMCP client; see the header.
 dDNNF BooleanCircuit::parseDDNNF(std::istream &in,
                                  const std::vector<gate_t> &inputOrder) const {
   const bool circuit_input = !inputOrder.empty();
 
-  std::string line;
-  getline(in,line);
+  NNFTokenizer tok(in);
 
   // Tolerant NNF detection (the single `nnf` parser): the classic c2d/d4
   // form opens with an "nnf <nodes> <edges> <vars>" magic line and roots at
@@ -1417,37 +1785,63 @@ dDNNF BooleanCircuit::parseDDNNF(std::istream &in,
   // header on an empty file is an unsatisfiable formula; a missing header on
   // a non-empty file is the d4-family form.  (The d4v2 native-circuit path
   // also produces the header-less d4 form.)
+  std::string_view c;
+  if(!tok.nextLine() || !tok.token(c)) {
+    // unsatisfiable formula (empty output)
+    return dDNNF();
+  }
   bool new_d4;
-  if(line.rfind("nnf", 0) != 0) {
-    if(line.empty()) {
-      // unsatisfiable formula (empty output)
-      return dDNNF();
-    }
+  bool have_line = true;
+  if(c.substr(0, 3)!="nnf") {
     new_d4 = true;
+    tok.rewind();
   } else {
     new_d4 = false;
-    std::string nnf;
-    unsigned nb_nodes, nb_edges, nb_variables;
-
-    std::stringstream ss(line);
-    ss >> nnf >> nb_nodes >> nb_edges >> nb_variables;
+    long nb_nodes, nb_edges, nb_variables;
+    if(!tok.integer(nb_nodes) || !tok.integer(nb_edges)
+       || !tok.integer(nb_variables))
+      nb_variables = -1;
 
-    if(nb_variables!=gates.size())
+    if(nb_variables<0 || static_cast<size_t>(nb_variables)!=gates.size())
       throw CircuitException("Unreadable d-DNNF (wrong number of variables: " + std::to_string(nb_variables) +" vs " + std::to_string(gates.size()) + ")");
 
-    getline(in,line);
+    have_line = tok.nextLine();
   }
 
   dDNNF dnnf;
 
+  // NNF node numbers to d-DNNF gates.  A node may be referenced before
+  // its own line (d4 edges go to nodes declared later): it is then
+  // created untyped, and typed by its line.
+  const gate_t none{std::numeric_limits<std::underlying_type<gate_t>::type>::max()};
+  std::vector<gate_t> node_gate;
+  auto node = [&](long n) -> gate_t {
+    if(n<0 || n>std::numeric_limits<int>::max())
+      throw CircuitException("Unreadable d-DNNF (bad node number: "+std::to_string(n)+")");
+    const size_t k = static_cast<size_t>(n);
+    if(k>=node_gate.size())
+      node_gate.resize(std::max(k+1, 2*node_gate.size()), none);
+    if(node_gate[k]==none)
+      node_gate[k] = dnnf.setGate(BooleanGate::UNDETERMINED);
+    return node_gate[k];
+  };
+  auto declare = [&](long n, BooleanGate t) -> gate_t {
+    const gate_t id = node(n);
+    dnnf.setGateType(id, t);
+    return id;
+  };
+  auto known = [&](long n) {
+    return n>=0 && static_cast<size_t>(n)<node_gate.size() && node_gate[n]!=none;
+  };
+
   // Map a d-DNNF literal's variable to the IN gate it stands for, if any.
   // CNF mode: variable = gate id + 1, real only for IN gates (every other
   // variable is a Tseytin auxiliary to skip). Circuit mode: variables 1..k
   // are the inputs in BCS12's declaration order, everything above k is an
   // internal-gate variable to skip.
   size_t k = inputOrder.size();
-  auto resolveVar = [&](int v) -> std::pair<bool, gate_t> {
-    unsigned idx = static_cast<unsigned>(abs(v));
+  auto resolveVar = [&](long v) -> std::pair<bool, gate_t> {
+    unsigned long idx = static_cast<unsigned long>(v<0 ? -v : v);
     if(circuit_input) {
       if(idx>=1 && idx<=k)
         return {true, inputOrder[idx-1]};
@@ -1458,72 +1852,80 @@ dDNNF BooleanCircuit::parseDDNNF(std::istream &in,
     return {false, gate_t{}};
   };
 
-  unsigned i=0;
-  do {
-    std::stringstream ss(line);
+  // One d-DNNF input per circuit input, named by its UUID; an input
+  // without one (as rewriteMultivaluedGates() synthesises) stays a distinct
+  // unnamed gate rather than being merged with the others.
+  std::vector<gate_t> input_gate(gates.size(), none);
+  auto literal = [&](gate_t in_gate, bool negated) -> gate_t {
+    auto pid = static_cast<std::underlying_type<gate_t>::type>(in_gate);
+    if(input_gate[pid]==none) {
+      const auto u = getUUID(in_gate);
+      input_gate[pid] = u.empty() ? dnnf.setGate(BooleanGate::IN, prob[pid])
+                                  : dnnf.setGate(u, BooleanGate::IN, prob[pid]);
+    }
+    if(!negated)
+      return input_gate[pid];
+    auto not_gate = dnnf.setGate(BooleanGate::NOT);
+    dnnf.addWire(not_gate, input_gate[pid]);
+    return not_gate;
+  };
 
-    std::string c;
-    ss >> c;
+  std::vector<long> decisions;
+  long i=0;
+  for(; have_line; have_line = tok.nextLine()) {
+    if(tok.blank())
+      continue;
+    tok.token(c);
 
     if(c=="O") {
-      int var, args;
-      ss >> var >> args;
-      auto id=dnnf.getGate(std::to_string(i));
-      dnnf.setGate(std::to_string(i), BooleanGate::OR);
-      int g;
-      while(ss >> g) {
-        auto id2=dnnf.getGate(std::to_string(g));
-        dnnf.addWire(id,id2);
-      }
+      long var, args;
+      tok.integer(var);
+      tok.integer(args);
+      auto id=declare(i, BooleanGate::OR);
+      long g;
+      while(tok.integer(g))
+        dnnf.addWire(id,node(g));
     } else if(c=="A") {
-      int args;
-      ss >> args;
-      auto id=dnnf.getGate(std::to_string(i));
-      dnnf.setGate(std::to_string(i), BooleanGate::AND);
-      int g;
-      while(ss >> g) {
-        auto id2=dnnf.getGate(std::to_string(g));
-        dnnf.addWire(id,id2);
-      }
+      long args;
+      tok.integer(args);
+      auto id=declare(i, BooleanGate::AND);
+      long g;
+      while(tok.integer(g))
+        dnnf.addWire(id,node(g));
     } else if(c=="L") {
-      int leaf;
-      ss >> leaf;
-      auto and_gate=dnnf.setGate(std::to_string(i), BooleanGate::AND);
+      long leaf=0;
+      tok.integer(leaf);
+      auto and_gate=declare(i, BooleanGate::AND);
       auto [is_in, in_gate] = resolveVar(leaf);
-      if(is_in) {
-        auto pid = static_cast<std::underlying_type<gate_t>::type>(in_gate);
-        auto leaf_gate = dnnf.setGate(getUUID(in_gate), BooleanGate::IN, prob[pid]);
-        if(leaf<0) {
-          auto not_gate = dnnf.setGate(BooleanGate::NOT);
-          dnnf.addWire(not_gate, leaf_gate);
-          dnnf.addWire(and_gate, not_gate);
-        } else {
-          dnnf.addWire(and_gate, leaf_gate);
-        }
-      } else {
-        ; // Do nothing, TRUE gate
-      }
+      if(is_in)
+        dnnf.addWire(and_gate, literal(in_gate, leaf<0));
+      // else: do nothing, TRUE gate
     } else if(c=="f" || c=="o") {
       // d4 extended format
       // A FALSE gate is an OR gate without wires
-      int var;
-      ss >> var;
-      dnnf.setGate(std::to_string(var), BooleanGate::OR);
+      long var;
+      if(!tok.integer(var))
+        throw CircuitException("Unreadable d-DNNF (node without number)");
+      declare(var, BooleanGate::OR);
     } else if(c=="t" || c=="a") {
       // d4 extended format
       // A TRUE gate is an AND gate without wires
-      int var;
-      ss >> var;
-      dnnf.setGate(std::to_string(var), BooleanGate::AND);
-    } else if(dnnf.hasGate(c)) {
-      // d4 extended format
-      int var;
-      ss >> var;
-      auto id2=dnnf.getGate(std::to_string(var));
-
-      std::vector<int> decisions;
-      int decision;
-      while(ss >> decision) {
+      long var;
+      if(!tok.integer(var))
+        throw CircuitException("Unreadable d-DNNF (node without number)");
+      declare(var, BooleanGate::AND);
+    } else {
+      // d4 extended format: an edge "<from> <to> <literals> 0"
+      long from, to;
+      if(!NNFTokenizer::toInteger(c, from) || !known(from))
+        throw CircuitException(std::string("Unreadable d-DNNF (unknown node type: ")+std::string(c)+")");
+      if(!tok.integer(to))
+        throw CircuitException("Unreadable d-DNNF (edge without target)");
+      auto id2=node(to);
+
+      decisions.clear();
+      long decision;
+      while(tok.integer(decision)) {
         if(decision==0)
           break;
         // Edges carry decision literals over both real inputs and internal
@@ -1535,31 +1937,22 @@ dDNNF BooleanCircuit::parseDDNNF(std::istream &in,
       }
 
       if(decisions.empty()) {
-        dnnf.addWire(dnnf.getGate(c), id2);
+        dnnf.addWire(node(from), id2);
       } else {
         auto and_gate = dnnf.setGate(BooleanGate::AND);
-        dnnf.addWire(dnnf.getGate(c), and_gate);
+        dnnf.addWire(node(from), and_gate);
         dnnf.addWire(and_gate, id2);
-        for(auto leaf : decisions) {
-          auto in_gate = resolveVar(leaf).second;
-          auto pid = static_cast<std::underlying_type<gate_t>::type>(in_gate);
-          auto leaf_gate = dnnf.setGate(getUUID(in_gate), BooleanGate::IN, prob[pid]);
-          if(leaf<0) {
-            auto not_gate = dnnf.setGate(BooleanGate::NOT);
-            dnnf.addWire(not_gate, leaf_gate);
-            dnnf.addWire(and_gate, not_gate);
-          } else {
-            dnnf.addWire(and_gate, leaf_gate);
-          }
-        }
+        for(auto leaf : decisions)
+          dnnf.addWire(and_gate, literal(resolveVar(leaf).second, leaf<0));
       }
-    } else
-      throw CircuitException(std::string("Unreadable d-DNNF (unknown node type: ")+c+")");
+    }
 
     ++i;
-  } while(getline(in, line));
+  }
 
-  dnnf.setRoot(dnnf.getGate(new_d4?"1":std::to_string(i-1)));
+  if(!new_d4 && i==0)
+    throw CircuitException("Unreadable d-DNNF (no node)");
+  dnnf.setRoot(node(new_d4 ? 1 : i-1));
 
   // External NNF writers (c2d, minic2d, dsharp) leave TRUE constants
   // (empty AND gates) and FALSE constants (empty OR gates) embedded in
@@ -1573,6 +1966,132 @@ dDNNF BooleanCircuit::parseDDNNF(std::istream &in,
   return dnnf;
 }
 
+// Read a ddnnf-bin d-DNNF (dDNNF::toBinaryNNF) into a dDNNF over this
+// circuit's input gates.  See the header.
+dDNNF BooleanCircuit::parseBinaryDDNNF(std::string_view in,
+                                       const std::vector<gate_t> &inputOrder) const {
+  const char *p = in.data();
+  const char *const end = p + in.size();
+  auto bad = [](const char *what) {
+    return CircuitException(std::string("Unreadable binary d-DNNF (")+what+")");
+  };
+  auto varint = [&]() -> uint64_t {
+    uint64_t v = 0;
+    for(unsigned shift = 0; p < end && shift < 64; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t>(*p++);
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if(!(byte & 0x80))
+        return v;
+    }
+    throw bad("truncated");
+  };
+
+  if(in.size() < 6 || std::memcmp(p, "DNNB", 4) != 0)
+    throw bad("bad magic");
+  if(p[4] != 1)
+    throw bad("unknown version");
+  p += 6;  // the probabilities, if any, are not read: inputs keep ours
+  const uint64_t nb_variables = varint();
+  const uint64_t nb_literals = varint();
+  const uint64_t nb_nodes = varint();
+  const uint64_t nb_edges = varint();
+  // Every literal, node and edge takes a byte at least: a count beyond the
+  // payload is corrupt, and rejecting it bounds the allocations below.
+  if(nb_literals > static_cast<uint64_t>(end-p) || nb_nodes > static_cast<uint64_t>(end-p)
+     || nb_edges > static_cast<uint64_t>(end-p))
+    throw bad("counts beyond the payload");
+
+  const bool circuit_input = !inputOrder.empty();
+  if(nb_nodes > 0 && !circuit_input && nb_variables != gates.size())
+    throw CircuitException("Unreadable d-DNNF (wrong number of variables: " + std::to_string(nb_variables) +" vs " + std::to_string(gates.size()) + ")");
+  if(nb_nodes == 0)
+    return dDNNF();  // unsatisfiable formula
+
+  dDNNF dnnf;
+  dnnf.gates.reserve(nb_nodes + nb_literals);
+  dnnf.wires.reserve(nb_nodes + nb_literals);
+  dnnf.prob.reserve(nb_nodes + nb_literals);
+
+  // Literal table: the gate each literal stands for, created on first use.
+  // As in parseDDNNF, a variable that is no input of ours (a Tseytin
+  // auxiliary, or an internal-gate variable in circuit mode) is projected
+  // out: its literal is a TRUE (empty AND) gate.
+  const gate_t none{std::numeric_limits<std::underlying_type<gate_t>::type>::max()};
+  std::vector<long> literals(nb_literals);
+  for(auto &l : literals) {
+    const uint64_t z = varint();
+    l = (z & 1) ? -static_cast<long>((z + 1) >> 1) : static_cast<long>(z >> 1);
+  }
+  std::vector<gate_t> literal_gate(nb_literals, none);
+  std::vector<gate_t> input_gate(gates.size(), none);
+  auto literal = [&](uint64_t i) -> gate_t {
+    if(i >= nb_literals)
+      throw bad("bad literal");
+    if(literal_gate[i] != none)
+      return literal_gate[i];
+    const long l = literals[i];
+    const unsigned long v = static_cast<unsigned long>(l < 0 ? -l : l);
+    gate_t in_gate = none;
+    if(circuit_input) {
+      if(v >= 1 && v <= inputOrder.size())
+        in_gate = inputOrder[v-1];
+    } else if(v >= 1 && v-1 < gates.size() && gates[v-1] == BooleanGate::IN)
+      in_gate = static_cast<gate_t>(v-1);
+    if(in_gate == none)
+      return literal_gate[i] = dnnf.setGate(BooleanGate::AND);
+    const auto pid = static_cast<std::underlying_type<gate_t>::type>(in_gate);
+    if(input_gate[pid] == none) {
+      const auto u = getUUID(in_gate);
+      input_gate[pid] = u.empty() ? dnnf.setGate(BooleanGate::IN, prob[pid])
+                                  : dnnf.setGate(u, BooleanGate::IN, prob[pid]);
+    }
+    if(l > 0)
+      return literal_gate[i] = input_gate[pid];
+    const gate_t not_gate = dnnf.setGate(BooleanGate::NOT);
+    dnnf.addWire(not_gate, input_gate[pid]);
+    return literal_gate[i] = not_gate;
+  };
+
+  // The heads first, then the children of each AND and OR in turn: the
+  // children section starts where the heads end, so read the heads in one
+  // pass to find it.
+  std::vector<uint64_t> heads(nb_nodes);
+  uint64_t total = 0;
+  for(auto &h : heads) {
+    h = varint();
+    if((h & 3) == 1 || (h & 3) == 2)
+      total += h >> 2;
+    else if((h & 3) != 0)
+      throw bad("unknown node kind");
+  }
+  if(total != nb_edges)
+    throw bad("edge count mismatch");
+
+  std::vector<gate_t> node_gate(nb_nodes);
+  for(uint64_t i = 0; i < nb_nodes; ++i) {
+    const uint64_t h = heads[i];
+    if((h & 3) == 0) {
+      node_gate[i] = literal(h >> 2);
+      continue;
+    }
+    const gate_t id = dnnf.setGate((h & 3) == 1 ? BooleanGate::AND : BooleanGate::OR);
+    auto &w = dnnf.wires[static_cast<std::underlying_type<gate_t>::type>(id)];
+    w.reserve(h >> 2);
+    for(uint64_t k = 0; k < (h >> 2); ++k) {
+      const uint64_t d = varint();
+      if(d == 0 || d > i)
+        throw bad("bad child");
+      w.push_back(node_gate[i-d]);
+    }
+    node_gate[i] = id;
+  }
+
+  dnnf.setRoot(node_gate[nb_nodes-1]);
+  // As parseDDNNF: constants (projected literals, empty ORs) are folded.
+  dnnf.simplify();
+  return dnnf;
+}
+
 // Generic weighted-model-counting runner.  Selects the counter from the
 // registry by logical name, checks its binary and dependencies resolve,
 // writes the weighted CNF in the convention its `parser` implies, runs the
@@ -1623,22 +2142,21 @@ double BooleanCircuit::wmcCount(gate_t g, const std::string &requested,
   const std::string &dirname = tmp.path();
   std::string filename    = tmp.file("input");
   std::string outfilename = tmp.file("input.out");
-  {
-    std::ofstream ofs(filename);
+  auto writeInput = [&](std::ostream &os) {
     if(weightmc_io) {
       // weightmc reads weights inline, in its own weighted-DIMACS dialect.
-      ofs << TseytinCNF(g, true);
+      writeTseytinCNF(os, g, true);
     } else {
       // MCC 2024 weighted DIMACS: a plain CNF plus per-input weight lines.
-      ofs << "c t wmc\n";
-      ofs << TseytinCNF(g, false);
+      os << "c t wmc\n";
+      writeTseytinCNF(os, g, false);
       for(gate_t in : inputs) {
         int id = static_cast<int>(in) + 1;
-        ofs << "c p weight " << id << ' ' << getProb(in)        << " 0\n";
-        ofs << "c p weight -" << id << ' ' << (1.0 - getProb(in)) << " 0\n";
+        os << "c p weight " << id << ' ' << getProb(in)        << " 0\n";
+        os << "c p weight -" << id << ' ' << (1.0 - getProb(in)) << " 0\n";
       }
     }
-  }
+  };
 
   // {tmpdir} (sharpsat-td's flowcutter scratch) and {pivotAC} (weightmc's
   // approximation tolerance, from opt='delta;epsilon') are offered as
@@ -1658,44 +2176,84 @@ double BooleanCircuit::wmcCount(gate_t g, const std::string &requested,
       filename, outfilename, rec->binary,
       {{"tmpdir", dirname}, {"pivotAC", std::to_string(pivotAC)}});
 
-  int retvalue = run_external_tool(cmdline);
-  CHECK_FOR_INTERRUPTS();
+  auto parse = [&](std::istream &is) -> double {
+    if(weightmc_io) {
+      // weightmc prints the count as "<mantissa> x 2^<exp>" on its last line.
+      std::string line, prev_line;
+      while(getline(is, line)) prev_line = line;
+      std::stringstream ss(prev_line);
+      std::string result;
+      ss >> result >> result >> result >> result >> result;
+      std::istringstream iss(result);
+      std::string val, exp;
+      getline(iss, val, 'x');
+      getline(iss, exp);
+      if(exp.size() < 2)
+        throw CircuitException("weightmc: could not parse '" + prev_line + "'");
+      double value = stod(val);
+      double exponent = stod(exp.substr(2));
+      return value * pow(2.0, exponent);
+    } else {
+      // The count is on the last "c s exact ..." (or "s wmc ...") line;
+      // parse_wmc_value tolerates the per-tool token layout on that line.
+      std::string line, matched;
+      while(getline(is, line))
+        if(line.rfind("c s exact", 0) == 0 || line.rfind("s wmc", 0) == 0)
+          matched = line;
+      if(matched.empty())
+        throw CircuitException(tool + ": could not find a count line in output");
+      return parse_wmc_value(matched, tool.c_str());
+    }
+  };
+
+  // As in compilation(): {stdin} / {stdout} in the template stream the
+  // weighted CNF into the counter and read its count from a pipe.
+  const bool via_stdin = provsql::templateReadsStdin(rec->argtpl);
+  const bool via_stdout = provsql::templateWritesStdout(rec->argtpl);
+  if(!via_stdin) {
+    std::ofstream ofs(filename);
+    writeInput(ofs);
+  }
+
+  std::optional<double> ret;
+  int retvalue;
+  if(via_stdin || via_stdout) {
+    try {
+      ExternalToolProcess process(cmdline, via_stdin, via_stdout);
+      if(via_stdin) {
+        writeInput(process.in());
+        process.closeInput();
+      }
+      if(via_stdout) {
+        try {
+          ret = parse(process.out());
+        } catch(const CircuitException &) {
+          // No count from a failing counter: report its status instead.
+          if(!process.wait())
+            throw;
+        }
+      }
+      retvalue = process.wait();
+    } catch(const std::runtime_error &) {
+      // A counter stopped for a pending cancel/terminate: raise it.
+      CHECK_FOR_INTERRUPTS();
+      throw;
+    }
+  } else {
+    retvalue = run_external_tool(cmdline);
+    CHECK_FOR_INTERRUPTS();
+  }
   if(retvalue)
     throw CircuitException(format_external_tool_status(retvalue, tool));
 
-  std::ifstream ifs(outfilename.c_str());
-  double ret;
-  if(weightmc_io) {
-    // weightmc prints the count as "<mantissa> x 2^<exp>" on its last line.
-    std::string line, prev_line;
-    while(getline(ifs, line)) prev_line = line;
-    std::stringstream ss(prev_line);
-    std::string result;
-    ss >> result >> result >> result >> result >> result;
-    std::istringstream iss(result);
-    std::string val, exp;
-    getline(iss, val, 'x');
-    getline(iss, exp);
-    if(exp.size() < 2)
-      throw CircuitException("weightmc: could not parse '" + prev_line + "'");
-    double value = stod(val);
-    double exponent = stod(exp.substr(2));
-    ret = value * pow(2.0, exponent);
-  } else {
-    // The count is on the last "c s exact ..." (or "s wmc ...") line;
-    // parse_wmc_value tolerates the per-tool token layout on that line.
-    std::string line, matched;
-    while(getline(ifs, line))
-      if(line.rfind("c s exact", 0) == 0 || line.rfind("s wmc", 0) == 0)
-        matched = line;
-    if(matched.empty())
-      throw CircuitException(tool + ": could not find a count line in output");
-    ret = parse_wmc_value(matched, tool.c_str());
+  if(!via_stdout) {
+    std::ifstream ifs(outfilename.c_str());
+    ret = parse(ifs);
   }
 
   if(provsql_verbose >= 20)
     tmp.keep();
-  return ret;
+  return *ret;
 }
 
 #endif // external-tool compilation / counting (excluded from tdkc)
@@ -2160,9 +2718,11 @@ dDNNF BooleanCircuit::makeDD(gate_t g, const std::string &method, const std::str
     return compilation(g, args);
   } else if(method=="tree-decomposition") {
     try {
-      TreeDecomposition td(*this);
-      return dDNNFTreeDecompositionBuilder{
-        *this, g, td}.build();
+      return provsql::cachedDD(*this, g, "tree-decomposition", [&] {
+        TreeDecomposition td(*this);
+        return dDNNFTreeDecompositionBuilder{
+          *this, g, td}.build();
+      });
     } catch(TreeDecompositionException &) {
       provsql_error("Treewidth greater than %u", TreeDecomposition::MAX_TREEWIDTH);
     }
@@ -2176,9 +2736,11 @@ dDNNF BooleanCircuit::makeDD(gate_t g, const std::string &method, const std::str
         provsql_notice("Circuit interpreted as dD, %ld gates", dd.getNbGates());
     } catch(CircuitException &) {
       try {
-        TreeDecomposition td(*this);
-        dd = dDNNFTreeDecompositionBuilder{
-          *this, g, td}.build();
+        dd = provsql::cachedDD(*this, g, "tree-decomposition", [&] {
+          TreeDecomposition td(*this);
+          return dDNNFTreeDecompositionBuilder{
+            *this, g, td}.build();
+        });
         if(provsql_verbose>=25)
           provsql_notice("dD obtained by tree decomposition, %ld gates", dd.getNbGates());
       } catch(TreeDecompositionException &) {
@@ -33,6 +33,7 @@
 #include <map>
 #include <vector>
 #include <iosfwd>
+#include <string_view>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/unordered_map.hpp>
@@ -90,18 +91,6 @@ constexpr unsigned DNNF_CERT_INFO = 1;
  */
 class BooleanCircuit : public Circuit<BooleanGate> {
 private:
-/**
- * @brief Evaluate the sub-circuit at @p g on one sampled world.
- *
- * Each gate in @p sampled is treated as @c true; all other @c IN gates
- * are @c false.
- *
- * @param g        Root gate to evaluate.
- * @param sampled  Set of input gates that are @c true in this world.
- * @return         Boolean value of the circuit at gate @p g.
- */
-bool evaluate(gate_t g, const std::unordered_set<gate_t> &sampled) const;
-
 /**
  * @brief Recursive helper for @c interpretAsDD().
  *
@@ -321,10 +310,14 @@ unsigned getInfo(gate_t g) const;
 /**
  * @brief Compute the probability by exact enumeration of all possible worlds.
  *
- * Only tractable for circuits with a small number of input gates.
+ * Only tractable for circuits with a small number of input gates.  Worlds
+ * are evaluated 64 at a time and visited in Gray-code order, each step
+ * recomputing only the gates above the one input it flips.
  *
  * @param g  Root gate.
  * @return   Exact probability.
+ * @throws CircuitException on a multivalued input, with 64 or more inputs
+ *         to enumerate, or when interrupted.
  */
 double possibleWorlds(gate_t g) const;
 
@@ -363,6 +356,24 @@ dDNNF compilation(gate_t g, std::string compiler,
 dDNNF parseDDNNF(std::istream &in,
                  const std::vector<gate_t> &inputOrder) const;
 
+/**
+ * @brief Read a binary @c ddnnf-bin d-DNNF into a @c dDNNF over this
+ *        circuit's input gates.
+ *
+ * The binary counterpart of @c parseDDNNF(), for a KCMCP server answering
+ * in @c ddnnf-bin (the format of @c dDNNF::toBinaryNNF): the gates and
+ * wires are built straight from the buffer, without tokenising text.
+ * Variables map to input gates as in @c parseDDNNF(); the probabilities
+ * the format may carry are ignored, inputs keeping this circuit's own.
+ *
+ * @param in          The binary d-DNNF.
+ * @param inputOrder  Circuit-mode input-variable to IN-gate map (empty = CNF).
+ * @return            The compiled @c dDNNF (empty if the formula is unsat).
+ * @throws CircuitException on a malformed input.
+ */
+dDNNF parseBinaryDDNNF(std::string_view in,
+                       const std::vector<gate_t> &inputOrder) const;
+
 /**
  * @brief Estimate the probability via Monte Carlo sampling.
  *
@@ -437,8 +448,10 @@ bool dnfShapeInfo(gate_t g, std::size_t &num_clauses) const;
  * unbiased for any budget).
  *
  * The @p clauses / @p supports are those returned by @c dnfShape.  The
- * @c mt19937_64 is seeded from @c provsql.monte_carlo_seed exactly as
- * @c monteCarlo, so the estimate is reproducible under a pinned seed.
+ * rounds are drawn in blocks, spread over @c provsql.sampler_threads
+ * threads, each block from its own stream of the run keyed by
+ * @c provsql.monte_carlo_seed (see @c ParallelSampler.h), so the estimate
+ * is reproducible under a pinned seed, whatever the number of threads.
  *
  * @param clauses   Top-level clause roots (from @c dnfShape).
  * @param supports  Per-clause reachable @c IN leaves (from @c dnfShape).
@@ -702,6 +715,22 @@ std::string exportCircuit(gate_t g) const;
  */
 std::string TseytinCNF(gate_t g, bool display_prob, bool mapping = false) const;
 
+/**
+ * @brief Write the Tseytin transformation of the sub-circuit at @p g to
+ *        @p out.
+ *
+ * The text @c TseytinCNF() returns, written clause by clause as it is
+ * generated, so that the CNF of a large circuit goes to a file or to a
+ * tool's pipe without ever being held in memory whole.
+ *
+ * @param out          Destination stream.
+ * @param g            Root gate.
+ * @param display_prob See @c TseytinCNF().
+ * @param mapping      See @c TseytinCNF().
+ */
+void writeTseytinCNF(std::ostream &out, gate_t g, bool display_prob,
+                     bool mapping = false) const;
+
 /**
  * @brief One row of the Tseytin variable mapping.
  *
@@ -753,7 +782,7 @@ std::vector<CNFInputMapping> tseytinVariableMapping() const;
 std::string BCS12(gate_t g, std::vector<gate_t> &inputOrder) const;
 
 /**
- * @brief Parse a Panini (KCBox) DD output file into a ProvSQL d-DNNF.
+ * @brief Parse a Panini (KCBox) DD output into a ProvSQL d-DNNF.
  *
  * The @c panini-dd output parser, selected by @c compilation() for the
  * @c panini-* records.  Those records run the generic compile path (a Tseytin
@@ -767,10 +796,10 @@ std::string BCS12(gate_t g, std::vector<gate_t> &inputOrder) const;
  * @c K (kernelize) nodes that break decomposability, so those variants are
  * not registered and a @c K node here is an error.
  *
- * @param outfilename  Path to Panini's DD output file.
- * @return             The compiled d-DNNF.
+ * @param in  Panini's DD output (its output file, or its standard output).
+ * @return    The compiled d-DNNF.
  */
-dDNNF parsePaniniDD(const std::string &outfilename) const;
+dDNNF parsePaniniDD(std::istream &in) const;
 
 /**
  * @brief Boost serialisation support.
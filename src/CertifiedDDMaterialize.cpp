@@ -15,6 +15,7 @@ extern "C" {
 
 #include "provsql_utils.h"
 #include "provsql_mmap.h"
+#include "provsql_uuid.h"
 }
 
 #include "CertifiedDDMaterialize.h"
@@ -27,88 +28,10 @@ extern "C" {
 #include <unordered_set>
 #include <vector>
 
-namespace {
-
-/**
- * @brief Minimal SHA-1 (RFC 3174), used for RFC 4122 version-5 UUIDs.
- *
- * Self-contained so the content addressing builds on every supported
- * PostgreSQL version.
- */
-void sha1(const unsigned char *data, std::size_t len, unsigned char out[20])
-{
-  uint32_t h[5] = {0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u,
-                   0xC3D2E1F0u};
-  const std::size_t total = ((len + 8) / 64 + 1) * 64;
-  std::vector<unsigned char> buf(total, 0);
-  std::copy(data, data + len, buf.begin());
-  buf[len] = 0x80;
-  const uint64_t bits = static_cast<uint64_t>(len) * 8;
-  for (int i = 0; i < 8; ++i)
-    buf[total - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
-
-  for (std::size_t chunk = 0; chunk < total; chunk += 64) {
-    uint32_t w[80];
-    for (int i = 0; i < 16; ++i)
-      w[i] = (static_cast<uint32_t>(buf[chunk + 4*i]) << 24) |
-             (static_cast<uint32_t>(buf[chunk + 4*i + 1]) << 16) |
-             (static_cast<uint32_t>(buf[chunk + 4*i + 2]) << 8) |
-             static_cast<uint32_t>(buf[chunk + 4*i + 3]);
-    for (int i = 16; i < 80; ++i) {
-      const uint32_t v = w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16];
-      w[i] = (v << 1) | (v >> 31);
-    }
-    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
-    for (int i = 0; i < 80; ++i) {
-      uint32_t f, k;
-      if (i < 20) {
-        f = (b & c) | (~b & d);
-        k = 0x5A827999u;
-      } else if (i < 40) {
-        f = b ^ c ^ d;
-        k = 0x6ED9EBA1u;
-      } else if (i < 60) {
-        f = (b & c) | (b & d) | (c & d);
-        k = 0x8F1BBCDCu;
-      } else {
-        f = b ^ c ^ d;
-        k = 0xCA62C1D6u;
-      }
-      const uint32_t tmp = ((a << 5) | (a >> 27)) + f + e + k + w[i];
-      e = d;
-      d = c;
-      c = (b << 30) | (b >> 2);
-      b = a;
-      a = tmp;
-    }
-    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
-  }
-  for (int i = 0; i < 5; ++i) {
-    out[4*i]     = static_cast<unsigned char>(h[i] >> 24);
-    out[4*i + 1] = static_cast<unsigned char>(h[i] >> 16);
-    out[4*i + 2] = static_cast<unsigned char>(h[i] >> 8);
-    out[4*i + 3] = static_cast<unsigned char>(h[i]);
-  }
-}
-
-} // namespace
-
 pg_uuid_t provsqlUuidV5(const std::string &name)
 {
-  // uuid_ns_provsql() = 920d4f02-8718-5319-9532-d4ab83a64489
-  static const unsigned char ns[16] = {
-    0x92, 0x0d, 0x4f, 0x02, 0x87, 0x18, 0x53, 0x19,
-    0x95, 0x32, 0xd4, 0xab, 0x83, 0xa6, 0x44, 0x89
-  };
-  std::vector<unsigned char> data(16 + name.size());
-  std::copy(ns, ns + 16, data.begin());
-  std::copy(name.begin(), name.end(), data.begin() + 16);
-  unsigned char digest[20];
-  sha1(data.data(), data.size(), digest);
   pg_uuid_t u;
-  std::copy(digest, digest + 16, u.data);
-  u.data[6] = static_cast<unsigned char>((u.data[6] & 0x0F) | 0x50);
-  u.data[8] = static_cast<unsigned char>((u.data[8] & 0x3F) | 0x80);
+  provsql_uuid_v5(name.data(), name.size(), &u);
   return u;
 }
 
@@ -18,9 +18,11 @@
  * A circuit is a directed acyclic graph where:
  * - Each **gate** has a type drawn from @c gateType (a user-supplied enum).
  * - **Wires** are directed edges from parent gates to their children.
- * - Each gate may optionally be associated with a UUID string, enabling
+ * - Each gate may optionally be associated with a UUID, enabling
  *   round-tripping between the in-memory circuit and the persistent mmap
- *   representation.
+ *   representation.  The UUID is either a string or, for circuits loaded
+ *   from the mmap store, a 16-byte @c binary_uuid whose text form is only
+ *   produced when asked for.
  *
  * @c Circuit.hpp (included by subclass headers) provides the out-of-line
  * template method implementations.
@@ -32,9 +34,12 @@
 #ifndef CIRCUIT_H
 #define CIRCUIT_H
 
+#include <cstdint>
+#include <cstring>
 #include <unordered_map>
 #include <unordered_set>
 #include <iostream>
+#include <string>
 #include <set>
 #include <vector>
 #include <type_traits>
@@ -48,13 +53,49 @@
  */
 enum class gate_t : size_t {};
 
+/**
+ * @brief A UUID in the 16-byte binary form the mmap store keeps it in.
+ *
+ * Layout-compatible with PostgreSQL's @c pg_uuid_t, which this header
+ * cannot name: it is also compiled into the standalone @c tdkc binary.
+ */
+struct binary_uuid {
+  unsigned char data[16]; ///< The UUID's bytes, in network order
+
+  /** @brief Byte-wise equality. */
+  bool operator==(const binary_uuid &o) const {
+    return std::memcmp(data, o.data, sizeof data) == 0;
+  }
+};
+
+/**
+ * @brief Hash functor for @c binary_uuid.
+ *
+ * The leading bytes of the random (v4) and name-based (v5) UUIDs ProvSQL
+ * mints are already uniformly distributed, so they are used as they are.
+ */
+struct binary_uuid_hash {
+  /** @brief Hash @p u. */
+  std::size_t operator()(const binary_uuid &u) const {
+    std::uint64_t h;
+    std::memcpy(&h, u.data, sizeof h);
+    return static_cast<std::size_t>(h);
+  }
+};
+
 /**
  * @brief Generic template base class for provenance circuits.
  *
  * A @c Circuit stores:
  * - A vector of gate types indexed by @c gate_t.
  * - A vector of child-wire lists (also indexed by @c gate_t).
- * - Bidirectional maps between gate UUIDs (strings) and @c gate_t IDs.
+ * - Bidirectional maps between gate UUIDs and @c gate_t IDs.
+ *
+ * A gate is named either by a UUID string or by a @c binary_uuid.  Both
+ * kinds of name live side by side and every lookup consults both, so a
+ * circuit loaded with binary names still answers @c getGate(std::string)
+ * for the text form of any of them.  The text form of a binary name is
+ * only built by @c getUUID.
  *
  * @tparam gateType  Enumeration of gate kinds for this circuit variant.
  */
@@ -67,6 +108,9 @@ using uuid = std::string;
 protected:
 std::unordered_map<uuid, gate_t> uuid2id;  ///< UUID string → gate index
 std::unordered_map<gate_t, uuid> id2uuid;  ///< Gate index → UUID string
+std::unordered_map<binary_uuid, gate_t, binary_uuid_hash> buuid2id; ///< Binary UUID → gate index
+std::vector<binary_uuid> id2buuid;         ///< Gate index → binary UUID, valid where @c binary_named is set
+std::vector<bool> binary_named;            ///< Whether a gate is named by a binary UUID
 
 std::vector<gateType> gates;                 ///< Gate type for each gate
 std::vector<std::vector<gate_t> > wires;     ///< Child wire lists for each gate
@@ -81,6 +125,17 @@ void setGateType(gate_t g, gateType t)
   gates[static_cast<std::underlying_type<gate_t>::type>(g)]=t;
 }
 
+/**
+ * @brief Make every name of gate @p from designate gate @p to instead.
+ *
+ * Used when @p from has been collapsed into @p to and lookups by UUID
+ * must land on the survivor.  @c getUUID(from) is unaffected.
+ *
+ * @param from  Gate whose names to redirect.
+ * @param to    Gate they now designate.
+ */
+void redirectUUID(gate_t from, gate_t to);
+
 protected:
 /**
  * @brief Allocate a new gate with a default-initialised type.
@@ -115,6 +170,17 @@ std::vector<gate_t>::size_type getNbGates() const {
  */
 gate_t getGate(const uuid &u);
 
+/**
+ * @brief Return (or create) the gate associated with binary UUID @p u.
+ *
+ * Same as @c getGate(const uuid&), without building the text form of
+ * @p u.
+ *
+ * @param u  Binary UUID.
+ * @return   Gate identifier for @p u.
+ */
+gate_t getGate(const binary_uuid &u);
+
 /**
  * @brief Return the UUID string associated with gate @p g.
  * @param g  Gate identifier.
@@ -122,6 +188,21 @@ gate_t getGate(const uuid &u);
  */
 uuid getUUID(gate_t g) const;
 
+/**
+ * @brief Return the binary UUID naming gate @p g, if it has one.
+ * @param g  Gate identifier.
+ * @param u  Output: the UUID, when there is one.
+ * @return   @c false if @p g is not named by a @c binary_uuid.
+ */
+bool getBinaryUUID(gate_t g, binary_uuid &u) const
+{
+  auto i=static_cast<std::underlying_type<gate_t>::type>(g);
+  if(i>=binary_named.size() || !binary_named[i])
+    return false;
+  u=id2buuid[i];
+  return true;
+}
+
 /**
  * @brief Return the type of gate @p g.
  * @param g  Gate identifier.
@@ -164,6 +245,18 @@ const std::vector<gate_t> &getWires(gate_t g) const
  */
 virtual gate_t setGate(const uuid &u, gateType type);
 
+/**
+ * @brief Create or update the gate associated with binary UUID @p u.
+ *
+ * Same as @c setGate(const uuid&, gateType), without building the text
+ * form of @p u.
+ *
+ * @param u     Binary UUID to associate with the gate.
+ * @param type  Gate type.
+ * @return      Gate identifier.
+ */
+virtual gate_t setGate(const binary_uuid &u, gateType type);
+
 /**
  * @brief Allocate a new gate with type @p type and no UUID.
  * @param type  Gate type.
@@ -178,6 +271,13 @@ virtual gate_t setGate(gateType type);
  */
 bool hasGate(const uuid &u) const;
 
+/**
+ * @brief Test whether a gate with binary UUID @p u exists.
+ * @param u  Binary UUID.
+ * @return   @c true if a gate with this UUID is present.
+ */
+bool hasGate(const binary_uuid &u) const;
+
 /**
  * @brief Add a directed wire from gate @p f (parent) to gate @p t (child).
  * @param f  Source (parent) gate.
@@ -7,12 +7,15 @@
  * be instantiated by the compiler in each translation unit that uses them).
  *
  * Implemented methods:
- * - @c hasGate(): UUID membership test.
+ * - @c hasGate(): UUID membership test, for string and binary UUIDs.
  * - @c getGate(): UUID → gate_t lookup, allocating a new gate on miss.
- * - @c getUUID(): gate_t → UUID string lookup.
+ * - @c getUUID(): gate_t → UUID string lookup, formatting binary names.
+ * - @c redirectUUID(): point a gate's names at another gate.
  * - @c addGate(): default gate allocation (extends @c gates and @c wires vectors).
  * - @c setGate(gateType): allocate a new gate and set its type.
- * - @c setGate(const uuid&, gateType): create/update a UUID-named gate.
+ * - @c setGate(const uuid&, gateType) and
+ *   @c setGate(const binary_uuid&, gateType): create/update a UUID-named
+ *   gate.
  * - @c addWire(): append a directed edge.
  *
  * Included by subclass headers that need these implementations (e.g.
@@ -23,28 +26,127 @@
 
 #include "Circuit.h"
 
+/**
+ * @brief Format @p u the way @c uuid2string formats a @c pg_uuid_t:
+ *        lowercase hex, hyphenated 8-4-4-4-12.
+ */
+inline std::string binaryUUIDToString(const binary_uuid &u)
+{
+  static const char hex_chars[] = "0123456789abcdef";
+  std::string result(36, '-');
+  for(unsigned i=0, j=0; i<sizeof u.data; ++i) {
+    if(i == 4 || i == 6 || i == 8 || i == 10)
+      ++j;
+    result[j++] = hex_chars[u.data[i] >> 4];
+    result[j++] = hex_chars[u.data[i] & 0x0F];
+  }
+  return result;
+}
+
+/**
+ * @brief Parse @p s into @p u, if it is in the form
+ *        @c binaryUUIDToString produces.
+ *
+ * Other spellings of the same UUID are rejected: a string-named gate is
+ * found only under its exact name, and a binary-named one only under
+ * the name @c getUUID gives it.
+ *
+ * @return @c false if @p s is not such a string.
+ */
+inline bool stringToBinaryUUID(const std::string &s, binary_uuid &u)
+{
+  if(s.size() != 36)
+    return false;
+  auto nibble = [](char c) -> int {
+                  if(c >= '0' && c <= '9') return c - '0';
+                  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+                  return -1;
+                };
+  for(unsigned i=0, j=0; i<sizeof u.data; ++i) {
+    if(i == 4 || i == 6 || i == 8 || i == 10) {
+      if(s[j] != '-')
+        return false;
+      ++j;
+    }
+    int hi = nibble(s[j++]), lo = nibble(s[j++]);
+    if(hi < 0 || lo < 0)
+      return false;
+    u.data[i] = static_cast<unsigned char>(hi << 4 | lo);
+  }
+  return true;
+}
+
 template<class gateType>
 bool Circuit<gateType>::hasGate(const uuid &u) const
 {
-  return uuid2id.find(u)!=uuid2id.end();
+  if(uuid2id.find(u)!=uuid2id.end())
+    return true;
+  binary_uuid b;
+  return !buuid2id.empty() && stringToBinaryUUID(u, b)
+         && buuid2id.find(b)!=buuid2id.end();
+}
+
+template<class gateType>
+bool Circuit<gateType>::hasGate(const binary_uuid &u) const
+{
+  if(buuid2id.find(u)!=buuid2id.end())
+    return true;
+  return !uuid2id.empty()
+         && uuid2id.find(binaryUUIDToString(u))!=uuid2id.end();
 }
 
 template<class gateType>
 gate_t Circuit<gateType>::getGate(const uuid &u)
 {
   auto it=uuid2id.find(u);
-  if(it==uuid2id.end()) {
-    gate_t id=addGate();
-    uuid2id[u]=id;
-    id2uuid[id]=u;
-    return id;
-  } else
+  if(it!=uuid2id.end())
+    return it->second;
+
+  binary_uuid b;
+  if(!buuid2id.empty() && stringToBinaryUUID(u, b)) {
+    auto bit=buuid2id.find(b);
+    if(bit!=buuid2id.end())
+      return bit->second;
+  }
+
+  gate_t id=addGate();
+  uuid2id[u]=id;
+  id2uuid[id]=u;
+  return id;
+}
+
+template<class gateType>
+gate_t Circuit<gateType>::getGate(const binary_uuid &u)
+{
+  auto it=buuid2id.find(u);
+  if(it!=buuid2id.end())
     return it->second;
+
+  if(!uuid2id.empty()) {
+    auto sit=uuid2id.find(binaryUUIDToString(u));
+    if(sit!=uuid2id.end())
+      return sit->second;
+  }
+
+  gate_t id=addGate();
+  auto i=static_cast<std::underlying_type<gate_t>::type>(id);
+  if(id2buuid.size()<=i) {
+    id2buuid.resize(gates.size());
+    binary_named.resize(gates.size());
+  }
+  id2buuid[i]=u;
+  binary_named[i]=true;
+  buuid2id[u]=id;
+  return id;
 }
 
 template<class gateType>
 typename Circuit<gateType>::uuid Circuit<gateType>::getUUID(gate_t g) const
 {
+  auto i=static_cast<std::underlying_type<gate_t>::type>(g);
+  if(i<binary_named.size() && binary_named[i])
+    return binaryUUIDToString(id2buuid[i]);
+
   auto it = id2uuid.find(g);
   if(it==id2uuid.end())
     return "";
@@ -77,6 +179,26 @@ gate_t Circuit<gateType>::setGate(const uuid &u, gateType type)
   return id;
 }
 
+template<class gateType>
+gate_t Circuit<gateType>::setGate(const binary_uuid &u, gateType type)
+{
+  gate_t id = getGate(u);
+  gates[static_cast<std::underlying_type<gate_t>::type>(id)] = type;
+  return id;
+}
+
+template<class gateType>
+void Circuit<gateType>::redirectUUID(gate_t from, gate_t to)
+{
+  auto it = id2uuid.find(from);
+  if(it != id2uuid.end())
+    uuid2id[it->second] = to;
+
+  auto i=static_cast<std::underlying_type<gate_t>::type>(from);
+  if(i<binary_named.size() && binary_named[i])
+    buuid2id[id2buuid[i]] = to;
+}
+
 template<class gateType>
 void Circuit<gateType>::addWire(gate_t f, gate_t t)
 {
@@ -7,21 +7,24 @@
  *   worker IPC channel) and constructs a @c BooleanCircuit.
  * - @c getGenericCircuit(): same but constructs a @c GenericCircuit.
  *
- * The internal @c getCircuitFromMMap<C>() template handles the IPC
- * protocol: it sends a request through the shared-memory pipe,
- * receives a Boost-serialised circuit blob from the background worker,
- * and deserialises it into the appropriate circuit type.
+ * A circuit already loaded during the statement is taken from the
+ * loaded-circuit cache (@c LoadedCircuitCache.h).  Any other is built
+ * from this backend's read-only view of the store when it can be (@c storeReaderGenericCircuit); otherwise
+ * @c getCircuitFromMMap() handles the IPC protocol: it sends a request
+ * through the shared-memory request ring, receives a flat circuit image
+ * (@c FlatCircuit.h) in this backend's reply slot, and builds the
+ * @c GenericCircuit from it, then added to the cache before any
+ * load-time simplification.
  */
 #include <cmath>
 
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/iostreams/device/array.hpp>
-#include <boost/iostreams/stream.hpp>
-
 #include "CircuitFromMMap.h"
+#include "FlatCircuit.h"
 #include "MMappedCircuit.h"
 #include "HybridEvaluator.h"
+#include "LoadedCircuitCache.h"
 #include "RangeCheck.h"
+#include "StoreReader.h"
 #include "having_semantics.hpp"
 #include "semiring/BoolExpr.h"
 #include "provsql_utils_cpp.h"
@@ -35,22 +38,15 @@ extern "C" {
 #include "provsql_utils.h"
 }
 
+#ifndef PROVSQL_INPROCESS_STORE
 /**
- * @brief Read and deserialise a circuit rooted at @p token from the mmap worker.
- * @tparam C           Circuit type to deserialise (@c BooleanCircuit or @c GenericCircuit).
- * @param token        UUID of the root gate to retrieve.
- * @param message_char IPC message-type byte sent to the background worker.
- * @return             Deserialised circuit of type @c C.
+ * @brief Send the request in the shared write buffer and build the
+ *        circuit the worker replies with.
+ * @param message_char IPC message-type byte of the request, for errors.
+ * @return             The circuit.
  */
-template<typename C>
-static C getCircuitFromMMap(pg_uuid_t token, char message_char)
+static GenericCircuit getCircuitFromMMap(char message_char)
 {
-  STARTWRITEM();
-  ADDWRITEM(&message_char, char);
-  ADDWRITEDB();
-  ADDWRITEM(&token, pg_uuid_t);
-
-  provsql_shmem_lock_exclusive();
   if(!SENDWRITEM())
     provsql_error("Cannot write to pipe (message type %c)", message_char);
 
@@ -58,23 +54,28 @@ static C getCircuitFromMMap(pg_uuid_t token, char message_char)
   if(!READB(size, unsigned long))
     provsql_error("Cannot read from pipe (message type %c)", message_char);
 
-  char *buf = new char[size];
-  if(!READB_BYTES(buf, size)) {
-    provsql_shmem_unlock();
+  /* Aligned for the image's 8-byte fields, which char[] need not be. */
+  uint64_t *buf = new uint64_t[(size + 7) / 8];
+  char *bytes = reinterpret_cast<char *>(buf);
+  if(!READB_BYTES(bytes, size)) {
     delete [] buf;
     provsql_error("Cannot read from pipe (message type %c)", message_char);
   }
-  provsql_shmem_unlock();
 
-  boost::iostreams::stream<boost::iostreams::array_source> stream(buf, size);
-  boost::archive::binary_iarchive ia(stream);
-  C c;
-  ia >> c;
+  GenericCircuit c;
+  try {
+    c = FlatCircuitView(bytes, size).toGenericCircuit();
+  } catch(const CircuitException &e) {
+    delete [] buf;
+    provsql_error("Invalid circuit from the mmap worker (message type %c): %s",
+                  message_char, e.what());
+  }
 
   delete [] buf;
 
   return c;
 }
+#endif /* PROVSQL_INPROCESS_STORE */
 
 BooleanCircuit getBooleanCircuit(
   GenericCircuit &gc,
@@ -82,7 +83,19 @@ BooleanCircuit getBooleanCircuit(
   gate_t &gate,
   std::unordered_map<gate_t, gate_t> &gc_to_bc)
 {
-  auto ggate = gc.getGate(uuid2string(token));
+  std::vector<gate_t> gates;
+  BooleanCircuit c = getBooleanCircuit(
+    gc, std::vector<gate_t>{gc.getGate(uuid2string(token))}, gates, gc_to_bc);
+  gate = gates[0];
+  return c;
+}
+
+BooleanCircuit getBooleanCircuit(
+  GenericCircuit &gc,
+  const std::vector<gate_t> &roots,
+  std::vector<gate_t> &gates,
+  std::unordered_map<gate_t, gate_t> &gc_to_bc)
+{
   BooleanCircuit c;
   for(gate_t u: gc.getInputs()) {
     gc_to_bc[u]=c.setGate(gc.getUUID(u), BooleanGate::IN, gc.getProb(u));
@@ -98,8 +111,11 @@ BooleanCircuit getBooleanCircuit(
     }
   }
   semiring::BoolExpr semiring(c);
-  provsql_having(gc, ggate, gc_to_bc, semiring);
-  gate=gc.evaluate(ggate, gc_to_bc, semiring);
+  gates.clear();
+  for(gate_t ggate: roots) {
+    provsql_having(gc, ggate, gc_to_bc, semiring);
+    gates.push_back(gc.evaluate(ggate, gc_to_bc, semiring));
+  }
   propagateDNNFCertificate(gc, gc_to_bc, c);
 
   return c;
@@ -177,13 +193,31 @@ static void applyLoadTimeSimplification(GenericCircuit &gc)
   }
 }
 
-GenericCircuit getGenericCircuit(pg_uuid_t token)
+GenericCircuit getStoredGenericCircuit(pg_uuid_t token)
 {
+  GenericCircuit gc;
+  if(!loadedCircuitCacheGet({token}, gc)) {
 #ifdef PROVSQL_INPROCESS_STORE
-  GenericCircuit gc = provsql_inproc_generic_circuit(token);
+    gc = provsql_inproc_generic_circuit(token);
 #else
-  GenericCircuit gc = getCircuitFromMMap<GenericCircuit>(token, 'g');
+    if(!storeReaderGenericCircuit({token}, gc)) {
+      char message_char = 'g';
+      STARTWRITEM();
+      ADDWRITEM(&message_char, char);
+      ADDWRITEDB();
+      ADDWRITEM(&token, pg_uuid_t);
+      gc = getCircuitFromMMap(message_char);
+    }
 #endif
+    loadedCircuitCachePut({token}, gc);
+  }
+
+  return gc;
+}
+
+GenericCircuit getGenericCircuit(pg_uuid_t token)
+{
+  GenericCircuit gc = getStoredGenericCircuit(token);
 
   /* Apply universal cmp-resolution passes (currently RangeCheck) at
    * load time so every downstream consumer -- semiring evaluators,
@@ -204,12 +238,12 @@ GenericCircuit getGenericCircuit(pg_uuid_t token)
 
 /**
  * @brief IPC: ship a 'j' (joint) request to the mmap worker and
- *        deserialise the returned @c GenericCircuit.
+ *        build the returned @c GenericCircuit.
  *
- * Mirrors @c getCircuitFromMMap but writes the multi-root payload
- * the worker's @c 'j' handler expects: <tt>'j' Oid nb_roots {pg_uuid_t}*</tt>.
- * The response shape is identical to @c 'g' -- @c unsigned @c long
- * size prefix followed by a Boost-serialised @c GenericCircuit.
+ * Writes the multi-root payload the worker's @c 'j' handler expects:
+ * <tt>'j' Oid nb_roots {pg_uuid_t}*</tt>.  The response shape is
+ * identical to @c 'g' -- @c unsigned @c long size prefix followed by a
+ * flat circuit image.
  */
 static GenericCircuit getJointCircuitFromMMap(
     const std::vector<pg_uuid_t> &tokens)
@@ -217,6 +251,12 @@ static GenericCircuit getJointCircuitFromMMap(
 #ifdef PROVSQL_INPROCESS_STORE
   return provsql_inproc_joint_circuit(tokens);
 #else
+  {
+    GenericCircuit c;
+    if(storeReaderGenericCircuit(tokens, c))
+      return c;
+  }
+
   char message_char = 'j';
   unsigned nb_roots = static_cast<unsigned>(tokens.size());
   STARTWRITEM();
@@ -226,30 +266,7 @@ static GenericCircuit getJointCircuitFromMMap(
   for(const pg_uuid_t &t : tokens)
     ADDWRITEM(&t, pg_uuid_t);
 
-  provsql_shmem_lock_exclusive();
-  if(!SENDWRITEM())
-    provsql_error("Cannot write to pipe (message type j)");
-
-  unsigned long size;
-  if(!READB(size, unsigned long))
-    provsql_error("Cannot read from pipe (message type j)");
-
-  char *buf = new char[size];
-  if(!READB_BYTES(buf, size)) {
-    provsql_shmem_unlock();
-    delete [] buf;
-    provsql_error("Cannot read from pipe (message type j)");
-  }
-  provsql_shmem_unlock();
-
-  boost::iostreams::stream<boost::iostreams::array_source> stream(buf, size);
-  boost::archive::binary_iarchive ia(stream);
-  GenericCircuit c;
-  ia >> c;
-
-  delete [] buf;
-
-  return c;
+  return getCircuitFromMMap(message_char);
 #endif /* PROVSQL_INPROCESS_STORE */
 }
 
@@ -257,7 +274,11 @@ GenericCircuit getJointCircuit(
   const std::vector<pg_uuid_t> &tokens,
   std::vector<gate_t> &gates)
 {
-  GenericCircuit gc = getJointCircuitFromMMap(tokens);
+  GenericCircuit gc;
+  if(!loadedCircuitCacheGet(tokens, gc)) {
+    gc = getJointCircuitFromMMap(tokens);
+    loadedCircuitCachePut(tokens, gc);
+  }
 
   applyLoadTimeSimplification(gc);
 
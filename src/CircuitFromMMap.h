@@ -58,6 +58,28 @@ BooleanCircuit getBooleanCircuit(
   gate_t &gate,
   std::unordered_map<gate_t, gate_t> &gc_to_bc);
 
+/**
+ * @brief Build one @c BooleanCircuit for several roots of @p gc.
+ *
+ * Same as the single-root variant, for every gate of @p roots in turn,
+ * with @p gc_to_bc shared between them: a sub-circuit common to several
+ * roots is translated once, and the roots' images share its gates.
+ *
+ * @param gc        Source generic circuit (mutated through HAVING
+ *                  evaluation).
+ * @param roots     Root gates of @p gc.
+ * @param gates     Output: @c gate_t of each root within the returned
+ *                  circuit, in the order of @p roots.
+ * @param gc_to_bc  Output: mapping from @c gc gates to the corresponding
+ *                  gates in the returned @c BooleanCircuit.
+ * @return          An in-memory @c BooleanCircuit.
+ */
+BooleanCircuit getBooleanCircuit(
+  GenericCircuit &gc,
+  const std::vector<gate_t> &roots,
+  std::vector<gate_t> &gates,
+  std::unordered_map<gate_t, gate_t> &gc_to_bc);
+
 /**
  * @brief Build a @c GenericCircuit from the mmap store rooted at @p token.
  *
@@ -71,6 +93,20 @@ BooleanCircuit getBooleanCircuit(
  */
 GenericCircuit getGenericCircuit(pg_uuid_t token);
 
+/**
+ * @brief Build a @c GenericCircuit from the mmap store rooted at @p token,
+ *        without the load-time simplification passes.
+ *
+ * Returns the circuit exactly as stored, for evaluators that cannot rely
+ * on the identities those passes assume -- notably the user-defined
+ * semirings of @c provenance_evaluate(), which are given every gate of
+ * the circuit as it was built.
+ *
+ * @param token  UUID of the root gate.
+ * @return       An in-memory @c GenericCircuit.
+ */
+GenericCircuit getStoredGenericCircuit(pg_uuid_t token);
+
 /**
  * @brief Propagate the per-gate d-DNNF certificate from @p gc to @p c.
  *
@@ -0,0 +1,432 @@
+/**
+ * @file CompiledCircuitCache.cpp
+ * @brief Persistent cache of compiled d-DNNFs: implementation.
+ *
+ * Implements @c CompiledCircuitKey (@c CompiledCircuitCache.h): hashing
+ * a Boolean circuit into a key, the binary d-DNNF file format, and the
+ * size-bounded eviction of the least recently used files.
+ */
+#include "CompiledCircuitCache.h"
+#include "MMappedCircuit.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "miscadmin.h"
+#include "provsql_utils.h"
+}
+#include "provsql_error.h"
+
+namespace provsql {
+
+namespace {
+
+/** @brief Name of the cache directory, in the database's store directory. */
+constexpr const char *kDirectory = "provsql_compiled";
+
+/** @brief First bytes of every cache file. */
+constexpr char kMagic[8] = {'P', 'V', 'S', 'Q', 'L', 'D', 'D', '\0'};
+
+/** @brief Version of the file format. */
+constexpr uint32_t kVersion = 1;
+
+/** @brief Age, in seconds, past which a temporary file is an orphan. */
+constexpr time_t kOrphanAge = 3600;
+
+/** @brief Bit of a gate's type byte: the gate has a name. */
+constexpr uint8_t kNamed = 0x10;
+
+/** @brief Bit of a gate's type byte: the gate has an info. */
+constexpr uint8_t kInfo = 0x20;
+
+/** @brief splitmix64's finaliser: a bijective 64-bit mix. */
+uint64_t mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/** @brief Two independent 64-bit hashes of a stream of words. */
+struct Hasher {
+  uint64_t a = 0x243f6a8885a308d3ULL;  ///< First lane
+  uint64_t b = 0x13198a2e03707344ULL;  ///< Second lane
+
+  void word(uint64_t w) {
+    a = mix(a ^ w);
+    b = mix(b + w * 0x9e3779b97f4a7c15ULL);
+  }
+
+  void bytes(const std::string &s) {
+    word(s.size());
+    for(size_t i = 0; i < s.size(); i += 8) {
+      uint64_t w = 0;
+      std::memcpy(&w, s.data() + i, std::min<size_t>(8, s.size() - i));
+      word(w);
+    }
+  }
+
+  void real(double d) {
+    uint64_t w;
+    std::memcpy(&w, &d, sizeof w);
+    word(w);
+  }
+};
+
+/** @brief Whether gate type @p t carries a probability. */
+bool hasProb(BooleanGate t)
+{
+  return t == BooleanGate::IN || t == BooleanGate::MULIN;
+}
+
+/** @brief Append @p v to @p out, seven bits per byte. */
+void putVarint(std::string &out, uint64_t v)
+{
+  while(v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+/** @brief Reads a cache file back, throwing on anything malformed. */
+class Reader {
+  const std::string &in;
+  size_t pos = 0;
+
+public:
+  explicit Reader(const std::string &s) : in(s) {}
+
+  const char *take(size_t n) {
+    if(n > in.size() - pos)
+      throw std::runtime_error("truncated");
+    pos += n;
+    return in.data() + pos - n;
+  }
+
+  uint64_t varint() {
+    uint64_t v = 0;
+    for(unsigned shift = 0; shift < 64; shift += 7) {
+      const uint8_t byte = static_cast<uint8_t>(*take(1));
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if(!(byte & 0x80))
+        return v;
+    }
+    throw std::runtime_error("bad varint");
+  }
+
+  template<class T> T raw() {
+    T v;
+    std::memcpy(&v, take(sizeof v), sizeof v);
+    return v;
+  }
+
+  bool done() const {
+    return pos == in.size();
+  }
+};
+
+/** @brief Directory of the cache of the current database. */
+std::string directory()
+{
+  return MMappedCircuit::storePath(MyDatabaseId, MyDatabaseTableSpace,
+                                   kDirectory);
+}
+
+/** @brief Budget of the cache, in bytes. */
+uint64_t budget()
+{
+  return static_cast<uint64_t>(provsql_compiled_circuit_cache) * 1024;
+}
+
+/** @brief Modification time of @p st, to the nanosecond: files written
+ *  or read back within the same second are still told apart. */
+std::pair<time_t, long> modified(const struct stat &st)
+{
+#if defined(__APPLE__)
+  return {st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec};
+#else
+  return {st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+#endif
+}
+
+/**
+ * @brief Remove the least recently used files of @p dir until they fit in
+ *        the budget, and temporary files left by a crashed backend.
+ * @return The size of the files left.
+ */
+uint64_t evict(const std::string &dir)
+{
+  DIR *d = opendir(dir.c_str());
+  if(!d)
+    return 0;
+
+  struct File {
+    std::pair<time_t, long> used;
+    uint64_t size;
+    std::string path;
+  };
+  std::vector<File> files;
+  uint64_t total = 0;
+  const time_t now = time(nullptr);
+
+  while(struct dirent *e = readdir(d)) {
+    const std::string name = e->d_name;
+    const std::string path = dir + "/" + name;
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+      if(now - st.st_mtime > kOrphanAge)
+        unlink(path.c_str());
+    } else if(name.size() > 3 && name.compare(name.size() - 3, 3, ".dd") == 0) {
+      files.push_back({modified(st), static_cast<uint64_t>(st.st_size), path});
+      total += st.st_size;
+    }
+  }
+  closedir(d);
+
+  if(total <= budget())
+    return total;
+  std::sort(files.begin(), files.end(), [](const File &x, const File &y) {
+    return x.used < y.used;
+  });
+  for(const auto &f: files) {
+    if(total <= budget())
+      break;
+    if(unlink(f.path.c_str()) == 0)
+      total -= f.size;
+  }
+  return total;
+}
+
+/**
+ * @brief Size of the cache directory when this backend last scanned it,
+ *        plus what it has stored since; negative before the first scan.
+ *
+ * Other backends' files are only counted from the next scan on, so each
+ * backend scans when its own writes may have taken the directory past the
+ * budget, not on every write.
+ */
+int64_t known_size = -1;
+
+/** @brief Account for the @p added bytes just stored in @p dir, evicting
+ *  when the directory may have outgrown the budget. */
+void stored(const std::string &dir, uint64_t added)
+{
+  if(known_size >= 0) {
+    known_size += added;
+    if(static_cast<uint64_t>(known_size) <= budget())
+      return;
+  }
+  known_size = static_cast<int64_t>(evict(dir));
+}
+
+}  // namespace
+
+CompiledCircuitKey::CompiledCircuitKey(const BooleanCircuit &c, gate_t g,
+                                       const std::string &route) :
+  enabled(provsql_compiled_circuit_cache > 0), hash{0, 0},
+  start(std::chrono::steady_clock::now())
+{
+  if(!enabled)
+    return;
+
+  // Builds read the whole circuit (a tree decomposition covers every
+  // gate, not only those under g), so the whole circuit is hashed.
+  Hasher h;
+  h.bytes(route);
+  h.word(static_cast<uint64_t>(g));
+  h.word(c.getNbGates());
+  for(size_t i = 0; i < c.getNbGates(); ++i) {
+    const gate_t u = static_cast<gate_t>(i);
+    const BooleanGate t = c.getGateType(u);
+    h.word(static_cast<uint64_t>(t));
+    h.bytes(c.getUUID(u));
+    if(hasProb(t))
+      h.real(c.getProb(u));
+    h.word(c.getInfo(u));
+    const auto &w = c.getWires(u);
+    h.word(w.size());
+    for(gate_t v: w)
+      h.word(static_cast<uint64_t>(v));
+  }
+  hash[0] = h.a;
+  hash[1] = h.b;
+}
+
+std::string CompiledCircuitKey::path() const
+{
+  char name[2 * 16 + 4];
+  snprintf(name, sizeof name, "%016llx%016llx.dd",
+           static_cast<unsigned long long>(hash[0]),
+           static_cast<unsigned long long>(hash[1]));
+  return directory() + "/" + name;
+}
+
+std::optional<dDNNF> CompiledCircuitKey::get() const
+{
+  if(!enabled)
+    return std::nullopt;
+
+  const std::string p = path();
+  std::string content;
+  {
+    std::ifstream ifs(p, std::ios::binary);
+    if(!ifs)
+      return std::nullopt;
+    content.assign(std::istreambuf_iterator<char>(ifs),
+                   std::istreambuf_iterator<char>());
+  }
+
+  try {
+    Reader r(content);
+    if(std::memcmp(r.take(sizeof kMagic), kMagic, sizeof kMagic) != 0
+       || r.raw<uint32_t>() != kVersion
+       || r.raw<uint64_t>() != hash[0] || r.raw<uint64_t>() != hash[1])
+      throw std::runtime_error("not this artefact");
+
+    const uint64_t nb = r.varint();
+    const uint64_t root = r.varint();
+    if(root >= nb)
+      throw std::runtime_error("bad root");
+    const bool probabilistic = r.raw<uint8_t>() != 0;
+
+    dDNNF dd;
+    std::vector<std::vector<gate_t> > wires(nb);
+    for(uint64_t i = 0; i < nb; ++i) {
+      const uint8_t head = r.raw<uint8_t>();
+      const BooleanGate t = static_cast<BooleanGate>(head & 0x0f);
+      if(t > BooleanGate::MULVAR)
+        throw std::runtime_error("bad gate type");
+      std::string name;
+      if(head & kNamed) {
+        const uint64_t len = r.varint();
+        name.assign(r.take(len), len);
+      }
+      gate_t u;
+      if(hasProb(t)) {
+        const double p = r.raw<double>();
+        u = name.empty() ? dd.setGate(t, p) : dd.setGate(name, t, p);
+      } else
+        u = name.empty() ? dd.setGate(t) : dd.setGate(name, t);
+      if(static_cast<uint64_t>(u) != i)
+        throw std::runtime_error("duplicate name");
+      if(head & kInfo)
+        dd.setInfo(u, r.varint());
+      wires[i].resize(r.varint());
+      for(auto &v: wires[i]) {
+        const uint64_t z = r.varint();
+        const int64_t target = static_cast<int64_t>(i)
+          - static_cast<int64_t>((z >> 1) ^ -(z & 1));
+        if(target < 0 || static_cast<uint64_t>(target) >= nb)
+          throw std::runtime_error("bad wire");
+        v = static_cast<gate_t>(target);
+      }
+    }
+    if(!r.done())
+      throw std::runtime_error("trailing bytes");
+
+    for(uint64_t i = 0; i < nb; ++i)
+      for(gate_t v: wires[i])
+        dd.addWire(static_cast<gate_t>(i), v);
+    dd.setRoot(static_cast<gate_t>(root));
+    // Sticky in the original, which may have shed its last uncertain input.
+    dd.probabilistic = probabilistic;
+
+    // A hit makes the file the most recently used.
+    utimensat(AT_FDCWD, p.c_str(), nullptr, 0);
+    if(provsql_verbose>=20)
+      provsql_notice("d-DNNF read from the compiled-circuit cache");
+    return dd;
+  } catch(const std::exception &) {
+    // Not a file this version wrote for this key: drop it.
+    unlink(p.c_str());
+    return std::nullopt;
+  }
+}
+
+dDNNF CompiledCircuitKey::put(dDNNF dd) const
+{
+  if(!enabled)
+    return dd;
+  const double ms = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  if(ms < provsql_compiled_circuit_cache_min_time)
+    return dd;
+
+  std::string out(kMagic, sizeof kMagic);
+  out.append(reinterpret_cast<const char *>(&kVersion), sizeof kVersion);
+  out.append(reinterpret_cast<const char *>(hash), sizeof hash);
+  const size_t nb = dd.getNbGates();
+  putVarint(out, nb);
+  putVarint(out, static_cast<uint64_t>(dd.getRoot()));
+  out.push_back(dd.isProbabilistic() ? 1 : 0);
+  for(size_t i = 0; i < nb; ++i) {
+    const gate_t u = static_cast<gate_t>(i);
+    const BooleanGate t = dd.getGateType(u);
+    const std::string name = dd.getUUID(u);
+    const unsigned info = dd.getInfo(u);
+    out.push_back(static_cast<char>(static_cast<uint8_t>(t)
+                                    | (name.empty() ? 0 : kNamed)
+                                    | (info ? kInfo : 0)));
+    if(!name.empty()) {
+      putVarint(out, name.size());
+      out += name;
+    }
+    if(hasProb(t)) {
+      const double p = dd.getProb(u);
+      out.append(reinterpret_cast<const char *>(&p), sizeof p);
+    }
+    if(info)
+      putVarint(out, info);
+    const auto &w = dd.getWires(u);
+    putVarint(out, w.size());
+    for(gate_t v: w) {
+      const int64_t d = static_cast<int64_t>(i) - static_cast<int64_t>(v);
+      putVarint(out, (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63));
+    }
+  }
+  if(out.size() > budget())
+    return dd;
+
+  // Written aside and renamed into place: a concurrent reader, in this
+  // backend or another, sees the whole file or none.
+  const std::string dir = directory();
+  const std::string p = path();
+  const std::string tmp = p + "." + std::to_string(getpid()) + ".tmp";
+  mkdir(dir.c_str(), S_IRWXU);
+  {
+    std::ofstream ofs(tmp, std::ios::binary);
+    ofs.write(out.data(), out.size());
+    if(!ofs) {
+      unlink(tmp.c_str());
+      return dd;
+    }
+  }
+  if(rename(tmp.c_str(), p.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return dd;
+  }
+  if(provsql_verbose>=20)
+    provsql_notice("d-DNNF stored in the compiled-circuit cache");
+  stored(dir, out.size());
+
+  return dd;
+}
+
+}  // namespace provsql
@@ -0,0 +1,98 @@
+/**
+ * @file CompiledCircuitCache.h
+ * @brief Persistent cache of compiled d-DNNFs, shared by all backends.
+ *
+ * Compiling a lineage to a d-DNNF -- by an external knowledge compiler
+ * (@c BooleanCircuit::compilation) or by a tree decomposition
+ * (@c dDNNFTreeDecompositionBuilder) -- is usually the dominant cost of
+ * @c probability_evaluate, @c shapley, @c compile_to_ddnnf and the
+ * evaluations built on them, and it is repeated by every call on the same
+ * token.  Gates never change once written, so the d-DNNF a route builds
+ * for a given Boolean circuit never changes either.
+ *
+ * The cache keeps those d-DNNFs on disk, one file per artefact, in a
+ * @c provsql_compiled directory next to the database's circuit store.  An
+ * artefact is keyed by a 128-bit hash of everything its build reads: the
+ * whole Boolean circuit (gate types, wires, names, probabilities and
+ * infos), the gate compiled, and the route (with the compiler and its
+ * binary).  A probability set later, a clean-up or a placeholder resolved
+ * therefore simply yield another key: nothing is ever stale.
+ *
+ * Files are written under a temporary name and renamed into place, so a
+ * concurrent reader sees a whole file or none.  A hit touches the file;
+ * when the directory outgrows @c provsql.compiled_circuit_cache
+ * kilobytes, the least recently touched files are removed.  A backend
+ * keeps a running total of the directory's size rather than scanning it
+ * on every write, and only scans when that total crosses the budget.
+ * Builds faster than @c provsql.compiled_circuit_cache_min_time
+ * milliseconds are not stored, reading them back being no cheaper.
+ * The cache is best effort: a file that cannot be read or written is a
+ * miss, never an error.
+ *
+ * Files use a compact binary d-DNNF format: a header (magic, version,
+ * key, gate count, root, probabilistic flag), then every gate in order --
+ * type, name, probability, info and wires, the latter as varint offsets
+ * from the gate's own index.
+ */
+#ifndef COMPILED_CIRCUIT_CACHE_H
+#define COMPILED_CIRCUIT_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "dDNNF.h"
+
+namespace provsql {
+
+/**
+ * @brief One lookup of the compiled-circuit cache: the d-DNNF a route
+ *        builds for one gate of one Boolean circuit.
+ *
+ * Constructing the key hashes the circuit, and starts the clock @c put()
+ * reads to decide whether the build was worth storing.
+ */
+class CompiledCircuitKey {
+  bool enabled;                 ///< Whether the cache is in use
+  uint64_t hash[2];             ///< Key of the artefact
+  std::chrono::steady_clock::time_point start;  ///< When the lookup began
+
+  /** @brief Path of the artefact's file. */
+  std::string path() const;
+
+public:
+  /**
+   * @brief Key of the d-DNNF @p route builds for gate @p g of @p c.
+   * @param route  Route name, plus whatever else its output depends on
+   *               (for instance the compiler and its binary).
+   */
+  CompiledCircuitKey(const BooleanCircuit &c, gate_t g, const std::string &route);
+
+  /** @brief The cached d-DNNF, if any. */
+  std::optional<dDNNF> get() const;
+
+  /**
+   * @brief Store @p dd, just built, if the build was long enough.
+   * @return @p dd.
+   */
+  dDNNF put(dDNNF dd) const;
+};
+
+/**
+ * @brief The d-DNNF @p route builds for gate @p g of @p c: from the
+ *        cache, or from @p build, whose result is then stored.
+ */
+template<class Build>
+dDNNF cachedDD(const BooleanCircuit &c, gate_t g, const std::string &route,
+               Build build)
+{
+  CompiledCircuitKey key(c, g, route);
+  if(auto dd = key.get())
+    return std::move(*dd);
+  return key.put(build());
+}
+
+}  // namespace provsql
+
+#endif  // COMPILED_CIRCUIT_CACHE_H
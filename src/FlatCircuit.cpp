@@ -0,0 +1,139 @@
+/**
+ * @file FlatCircuit.cpp
+ * @brief Building, reading and materialising flat circuit images.
+ *
+ * See @c FlatCircuit.h for the layout.
+ */
+#include <cmath>
+
+#include "FlatCircuit.h"
+#include "Circuit.hpp"
+
+gate_t FlatCircuitBuilder::getGate(const binary_uuid &u)
+{
+  auto it = ids.find(u);
+  if(it != ids.end())
+    return it->second;
+
+  gate_t id{uuids.size()};
+  ids.emplace(u, id);
+  uuids.push_back(u);
+  prob.push_back(NAN);
+  first_wire.push_back(0);
+  nb_children.push_back(0);
+  types.push_back(gate_input);
+  return id;
+}
+
+gate_t FlatCircuitBuilder::setGate(const binary_uuid &u, gate_type type)
+{
+  gate_t id = getGate(u);
+  types[static_cast<std::size_t>(id)] = type;
+  return id;
+}
+
+void FlatCircuitBuilder::addWire(gate_t f, gate_t t)
+{
+  auto i = static_cast<std::size_t>(f);
+  if(nb_children[i]++ == 0)
+    first_wire[i] = wires.size();
+  wires.push_back(static_cast<uint64_t>(t));
+}
+
+void FlatCircuitBuilder::setExtra(gate_t g, const std::string &s)
+{
+  extras.push_back({static_cast<uint64_t>(g), extra_data.size(), s.size()});
+  extra_data += s;
+}
+
+std::vector<std::pair<const void *, std::size_t> > FlatCircuitBuilder::sections()
+{
+  head = FlatCircuitHeader{};
+  head.magic = FlatCircuitHeader::MAGIC;
+  head.version = FlatCircuitHeader::VERSION;
+  head.nb_gates = uuids.size();
+  head.nb_wires = wires.size();
+  head.nb_infos = infos.size();
+  head.nb_extras = extras.size();
+  head.extra_bytes = extra_data.size();
+
+  return {
+    {&head, sizeof head},
+    {uuids.data(), uuids.size() * sizeof(binary_uuid)},
+    {prob.data(), prob.size() * sizeof(double)},
+    {first_wire.data(), first_wire.size() * sizeof(uint64_t)},
+    {wires.data(), wires.size() * sizeof(uint64_t)},
+    {infos.data(), infos.size() * sizeof(FlatCircuitInfos)},
+    {extras.data(), extras.size() * sizeof(FlatCircuitExtra)},
+    {nb_children.data(), nb_children.size() * sizeof(uint32_t)},
+    {types.data(), types.size() * sizeof(uint32_t)},
+    {extra_data.data(), extra_data.size()},
+  };
+}
+
+FlatCircuitView::FlatCircuitView(const char *data, std::size_t size)
+{
+  if(size < sizeof(FlatCircuitHeader))
+    throw CircuitException("Truncated flat circuit image");
+  head = reinterpret_cast<const FlatCircuitHeader *>(data);
+  if(head->magic != FlatCircuitHeader::MAGIC)
+    throw CircuitException("Not a flat circuit image");
+  if(head->version != FlatCircuitHeader::VERSION)
+    throw CircuitException("Flat circuit image of version " +
+                           std::to_string(head->version) + ", expected " +
+                           std::to_string(FlatCircuitHeader::VERSION));
+
+  /* Walk the sections, refusing any that would run past the end; each
+     count is compared with what is left before being multiplied, so the
+     product cannot overflow. */
+  std::size_t pos = sizeof(FlatCircuitHeader);
+  auto take = [&](uint64_t count, std::size_t elt) -> const char * {
+                if(count > (size - pos) / elt)
+                  throw CircuitException("Truncated flat circuit image");
+                const char *p = data + pos;
+                pos += count * elt;
+                return p;
+              };
+
+  uuids       = reinterpret_cast<const binary_uuid *>(take(head->nb_gates, sizeof(binary_uuid)));
+  prob        = reinterpret_cast<const double *>(take(head->nb_gates, sizeof(double)));
+  first_wire  = reinterpret_cast<const uint64_t *>(take(head->nb_gates, sizeof(uint64_t)));
+  wires       = reinterpret_cast<const uint64_t *>(take(head->nb_wires, sizeof(uint64_t)));
+  infos       = reinterpret_cast<const FlatCircuitInfos *>(take(head->nb_infos, sizeof(FlatCircuitInfos)));
+  extras      = reinterpret_cast<const FlatCircuitExtra *>(take(head->nb_extras, sizeof(FlatCircuitExtra)));
+  nb_children = reinterpret_cast<const uint32_t *>(take(head->nb_gates, sizeof(uint32_t)));
+  types       = reinterpret_cast<const uint32_t *>(take(head->nb_gates, sizeof(uint32_t)));
+  extra_data  = take(head->extra_bytes, 1);
+
+  if(pos != size)
+    throw CircuitException("Trailing bytes after flat circuit image");
+}
+
+GenericCircuit FlatCircuitView::toGenericCircuit() const
+{
+  GenericCircuit result;
+  const std::size_t n = getNbGates();
+
+  for(std::size_t i=0; i<n; ++i)
+    result.setGate(uuids[i], getGateType(gate_t{i}));
+
+  for(std::size_t i=0; i<n; ++i) {
+    gate_t g{i};
+    if(!std::isnan(prob[i]))
+      result.setProb(g, prob[i]);
+    const unsigned nb = nb_children[i];
+    auto &w = result.getWires(g);
+    w.reserve(nb);
+    for(unsigned k=0; k<nb; ++k)
+      w.push_back(getChild(g, k));
+  }
+
+  for(uint64_t i=0; i<head->nb_infos; ++i)
+    result.setInfos(gate_t{infos[i].gate}, infos[i].info1, infos[i].info2);
+
+  for(uint64_t i=0; i<head->nb_extras; ++i)
+    result.setExtra(gate_t{extras[i].gate},
+                    std::string(extra_data + extras[i].offset, extras[i].length));
+
+  return result;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file FlatCircuit.h
+ * @brief Flat, relocatable image of a circuit, as the mmap worker hands
+ *        it to a backend.
+ *
+ * When a backend cannot load a circuit from its own view of the store
+ * (see @c StoreReader.h), the worker loads it and sends it over the
+ * reply ring.  It used to build a @c GenericCircuit, serialise it with
+ * Boost.Serialization and send that; the backend deserialised it into a
+ * new @c GenericCircuit.  The worker now builds a @c FlatCircuitBuilder
+ * instead -- a handful of arrays, filled by the same traversal -- and
+ * sends the arrays as they are, behind a @c FlatCircuitHeader.  The
+ * backend wraps the bytes it receives in a @c FlatCircuitView, which
+ * reads them in place, and materialises a @c GenericCircuit from it in
+ * one pass.
+ *
+ * The image holds no pointers: every section is located by the counts
+ * in the header, so it can be read from any address.  Its layout is
+ *
+ * | Section        | Element                 | Count               |
+ * |----------------|-------------------------|---------------------|
+ * | header         | @c FlatCircuitHeader    | 1                   |
+ * | UUIDs          | @c binary_uuid          | @c nb_gates         |
+ * | probabilities  | @c double, @c NaN unset | @c nb_gates         |
+ * | first wire     | @c uint64_t             | @c nb_gates         |
+ * | wires          | @c uint64_t gate index  | @c nb_wires         |
+ * | infos          | @c FlatCircuitInfos     | @c nb_infos         |
+ * | extras         | @c FlatCircuitExtra     | @c nb_extras        |
+ * | child counts   | @c uint32_t             | @c nb_gates         |
+ * | gate types     | @c uint32_t             | @c nb_gates         |
+ * | extra bytes    | @c char                 | @c extra_bytes      |
+ *
+ * Sections come in decreasing order of alignment, so that each one is
+ * aligned in a buffer aligned for the first.  Gate @c i's children are
+ * @c wires[first_wire[i]] to @c wires[first_wire[i]+child_count[i]-1].
+ *
+ * The worker and a backend run the same build except across an upgrade
+ * that has not restarted the server; the header's @c version is what
+ * turns that into an error rather than a misread.
+ */
+#ifndef FLAT_CIRCUIT_H
+#define FLAT_CIRCUIT_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "GenericCircuit.h"
+
+extern "C" {
+#include "provsql_utils.h"
+}
+
+/** @brief Leading fields of a flat circuit image. */
+struct FlatCircuitHeader {
+  uint64_t magic;       ///< @c FlatCircuitHeader::MAGIC
+  uint32_t version;     ///< @c FlatCircuitHeader::VERSION
+  uint32_t reserved;    ///< Zero; pads the header to a multiple of 8 bytes
+  uint64_t nb_gates;    ///< Number of gates
+  uint64_t nb_wires;    ///< Number of wires, over all gates
+  uint64_t nb_infos;    ///< Number of gates carrying an @c info1 / @c info2 pair
+  uint64_t nb_extras;   ///< Number of gates carrying an extra string
+  uint64_t extra_bytes; ///< Total length of the extra strings
+
+  /** @brief Magic constant identifying a flat circuit image. */
+  static constexpr uint64_t MAGIC =
+    uint64_t('P')       | uint64_t('v') <<  8 | uint64_t('S') << 16 | uint64_t('F') << 24 |
+    uint64_t('l') << 32 | uint64_t('a') << 40 | uint64_t('t') << 48 | uint64_t('C') << 56;
+
+  /** @brief Layout version this build writes and reads. */
+  static constexpr uint32_t VERSION = 1;
+};
+
+/** @brief The @c info1 / @c info2 pair of one gate of a flat image. */
+struct FlatCircuitInfos {
+  uint64_t gate;  ///< Gate index
+  uint32_t info1; ///< @c GenericCircuit::getInfos first component
+  uint32_t info2; ///< @c GenericCircuit::getInfos second component
+};
+
+/** @brief Where the extra string of one gate of a flat image lies. */
+struct FlatCircuitExtra {
+  uint64_t gate;   ///< Gate index
+  uint64_t offset; ///< Start of the string in the extra-bytes section
+  uint64_t length; ///< Its length
+};
+
+/**
+ * @brief Accumulates a circuit in flat-image form.
+ *
+ * Offers the subset of @c GenericCircuit's interface that
+ * @c MMappedCircuit's loader uses, so that the loader fills either.  A
+ * gate's wires must be added consecutively, which the loader does.
+ */
+class FlatCircuitBuilder {
+std::unordered_map<binary_uuid, gate_t, binary_uuid_hash> ids; ///< UUID → gate index
+std::vector<binary_uuid> uuids;          ///< UUID section
+std::vector<double> prob;                ///< Probability section
+std::vector<uint64_t> first_wire;        ///< First-wire section
+std::vector<uint64_t> wires;             ///< Wire section
+std::vector<FlatCircuitInfos> infos;     ///< Infos section
+std::vector<FlatCircuitExtra> extras;    ///< Extras section
+std::vector<uint32_t> nb_children;       ///< Child-count section
+std::vector<uint32_t> types;             ///< Gate-type section
+std::string extra_data;                  ///< Extra-bytes section
+FlatCircuitHeader head;                  ///< Header, filled by @c sections()
+
+public:
+/** @brief Number of gates so far. */
+std::size_t getNbGates() const {
+  return uuids.size();
+}
+
+/**
+ * @brief Return (or create, as an input gate) the gate named @p u.
+ * @param u  Binary UUID of the gate.
+ * @return   Its index.
+ */
+gate_t getGate(const binary_uuid &u);
+
+/**
+ * @brief Return (or create) the gate named @p u, and set its type.
+ * @param u     Binary UUID of the gate.
+ * @param type  Its type.
+ * @return      Its index.
+ */
+gate_t setGate(const binary_uuid &u, gate_type type);
+
+/** @brief Set the probability of gate @p g. */
+void setProb(gate_t g, double p) {
+  prob[static_cast<std::size_t>(g)] = p;
+}
+
+/** @brief Make room for @p n more wires. */
+void reserveWires(gate_t, unsigned n) {
+  wires.reserve(wires.size() + n);
+}
+
+/**
+ * @brief Append the wire @p f → @p t.
+ *
+ * All of @p f's wires must be added before any other gate's.
+ */
+void addWire(gate_t f, gate_t t);
+
+/** @brief Record the @c info1 / @c info2 pair of gate @p g. */
+void setInfos(gate_t g, unsigned info1, unsigned info2) {
+  infos.push_back({static_cast<uint64_t>(g), info1, info2});
+}
+
+/** @brief Record the extra string of gate @p g. */
+void setExtra(gate_t g, const std::string &s);
+
+/**
+ * @brief Return the image, as a list of byte ranges to be written one
+ *        after the other.
+ *
+ * The ranges point into the builder, which must outlive their use.
+ */
+std::vector<std::pair<const void *, std::size_t> > sections();
+};
+
+/**
+ * @brief Read-only view of a flat circuit image.
+ *
+ * Does not copy or own the bytes it is given.
+ */
+class FlatCircuitView {
+const FlatCircuitHeader *head;         ///< Header
+const binary_uuid *uuids;              ///< UUID section
+const double *prob;                    ///< Probability section
+const uint64_t *first_wire;            ///< First-wire section
+const uint64_t *wires;                 ///< Wire section
+const FlatCircuitInfos *infos;         ///< Infos section
+const FlatCircuitExtra *extras;        ///< Extras section
+const uint32_t *nb_children;           ///< Child-count section
+const uint32_t *types;                 ///< Gate-type section
+const char *extra_data;                ///< Extra-bytes section
+
+public:
+/**
+ * @brief Wrap the image at @p data.
+ *
+ * @param data  Start of the image, aligned for @c uint64_t.
+ * @param size  Its length in bytes.
+ * @throw CircuitException if @p data is not an image of this version,
+ *        or is inconsistent with @p size.
+ */
+FlatCircuitView(const char *data, std::size_t size);
+
+/** @brief Number of gates. */
+std::size_t getNbGates() const {
+  return head->nb_gates;
+}
+
+/** @brief Binary UUID of gate @p g. */
+const binary_uuid &getUUID(gate_t g) const {
+  return uuids[static_cast<std::size_t>(g)];
+}
+
+/** @brief Type of gate @p g. */
+gate_type getGateType(gate_t g) const {
+  return static_cast<gate_type>(types[static_cast<std::size_t>(g)]);
+}
+
+/** @brief Probability of gate @p g, @c NaN if it has none. */
+double getProb(gate_t g) const {
+  return prob[static_cast<std::size_t>(g)];
+}
+
+/** @brief Number of children of gate @p g. */
+unsigned getNbChildren(gate_t g) const {
+  return nb_children[static_cast<std::size_t>(g)];
+}
+
+/** @brief The @p k-th child of gate @p g. */
+gate_t getChild(gate_t g, unsigned k) const {
+  return gate_t{wires[first_wire[static_cast<std::size_t>(g)] + k]};
+}
+
+/**
+ * @brief Build the @c GenericCircuit the image describes.
+ *
+ * Gate @c i of the image is gate @c i of the result, named by its binary
+ * UUID.
+ */
+GenericCircuit toGenericCircuit() const;
+};
+
+#endif /* FLAT_CIRCUIT_H */
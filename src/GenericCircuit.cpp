@@ -7,11 +7,13 @@
  * - @c addGate(): allocates a new gate and extends the @c prob vector.
  * - @c setGate(gate_type): creates a new gate, registering it as an
  *   input gate when the type is @c gate_input or @c gate_update.
- * - @c setGate(const uuid&, gate_type): same with UUID binding.
+ * - @c setGate(const uuid&, gate_type) and
+ *   @c setGate(const binary_uuid&, gate_type): same with UUID binding.
  *
  * The template method @c evaluate() is defined in @c GenericCircuit.hpp.
  */
 #include "GenericCircuit.h"
+#include "Circuit.hpp"
 
 #include <unordered_set>
 
@@ -33,6 +35,15 @@ gate_t GenericCircuit::setGate(const uuid &u, gate_type type)
   return id;
 }
 
+gate_t GenericCircuit::setGate(const binary_uuid &u, gate_type type)
+{
+  auto id = Circuit::setGate(u, type);
+  if(type == gate_input || type==gate_update) {
+    inputs.insert(id);
+  }
+  return id;
+}
+
 gate_t GenericCircuit::addGate()
 {
   auto id=Circuit::addGate();
@@ -180,8 +191,7 @@ bool GenericCircuit::foldSemiringIdentities()
     }
     for (const auto &kv : redirect) {
       gate_t g = kv.first, target = kv.second;
-      auto uit = id2uuid.find(g);
-      if (uit != id2uuid.end()) uuid2id[uit->second] = target;
+      redirectUUID(g, target);
       if (boolean_assumed_gates.count(g)) boolean_assumed_gates.insert(target);
       if (absorptive_assumed_gates.count(g))
         absorptive_assumed_gates.insert(target);
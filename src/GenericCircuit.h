@@ -17,8 +17,9 @@
  * - A probability vector for probabilistic evaluation.
  * - The set of input gate IDs (for semiring evaluation traversal).
  *
- * The circuit is Boost-serialisable, which is used when sending it as
- * a blob to an external knowledge-compiler process.
+ * When the mmap worker loads a circuit for a backend, it sends it as a
+ * flat image (@c FlatCircuit.h), from which the backend builds the
+ * @c GenericCircuit.
  */
 #ifndef GENERIC_CIRCUIT_H
 #define GENERIC_CIRCUIT_H
@@ -26,12 +27,6 @@
 #include <map>
 #include <type_traits>
 
-#include <boost/archive/binary_oarchive.hpp>
-#include <boost/serialization/unordered_map.hpp>
-#include <boost/serialization/map.hpp>
-#include <boost/serialization/set.hpp>
-#include <boost/serialization/vector.hpp>
-
 #include "Circuit.h"
 #include "semiring/Semiring.h"
 
@@ -119,6 +114,8 @@ gate_t addGate() override;
 gate_t setGate(gate_type type) override;
 /** @copydoc Circuit::setGate(const uuid&, gateType) */
 gate_t setGate(const uuid &u, gate_type type) override;
+/** @copydoc Circuit::setGate(const binary_uuid&, gateType) */
+gate_t setGate(const binary_uuid &u, gate_type type) override;
 
 /**
  * @brief Return the set of input (leaf) gates.
@@ -639,26 +636,7 @@ bool isCategoricalMixture(gate_t g) const
   return true;
 }
 
-/**
- * @brief Boost serialisation support.
- * @param ar       Boost archive (input or output).
- * @param version  Archive version (unused).
- */
-template<class Archive>
-void serialize (Archive & ar, const unsigned int version)
-{
-  ar & uuid2id;
-  ar & id2uuid;
-  ar & gates;
-  ar & wires;
-  ar & infos;
-  ar & extra;
-  ar & inputs;
-  ar & prob;
-}
-
 friend class dDNNFTreeDecompositionBuilder;
-friend class boost::serialization::access;
 
 /**
  * @brief Evaluate the sub-circuit rooted at gate @p g over semiring @p semiring.
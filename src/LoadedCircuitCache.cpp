@@ -0,0 +1,200 @@
+/**
+ * @file LoadedCircuitCache.cpp
+ * @brief Per-backend cache of loaded circuits: implementation.
+ *
+ * Implements @c loadedCircuitCacheGet() and @c loadedCircuitCachePut()
+ * (@c LoadedCircuitCache.h) and the C-linkage
+ * @c loaded_circuit_cache_reset() (@c loaded_circuit_cache.h).
+ *
+ * Cached circuits are kept in a list, most recently used first.  An
+ * index maps the UUID of every cached gate to the most recent circuit
+ * containing it, which is where a lookup looks for its first root.
+ */
+#include <cstring>
+#include <list>
+#include <set>
+#include <unordered_map>
+
+#include "LoadedCircuitCache.h"
+#include "MMappedCircuit.h"
+#include "Circuit.hpp"
+
+extern "C" {
+#include "loaded_circuit_cache.h"
+}
+
+namespace {
+
+/** @brief One cached circuit. */
+struct Entry {
+  std::vector<pg_uuid_t> roots; ///< Roots it was loaded from
+  GenericCircuit circuit;       ///< The circuit, as loaded
+};
+
+/** @brief Byte-wise order on binary UUIDs, the order of the loader's work list. */
+struct binary_uuid_less {
+  /** @brief Whether @p a comes before @p b. */
+  bool operator()(const binary_uuid &a, const binary_uuid &b) const {
+    return std::memcmp(a.data, b.data, sizeof a.data) < 0;
+  }
+};
+
+/** @brief Cached circuits, most recently used first. */
+std::list<Entry> entries;
+
+/** @brief Total number of gates of @c entries. */
+std::size_t nb_gates = 0;
+
+/** @brief Gate UUID → most recent entry containing it. */
+std::unordered_map<binary_uuid, std::list<Entry>::iterator, binary_uuid_hash> where;
+
+}
+
+/** @brief Binary form of @p u. */
+static binary_uuid toBinaryUUID(const pg_uuid_t &u)
+{
+  binary_uuid b;
+  memcpy(b.data, u.data, sizeof b.data);
+  return b;
+}
+
+/** @brief Whether @p a and @p b list the same roots, in the same order. */
+static bool sameRoots(const std::vector<pg_uuid_t> &a,
+                      const std::vector<pg_uuid_t> &b)
+{
+  if(a.size() != b.size())
+    return false;
+  for(std::size_t i=0; i<a.size(); ++i)
+    if(memcmp(a[i].data, b[i].data, sizeof a[i].data))
+      return false;
+  return true;
+}
+
+/**
+ * @brief Copy the part of @p from reachable from @p roots into @p result.
+ *
+ * Follows @c MMappedCircuit::loadCircuit step by step, reading gates
+ * from @p from rather than from the store, so that @p result is
+ * numbered exactly as a load from the store would number it.
+ */
+static void extract(GenericCircuit &from,
+                    const std::vector<pg_uuid_t> &roots,
+                    GenericCircuit &result)
+{
+  std::set<binary_uuid, binary_uuid_less> to_process;
+  for(const auto &r : roots)
+    to_process.insert(toBinaryUUID(r));
+
+  std::vector<bool> processed; // indexed by gate_t of result
+
+  while(!to_process.empty()) {
+    binary_uuid u = *to_process.begin();
+    to_process.erase(to_process.begin());
+
+    gate_t g = from.getGate(u);
+    gate_type type = from.getGateType(g);
+    gate_t id = result.setGate(u, type);
+    auto i = static_cast<std::underlying_type<gate_t>::type>(id);
+    if(processed.size() <= i)
+      processed.resize(result.getNbGates());
+    processed[i] = true;
+
+    /* Gates absent from the store were loaded as inputs with the
+     * default probability; copying that default changes nothing. */
+    result.setProb(id, from.getProb(g));
+
+    const auto &w = from.getWires(g);
+    result.getWires(id).reserve(w.size());
+    for(gate_t c : w) {
+      binary_uuid cu;
+      from.getBinaryUUID(c, cu);
+      gate_t rc = result.getGate(cu);
+      result.addWire(id, rc);
+      auto ci = static_cast<std::underlying_type<gate_t>::type>(rc);
+      if(ci >= processed.size() || !processed[ci])
+        to_process.insert(cu);
+    }
+
+    if(MMappedCircuit::infosAlwaysLoaded(type)) {
+      auto infos = from.getInfos(g);
+      result.setInfos(id, infos.first, infos.second);
+    } else if(MMappedCircuit::infosLoadedWhenSet(type)) {
+      auto infos = from.getInfos(g);
+      if(infos != std::make_pair(static_cast<unsigned>(-1), static_cast<unsigned>(-1)))
+        result.setInfos(id, infos.first, infos.second);
+    }
+
+    if(MMappedCircuit::extraLoaded(type))
+      result.setExtra(id, from.getExtra(g));
+  }
+}
+
+/** @brief Remove the least recently used entry. */
+static void evict()
+{
+  auto last = std::prev(entries.end());
+  const GenericCircuit &c = last->circuit;
+  for(std::size_t i=0; i<c.getNbGates(); ++i) {
+    binary_uuid u;
+    if(!c.getBinaryUUID(gate_t{i}, u))
+      continue;
+    auto it = where.find(u);
+    if(it != where.end() && it->second == last)
+      where.erase(it);
+  }
+  nb_gates -= c.getNbGates();
+  entries.pop_back();
+}
+
+bool loadedCircuitCacheGet(const std::vector<pg_uuid_t> &roots,
+                           GenericCircuit &out)
+{
+  if(provsql_loaded_circuit_cache <= 0 || roots.empty() || entries.empty())
+    return false;
+
+  auto it = where.find(toBinaryUUID(roots[0]));
+  if(it == where.end())
+    return false;
+  auto e = it->second;
+
+  if(sameRoots(e->roots, roots)) {
+    out = e->circuit;
+  } else {
+    for(const auto &r : roots)
+      if(!e->circuit.hasGate(toBinaryUUID(r)))
+        return false;
+    GenericCircuit result;
+    extract(e->circuit, roots, result);
+    out = std::move(result);
+  }
+
+  entries.splice(entries.begin(), entries, e);
+  return true;
+}
+
+void loadedCircuitCachePut(const std::vector<pg_uuid_t> &roots,
+                           const GenericCircuit &c)
+{
+  const std::size_t cap = provsql_loaded_circuit_cache > 0 ?
+                          static_cast<std::size_t>(provsql_loaded_circuit_cache) : 0;
+  if(roots.empty() || c.getNbGates() > cap)
+    return;
+
+  entries.push_front({roots, c});
+  nb_gates += c.getNbGates();
+  for(std::size_t i=0; i<c.getNbGates(); ++i) {
+    binary_uuid u;
+    if(c.getBinaryUUID(gate_t{i}, u))
+      where[u] = entries.begin();
+  }
+
+  while(nb_gates > cap)
+    evict();
+}
+
+void loaded_circuit_cache_reset(void)
+{
+  where.clear();
+  entries.clear();
+  nb_gates = 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file LoadedCircuitCache.h
+ * @brief C++ side of the per-backend cache of loaded circuits.
+ *
+ * See @c loaded_circuit_cache.h for what is cached and for how long.
+ * The cache holds circuits as loaded, before any load-time
+ * simplification, named by binary UUID, up to
+ * @c provsql.loaded_circuit_cache gates in all; the least recently used
+ * circuit is evicted first.
+ *
+ * A load is answered from the cache when an earlier load had the same
+ * roots, or when every root is a gate of one cached circuit: the circuit
+ * under those roots is then extracted from it.  Either way the answer is
+ * the circuit @c MMappedCircuit::createGenericCircuit would build --
+ * the same gates, with the same @c gate_t numbering.
+ */
+#ifndef LOADED_CIRCUIT_CACHE_CPP_H
+#define LOADED_CIRCUIT_CACHE_CPP_H
+
+#include <vector>
+
+#include "GenericCircuit.h"
+
+extern "C" {
+#include "provsql_utils.h"
+}
+
+/**
+ * @brief Look up the circuit reachable from @p roots in the cache.
+ *
+ * @param roots  UUIDs whose reachable closure to load.
+ * @param out    Output: a copy of the circuit, on a hit.
+ * @return       @c false on a miss.
+ */
+bool loadedCircuitCacheGet(const std::vector<pg_uuid_t> &roots,
+                           GenericCircuit &out);
+
+/**
+ * @brief Add a circuit just loaded from the store to the cache.
+ *
+ * @param roots  The roots it was loaded from.
+ * @param c      The circuit, as loaded.
+ */
+void loadedCircuitCachePut(const std::vector<pg_uuid_t> &roots,
+                           const GenericCircuit &c);
+
+#endif /* LOADED_CIRCUIT_CACHE_CPP_H */
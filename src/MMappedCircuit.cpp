@@ -12,7 +12,7 @@
  * - @c destroy_provsql_mmap(): called on shutdown; syncs and deletes the
  *   singleton.
  * - @c provsql_mmap_main_loop(): the worker's main loop; receives gate-
- *   creation messages from backends over the IPC pipe and writes them
+ *   creation messages from backends over the request ring and writes them
  *   to the mmap store.
  *
  * The @c createGenericCircuit() function performs a BFS from a root UUID,
@@ -21,15 +21,14 @@
 #include <cerrno>
 #include <cmath>
 #include <map>
-#include <sstream>
 #include <string>
 
 #include "MMappedCircuit.h"
+#include "FlatCircuit.h"
 #include "GenericCircuit.h"
 #include "Circuit.hpp"
 #include "provsql_utils_cpp.h"
 
-#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
@@ -129,23 +128,27 @@ void MMappedCircuit::createGate(
       const unsigned long wires_idx = wires.nbElements();
       for(const auto &c: children)
         wires.add(c);
-      // Wires first, then the record's own fields: an upgrade seen
-      // half-done would otherwise claim children that are not there yet.
-      gates[idx].children_idx = wires_idx;
-      gates[idx].nb_children = static_cast<unsigned>(children.size());
-      gates[idx].type = type;
       for(const auto &c: children)
         if(mapping[c] == MMappedUUIDHashTable::NOTHING)
           appendGate(c, gate_input, {});
+      // Wires and children first, then the record's own fields, with
+      // nb_children and type released last: an upgrade seen half-done
+      // would otherwise claim children that are not there yet.
+      gates[idx].children_idx = wires_idx;
+      __atomic_store_n(&gates[idx].nb_children,
+                       static_cast<unsigned>(children.size()), __ATOMIC_RELEASE);
+      __atomic_store_n(&gates[idx].type, type, __ATOMIC_RELEASE);
     }
     return;
   }
 
-  appendGate(token, type, children);
-
+  // Children before the parent, so that a reader that finds the parent
+  // finds its children too.
   for(const auto &c: children)
     if(mapping[c] == MMappedUUIDHashTable::NOTHING)
       appendGate(c, gate_input, {});
+
+  appendGate(token, type, children);
 }
 
 gate_type MMappedCircuit::getGateType(pg_uuid_t token) const
@@ -154,7 +157,7 @@ gate_type MMappedCircuit::getGateType(pg_uuid_t token) const
   if(idx == MMappedUUIDHashTable::NOTHING)
     return gate_input;
   else
-    return gates[idx].type;
+    return __atomic_load_n(&gates[idx].type, __ATOMIC_ACQUIRE);
 }
 
 std::vector<pg_uuid_t> MMappedCircuit::getChildren(pg_uuid_t token) const
@@ -163,7 +166,8 @@ std::vector<pg_uuid_t> MMappedCircuit::getChildren(pg_uuid_t token) const
   auto idx = mapping[token];
   if(idx != MMappedUUIDHashTable::NOTHING) {
     const GateInformation &gi = gates[idx];
-    for(unsigned long k=gi.children_idx; k<gi.children_idx+gi.nb_children; ++k)
+    const unsigned nb = __atomic_load_n(&gi.nb_children, __ATOMIC_ACQUIRE);
+    for(unsigned long k=gi.children_idx; k<gi.children_idx+nb; ++k)
       result.push_back(wires[k]);
   }
   return result;
@@ -223,7 +227,14 @@ bool MMappedCircuit::hasProbAt(unsigned long idx) const
 double MMappedCircuit::getProb(pg_uuid_t token) const
 {
   auto idx = mapping[token];
-  if(idx == MMappedUUIDHashTable::NOTHING || !carriesProb(gates[idx].type))
+  if(idx == MMappedUUIDHashTable::NOTHING)
+    return NAN;
+  return probAt(idx);
+}
+
+double MMappedCircuit::probAt(unsigned long idx) const
+{
+  if(!carriesProb(gates[idx].type))
     return NAN;
   if(!std::isnan(gates[idx].prob))
     return gates[idx].prob;
@@ -315,7 +326,8 @@ MMappedCircuit::SetAnnotationResult MMappedCircuit::setExtra(
   gates[idx].extra_idx=extra.nbElements();
   for(auto c: s)
     extra.add(c);
-  gates[idx].extra_len=s.size();
+  __atomic_store_n(&gates[idx].extra_len, static_cast<unsigned>(s.size()),
+                   __ATOMIC_RELEASE);
   return SetAnnotationResult::Written;
 }
 
@@ -331,14 +343,21 @@ std::pair<unsigned, unsigned> MMappedCircuit::getInfos(pg_uuid_t token) const
 }
 
 std::string MMappedCircuit::getExtra(pg_uuid_t token) const
+{
+  auto idx = mapping[token];
+  if(idx == MMappedUUIDHashTable::NOTHING)
+    return "";
+  return extraAt(idx);
+}
+
+std::string MMappedCircuit::extraAt(unsigned long idx) const
 {
   std::string result;
 
-  auto idx = mapping[token];
-  if(idx != MMappedUUIDHashTable::NOTHING) {
-    for(unsigned long start=gates[idx].extra_idx, k=start, end=start+gates[idx].extra_len; k<end; ++k)
-      result+=extra[k];
-  }
+  const unsigned len = __atomic_load_n(&gates[idx].extra_len, __ATOMIC_ACQUIRE);
+  result.reserve(len);
+  for(unsigned long start=gates[idx].extra_idx, k=start, end=start+len; k<end; ++k)
+    result+=extra[k];
 
   return result;
 }
@@ -496,11 +515,35 @@ extern "C" void provsql_store_flush(void)
   store_dirty = false;
 }
 
+#ifndef PROVSQL_INPROCESS_STORE
+/** @brief Reply to a @c 'g' or @c 'j' request (@p message_char) with the
+ *  flat image of the circuit reachable from @p roots, preceded by its
+ *  length. */
+static void sendFlatCircuit(const MMappedCircuit &circuit,
+                            const std::vector<pg_uuid_t> &roots,
+                            char message_char)
+{
+  FlatCircuitBuilder flat;
+  circuit.createFlatCircuit(roots, flat);
+
+  const auto sections = flat.sections();
+  unsigned long size = 0;
+  for(const auto &[p, n]: sections)
+    size += n;
+
+  if(!WRITEB(&size, unsigned long))
+    provsql_error("Cannot write to pipe (message type %c)", message_char);
+  for(const auto &[p, n]: sections)
+    if(n > 0 && !WRITEB_BYTES(p, n))
+      provsql_error("Cannot write to pipe (message type %c)", message_char);
+}
+#endif
+
 extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
 {
     MMappedCircuit *circuit = getCircuit(db_oid, db_tablespace);
 
-    if(c=='C' || c=='P' || c=='I' || c=='E')
+    if(c=='C' || c=='B' || c=='P' || c=='Q' || c=='I' || c=='E' || c=='R')
       store_dirty = true;
 
     switch(c) {
@@ -522,6 +565,45 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
       break;
     }
 
+    case 'B':
+    {
+      /* A backend's batch of gate creations (see provsql_gate_batch_flush):
+         read whole, then applied record by record. */
+      unsigned len, nb_gates;
+
+      if(!READM(len, unsigned) || !READM(nb_gates, unsigned))
+        provsql_error("Cannot read from pipe (message type B)");
+
+      std::vector<char> payload(len);
+      if(len > 0 && !READM_BYTES(payload.data(), len))
+        provsql_error("Cannot read from pipe (message type B)");
+
+      const char *p = payload.data();
+      const char *end = p + len;
+      std::vector<pg_uuid_t> children;
+      for(unsigned g=0; g<nb_gates; ++g) {
+        pg_uuid_t token;
+        gate_type type;
+        unsigned nb_children;
+
+        if(static_cast<size_t>(end - p) < sizeof(pg_uuid_t) + sizeof(gate_type) + sizeof(unsigned))
+          provsql_error("Truncated message (message type B)");
+        memcpy(&token, p, sizeof(pg_uuid_t)); p += sizeof(pg_uuid_t);
+        memcpy(&type, p, sizeof(gate_type)); p += sizeof(gate_type);
+        memcpy(&nb_children, p, sizeof(unsigned)); p += sizeof(unsigned);
+
+        if(static_cast<size_t>(end - p) / sizeof(pg_uuid_t) < nb_children)
+          provsql_error("Truncated message (message type B)");
+        children.resize(nb_children);
+        if(nb_children > 0)
+          memcpy(children.data(), p, nb_children * sizeof(pg_uuid_t));
+        p += nb_children * sizeof(pg_uuid_t);
+
+        circuit->createGate(token, type, children);
+      }
+      break;
+    }
+
     case 'P':
     {
       pg_uuid_t token;
@@ -538,6 +620,42 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
       break;
     }
 
+    case 'Q':
+    {
+      /* A batch of probability writes (see provsql_internal_set_probs):
+         applied in order up to the first refused, with one reply for the
+         batch -- how far it got, each row's outcome, and the value that
+         refused it. */
+      unsigned nb;
+      double existing = 0.;
+
+      if(!READM(nb, unsigned))
+        provsql_error("Cannot read from pipe (message type Q)");
+
+      std::vector<pg_uuid_t> tokens(nb);
+      std::vector<double> probs(nb);
+      for(unsigned i=0; i<nb; ++i)
+        if(!READM(tokens[i], pg_uuid_t) || !READM(probs[i], double))
+          provsql_error("Cannot read from pipe (message type Q)");
+
+      std::vector<char> results;
+      results.reserve(nb);
+      for(unsigned i=0; i<nb; ++i) {
+        auto result = circuit->setProb(tokens[i], probs[i], &existing);
+        results.push_back(static_cast<char>(result));
+        if(result == MMappedCircuit::SetProbResult::NotProbGate
+           || result == MMappedCircuit::SetProbResult::AlreadySet)
+          break;
+      }
+
+      unsigned done = results.size();
+      if(!WRITEB(&done, unsigned)
+         || (done > 0 && !WRITEB_BYTES(results.data(), done))
+         || !WRITEB(&existing, double))
+        provsql_error("Cannot write response to pipe (message type Q)");
+      break;
+    }
+
     case 'q':
     {
       /* Is a probability written on this gate, and which one?  Distinct
@@ -574,6 +692,52 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
       break;
     }
 
+    case 'R':
+    {
+      /* A batch of repair_key rows (see provsql_internal_repair_key): per
+         row, the block's key input gate, the row's mulinput gate and its
+         infos.  Every row is applied; the reply names the first whose
+         infos were refused. */
+      unsigned nb_rows;
+      char result = static_cast<char>(MMappedCircuit::SetAnnotationResult::Written);
+      pg_uuid_t conflict{};
+      std::pair<unsigned, unsigned> existing{0, 0};
+      std::vector<pg_uuid_t> key(1);
+      bool have_key = false;
+
+      if(!READM(nb_rows, unsigned))
+        provsql_error("Cannot read from pipe (message type R)");
+
+      for(unsigned i=0; i<nb_rows; ++i) {
+        pg_uuid_t token, key_token;
+        unsigned info1, info2;
+        std::pair<unsigned, unsigned> had{0, 0};
+
+        if(!READM(token, pg_uuid_t) || !READM(key_token, pg_uuid_t)
+           || !READM(info1, unsigned) || !READM(info2, unsigned))
+          provsql_error("Cannot read from pipe (message type R)");
+
+        if(!have_key || memcmp(&key[0], &key_token, sizeof(pg_uuid_t))) {
+          key[0] = key_token;
+          have_key = true;
+          circuit->createGate(key_token, gate_input, {});
+        }
+        circuit->createGate(token, gate_mulinput, key);
+        if(circuit->setInfos(token, info1, info2, &had)
+           == MMappedCircuit::SetAnnotationResult::AlreadySet
+           && result != static_cast<char>(MMappedCircuit::SetAnnotationResult::AlreadySet)) {
+          result = static_cast<char>(MMappedCircuit::SetAnnotationResult::AlreadySet);
+          conflict = token;
+          existing = had;
+        }
+      }
+
+      if(!WRITEB(&result, char) || !WRITEB(&conflict, pg_uuid_t)
+         || !WRITEB(&existing.first, unsigned) || !WRITEB(&existing.second, unsigned))
+        provsql_error("Cannot write response to pipe (message type R)");
+      break;
+    }
+
     case 'E':
     {
       pg_uuid_t token;
@@ -698,16 +862,7 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
          directly instead of issuing the 'g' message. */
       provsql_error("message type g is not used by the in-process store");
 #else
-      std::stringstream ss;
-      boost::archive::binary_oarchive oa(ss);
-      oa << circuit->createGenericCircuit(token);
-
-      ss.seekg(0, std::ios::end);
-      unsigned long size = ss.tellg();
-      ss.seekg(0, std::ios::beg);
-
-      if(!WRITEB(&size, unsigned long) || !WRITEB_BYTES(ss.str().data(), size))
-        provsql_error("Cannot write to pipe (message type g)");
+      sendFlatCircuit(*circuit, std::vector<pg_uuid_t>{token}, 'g');
 #endif
       break;
     }
@@ -748,7 +903,7 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
     case 'S':
     {
       /* Sync barrier: force everything written so far to stable storage
-         and say so.  Because the pipe is FIFO and the worker single
+         and say so.  Because the request ring is FIFO and the worker single
          threaded, the reply also proves every earlier message from this
          backend has been *applied*, not merely queued. */
       provsql_store_flush();
@@ -797,16 +952,7 @@ extern "C" void provsql_mmap_dispatch(char c, Oid db_oid, Oid db_tablespace)
          directly instead of issuing the 'j' message. */
       provsql_error("message type j is not used by the in-process store");
 #else
-      std::stringstream ss;
-      boost::archive::binary_oarchive oa(ss);
-      oa << circuit->createGenericCircuit(roots);
-
-      ss.seekg(0, std::ios::end);
-      unsigned long size = ss.tellg();
-      ss.seekg(0, std::ios::beg);
-
-      if(!WRITEB(&size, unsigned long) || !WRITEB_BYTES(ss.str().data(), size))
-        provsql_error("Cannot write to pipe (message type j)");
+      sendFlatCircuit(*circuit, roots, 'j');
 #endif
       break;
     }
@@ -822,36 +968,21 @@ void provsql_mmap_main_loop()
   char c;
 
   for(;;) {
-    struct pollfd pfd;
-    pfd.fd = provsql_shared_state->pipebmr;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
-
     /* Wait indefinitely while there is nothing to force out; once a write
        has landed, wake up after the flush interval and force it, so an
        idle store is never more than that far behind the disk. */
-    int r = poll(&pfd, 1,
-                 store_dirty ? PROVSQL_STORE_FLUSH_INTERVAL_MS : -1);
-    if(r < 0) {
-      if(errno == EINTR)
-        continue;
-      break;
-    }
-    if(r == 0) {
+    if(!provsql_ring_next_request(
+         store_dirty ? PROVSQL_STORE_FLUSH_INTERVAL_MS : -1)) {
       provsql_store_flush();
       continue;
     }
 
-    if(!READM(c, char))
-      break;
     Oid db_oid, db_tablespace;
-    if(!READM(db_oid, Oid) || !READM(db_tablespace, Oid))
-      provsql_error("Cannot read message header from pipe");
+    if(!READM(c, char) || !READM(db_oid, Oid) || !READM(db_tablespace, Oid))
+      provsql_error("Cannot read message header from the request ring");
     provsql_mmap_dispatch(c, db_oid, db_tablespace);
+    provsql_ring_request_done();
   }
-
-  int e = errno;
-  provsql_error("Reading from pipe: %s", strerror(e));
 }
 #endif
 
@@ -1021,6 +1152,9 @@ MMappedCircuit::Counts MMappedCircuit::sweepInto(
         continue;
       nmapping.publish(mapping.slotKey(k), newidx[v]);
     }
+    /* The files are renamed into place one by one; a growth still in
+       progress would leave half the mapping behind, in a ".next" file. */
+    nmapping.finishGrowth();
 
     out.gates = ngates.nbElements();
     out.wires = nwires.nbElements();
@@ -1051,73 +1185,143 @@ GenericCircuit MMappedCircuit::createGenericCircuit(pg_uuid_t token) const
   return createGenericCircuit(std::vector<pg_uuid_t>{token});
 }
 
+/** @brief The @c binary_uuid naming @p u in an in-memory circuit. */
+static binary_uuid toBinaryUUID(const pg_uuid_t &u)
+{
+  binary_uuid b;
+  static_assert(sizeof b.data == sizeof u.data, "UUID sizes differ");
+  memcpy(b.data, u.data, sizeof b.data);
+  return b;
+}
+
+bool MMappedCircuit::infosAlwaysLoaded(gate_type type)
+{
+  return type==gate_mulinput || type==gate_eq || type==gate_agg
+         || type==gate_cmp  || type==gate_arith;
+}
+
+bool MMappedCircuit::infosLoadedWhenSet(gate_type type)
+{
+  /* The d-DNNF certificate (DNNF_CERT_INFO in info1: deterministic
+   * plus / decomposable times) and, alongside it in info2, the tag of
+   * the planner-time route that produced the root (@c provsql_route);
+   * on a gate_assumed the route tag is in info1.  Copied only when
+   * set, so unmarked gates do not bloat the in-memory infos map with
+   * zeros. */
+  return type==gate_plus || type==gate_times || type==gate_assumed;
+}
+
+bool MMappedCircuit::extraLoaded(gate_type type)
+{
+  /* gate_assumed carries its assumption kind ('boolean' /
+   * 'absorptive') in extra; gate_mobius carries its per-child integer
+   * coefficients ("uuid:coeff" tokens); a gate_arith PERCENTILE
+   * carries its fraction (agg-carrier arith gates carry a display
+   * value there, inert for evaluation); gates stored without the
+   * label have none and default to 'boolean' at
+   * evaluation. */
+  return type==gate_project || type==gate_value || type==gate_agg
+         || type==gate_rv || type==gate_mulinput || type==gate_annotation
+         || type==gate_assumed || type==gate_mobius || type==gate_arith
+         || type==gate_observe;
+}
+
+/** @brief Make room for @p n wires out of gate @p g of @p c. */
+static void reserveWires(GenericCircuit &c, gate_t g, unsigned n)
+{
+  c.getWires(g).reserve(n);
+}
+
+/** @copydoc reserveWires(GenericCircuit&, gate_t, unsigned) */
+static void reserveWires(FlatCircuitBuilder &c, gate_t g, unsigned n)
+{
+  c.reserveWires(g, n);
+}
+
 GenericCircuit MMappedCircuit::createGenericCircuit(
     const std::vector<pg_uuid_t> &roots) const
+{
+  GenericCircuit result;
+  loadCircuit(roots, result);
+  return result;
+}
+
+GenericCircuit MMappedCircuit::createGenericCircuitChecked(
+    const std::vector<pg_uuid_t> &roots, bool misses_final) const
+{
+  GenericCircuit result;
+  loadCircuit(roots, result, true, misses_final);
+  return result;
+}
+
+void MMappedCircuit::createFlatCircuit(const std::vector<pg_uuid_t> &roots,
+                                       FlatCircuitBuilder &out) const
+{
+  loadCircuit(roots, out);
+}
+
+template<class C>
+void MMappedCircuit::loadCircuit(const std::vector<pg_uuid_t> &roots,
+                                 C &result, bool check_misses,
+                                 bool misses_final) const
 {
   /* Seed the work list with every root.  std::set deduplicates so a
    * UUID listed twice (or reached as a child of one root and the
    * other's root itself) is processed only once.  Shared subgraphs
    * therefore land on a single gate_t in `result` -- the property
    * that lets the conditional MC sampler couple the indicator and
-   * value paths through @c Sampler::scalar_cache_ / @c bool_cache_. */
-  std::set<pg_uuid_t> to_process, processed;
+   * value paths through @c Sampler::scalar_cache_ / @c bool_cache_.
+   * The work list stays ordered, rather than being a plain stack, so
+   * that gate_t numbering -- on which seeded Monte Carlo runs and the
+   * order of some outputs depend -- is independent of the loader. */
+  std::set<pg_uuid_t> to_process;
   for(const auto &r : roots)
     to_process.insert(r);
 
-  GenericCircuit result;
+  std::vector<bool> processed; // indexed by gate_t
 
   while(!to_process.empty()) {
     pg_uuid_t uuid = *to_process.begin();
     to_process.erase(to_process.begin());
-    processed.insert(uuid);
-    std::string f{uuid2string(uuid)};
 
-    gate_type type = getGateType(uuid);
-    gate_t id = result.setGate(f, type);
-    double prob = getProb(uuid);
+    auto idx = mapping[uuid];
+    const bool stored = idx != MMappedUUIDHashTable::NOTHING;
+    if(!stored && check_misses && (!misses_final || replaced()))
+      throw StaleMiss();
+    gate_type type = stored ?
+                     __atomic_load_n(&gates[idx].type, __ATOMIC_ACQUIRE) :
+                     gate_input;
+    gate_t id = result.setGate(toBinaryUUID(uuid), type);
+    auto i = static_cast<std::underlying_type<gate_t>::type>(id);
+    if(processed.size() <= i)
+      processed.resize(result.getNbGates());
+    processed[i] = true;
+
+    if(!stored)
+      continue;
+
+    const GateInformation &gi = gates[idx];
+    double prob = probAt(idx);
     if(!std::isnan(prob))
       result.setProb(id, prob);
 
-    std::vector<pg_uuid_t> children = getChildren(uuid);
-    for(unsigned i=0; i<children.size(); ++i) {
-      result.addWire(
-        id,
-        result.getGate(uuid2string(children[i])));
-      if(processed.find(children[i])==processed.end())
-        to_process.insert(children[i]);
+    const unsigned nb = __atomic_load_n(&gi.nb_children, __ATOMIC_ACQUIRE);
+    const unsigned long first = gi.children_idx;
+    reserveWires(result, id, nb);
+    for(unsigned long k=first; k<first+nb; ++k) {
+      const pg_uuid_t &child = wires[k];
+      gate_t c = result.getGate(toBinaryUUID(child));
+      result.addWire(id, c);
+      auto ci = static_cast<std::underlying_type<gate_t>::type>(c);
+      if(ci >= processed.size() || !processed[ci])
+        to_process.insert(child);
     }
 
-    if(type==gate_mulinput || type==gate_eq || type==gate_agg
-       || type==gate_cmp  || type==gate_arith) {
-      auto [info1, info2] = getInfos(uuid);
-      result.setInfos(id, info1, info2);
-    } else if(type==gate_plus || type==gate_times || type==gate_assumed) {
-      /* The d-DNNF certificate (DNNF_CERT_INFO in info1: deterministic
-       * plus / decomposable times) and, alongside it in info2, the tag of
-       * the planner-time route that produced the root (@c provsql_route);
-       * on a gate_assumed the route tag is in info1.  Copied only when
-       * set, so unmarked gates do not bloat the in-memory infos map with
-       * zeros. */
-      auto [info1, info2] = getInfos(uuid);
-      if(info1 != 0 || info2 != 0)
-        result.setInfos(id, info1, info2);
-    }
+    if(infosAlwaysLoaded(type)
+       || (infosLoadedWhenSet(type) && (gi.info1 != 0 || gi.info2 != 0)))
+      result.setInfos(id, gi.info1, gi.info2);
 
-    if(type==gate_project || type==gate_value || type==gate_agg
-       || type==gate_rv || type==gate_mulinput || type==gate_annotation
-       || type==gate_assumed || type==gate_mobius || type==gate_arith
-       || type==gate_observe) {
-      /* gate_assumed carries its assumption kind ('boolean' /
-       * 'absorptive') in extra; gate_mobius carries its per-child integer
-       * coefficients ("uuid:coeff" tokens); a gate_arith PERCENTILE
-       * carries its fraction (agg-carrier arith gates carry a display
-       * value there, inert for evaluation); gates stored without the
-       * label have none and default to 'boolean' at
-       * evaluation. */
-      auto extra = getExtra(uuid);
-      result.setExtra(id, extra);
-    }
+    if(extraLoaded(type))
+      result.setExtra(id, extraAt(idx));
   }
-
-  return result;
 }
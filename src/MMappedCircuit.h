@@ -18,6 +18,14 @@
  * PostgreSQL data directory, and are opened/created by the ProvSQL
  * background worker on the first message for that database.
  *
+ * The worker writes the store; backends may open it read-only and answer
+ * lookups from their own mapping (see @c store_reader.h).  Every write
+ * is ordered so that such a reader, running concurrently, never follows
+ * an index to something not yet written: records before the mapping
+ * entries that point at them, children before their parents, and the
+ * fields that say how much to read (@c nb_children, @c extra_len) after
+ * the data they cover.
+ *
  * The free-function @c createGenericCircuit() traverses the mmap data
  * starting from a given root UUID to construct an in-memory
  * @c GenericCircuit for evaluation.
@@ -32,13 +40,15 @@
  * a field -- or that renumbers a @c gate_type enumerator -- silently
  * breaks every existing installation's on-disk mmap files.  If such a
  * change is necessary, bump an explicit format-version header in the
- * mmap files, write a migration path, and call it out in a release note.
+ * mmap files, write a migration path, and call it out in a release note
+ * -- as @c GATES_VERSION and @c MMappedUUIDHashTable::MAPPING_VERSION do.
  */
 #ifndef MMAPPED_CIRCUIT_H
 #define MMAPPED_CIRCUIT_H
 
 #include <cmath>
 #include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -50,6 +60,7 @@ extern "C" {
 #include "provsql_utils.h"
 }
 
+class FlatCircuitBuilder;
 /**
  * @brief Per-gate metadata stored in the @c gates @c MMappedVector.
  *
@@ -108,7 +119,20 @@ void appendGate(pg_uuid_t token, gate_type type,
  *  probability (see @c GATES_VERSION for the version-1 leniency). */
 bool hasProbAt(unsigned long idx) const;
 
+/** @brief @c getProb for the gate record at index @p idx. */
+double probAt(unsigned long idx) const;
+
+/** @brief @c getExtra for the gate record at index @p idx. */
+std::string extraAt(unsigned long idx) const;
 
+/** @brief Load the circuit reachable from @p roots into @p out, a
+ *  @c GenericCircuit or a @c FlatCircuitBuilder.  With @p check_misses,
+ *  a token the mapping does not hold raises @c StaleMiss unless
+ *  @p misses_final and the mapping has not been replaced (see
+ *  @c createGenericCircuitChecked). */
+template<class C>
+void loadCircuit(const std::vector<pg_uuid_t> &roots, C &out,
+                 bool check_misses = false, bool misses_final = true) const;
 
 /** @brief Delegating constructor that accepts pre-built paths. */
 MMappedCircuit(const std::string &mp, const std::string &gp,
@@ -369,6 +393,25 @@ inline bool legacyProbabilities() const {
 
 
 
+/**
+ * @brief Whether @p token is in the mapping.
+ *
+ * The getters answer a token that is not with the lazy defaults of an
+ * input gate; this tells the two cases apart.
+ */
+inline bool hasGate(pg_uuid_t token) const {
+  return mapping[token] != MMappedUUIDHashTable::NOTHING;
+}
+
+/**
+ * @brief Whether the writer has replaced the mapping file since this
+ *        read-only circuit opened it (see
+ *        @c MMappedUUIDHashTable::replaced).
+ */
+inline bool replaced() const {
+  return mapping.replaced();
+}
+
 /**
  * @brief Return the type of the gate identified by @p token.
  * @param token  UUID of the gate.
@@ -435,6 +478,11 @@ GenericCircuit createGenericCircuit(pg_uuid_t token) const;
  * @brief Build an in-memory @c GenericCircuit reachable from any of
  *        @p roots.
  *
+ * Gates are named by their binary UUIDs (@c Circuit::getGate(const
+ * binary_uuid&)): no UUID string is built or hashed while loading, and
+ * each gate costs one lookup in @c mapping, its record and wires being
+ * read in place.
+ *
  * Multi-root variant of @c createGenericCircuit.  Seeds the BFS with
  * every UUID in @p roots so a shared subgraph reachable from more
  * than one root is represented by a single @c gate_t (the
@@ -451,6 +499,66 @@ GenericCircuit createGenericCircuit(pg_uuid_t token) const;
  */
 GenericCircuit createGenericCircuit(
     const std::vector<pg_uuid_t> &roots) const;
+
+/**
+ * @brief Raised by @c createGenericCircuitChecked on a token it cannot
+ *        tell is absent from the store.
+ */
+class StaleMiss : public std::runtime_error {
+public:
+/** @brief Construct with a fixed message. */
+StaleMiss()
+  : std::runtime_error("ProvSQL mmap: token missing from a view that may be behind") {
+}
+};
+
+/**
+ * @brief @c createGenericCircuit on a read-only circuit that may be
+ *        behind the worker, or whose mapping may have been replaced.
+ *
+ * Any gate of the circuit -- a root or a child reached at any depth --
+ * that the mapping does not hold would be loaded as an input gate, which
+ * is only right if the store does not hold it either.  Here, such a miss
+ * raises @c StaleMiss instead when @p misses_final is @c false, or when
+ * the writer has replaced the mapping (@c replaced()).
+ *
+ * @param roots         As for @c createGenericCircuit.
+ * @param misses_final  Whether everything that could hold a gate of the
+ *                      circuit had been written when the load started.
+ */
+GenericCircuit createGenericCircuitChecked(
+    const std::vector<pg_uuid_t> &roots, bool misses_final) const;
+
+/**
+ * @brief Whether loading a gate of type @p type copies its @c info1 /
+ *        @c info2 pair, zero or not.
+ */
+static bool infosAlwaysLoaded(gate_type type);
+
+/**
+ * @brief Whether loading a gate of type @p type copies its @c info1 /
+ *        @c info2 pair when either is non-zero.
+ */
+static bool infosLoadedWhenSet(gate_type type);
+
+/**
+ * @brief Whether loading a gate of type @p type copies its extra
+ *        string, empty or not.
+ */
+static bool extraLoaded(gate_type type);
+
+/**
+ * @brief Load the circuit reachable from @p roots as a flat image.
+ *
+ * The worker's side of the @c 'g' and @c 'j' requests: the same
+ * traversal as @c createGenericCircuit, into the form it is sent to the
+ * backend in (see @c FlatCircuit.h).
+ *
+ * @param roots  UUIDs whose reachable closure to load.
+ * @param out    Empty builder to load into.
+ */
+void createFlatCircuit(const std::vector<pg_uuid_t> &roots,
+                       FlatCircuitBuilder &out) const;
 };
 
 #ifdef PROVSQL_INPROCESS_STORE
@@ -11,14 +11,19 @@
  * - @c sync(): flush the backing region (@c MappedRegion::sync()).
  *
  * Internal helpers:
- * - @c grow(): double the table size and rehash.
- * - @c find(): locate the slot index for a UUID (or @c NOTHING if absent).
- * - @c set(): write a key-value pair into the table.
+ * - @c startGrowth() / @c migrate() / @c completeGrowth(): grow into a
+ *   table of twice the capacity, a few groups per insertion, and put it
+ *   in place at the next flush.
+ * - @c upgrade(): rewrite a version-1 file to the current layout.
+ * - @c rebuild(): lay out a fresh table in memory, for it.
+ * - @c find(): locate the slot of a UUID, or the empty slot it would take.
  */
 #include "MMappedUUIDHashTable.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <new>
@@ -31,6 +36,43 @@
 
 #include <sys/mman.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/**
+ * @brief Match the 16 control bytes at @p ctrl against @p h2.
+ *
+ * @param ctrl   Control bytes of a group.
+ * @param h2     Control byte of the key sought.
+ * @param empty  Output: bit @c i set iff slot @c i of the group is empty.
+ * @return       Bit @c i set iff slot @c i's control byte is @p h2.
+ */
+inline unsigned matchGroup(const uint8_t *ctrl, uint8_t h2, unsigned &empty)
+{
+#if defined(__SSE2__)
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+  empty = ~static_cast<unsigned>(_mm_movemask_epi8(c)) & 0xffff;
+  return static_cast<unsigned>(
+    _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(static_cast<char>(h2)))));
+#else
+  unsigned match = 0;
+  empty = 0;
+  for(unsigned i=0; i<16; ++i) {
+    const uint8_t b = __atomic_load_n(&ctrl[i], __ATOMIC_RELAXED);
+    if(!(b & 0x80))
+      empty |= 1u << i;
+    else if(b == h2)
+      match |= 1u << i;
+  }
+  return match;
+#endif
+}
+
+}
+
 MMappedUUIDHashTable::MMappedUUIDHashTable(const char *filename, bool read_only, uint64_t magic_value)
 {
   path_ = filename;
@@ -39,6 +81,8 @@ MMappedUUIDHashTable::MMappedUUIDHashTable(const char *filename, bool read_only,
   bool empty = (size == 0);
 
   if(empty) {
+    if(read_only)
+      throw std::runtime_error("ProvSQL mmap: cannot initialise a read-only file");
     size = table_t::sizeForLogSize(STARTING_LOG_SIZE);
     region.resizeFile(size);
   }
@@ -47,136 +91,379 @@ MMappedUUIDHashTable::MMappedUUIDHashTable(const char *filename, bool read_only,
   table = reinterpret_cast<table_t *>(region.base());
 
   if(empty) {
+    /* The groups are zero, i.e. empty, as the file was extended. */
     table->magic     = magic_value;
-    table->version   = 1;
+    table->version   = MAPPING_VERSION;
     table->elem_size = static_cast<uint16_t>(sizeof(value_t));
     table->flags     = 0;
-    table->log_size = table_t::logSizeForSize(size);
+    table->log_size = STARTING_LOG_SIZE;
     table->nb_elements = 0;
     table->next_value = 0;
-    for(unsigned long i=0; i<table->capacity(); ++i) {
-      table->t[i].value = NOTHING;
-    }
+    table->migrated = 0;
   } else {
     if(table->magic != magic_value)
       throw std::runtime_error("ProvSQL mmap: wrong file type (magic mismatch)");
-    if(table->version != 1)
+    if(table->version == 0 || table->version > MAPPING_VERSION)
       throw std::runtime_error("ProvSQL mmap: unsupported format version "
                                + std::to_string(table->version));
     if(table->elem_size != sizeof(value_t))
       throw std::runtime_error("ProvSQL mmap: element size mismatch (recompile required)");
     unclean_ = (table->flags & FLAG_DIRTY) != 0;
+    if(table->version < MAPPING_VERSION) {
+      if(read_only)
+        throw std::runtime_error("ProvSQL mmap: mapping file of version "
+                                 + std::to_string(table->version)
+                                 + " not yet upgraded by the writer");
+      upgrade();
+    }
   }
 
+  if(__atomic_load_n(&table->flags, __ATOMIC_ACQUIRE) & FLAG_GROWING) {
+    if(read_only)
+      openNext(true);
+    else {
+      /* A growth the previous writer did not finish: carry on with it,
+         unless its new table never got as far as being complete on
+         disk, in which case nothing was added to it and it starts over. */
+      try {
+        openNext(false);
+        unclean_ = unclean_ || (next->flags & FLAG_DIRTY);
+      } catch(const std::runtime_error &) {
+        next_region.close();
+        next = nullptr;
+        table->flags &= ~FLAG_GROWING;
+        startGrowth();
+      }
+    }
+  } else if(!read_only)
+    /* Debris of a growth that had not started, or of a store replaced
+       by a clean-up. */
+    unlink(nextPath().c_str());
+
   /* Mark the file open for writing; the destructor clears it.  Found still
      set on open, it says the previous writer died mid-write, which
      provsql.check_store() reports. */
-  if(!read_only)
+  if(!read_only) {
     table->flags |= FLAG_DIRTY;
+    if(next)
+      next->flags |= FLAG_DIRTY;
+  }
 }
 
-/* Rehashing rebuilds the whole table, so it cannot be done in place: a
-   process killed part-way through an in-place rehash leaves the mapping
-   of every not-yet-reinserted token gone, and each of those tokens then
-   reads back as a fresh input -- silently, since an unknown token is a
-   valid input gate.  Instead the new table is built in memory and handed
-   to MappedRegion::replaceContents, which writes it to a sibling file,
-   forces it to disk, and renames it into place: a crash at any point
-   leaves either the complete old table or the complete new one. */
-void MMappedUUIDHashTable::grow()
+void MMappedUUIDHashTable::openNext(bool read_only)
 {
-  const unsigned new_log_size = table->log_size + 1;
-  const std::size_t new_size = table_t::sizeForLogSize(new_log_size);
-  const unsigned long new_capacity = 1ul << new_log_size;
+  const std::size_t size = table_t::sizeForLogSize(table->log_size + 1);
+  if(next_region.openFile(nextPath().c_str(), read_only) != size) {
+    next_region.close();
+    throw std::runtime_error("ProvSQL mmap: growing mapping file of the wrong size");
+  }
+  next_region.map(size);
+  next = reinterpret_cast<table_t *>(next_region.base());
+  if(next->magic != table->magic || next->version != MAPPING_VERSION
+     || next->log_size != table->log_size + 1) {
+    next_region.close();
+    next = nullptr;
+    throw std::runtime_error("ProvSQL mmap: growing mapping file does not match");
+  }
+}
 
-  std::vector<char> buf(new_size);
+unsigned long MMappedUUIDHashTable::find(const table_t *t, const pg_uuid_t &u,
+                                         uint64_t h, bool &found)
+{
+  const group_t *groups = t->groups();
+  const uint8_t h2 = static_cast<uint8_t>(FULL | (h & 0x7f));
+  const unsigned long group_mask = (t->capacity() / GROUP_SIZE) - 1;
+
+  unsigned long g = (h >> 7) & group_mask;
+  for(unsigned long step = 1;; ++step) {
+    const group_t &group = groups[g];
+    unsigned empty;
+    unsigned match = matchGroup(group.ctrl, h2, empty);
+    if(match)
+      /* Pairs with the release store of the control byte in publish():
+         the key and value of a slot whose byte we matched are those the
+         writer stored before it. */
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    /* A group fills from its first slot up, so a match past the first
+       empty slot cannot be there; it is only a byte read after the rest. */
+    if(empty)
+      match &= (1u << __builtin_ctz(empty)) - 1;
+    while(match) {
+      const unsigned i = __builtin_ctz(match);
+      if(!std::memcmp(&group.slot[i].uuid, &u, sizeof(pg_uuid_t))) {
+        found = true;
+        return g * GROUP_SIZE + i;
+      }
+      match &= match - 1;
+    }
+    if(empty) {
+      found = false;
+      return g * GROUP_SIZE + __builtin_ctz(empty);
+    }
+    /* Triangular probing visits every group of a power-of-two table. */
+    g = (g + step) & group_mask;
+  }
+}
+
+template<class Entry>
+void MMappedUUIDHashTable::rebuild(std::vector<char> &buf, unsigned log_size,
+                                   Entry entry, unsigned long n) const
+{
+  buf.assign(table_t::sizeForLogSize(log_size), 0);
   table_t *nt = reinterpret_cast<table_t *>(buf.data());
   nt->magic       = table->magic;
-  nt->version     = table->version;
+  nt->version     = MAPPING_VERSION;
   nt->elem_size   = table->elem_size;
   nt->flags       = table->flags;
-  nt->log_size    = new_log_size;
+  nt->log_size    = log_size;
   nt->nb_elements = table->nb_elements;
   nt->next_value  = table->next_value;
-  for(unsigned long i=0; i<new_capacity; ++i)
-    nt->t[i].value = NOTHING;
+  nt->migrated    = 0;
 
-  for(unsigned long i=0; i<table->capacity(); ++i) {
-    if(table->t[i].value == NOTHING)
+  for(unsigned long i=0; i<n; ++i) {
+    const value_t *e = entry(i);
+    if(!e)
       continue;
-    const value_t &e = table->t[i];
-    unsigned long k =
-      (*reinterpret_cast<const unsigned long *>(&e.uuid)) % new_capacity;
-    while(nt->t[k].value != NOTHING)
-      k = (k + 1) % new_capacity;
-    nt->t[k] = e;
+    const uint64_t h = hash(e->uuid);
+    bool found;
+    const unsigned long k = find(nt, e->uuid, h, found);
+    nt->slot(k) = *e;
+    nt->ctrl(k) = static_cast<uint8_t>(FULL | (h & 0x7f));
+  }
+}
+
+/* Rehashing rebuilds the whole table, so it cannot be done in place: a
+   process killed part-way through an in-place rehash leaves the mapping
+   of every not-yet-reinserted token gone, and each of those tokens then
+   reads back as a fresh input -- silently, since an unknown token is a
+   valid input gate.  Nor can it be done in one go, as it once was, in a
+   file renamed into place: that is a pause of every gate creation, for
+   as long as it takes to rewrite gigabytes, each time the store doubles.
+
+   So the new table lives in a file of its own while the old one stays
+   in place, untouched but for its header, and entries are copied over a
+   few groups at a time.  The file is created sparse, which makes it an
+   empty table at no cost (an empty slot is a zero byte), and complete
+   before FLAG_GROWING, set last, points at it: a crash at any point
+   leaves either the old table alone, with some debris the next open
+   removes, or the old table and a new one that, together, hold every
+   entry, and from which the growth resumes. */
+void MMappedUUIDHashTable::startGrowth()
+{
+  const std::string np = nextPath();
+  const std::size_t size = table_t::sizeForLogSize(table->log_size + 1);
+  unlink(np.c_str());
+  next_region.openFile(np.c_str(), false);
+  next_region.resizeFile(size);
+  next_region.map(size);
+  next = reinterpret_cast<table_t *>(next_region.base());
+  next->magic       = table->magic;
+  next->version     = MAPPING_VERSION;
+  next->elem_size   = table->elem_size;
+  next->flags       = FLAG_DIRTY;
+  next->log_size    = table->log_size + 1;
+  next->nb_elements = table->nb_elements;
+  next->next_value  = table->next_value;
+  next->migrated    = 0;
+  next_region.flush();
+
+  table->migrated = 0;
+  __atomic_fetch_or(&table->flags, FLAG_GROWING, __ATOMIC_RELEASE);
+}
+
+/* The old table's entries stay where they are as they are copied, so
+   that a reader probing both tables finds each of them throughout; a
+   group copied by a writer that died before recording it is copied
+   again, and entries already there are skipped.  Once every group has
+   been copied, the two tables simply stay as they are, lookups probing
+   both, until the next flush (see flush()). */
+void MMappedUUIDHashTable::migrate(unsigned long n)
+{
+  const unsigned long nb_groups = table->capacity() / GROUP_SIZE;
+  unsigned long g = table->migrated;
+  const unsigned long end = std::min(nb_groups, g + n);
+
+  for(; g<end; ++g) {
+    const group_t &group = table->groups()[g];
+    for(unsigned i=0; i<GROUP_SIZE; ++i) {
+      if(!(group.ctrl[i] & FULL))
+        break;  // a group fills from its first slot up
+      const pg_uuid_t &u = group.slot[i].uuid;
+      const uint64_t h = hash(u);
+      bool found;
+      const unsigned long k = find(next, u, h, found);
+      if(!found)
+        put(next, k, u, group.slot[i].value, h);
+    }
   }
+  table->migrated = g;
+}
 
-  region.replaceContents(path_.c_str(), buf.data(), new_size);
+/* The new file must be on disk before it is renamed over the old one,
+   which readers then notice as for any replaced file.  Forcing the whole
+   of it out is the one step whose cost depends on the table's size, so
+   it is left to flush(), which forces out the store anyway: it is then
+   only the pages the kernel has not yet written back by itself, and no
+   insertion waits for it.  The old file is unmapped a slice per
+   insertion, rather than all at once when it is closed; its contents are
+   left alone, for the backends still reading through their own mappings
+   of it. */
+void MMappedUUIDHashTable::completeGrowth()
+{
+  next_region.moveFile(nextPath().c_str(), path_.c_str());
+  retired.adopt(region);
+  region.adopt(next_region);
+  table = next;
+  next = nullptr;
+}
+
+void MMappedUUIDHashTable::finishGrowth()
+{
+  if(next && !read_only_) {
+    migrate(table->capacity() / GROUP_SIZE);
+    completeGrowth();
+  }
+}
+
+/* The version-1 layout is rewritten in one go, to a file renamed into
+   place, once: its slots followed the header directly, empty ones
+   holding NOTHING.  The new table is sized for the entries to sit below
+   the load factor. */
+void MMappedUUIDHashTable::upgrade()
+{
+  constexpr std::size_t V1_HEADER_SIZE = offsetof(table_t, migrated);
+  static_assert(V1_HEADER_SIZE == 40, "version-1 slots follow a 40-byte header");
+  const value_t *old = reinterpret_cast<const value_t *>(
+    reinterpret_cast<const char *>(table) + V1_HEADER_SIZE);
+  const unsigned long n = table->capacity();
+
+  unsigned log_size = STARTING_LOG_SIZE;
+  while(table->nb_elements >= MAXIMUM_LOAD_FACTOR * (1ul << log_size))
+    ++log_size;
+
+  std::vector<char> buf;
+  rebuild(buf, log_size,
+          [old](unsigned long i) {
+            return old[i].value == NOTHING ? nullptr : &old[i];
+          }, n);
+
+  region.replaceContents(path_.c_str(), buf.data(), buf.size());
   table = reinterpret_cast<table_t *>(region.base());
 }
 
 MMappedUUIDHashTable::~MMappedUUIDHashTable()
 {
-  if(table && !read_only_)
-    table->flags &= ~FLAG_DIRTY;
+  if(!read_only_) {
+    if(table)
+      table->flags &= ~FLAG_DIRTY;
+    if(next)
+      next->flags &= ~FLAG_DIRTY;
+  }
+  retired.close();
+  next_region.close();
   region.close();
 }
 
-unsigned long MMappedUUIDHashTable::find(pg_uuid_t u) const
+bool MMappedUUIDHashTable::replaced() const
+{
+  if(region.unlinked())
+    return true;
+  if(!next)
+    return __atomic_load_n(&table->flags, __ATOMIC_ACQUIRE) & FLAG_GROWING;
+  return next_region.unlinked();
+}
+
+const MMappedUUIDHashTable::value_t *MMappedUUIDHashTable::slotAt(unsigned long k) const
 {
-  auto k = hash(u);
-  while(table->t[k].value != NOTHING &&
-        std::memcmp(&table->t[k].uuid, &u, sizeof(pg_uuid_t))) {
-    k = (k+1) % table->capacity();
+  if(next) {
+    if(k < next->capacity())
+      return full(next, k) ? &next->slot(k) : nullptr;
+    k -= next->capacity();
+    if(k / GROUP_SIZE < table->migrated)
+      return nullptr;
   }
+  return full(table, k) ? &table->slot(k) : nullptr;
+}
 
-  return k;
+void MMappedUUIDHashTable::put(table_t *t, unsigned long k, const pg_uuid_t &u,
+                               unsigned long value, uint64_t h)
+{
+  t->slot(k).uuid = u;
+  t->slot(k).value = value;
+  /* The control byte publishes the entry: it is the last write, and a
+     release store, so a reader sees an empty slot or the whole thing --
+     and, having seen it, the gate record it indexes. */
+  __atomic_store_n(&t->ctrl(k), static_cast<uint8_t>(FULL | (h & 0x7f)),
+                   __ATOMIC_RELEASE);
 }
 
-unsigned long MMappedUUIDHashTable::operator[](pg_uuid_t u) const
+unsigned long MMappedUUIDHashTable::lookup(const pg_uuid_t &u, uint64_t h) const
 {
-  auto k = find(u);
+  bool found;
+  unsigned long k;
+  if(next) {
+    k = find(next, u, h, found);
+    if(found)
+      return next->slot(k).value;
+  }
+  k = find(table, u, h, found);
+  return found ? table->slot(k).value : NOTHING;
+}
 
-  return table->t[k].value;
+unsigned long MMappedUUIDHashTable::operator[](pg_uuid_t u) const
+{
+  return lookup(u, hash(u));
 }
 
 std::pair<unsigned long,bool> MMappedUUIDHashTable::add(pg_uuid_t u)
 {
-  auto k = find(u);
-  if(table->t[k].value != NOTHING)
-    return std::make_pair(table->t[k].value, false);
-  return publish(u, table->next_value);
+  auto v = lookup(u, hash(u));
+  if(v != NOTHING)
+    return std::make_pair(v, false);
+  return publish(u, current()->next_value);
 }
 
 std::pair<unsigned long,bool> MMappedUUIDHashTable::publish(pg_uuid_t u,
                                                             unsigned long value)
 {
-  auto k = find(u);
-
-  if(table->t[k].value != NOTHING)
-    return std::make_pair(table->t[k].value, false);
+  const uint64_t h = hash(u);
+  auto v = lookup(u, h);
+  if(v != NOTHING)
+    return std::make_pair(v, false);
 
-  if(table->nb_elements >= MAXIMUM_LOAD_FACTOR * table->capacity())
-    grow();
-  k = find(u);
+  if(next && migrated()
+     && next->nb_elements >= MAXIMUM_LOAD_FACTOR * next->capacity())
+    /* No flush has come round since the last growth was copied, and the
+       new table is due to grow in turn: it cannot wait any longer. */
+    completeGrowth();
+  if(!next && table->nb_elements >= MAXIMUM_LOAD_FACTOR * table->capacity())
+    startGrowth();
+  if(next)
+    migrate(MIGRATED_PER_INSERT);
+  else if(retired.base())
+    retired.release(RELEASED_PER_INSERT);
 
-  ++table->nb_elements;
-  table->t[k].uuid = u;
-  if(value + 1 > table->next_value)
-    table->next_value = value + 1;
-  /* The value store publishes the entry: it is the last write, and an
-     aligned 8-byte store, so a reader sees NOTHING or the whole thing. */
-  table->t[k].value = value;
+  table_t *t = current();
+  bool found;
+  auto k = find(t, u, h, found);
+  ++t->nb_elements;
+  if(value + 1 > t->next_value)
+    t->next_value = value + 1;
+  put(t, k, u, value, h);
   return std::make_pair(value, true);
 }
 
 void MMappedUUIDHashTable::sync()
 {
   region.sync();
+  next_region.sync();
 }
 
 void MMappedUUIDHashTable::flush()
 {
   region.flush();
+  if(next && !read_only_ && migrated())
+    completeGrowth();
+  else
+    next_region.flush();
 }
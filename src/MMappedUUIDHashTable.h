@@ -10,24 +10,50 @@
  *
  * Design constraints:
  * - **Append-only**: elements can be added but never removed.
- * - **Open addressing**: collisions are resolved by linear probing.
- * - **Trivial hash**: the first 8 bytes of the UUID are reinterpreted as
- *   a 64-bit integer and taken modulo the table capacity.  UUIDs are
- *   generated uniformly at random (version 4), so this is effectively
- *   uniform.
- * - **Automatic growth**: when the load factor exceeds @c MAXIMUM_LOAD_FACTOR
- *   the table is doubled in size and rehashed.
+ * - **Swiss-table layout**: slots come in groups of 16, headed by one
+ *   control byte per slot.  A full slot's control byte has its top bit
+ *   set and holds 7 bits of its key's hash, an empty one is zero, so one
+ *   16-byte comparison (SSE2 where available) tells which slots of a
+ *   group may hold the key and whether the group has room; only those
+ *   few slots are compared in full.  Collisions move on to the next
+ *   group by triangular probing.  An all-zero file is an empty table,
+ *   so a new one is not initialised beyond its header.
+ * - **Full-UUID hashing**: all 16 bytes are mixed, since a UUID's
+ *   version and variant bits are fixed and a version-5 UUID's other bits
+ *   are only as good as the hash it came from.
+ * - **Incremental growth**: when the load factor exceeds
+ *   @c MAXIMUM_LOAD_FACTOR, a table of twice the capacity is created
+ *   next to this one, in a file of the same name suffixed @c ".next".
+ *   New entries go there, and every insertion also moves the entries of
+ *   @c MIGRATED_PER_INSERT groups of the old table into it; lookups
+ *   probe both.  Once the last group has moved, the next flush of the
+ *   store forces the new file to disk and renames it over the old one.
+ *   No insertion ever rehashes, or forces out, the whole table, so the
+ *   cost of one does not grow with the store.
  *
- * Access to the table from multiple processes is serialised via the
- * ProvSQL LWLock in @c provsqlSharedState.
+ * The mmap worker is the only process that writes the table.  Backends
+ * may map it read-only and look keys up concurrently with the writer:
+ * an entry becomes visible through a release store of its control byte
+ * (see @c publish), entries are never removed from the old table while
+ * they are copied to the new one, and the end of a growth replaces the
+ * file rather than rewriting it, so a reader's mapping is never modified
+ * in a way it could observe half done -- it can only go stale, which
+ * @c replaced() detects.
+ *
+ * Version 1 of the file was a plain array of slots, linear-probed from
+ * the first 8 bytes of the UUID at a load factor of at most 1/2.  The
+ * writer rewrites such a file to the current version when it opens it
+ * (see @c MAPPING_VERSION); a read-only open refuses it until then.
  */
 #ifndef MMAPPED_UUID_HASH_TABLE_H
 #define MMAPPED_UUID_HASH_TABLE_H
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "MappedRegion.h"
 
@@ -43,13 +69,26 @@ class MMappedUUIDHashTable
 /** @brief One slot in the hash table: a UUID key and its associated integer value. */
 struct value_t {
   pg_uuid_t uuid;       ///< Key
-  unsigned long value;  ///< Associated integer (gate index), or 0 if slot is empty
+  unsigned long value;  ///< Associated integer (gate index); meaningful only if the slot is full
 };
 
 /**
- * @brief On-disk layout of the hash table stored in the mmap file.
+ * @brief A group of slots, with the control bytes that describe them.
  *
- * The header fields are followed by a flexible array of @c value_t slots.
+ * Keeping the two together means a lookup touches one page rather than
+ * two, whatever the table's size.
+ */
+struct group_t {
+  uint8_t ctrl[16];     ///< Control bytes (see @c FULL)
+  value_t slot[16];     ///< Slots
+};
+
+/**
+ * @brief On-disk header of the hash table stored in the mmap file.
+ *
+ * The header is followed, at @c GROUPS_OFFSET, by the @c capacity()/16
+ * groups of slots.  Its fields up to @c next_value are those of
+ * version 1, whose slots started right after them.
  */
 struct table_t {
   /**
@@ -58,78 +97,215 @@ struct table_t {
    * @return    Required file size in bytes.
    */
   static constexpr std::size_t sizeForLogSize(unsigned ls) {
-    return offsetof(table_t, t) + (1 << ls)*sizeof(value_t);
-  }
-  /**
-   * @brief Compute the log2 of the slot count from the file size.
-   * @param size  File size in bytes.
-   * @return      Log2 of the number of slots that fit in @p size.
-   */
-  static constexpr unsigned logSizeForSize(std::size_t size) {
-    size -= offsetof(table_t, t);
-    size /= sizeof(value_t);
-    size >>= 1;
-    unsigned log_size=0;
-    while(size) {
-      size >>= 1;
-      ++log_size;
-    }
-    return log_size;
+    return GROUPS_OFFSET + ((std::size_t{1} << ls) / GROUP_SIZE)*sizeof(group_t);
   }
   /**
    * @brief Maximum number of slots in the table (@c 2^log_size).
    * @return Current capacity (number of available hash-table slots).
    */
-  constexpr unsigned long capacity() {
-    return 1u << log_size;
+  constexpr unsigned long capacity() const {
+    return 1ul << log_size;
+  }
+  /** @brief The groups of slots. */
+  group_t *groups() {
+    return reinterpret_cast<group_t *>(reinterpret_cast<char *>(this) + GROUPS_OFFSET);
+  }
+  /** @copydoc groups() */
+  const group_t *groups() const {
+    return reinterpret_cast<const group_t *>(reinterpret_cast<const char *>(this) + GROUPS_OFFSET);
+  }
+  /** @brief Control byte of slot @p k. */
+  uint8_t &ctrl(unsigned long k) {
+    return groups()[k / GROUP_SIZE].ctrl[k % GROUP_SIZE];
+  }
+  /** @copydoc ctrl(unsigned long) */
+  const uint8_t &ctrl(unsigned long k) const {
+    return groups()[k / GROUP_SIZE].ctrl[k % GROUP_SIZE];
+  }
+  /** @brief Slot @p k. */
+  value_t &slot(unsigned long k) {
+    return groups()[k / GROUP_SIZE].slot[k % GROUP_SIZE];
+  }
+  /** @copydoc slot(unsigned long) */
+  const value_t &slot(unsigned long k) const {
+    return groups()[k / GROUP_SIZE].slot[k % GROUP_SIZE];
   }
 
   uint64_t magic;      ///< File-type identifier
-  uint16_t version;    ///< Format version (currently 1)
+  uint16_t version;    ///< Format version (see @c MAPPING_VERSION)
   uint16_t elem_size;  ///< sizeof(value_t) at write time
-  uint32_t flags;      ///< Bit 0: opened for writing and not closed since
+  uint32_t flags;      ///< @c FLAG_DIRTY, @c FLAG_GROWING
   unsigned log_size;          ///< log2 of the number of slots
   unsigned long nb_elements;  ///< Current number of stored key-value pairs
   unsigned long next_value;   ///< Next integer value to assign to a new UUID
-  value_t t[];                ///< Flexible array of hash-table slots
+  unsigned long migrated;     ///< While growing: groups already copied to the next table
 };
 
 MappedRegion region;  ///< Backing storage (shared mmap, or heap buffer)
 table_t *table;       ///< Typed view of @c region.base()
-std::string path_;    ///< Backing file, for the atomic rehash in @c grow()
+MappedRegion next_region;///< The table being grown into, while @c FLAG_GROWING
+table_t *next = nullptr;///< Typed view of @c next_region.base(), or @c nullptr
+MappedRegion retired; ///< The table a growth replaced, until given back
+std::string path_;    ///< Backing file, for the renames that end a growth
 bool read_only_ = false;///< Mapped read-only: the header must not be written
 bool unclean_ = false;///< The previous run left the dirty bit set
 
+/** @brief Offset of the first group in the file, past the header. */
+static constexpr std::size_t GROUPS_OFFSET=64;
+/** @brief Number of slots whose control bytes are matched at once. */
+static constexpr unsigned GROUP_SIZE=16;
+/** @brief Bit set in the control byte of a full slot, next to 7 bits of
+ *  hash.  An empty slot's control byte is zero. */
+static constexpr uint8_t FULL=0x80;
 /** @brief Initial log2 capacity (65 536 slots). */
 static constexpr unsigned STARTING_LOG_SIZE=16;
-/** @brief Rehash when this fraction of slots is occupied. */
-static constexpr double MAXIMUM_LOAD_FACTOR=.5;
+/** @brief Grow when this fraction of slots is occupied.  With 16-slot
+ *  groups an unsuccessful lookup still stops within a group or two. */
+static constexpr double MAXIMUM_LOAD_FACTOR=.875;
+/**
+ * @brief Number of groups of the old table moved to the new one by each
+ *        insertion during a growth.
+ *
+ * Growth starts with the old table's @c capacity()/16 groups to move;
+ * at 2 per insertion they have all moved after @c capacity()/32
+ * insertions, long before the new table, holding at most
+ * @c (7/8+1/32)×capacity() entries out of @c 2×capacity() slots, needs
+ * to grow in turn.
+ */
+static constexpr unsigned long MIGRATED_PER_INSERT=2;
+/**
+ * @brief Bytes of the table a growth replaced unmapped by each
+ *        insertion after it (see @c MappedRegion::release()).
+ *
+ * Unmapping the old file in one go, when it is closed, is a pause as
+ * long as the table is large.
+ */
+static constexpr std::size_t RELEASED_PER_INSERT=64 << 10;
+/** @brief Suffix of the file a growing table is moved into. */
+static constexpr const char *NEXT_SUFFIX=".next";
+
+static_assert(sizeof(table_t) <= GROUPS_OFFSET, "header overlaps the groups");
 
 /**
- * @brief Compute the starting slot index for UUID @p u.
+ * @brief Hash all 16 bytes of @p u.
  *
- * Reinterprets the first 8 bytes of @p u as a 64-bit integer and takes
- * it modulo the current capacity.
+ * The two halves, each offset by a constant so that a zero half does
+ * not absorb the other, are multiplied into a 128-bit product whose
+ * halves are folded together (the "mum" step of wyhash): one
+ * multiplication, every output bit depending on every input bit.  The
+ * low 7 bits become the control byte, the others choose the first group
+ * to probe.
  * @param u  UUID to hash.
- * @return   Slot index in [0, capacity).
+ * @return   64-bit hash.
  */
-inline unsigned long hash(pg_uuid_t u) const {
-  return *reinterpret_cast<unsigned long*>(&u) % (1 << table->log_size);
-};
+static inline uint64_t hash(const pg_uuid_t &u) {
+  uint64_t lo, hi;
+  std::memcpy(&lo, u.data, sizeof lo);
+  std::memcpy(&hi, u.data + sizeof lo, sizeof hi);
+  const unsigned __int128 m =
+    static_cast<unsigned __int128>(lo ^ 0xa0761d6478bd642fULL)
+    * (hi ^ 0xe7037ed1a0b428dbULL);
+  return static_cast<uint64_t>(m) ^ static_cast<uint64_t>(m >> 64);
+}
+
+/**
+ * @brief Find the slot holding @p u in @p t, or the empty slot where it
+ *        would be inserted.
+ *
+ * A full slot is recognised by its control byte, read with acquire
+ * semantics (see @c publish); the empty slot returned is the first of
+ * the probe sequence, which is where @c publish puts @p u.
+ * @param t      Table to search.
+ * @param u      UUID to look up.
+ * @param h      @c hash(u).
+ * @param found  Output: whether @p u is in @p t.
+ * @return       Slot index: @p u's, or the empty slot for it.
+ */
+static unsigned long find(const table_t *t, const pg_uuid_t &u, uint64_t h,
+                          bool &found);
+
+/** @brief Whether slot @p k of @p t is full, read with acquire semantics. */
+static inline bool full(const table_t *t, unsigned long k) {
+  return __atomic_load_n(&t->ctrl(k), __ATOMIC_ACQUIRE) & FULL;
+}
+
+/**
+ * @brief Store @p u and @p value in the empty slot @p k of @p t, the
+ *        control byte last (see @c publish).
+ */
+static void put(table_t *t, unsigned long k, const pg_uuid_t &u,
+                unsigned long value, uint64_t h);
+
+/** @brief The value of @p u, in the table being grown into and then in
+ *  this one, or @c NOTHING. */
+unsigned long lookup(const pg_uuid_t &u, uint64_t h) const;
+
+/** @brief The table new entries go to: @c next while growing. */
+inline table_t *current() const {
+  return next ? next : table;
+}
+
+/** @brief The slot that index @p k of @c slotValue() names, or
+ *  @c nullptr if it is empty. */
+const value_t *slotAt(unsigned long k) const;
+
+/** @brief Map the @c ".next" file of a growing table, checking that it
+ *  is the one this table grows into; throws if it is not there. */
+void openNext(bool read_only);
 
 /**
- * @brief Find the slot index of @p u, or @c NOTHING if absent.
- * @param u  UUID to look up.
- * @return   Slot index, or @c NOTHING if @p u is not in the table.
+ * @brief Build, in @p buf, a table of @c 2^log_size slots holding the
+ *        entries @p entry returns.
+ *
+ * @param buf       Output: the file contents.
+ * @param log_size  log2 of the new capacity.
+ * @param entry     @c entry(i) is the @c i-th entry to copy, or
+ *                  @c nullptr if there is none.
+ * @param n         Range of @c i.
  */
-unsigned long find(pg_uuid_t u) const;
-/** @brief Double the table capacity and rehash all existing entries. */
-void grow();
+template<class Entry>
+void rebuild(std::vector<char> &buf, unsigned log_size, Entry entry,
+             unsigned long n) const;
+
+/** @brief Create the table of twice the capacity to grow into, and mark
+ *  this one as growing. */
+void startGrowth();
+
+/** @brief Move the entries of up to @p n more groups into the next table. */
+void migrate(unsigned long n);
+
+/** @brief Whether every group has been moved into the next table. */
+inline bool migrated() const {
+  return table->migrated >= table->capacity() / GROUP_SIZE;
+}
+
+/** @brief Force the next table, every group moved into it, to disk and
+ *  put it in this one's place. */
+void completeGrowth();
+
+/** @brief Rewrite a version-1 file to the current layout. */
+void upgrade();
+
+/** @brief Path of the @c ".next" file. */
+inline std::string nextPath() const {
+  return path_ + NEXT_SUFFIX;
+}
 
 public:
 /** @brief Sentinel returned by @c operator[]() when the UUID is not present. */
 static constexpr unsigned long NOTHING=static_cast<unsigned long>(-1);
 
+/**
+ * @brief Format version of the mapping file this build writes.
+ *
+ * Version 1 was the linear-probed layout described at the top of this
+ * file.  It is still accepted by a writable open, which rehashes it into
+ * the current layout (one pass over the table, done once, by the worker
+ * on its first start after the upgrade); a read-only open throws, and a
+ * backend then asks the worker, as for any store it cannot read.
+ */
+static constexpr uint16_t MAPPING_VERSION = 2;
+
 /**
  * @brief Open (or create) the mmap-backed hash table.
  *
@@ -185,9 +361,10 @@ std::pair<unsigned long,bool> add(pg_uuid_t u);
  * points at it becomes visible, so that a process killed between the two
  * leaves an unreferenced record rather than a mapping entry pointing past
  * the end of the record vector -- which would shift every later gate for
- * the rest of the store's life.  The slot's @c value field is written
- * last, and an aligned 8-byte store is atomic on the supported platforms,
- * so a reader sees either @c NOTHING or the complete entry.
+ * the rest of the store's life.  The slot's control byte is written
+ * last, with a release store, so a reader -- in this process or one
+ * mapping the file read-only -- sees either @c NOTHING or the complete
+ * entry, together with the record it indexes.
  *
  * @param u      UUID to insert.
  * @param value  Value to associate with it.
@@ -196,27 +373,61 @@ std::pair<unsigned long,bool> add(pg_uuid_t u);
  */
 std::pair<unsigned long,bool> publish(pg_uuid_t u, unsigned long value);
 
+/**
+ * @brief Bit of @c table_t::flags set while a table of twice the
+ *        capacity is being filled from this one.
+ *
+ * That table is in the @c ".next" file; it holds the entries added
+ * since, and @c table_t::migrated says how far the copy has got.  A
+ * writer that finds the bit set on open resumes the growth; a reader
+ * maps both files.
+ */
+static constexpr uint32_t FLAG_GROWING = 2u;
+
+/**
+ * @brief Whether the writer has replaced the backing file since this
+ *        table mapped it, or started a growth this table does not see.
+ *
+ * Only meaningful on a read-only table.  The end of a growth renames the
+ * new file over the old one, and this table keeps reading the old
+ * inodes, whose entries are all still valid but which may not receive
+ * new ones; the start of one sends new entries to a file this table may
+ * not have mapped.  A reader that misses a key consults this before
+ * believing it.
+ */
+bool replaced() const;
+
 /** @brief The value the next @c add would assign.  Kept equal to the
  *  number of gate records by @c MMappedCircuit. */
 inline unsigned long nextValue() const {
-  return table->next_value;
+  return current()->next_value;
 }
 
-/** @brief The number of slots the table currently has. */
+/**
+ * @brief The number of slots, for iterating over them with
+ *        @c slotValue() and @c slotKey().
+ *
+ * While the table grows, the slots of the new table come first, then
+ * those of the old; the old table's slots already copied read as empty,
+ * so that every entry is seen once.
+ */
 inline unsigned long capacity() const {
-  return table->capacity();
+  return next ? next->capacity() + table->capacity() : table->capacity();
 }
 
 /** @brief The @p k-th slot's value, or @c NOTHING when the slot is empty.
- *  For consistency checks and for the clean-up's mark phase. */
+ *  For consistency checks and for the clean-up's mark phase, in the
+ *  writer. */
 inline unsigned long slotValue(unsigned long k) const {
-  return table->t[k].value;
+  const value_t *v = slotAt(k);
+  return v ? v->value : NOTHING;
 }
 
 /** @brief The @p k-th slot's key; only meaningful when @c slotValue(k)
  *  is not @c NOTHING. */
 inline pg_uuid_t slotKey(unsigned long k) const {
-  return table->t[k].uuid;
+  const value_t *v = slotAt(k);
+  return v ? v->uuid : pg_uuid_t{};
 }
 
 /**
@@ -224,16 +435,25 @@ inline pg_uuid_t slotKey(unsigned long k) const {
  * @return Element count.
  */
 inline unsigned long nbElements() const {
-  return table->nb_elements;
+  return current()->nb_elements;
 }
 
 /**
- * @brief Flush the backing region to its file (@c MappedRegion::sync()).
+ * @brief Finish a growth in progress at once, so that the table lives in
+ *        its file alone.
+ *
+ * For a table about to be renamed into place by its caller (the
+ * clean-up's rebuilt store), whose @c ".next" file would be left behind.
+ */
+void finishGrowth();
+
+/**
+ * @brief Flush the backing regions to their files (@c MappedRegion::sync()).
  */
 void sync();
 
-/** @brief Force the backing file to stable storage
- *  (@c MappedRegion::flush()). */
+/** @brief Force the backing files to stable storage
+ *  (@c MappedRegion::flush()), and end a growth whose copy is done. */
 void flush();
 };
 
@@ -52,8 +52,10 @@ struct data_t {
   T d[];                      ///< Flexible array of elements
 };
 
-MappedRegion region;  ///< Backing storage (shared mmap, or heap buffer)
-data_t *data;         ///< Typed view of @c region.base()
+/* Mutable so that a read-only view can follow the writer's growth from
+   the const accessor; see @c follow(). */
+mutable MappedRegion region;  ///< Backing storage (shared mmap, or heap buffer)
+mutable data_t *data;         ///< Typed view of @c region.base()
 bool read_only_ = false;///< Mapped read-only: the header must not be written
 bool unclean_ = false;///< The previous run left the dirty bit set
 
@@ -62,6 +64,13 @@ static constexpr unsigned STARTING_CAPACITY=(1u << 16);
 
 /** @brief Double the backing region and refresh @c data. */
 void grow();
+/**
+ * @brief Extend a read-only mapping so that it covers element @p k.
+ *
+ * Another process (the writer) may have grown the file since this
+ * process mapped it.  Throws if the file does not reach @p k either.
+ */
+void follow(unsigned long k) const;
 /**
  * @brief Unused overload kept for interface compatibility.
  * @param u  Ignored UUID parameter.
@@ -92,6 +101,12 @@ MMappedVector(const char *filename, bool read_only, uint64_t magic,
 
 /**
  * @brief Read-only element access by index.
+ *
+ * On a vector opened read-only, an index beyond the current mapping
+ * remaps onto the file's current size first (the writer grows the file
+ * under the reader's feet), and one beyond the file throws
+ * @c std::out_of_range rather than reading past it.
+ *
  * @param k  Zero-based element index.
  * @return   Const reference to element @p k.
  */
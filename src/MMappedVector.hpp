@@ -10,13 +10,15 @@
  * Implemented methods:
  * - @c MMappedVector(): open/create the backing file and map it.
  * - @c ~MMappedVector(): sync and unmap.
- * - @c operator[](k) const: read element @p k.
+ * - @c operator[](k) const: read element @p k (following the writer's
+ *   growth on a read-only vector).
  * - @c operator[](k): write element @p k.
  * - @c add(): append one element, growing the file if necessary.
  * - @c sync(): flush the backing region (@c MappedRegion::sync()).
  *
  * Internal helpers:
  * - @c grow(): double the capacity and remap the backing region.
+ * - @c follow(): extend a read-only mapping to the file's current size.
  */
 #ifndef MMAPPED_VECTOR_HPP
 #define MMAPPED_VECTOR_HPP
@@ -46,6 +48,8 @@ MMappedVector<T>::MMappedVector(const char *filename, bool read_only,
   bool empty = (length == 0);
 
   if(empty) {
+    if(read_only)
+      throw std::runtime_error("ProvSQL mmap: cannot initialise a read-only file");
     length = offsetof(data_t, d) + sizeof(T) * STARTING_CAPACITY;
     region.resizeFile(length);
   }
@@ -95,9 +99,20 @@ MMappedVector<T>::~MMappedVector()
   region.close();
 }
 
+template <typename T>
+void MMappedVector<T>::follow(unsigned long k) const
+{
+  region.refresh();
+  data = reinterpret_cast<data_t *>(region.base());
+  if(offsetof(data_t, d) + sizeof(T) * (k + 1) > region.length())
+    throw std::out_of_range("ProvSQL mmap: index beyond the end of the file");
+}
+
 template <typename T>
 inline const T &MMappedVector<T>::operator[](unsigned long k) const
 {
+  if(read_only_ && offsetof(data_t, d) + sizeof(T) * (k + 1) > region.length())
+    follow(k);
   return data->d[k];
 }
 
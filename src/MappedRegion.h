@@ -23,6 +23,7 @@
 #ifndef MAPPED_REGION_H
 #define MAPPED_REGION_H
 
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
 #include <cstdlib>
@@ -31,6 +32,7 @@
 #include <string>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "provsql_config.h"
@@ -63,6 +65,7 @@ int fd_ = -1;            ///< Backing file descriptor
 void *base_ = nullptr;   ///< Base of the mapped region / heap buffer
 std::size_t length_ = 0; ///< Current region length in bytes
 bool read_only_ = false; ///< Opened read-only (no write-back)
+std::size_t released_ = 0;///< Bytes already given back by @c release()
 
 public:
 MappedRegion() = default;
@@ -70,12 +73,13 @@ MappedRegion(const MappedRegion &) = delete;
 MappedRegion &operator=(const MappedRegion &) = delete;
 
 /**
- * @brief Open (creating if absent) the backing file.
+ * @brief Open (creating if absent, unless read-only) the backing file.
  * @return The file's current size in bytes (0 if newly created).
  */
 std::size_t openFile(const char *filename, bool read_only) {
   read_only_ = read_only;
-  fd_ = open(filename, O_CREAT | (read_only ? O_RDONLY : O_RDWR), 0600); // flawfinder: ignore
+  fd_ = read_only ? open(filename, O_RDONLY) // flawfinder: ignore
+                  : open(filename, O_CREAT | O_RDWR, 0600); // flawfinder: ignore
   if(fd_ == -1)
     throw std::runtime_error(strerror(errno));
   auto size = lseek(fd_, 0, SEEK_END);
@@ -144,6 +148,57 @@ void remap(std::size_t new_length) {
   length_ = new_length;
 }
 
+/**
+ * @brief Extend a read-only region to the backing file's current size.
+ *
+ * A reader's view of a file that another process keeps growing: the
+ * writer's @c remap() extends the file, the reader's mapping does not
+ * follow.  Never shrinks the region, never touches the file.
+ * @return @c true if the region grew.
+ */
+bool refresh() {
+  if(!read_only_)
+    return false;
+  auto size = lseek(fd_, 0, SEEK_END);
+  if(size < 0)
+    throw std::runtime_error(strerror(errno));
+  std::size_t new_length = static_cast<std::size_t>(size);
+  if(new_length <= length_)
+    return false;
+#ifdef PROVSQL_INPROCESS_STORE
+  void *p = realloc(base_, new_length);
+  if(!p)
+    throw std::runtime_error("ProvSQL: out of memory growing region");
+  base_ = p;
+  ssize_t r = pread(fd_, base_, new_length, 0); // flawfinder: ignore
+  if(r < 0)
+    throw std::runtime_error(strerror(errno));
+#else
+  void *p = ::mmap(nullptr, new_length, PROT_READ, MAP_SHARED, fd_, 0);
+  if(p == MAP_FAILED)
+    throw std::runtime_error(strerror(errno));
+  ::munmap(base_, length_);
+  base_ = p;
+#endif
+  length_ = new_length;
+  return true;
+}
+
+/**
+ * @brief Whether the backing file has been unlinked or renamed over
+ *        since it was opened.
+ *
+ * How a reader notices that the writer's @c replaceContents() has put a
+ * new file in place of the one it maps: the open descriptor keeps the old
+ * inode alive, with no link left to it.
+ */
+bool unlinked() const {
+  struct stat st;
+  if(fd_ == -1 || fstat(fd_, &st))
+    return true;
+  return st.st_nlink == 0;
+}
+
 /**
  * @brief Force the backing file's contents to stable storage.
  *
@@ -233,6 +288,92 @@ void replaceContents(const char *path, const void *data, std::size_t length) {
 #endif
 }
 
+/**
+ * @brief Rename the backing file from @p from to @p to, once its
+ *        contents are on stable storage.
+ *
+ * How a file built up alongside another, while both were live, takes
+ * the other's place: whoever opens @p to afterwards gets this file,
+ * complete; a crash before the rename leaves both as they were.  The
+ * region stays mapped, on what is now @p to.
+ */
+void moveFile(const char *from, const char *to) {
+  if(read_only_)
+    throw std::runtime_error("ProvSQL mmap: cannot move a read-only region");
+  flush();
+  if(::rename(from, to))
+    throw std::runtime_error(strerror(errno));
+#ifndef PROVSQL_INPROCESS_STORE
+  syncDirectoryOf(to);
+#endif
+}
+
+/**
+ * @brief Release this region, without writing it back, and take over
+ *        @p other's file and mapping.
+ *
+ * For a region whose file @p other's has just been moved over (see
+ * @c moveFile): there is nothing left worth writing to it.  @p other is
+ * left closed.
+ */
+void adopt(MappedRegion &other) {
+  if(base_) {
+#ifdef PROVSQL_INPROCESS_STORE
+    free(base_);
+#else
+    ::munmap(base_, length_);
+#endif
+  }
+  if(fd_ != -1)
+    ::close(fd_);
+  fd_ = other.fd_;
+  base_ = other.base_;
+  length_ = other.length_;
+  read_only_ = other.read_only_;
+  released_ = other.released_;
+  other.fd_ = -1;
+  other.base_ = nullptr;
+  other.length_ = 0;
+  other.released_ = 0;
+}
+
+/**
+ * @brief Unmap the next @p bytes of a region whose file has been
+ *        replaced.
+ *
+ * Unmapping a large region tears down all its page-table entries at
+ * once, which takes time in proportion to its size; this unmaps it a
+ * slice at a time instead, from the start.  Only this process's mapping
+ * is affected: the file itself is left untouched, since other processes
+ * may still map it and read from it until they notice it was replaced,
+ * and its storage is given back when the last of them closes it.
+ * Nothing is written back.
+ * @return @c true once the whole region has been released, and closed.
+ */
+bool release(std::size_t bytes) {
+  if(!base_)
+    return true;
+#ifndef PROVSQL_INPROCESS_STORE
+  bytes = std::min(bytes, length_ - released_);
+  ::munmap(static_cast<char *>(base_) + released_, bytes);
+  released_ += bytes;
+  if(released_ < length_)
+    return false;
+  base_ = nullptr;
+#else
+  (void) bytes;
+  free(base_);
+  base_ = nullptr;
+#endif
+  length_ = 0;
+  released_ = 0;
+  if(fd_ != -1) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  return true;
+}
+
 /** @brief Flush the region to the backing file (no-op when read-only). */
 void sync() {
   if(read_only_ || !base_)
@@ -256,6 +397,7 @@ void close() {
 #endif
     base_ = nullptr;
   }
+  released_ = 0;
   if(fd_ != -1) {
     ::close(fd_);
     fd_ = -1;
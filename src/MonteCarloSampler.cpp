@@ -3,6 +3,8 @@
  * @brief Implementation of the RV-aware Monte Carlo sampler.
  */
 #include "MonteCarloSampler.h"
+#include "BitParallelSampler.h"
+#include "ParallelSampler.h"
 #include "Aggregation.h"
 #include "RandomVariable.h"
 #include "distributions/Distribution.h"  // makeDistribution -> per-family sample()
@@ -676,6 +678,11 @@ double Sampler::evalWeight(gate_t g)
 
 double monteCarloRV(const GenericCircuit &gc, gate_t root, unsigned samples)
 {
+  // A Boolean circuit is sampled on provsql.sampler_threads threads; the
+  // RV-aware Sampler may reach the syscache, so it stays on this one.
+  if(auto bits = BitParallelSampler::fromGeneric(gc, root))
+    return bits->monteCarlo(samples, samplingKey());
+
   std::mt19937_64 rng = seedRng();
   Sampler sampler(gc, rng);
 
@@ -711,6 +718,14 @@ double monteCarloRVStopping(const GenericCircuit &gc, gate_t root,
   const double Y  = 4.0 * (e - 2.0) * std::log(2.0 / delta) / (eps * eps);
   const double Y1 = 1.0 + (1.0 + eps) * Y;
 
+  if(auto bits = BitParallelSampler::fromGeneric(gc, root)) {
+    // A success count reaches Y1 exactly when it reaches ceil(Y1).
+    const double mean = bits->stoppingRule(
+      static_cast<unsigned long>(std::ceil(Y1)), max_samples, samplingKey(),
+      samples_used, reached_target);
+    return reached_target ? Y1 / static_cast<double>(samples_used) : mean;
+  }
+
   std::mt19937_64 rng = seedRng();
   Sampler sampler(gc, rng);
 
@@ -71,6 +71,9 @@ std::mt19937_64 seedRng();
  * @param samples  Number of independent worlds to sample.
  * @return         Estimated probability that @p root is true.
  *
+ * A circuit with only Boolean gates below @p root is sampled 64 worlds at a
+ * time by @c BitParallelSampler instead.
+ *
  * @throws CircuitException on malformed circuits (unknown gate kind in
  *         a Boolean position, malformed @c extra, unknown comparison
  *         operator, etc.).
@@ -90,6 +93,8 @@ double monteCarloRV(const GenericCircuit &gc, gate_t root, unsigned samples);
  * @c Y1/N: a relative @c (eps,delta) approximation of @c Pr[root].  The sample
  * count @c N adapts to the true @c Pr[root] (expected @c Y1/Pr[root]), so the
  * cost is polynomial precisely when @c Pr[root] is at least @c 1/poly.
+ * As in @c monteCarloRV, a purely Boolean circuit goes through
+ * @c BitParallelSampler, which counts worlds exactly as this loop does.
  *
  * Sampling stops early at @p max_samples worlds; @p reached_target is then
  * @c false and the return is the plain unbiased @c success/N mean over the
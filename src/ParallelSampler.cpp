@@ -0,0 +1,182 @@
+/**
+ * @file ParallelSampler.cpp
+ * @brief Implementation of the block-parallel sampling driver.
+ */
+#include "ParallelSampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <pthread.h>
+#include <signal.h>
+
+#ifdef TDKC
+constexpr bool provsql_interrupted = false;
+constexpr int provsql_monte_carlo_seed = -1;
+constexpr int provsql_sampler_threads = 1;
+#else
+extern "C" {
+#include "provsql_utils.h"
+}
+#endif
+
+namespace provsql {
+
+namespace {
+
+/** @brief splitmix64's finaliser: a bijective 64-bit mix. */
+uint64_t mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+}  // namespace
+
+uint64_t samplingKey()
+{
+  if(provsql_monte_carlo_seed != -1)
+    return static_cast<uint64_t>(provsql_monte_carlo_seed);
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+std::mt19937_64 streamRng(uint64_t key, uint64_t stream)
+{
+  return std::mt19937_64(mix(mix(key) + (stream + 1) * 0x9e3779b97f4a7c15ULL));
+}
+
+unsigned samplerThreads()
+{
+  return provsql_sampler_threads > 1 ? static_cast<unsigned>(provsql_sampler_threads) : 1;
+}
+
+bool forEachBlock(unsigned long nblocks,
+                  const std::function<void(unsigned long, unsigned)> &body)
+{
+  std::atomic<unsigned long> next{0};
+  std::atomic<bool> stop{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto fail = [&]() {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if(!error)
+      error = std::current_exception();
+    stop = true;
+  };
+
+  auto work = [&](unsigned t) {
+    try {
+      while(!stop.load(std::memory_order_relaxed)) {
+        const unsigned long b = next.fetch_add(1, std::memory_order_relaxed);
+        if(b >= nblocks)
+          return;
+        body(b, t);
+      }
+    } catch(...) {
+      fail();
+    }
+  };
+
+  // Helpers inherit the signal mask of the thread that creates them: block
+  // everything while they start, so that signals meant for the backend
+  // (SIGINT for a cancel, SIGTERM, SIGUSR1 for latches) are never handled on
+  // a thread PostgreSQL does not know about.
+  const unsigned nthreads = static_cast<unsigned>(
+    std::min<unsigned long>(samplerThreads(), nblocks));
+  std::vector<std::thread> helpers;
+  if(nthreads > 1) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    try {
+      for(unsigned t = 1; t < nthreads; ++t)
+        helpers.emplace_back(work, t);
+    } catch(const std::system_error &) {
+      // Out of threads: carry on with those we got.
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  }
+
+  // The calling thread takes blocks too, and alone polls for interrupts.
+  bool interrupted = false;
+  try {
+    while(!stop.load(std::memory_order_relaxed)) {
+      if(provsql_interrupted) {
+        interrupted = true;
+        stop = true;
+        break;
+      }
+      const unsigned long b = next.fetch_add(1, std::memory_order_relaxed);
+      if(b >= nblocks)
+        break;
+      body(b, 0);
+    }
+  } catch(...) {
+    fail();
+  }
+
+  for(auto &h : helpers)
+    h.join();
+  if(error)
+    std::rethrow_exception(error);
+  return !interrupted;
+}
+
+bool stopAtThreshold(
+  unsigned long threshold, unsigned long max_samples, unsigned long block_size,
+  const std::function<unsigned long(unsigned long, unsigned long, unsigned)> &count,
+  const std::function<unsigned long(unsigned long, unsigned long, unsigned)> &locate,
+  unsigned long &samples_used, unsigned long &successes,
+  bool &interrupted)
+{
+  samples_used = 0;
+  successes = 0;
+  interrupted = false;
+  if(threshold == 0)
+    return true;
+
+  const unsigned long nblocks = (max_samples + block_size - 1) / block_size;
+  auto size = [&](unsigned long b) {
+    return std::min(block_size, max_samples - b * block_size);
+  };
+
+  // One block at a time on a single thread, so that no block past the
+  // stopping one is drawn; several per thread otherwise, to keep them busy
+  // between merges.
+  const unsigned threads = samplerThreads();
+  const unsigned long round = threads == 1 ? 1 : 4UL * threads;
+  std::vector<unsigned long> tally;
+
+  for(unsigned long first = 0; first < nblocks; first += round) {
+    const unsigned long n = std::min(round, nblocks - first);
+    tally.assign(n, 0);
+    if(!forEachBlock(n, [&](unsigned long i, unsigned t) {
+      tally[i] = count(first + i, size(first + i), t);
+    })) {
+      interrupted = true;
+      return false;
+    }
+
+    for(unsigned long i = 0; i < n; ++i) {
+      const unsigned long b = first + i;
+      if(successes + tally[i] >= threshold) {
+        samples_used = b * block_size + locate(b, threshold - successes, 0) + 1;
+        successes = threshold;
+        return true;
+      }
+      successes += tally[i];
+      samples_used += size(b);
+    }
+  }
+
+  return false;
+}
+
+}  // namespace provsql
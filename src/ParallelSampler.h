@@ -0,0 +1,102 @@
+/**
+ * @file ParallelSampler.h
+ * @brief Spread Monte Carlo sampling over helper threads, reproducibly.
+ *
+ * The samplers whose per-sample work is plain C++ over a circuit already
+ * loaded in memory -- @c BitParallelSampler (the @c monte-carlo and
+ * @c stopping-rule methods on Boolean circuits) and the Karp-Luby
+ * estimators -- cut their samples into fixed-size @e blocks and hand the
+ * blocks to up to @c provsql.sampler_threads threads, the calling backend
+ * thread included.
+ *
+ * Reproducibility does not depend on the thread count: block @c b always
+ * draws from its own stream, @c streamRng(key, b), a generator seeded from
+ * a hash of the run's key (@c provsql.monte_carlo_seed when pinned) and of
+ * the block number -- a counter-based derivation, so no stream depends on
+ * another having been stepped -- and tallies are merged by block number,
+ * never by arrival order.  A stopping rule is applied to the blocks in
+ * order (@c stopAtThreshold), as if they had been drawn one after the
+ * other, so its guarantee is the sequential one.
+ *
+ * Helper threads never call into PostgreSQL: they run with every signal
+ * blocked, do not allocate through @c palloc, and do not read
+ * @c provsql_interrupted; the calling thread polls it between blocks and
+ * tells the helpers to stop.  Samplers that may reach the catalog (the
+ * RV-aware @c Sampler resolves comparison operators through the syscache)
+ * stay on the calling thread.
+ */
+#ifndef PROVSQL_PARALLEL_SAMPLER_H
+#define PROVSQL_PARALLEL_SAMPLER_H
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace provsql {
+
+/**
+ * @brief Key of one sampling run: @c provsql.monte_carlo_seed, or fresh
+ *        bits from @c std::random_device when it is @c -1.
+ */
+uint64_t samplingKey();
+
+/**
+ * @brief Generator of stream @p stream of the run keyed @p key.
+ *
+ * A pure function of its arguments: distinct streams of one key are
+ * seeded from distinct, well-mixed 64-bit values.
+ */
+std::mt19937_64 streamRng(uint64_t key, uint64_t stream);
+
+/**
+ * @brief Number of threads sampling may use (@c provsql.sampler_threads,
+ *        at least 1).
+ */
+unsigned samplerThreads();
+
+/**
+ * @brief Run @p body on every block of @c [0, @p nblocks).
+ *
+ * @c body(b, t) processes block @c b on thread slot @c t, in
+ * @c [0, samplerThreads()): per-thread scratch can be indexed by @c t.
+ * Blocks run in no particular order.  @p body must not call PostgreSQL;
+ * an exception it throws is rethrown here, once every thread stopped.
+ *
+ * @return @c false if @c provsql_interrupted stopped the run, in which
+ *         case some blocks did not run.
+ */
+bool forEachBlock(unsigned long nblocks,
+                  const std::function<void(unsigned long, unsigned)> &body);
+
+/**
+ * @brief Sequential stopping rule over blocks processed in parallel.
+ *
+ * Samples are numbered from 0, @p block_size per block; sampling stops
+ * at the sample where the success count reaches @p threshold, or after
+ * @p max_samples samples.  Blocks are counted a round at a time, on all
+ * threads, then merged in block order.
+ *
+ * @param count   @c count(b, n, t): successes among the first @c n
+ *                samples of block @c b.
+ * @param locate  @c locate(b, k, t): index, within block @c b, of its
+ *                @c k-th (from 1) success; it redraws the block, which
+ *                its stream makes identical.
+ * @param samples_used  Output: samples up to and including the stopping
+ *                one, or @p max_samples.
+ * @param successes     Output: successes among them.
+ * @param interrupted   Output: whether @c provsql_interrupted stopped the
+ *                run, the other outputs then covering the blocks merged
+ *                so far.
+ * @return        Whether @p threshold was reached.
+ */
+bool stopAtThreshold(
+  unsigned long threshold, unsigned long max_samples, unsigned long block_size,
+  const std::function<unsigned long(unsigned long, unsigned long, unsigned)> &count,
+  const std::function<unsigned long(unsigned long, unsigned long, unsigned)> &locate,
+  unsigned long &samples_used, unsigned long &successes,
+  bool &interrupted);
+
+}  // namespace provsql
+
+#endif  // PROVSQL_PARALLEL_SAMPLER_H
@@ -0,0 +1,272 @@
+/**
+ * @file StoreReader.cpp
+ * @brief The backend's read-only view of the circuit store.
+ *
+ * Implements the C-linkage lookups of @c store_reader.h and
+ * @c storeReaderGenericCircuit() of @c StoreReader.h over one read-only
+ * @c MMappedCircuit per backend, opened on the first lookup for the
+ * backend's database.  Any exception the view raises -- a file that
+ * does not exist yet, an index past the end of a file -- is taken as "ask
+ * the worker": the view is dropped, to be reopened on the next lookup,
+ * and the lookup returns @c false.
+ */
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "MMappedCircuit.h"
+#include "StoreReader.h"
+
+extern "C" {
+#include "miscadmin.h"
+#include "provsql_mmap.h"
+#include "store_reader.h"
+}
+
+#ifndef PROVSQL_INPROCESS_STORE
+
+/** @brief This backend's view of its database's store, once opened. */
+static std::unique_ptr<MMappedCircuit> view;
+
+/**
+ * @brief Request-ring offset by which every request that wrote a gate
+ *        the current statement can see had been sent.
+ *
+ * Recorded at the start of every statement (@c store_reader_statement_start),
+ * after its snapshot was taken: a gate another backend created is only
+ * visible once that backend has committed, and it has sent its gates by
+ * then.
+ */
+static uint64 horizon = 0;
+
+/**
+ * @brief Return the view, if lookups may be answered from it now.
+ *
+ * Sends this backend's pending gate batch first, and waits for nothing:
+ * the view is used once the worker has handled this backend's own
+ * requests, whatever other backends keep sending meanwhile.
+ */
+static MMappedCircuit *currentView()
+{
+  if(!provsql_direct_store_reads || !OidIsValid(MyDatabaseId))
+    return nullptr;
+
+  provsql_gate_batch_flush();
+  if(!provsql_ring_handled_mine())
+    return nullptr;
+
+  if(!view) {
+    try {
+      view.reset(new MMappedCircuit(MyDatabaseId, MyDatabaseTableSpace, true));
+    } catch(const std::exception &) {
+      return nullptr;
+    }
+  }
+  return view.get();
+}
+
+/**
+ * @brief Whether a token the view misses from now on is absent from the
+ *        store, as far as the current statement can tell.
+ *
+ * Must be called before the lookups it vouches for: it is then ordered
+ * before them.
+ */
+static bool missesFinal()
+{
+  return provsql_ring_handled(horizon);
+}
+
+/**
+ * @brief Return the view, reopened first if @p token misses in a mapping
+ *        the worker has since replaced, or @c nullptr if the miss may
+ *        just mean that the view is behind.
+ *
+ * A token absent from an up-to-date mapping is absent from the store,
+ * and the getters' input-gate defaults are then the right answer.
+ */
+static MMappedCircuit *viewFor(pg_uuid_t token)
+{
+  MMappedCircuit *c = currentView();
+  if(!c)
+    return nullptr;
+
+  const bool misses_final = missesFinal();
+  if(c->hasGate(token))
+    return c;
+  if(c->replaced()) {
+    view.reset();
+    if(!(c = currentView()) || c->hasGate(token))
+      return c;
+  }
+  return misses_final ? c : nullptr;
+}
+
+bool storeReaderGenericCircuit(const std::vector<pg_uuid_t> &roots,
+                               GenericCircuit &out)
+{
+  /* A gate missing at any depth, not only a root, fails the load over:
+   * to a reopened view once if the mapping was replaced, to the worker
+   * otherwise. */
+  for(int attempt = 0; attempt < 2; ++attempt) {
+    try {
+      MMappedCircuit *c = currentView();
+      if(!c)
+        return false;
+      const bool misses_final = missesFinal();
+      out = c->createGenericCircuitChecked(roots, misses_final);
+      return true;
+    } catch(const MMappedCircuit::StaleMiss &) {
+      if(!view->replaced())
+        return false;
+      view.reset();
+    } catch(const std::exception &) {
+      view.reset();
+      return false;
+    }
+  }
+  return false;
+}
+
+bool store_reader_get_gate(pg_uuid_t token, gate_type *type,
+                           unsigned *nb_children, pg_uuid_t **children)
+{
+  std::vector<pg_uuid_t> v;
+
+  try {
+    MMappedCircuit *c = viewFor(token);
+    if(!c)
+      return false;
+    *type = c->getGateType(token);
+    v = c->getChildren(token);
+  } catch(const std::exception &) {
+    view.reset();
+    return false;
+  }
+
+  *nb_children = static_cast<unsigned>(v.size());
+  *children = nullptr;
+  if(!v.empty()) {
+    *children = reinterpret_cast<pg_uuid_t *>(calloc(v.size(), sizeof(pg_uuid_t)));
+    memcpy(*children, v.data(), v.size() * sizeof(pg_uuid_t));
+  }
+  return true;
+}
+
+bool store_reader_get_prob(pg_uuid_t token, double *prob)
+{
+  try {
+    MMappedCircuit *c = viewFor(token);
+    if(!c)
+      return false;
+    *prob = c->getProb(token);
+    return true;
+  } catch(const std::exception &) {
+    view.reset();
+    return false;
+  }
+}
+
+bool store_reader_get_prob_written(pg_uuid_t token, bool *has, double *prob)
+{
+  try {
+    MMappedCircuit *c = viewFor(token);
+    if(!c)
+      return false;
+    *prob = NAN;
+    *has = c->hasProb(token, prob);
+    return true;
+  } catch(const std::exception &) {
+    view.reset();
+    return false;
+  }
+}
+
+bool store_reader_get_infos(pg_uuid_t token, unsigned *info1, unsigned *info2)
+{
+  try {
+    MMappedCircuit *c = viewFor(token);
+    if(!c)
+      return false;
+    std::tie(*info1, *info2) = c->getInfos(token);
+    return true;
+  } catch(const std::exception &) {
+    view.reset();
+    return false;
+  }
+}
+
+bool store_reader_get_extra(pg_uuid_t token, char **data, unsigned *len)
+{
+  std::string s;
+
+  try {
+    MMappedCircuit *c = viewFor(token);
+    if(!c)
+      return false;
+    s = c->getExtra(token);
+  } catch(const std::exception &) {
+    view.reset();
+    return false;
+  }
+
+  *len = static_cast<unsigned>(s.size());
+  *data = reinterpret_cast<char *>(palloc(s.size() + 1));
+  memcpy(*data, s.data(), s.size());
+  return true;
+}
+
+void store_reader_reset(void)
+{
+  view.reset();
+}
+
+void store_reader_statement_start(void)
+{
+  horizon = provsql_ring_sent();
+}
+
+#else
+
+bool storeReaderGenericCircuit(const std::vector<pg_uuid_t> &, GenericCircuit &)
+{
+  return false;
+}
+
+bool store_reader_get_gate(pg_uuid_t, gate_type *, unsigned *, pg_uuid_t **)
+{
+  return false;
+}
+
+bool store_reader_get_prob(pg_uuid_t, double *)
+{
+  return false;
+}
+
+bool store_reader_get_prob_written(pg_uuid_t, bool *, double *)
+{
+  return false;
+}
+
+bool store_reader_get_infos(pg_uuid_t, unsigned *, unsigned *)
+{
+  return false;
+}
+
+bool store_reader_get_extra(pg_uuid_t, char **, unsigned *)
+{
+  return false;
+}
+
+void store_reader_reset(void)
+{
+}
+
+void store_reader_statement_start(void)
+{
+}
+
+#endif /* PROVSQL_INPROCESS_STORE */
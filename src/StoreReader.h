@@ -0,0 +1,35 @@
+/**
+ * @file StoreReader.h
+ * @brief C++ side of the backend's read-only view of the circuit store.
+ *
+ * The gate-by-gate lookups are exposed to C through @c store_reader.h;
+ * this header adds the one a C caller has no use for: loading a whole
+ * circuit from the view, for @c getGenericCircuit and
+ * @c getJointCircuit, without the worker building and serialising it.
+ */
+#ifndef STORE_READER_CPP_H
+#define STORE_READER_CPP_H
+
+#include <vector>
+
+#include "GenericCircuit.h"
+
+extern "C" {
+#include "provsql_utils.h"
+}
+
+/**
+ * @brief Build the circuit reachable from @p roots from the backend's
+ *        read-only view of the store.
+ *
+ * Same circuit as @c MMappedCircuit::createGenericCircuit in the worker.
+ *
+ * @param roots  UUIDs whose reachable closure to load.
+ * @param out    Output: the circuit, on success.
+ * @return @c false if the worker must be asked instead; see
+ *         @c store_reader.h.
+ */
+bool storeReaderGenericCircuit(const std::vector<pg_uuid_t> &roots,
+                               GenericCircuit &out);
+
+#endif /* STORE_READER_CPP_H */
@@ -84,22 +84,24 @@ void ToolRegistry::seed()
   // helper (invoked by relative path, hence the cd) and a scratch {tmpdir};
   // dpmc is a two-binary pipeline (htb | dmc) with no single binary of its
   // own.  The `wmc-line` parser scrapes the "c s exact" line; weightmc's
-  // mantissa x 2^e output needs its own `weightmc` parser.
+  // mantissa x 2^e output needs its own `weightmc` parser.  All four print
+  // their count on standard output, which is therefore read from a pipe
+  // ({stdout}); they read the CNF from a file, dpmc twice.
   records_.push_back({"sharpsat-td", "cli", "sharpsat-td", {"wmc"}, {"dimacs-cnf"},
                       "decimal", "wmc-line", 90, true, {"flow_cutter_pace17"},
                       "cd \"$(dirname \"$(command -v flow_cutter_pace17)\")\" && "
                       "{binary} -WE -decot 1 -decow 100 -tmpdir {tmpdir} "
-                      "-cs 3500 -prec 20 {in} > {out} 2>&1"});
+                      "-cs 3500 -prec 20 {in} > {stdout} 2>&1"});
   records_.push_back({"ganak",       "cli", "ganak",       {"wmc"}, {"dimacs-cnf"},
                       "decimal", "wmc-line", 80, true, {},
-                      "--mode 7 {in} > {out} 2>&1"});
+                      "--mode 7 {in} > {stdout} 2>&1"});
   records_.push_back({"weightmc",    "cli", "weightmc",    {"wmc"}, {"dimacs-cnf"},
                       "decimal", "weightmc", 70, true, {},
                       "--startIteration=0 --gaussuntil=400 --verbosity=0 "
-                      "--pivotAC={pivotAC} {in} > {out}"});
+                      "--pivotAC={pivotAC} {in} > {stdout}"});
   records_.push_back({"dpmc",        "cli", "",            {"wmc"}, {"dimacs-cnf"},
                       "decimal", "wmc-line", 60, true, {"htb", "dmc"},
-                      "htb --cf={in} | dmc --cf={in} > {out} 2>&1"});
+                      "htb --cf={in} | dmc --cf={in} > {stdout} 2>&1"});
 
   // Visualisation: a ProvSQL-local operation (no KCMCP counterpart); reads a
   // GraphViz DOT and returns graph-easy's ASCII art verbatim.
@@ -46,7 +46,9 @@ namespace provsql {
  * @brief Expand a command template into a runnable shell command line.
  *
  * Replaces @c {binary} / @c {in} / @c {out} and any @p extra placeholders
- * (e.g. @c {tmpdir}, @c {pivotAC}) in @p tpl.  When @p tpl contains no
+ * (e.g. @c {tmpdir}, @c {pivotAC}) in @p tpl, and @c {stdin} / @c {stdout}
+ * by @c /dev/stdin / @c /dev/stdout (see @c templateReadsStdin).  When @p tpl
+ * contains no
  * @c {binary} placeholder, a non-empty @p binary is prepended (the common
  * "<binary> <args>" shape); a template that places the binaries itself (the
  * @c dpmc pipeline) is returned as-is.
@@ -72,6 +74,8 @@ inline std::string expandCommandTemplate(
   sub(cmd, "binary", binary);
   sub(cmd, "in", in);
   sub(cmd, "out", out);
+  sub(cmd, "stdin", "/dev/stdin");
+  sub(cmd, "stdout", "/dev/stdout");
   for (const auto &kv : extra)
     sub(cmd, kv.first, kv.second);
   if (tpl.find("{binary}") == std::string::npos && !binary.empty())
@@ -79,6 +83,33 @@ inline std::string expandCommandTemplate(
   return cmd;
 }
 
+/**
+ * @brief Whether a tool run with template @p tpl reads its problem on its
+ *        standard input.
+ *
+ * A template names the tool's input @c {stdin} (rather than @c {in}) to say
+ * the tool reads it sequentially, from a pipe: the dispatcher then streams
+ * the problem into the tool as it is generated, with no temporary file.
+ */
+inline bool templateReadsStdin(const std::string &tpl)
+{
+  return tpl.find("{stdin}") != std::string::npos;
+}
+
+/**
+ * @brief Whether a tool run with template @p tpl writes its result on its
+ *        standard output.
+ *
+ * A template names the tool's output @c {stdout} (rather than @c {out}),
+ * possibly as a shell redirection (@c "> {stdout}"), to say the tool's
+ * standard output carries the result and nothing else: the dispatcher then
+ * parses it from a pipe as the tool produces it.
+ */
+inline bool templateWritesStdout(const std::string &tpl)
+{
+  return tpl.find("{stdout}") != std::string::npos;
+}
+
 /**
  * @brief One registered external tool.
  *
@@ -123,7 +154,10 @@ inline std::string expandCommandTemplate(
  *
  * @c argtpl is the command the dispatcher runs, with @c {in} / @c {out}
  * substituted by the input/output temp files and a few tool-specific
- * placeholders (@c {binary}, @c {tmpdir}, @c {pivotAC}).  When @c argtpl
+ * placeholders (@c {binary}, @c {tmpdir}, @c {pivotAC}).  A tool that can
+ * read its problem from a pipe, or whose standard output is its result,
+ * says so with @c {stdin} / @c {stdout} in place of @c {in} / @c {out}, and
+ * is driven through pipes instead of temp files.  When @c argtpl
  * contains no @c {binary}, the resolved @c binary is prepended; otherwise
  * the template is the whole command (used by the @c dpmc pipeline and the
  * @c sharpsat-td @c cd-prefix).  @c argtpl_circuit is the alternative command
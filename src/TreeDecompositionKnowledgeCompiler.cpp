@@ -9,6 +9,8 @@
  * Usage:
  * @code
  * tdkc <circuit_file>
+ * tdkc --kcmcp <endpoint> [--workers N] [--queue N] [--max-sessions N]
+ *              [--cache-mb N]
  * @endcode
  *
  * The circuit file is a text file produced by @c BooleanCircuit::exportCircuit()
@@ -27,6 +29,7 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <cstdlib>
 
 extern "C" {
 #include <sys/time.h>
@@ -49,20 +52,46 @@ static double get_timestamp ()
 
 /**
  * @brief Entry point for the standalone tree-decomposition knowledge compiler.
- * @param argc  Argument count; must be 2.
- * @param argv  Argument vector; @c argv[1] is the path to the circuit file.
+ * @param argc  Argument count: 2, or 3 and more for @c --kcmcp.
+ * @param argv  Argument vector; @c argv[1] is the path to the circuit file,
+ *              or @c --kcmcp followed by the endpoint and server options.
  * @return      0 on success, non-zero on error.
  */
 int main(int argc, char **argv) {
   // KCMCP reference-server mode: speak the Knowledge Compiler / Model Counter
   // Protocol on a Unix or TCP endpoint (see kcmcp_server.h).
-  if(argc == 3 && std::string(argv[1]) == "--kcmcp")
-    return kcmcp_serve(argv[2]);
+  bool usage = argc < 2;
+  if(argc >= 3 && std::string(argv[1]) == "--kcmcp") {
+    KcmcpServerOptions options;
+    for(int i=3; i+1<argc && !usage; i+=2) {
+      std::string opt = argv[i];
+      char *end;
+      unsigned long v = strtoul(argv[i+1], &end, 10);
+      if(*argv[i+1] == '\0' || *end != '\0')
+        usage = true;
+      else if(opt == "--workers")
+        options.workers = v;
+      else if(opt == "--queue")
+        options.queue = v;
+      else if(opt == "--max-sessions")
+        options.max_sessions = v;
+      else if(opt == "--cache-mb")
+        options.cache_mb = v;
+      else
+        usage = true;
+    }
+    if(argc % 2 == 0)
+      usage = true;
+    if(!usage)
+      return kcmcp_serve(argv[2], options);
+  } else if(argc != 2)
+    usage = true;
 
-  if(argc != 2) {
+  if(usage) {
     std::cerr << "Usage: " << argv[0] << " circuit\n"
               << "       " << argv[0]
-              << " --kcmcp unix:/path|host:port   (KCMCP reference server)"
+              << " --kcmcp unix:/path|host:port [--workers N] [--queue N]"
+              << " [--max-sessions N] [--cache-mb N]   (KCMCP reference server)"
               << std::endl;
     exit(1);
   }
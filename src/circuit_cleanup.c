@@ -64,6 +64,7 @@
 #include "utils/uuid.h"
 
 #include "circuit_cache.h"
+#include "loaded_circuit_cache.h"
 #include "provsql_mmap.h"
 #include "provsql_shmem.h"
 #include "provsql_utils.h"
@@ -266,6 +267,7 @@ Datum circuit_cleanup(PG_FUNCTION_ARGS)
   /* Our own caches answer "this gate exists" without contacting the
      worker, which would survive the rebuild as a lie. */
   circuit_cache_reset();
+  loaded_circuit_cache_reset();
 
   /* The root set outlives the SPI session that fills it, so it is
      allocated in our own context: SPI_finish frees everything palloc'd
@@ -10,7 +10,10 @@
  * - @c simplify(): constant propagation.
  * - @c condition() / @c conditionAndSimplify(): fix one variable.
  * - @c probabilityEvaluation(): exact probability in linear time.
+ * - @c probabilityGradient(): its derivatives in the input probabilities.
  * - @c shapley() / @c banzhaf(): power index computation.
+ * - @c shapleyAllVars() / @c banzhafAllVars(): the same for every
+ *   variable, by one bottom-up and one top-down pass.
  * - @c topological_order(): DFS topological sort.
  *
  * The private helpers @c shapley_delta() and @c shapley_alpha() implement
@@ -18,17 +21,21 @@
  */
 #include "dDNNF.h"
 #include "Circuit.hpp"
+#include "ParallelSampler.h"
 
 #include <unordered_map>
 #include <set>
 #include <stack>
 #include <variant>
 #include <cassert>
+#include <cmath>
 #include <algorithm>
 #include <functional>
 #include <numeric>
 #include <sstream>
 #include <iomanip>
+#include <cstring>
+#include <limits>
 
 std::unordered_set<gate_t> dDNNF::vars(gate_t root) const
 {
@@ -225,6 +232,158 @@ double dDNNF::probabilityEvaluation() const
   assert(false);
 }
 
+std::vector<gate_t> dDNNF::postorder() const
+{
+  std::vector<gate_t> order;
+  std::vector<bool> seen(gates.size());
+  std::vector<std::pair<gate_t, size_t> > stack{{root, 0}};
+  seen[static_cast<size_t>(root)] = true;
+  while(!stack.empty()) {
+    const gate_t g = stack.back().first;
+    const auto &w = getWires(g);
+    if(stack.back().second < w.size()) {
+      const gate_t c = w[stack.back().second++];
+      if(!seen[static_cast<size_t>(c)]) {
+        seen[static_cast<size_t>(c)] = true;
+        stack.emplace_back(c, 0);
+      }
+    } else {
+      order.push_back(g);
+      stack.pop_back();
+    }
+  }
+  return order;
+}
+
+std::unordered_map<gate_t, double, hash_gate_t> dDNNF::inputGradient(
+  const std::vector<gate_t> &order,
+  const std::function<double(gate_t)> &leaf,
+  std::vector<double> &value) const
+{
+  std::unordered_map<gate_t, double, hash_gate_t> result;
+
+  // Bottom-up: the value of every gate, as probabilityEvaluation()
+  // computes it (an AND without children is true, an OR without children
+  // false).
+  value.assign(gates.size(), 0.);
+  for(gate_t g: order) {
+    const auto &w = getWires(g);
+    double v;
+    switch(getGateType(g)) {
+    case BooleanGate::IN:
+      v = leaf(g);
+      break;
+    case BooleanGate::NOT:
+      v = 1 - value[static_cast<size_t>(w[0])];
+      break;
+    case BooleanGate::AND:
+      v = 1;
+      for(auto c: w)
+        v *= value[static_cast<size_t>(c)];
+      break;
+    case BooleanGate::OR:
+      v = 0;
+      for(auto c: w)
+        v += value[static_cast<size_t>(c)];
+      break;
+    default:
+      throw CircuitException("Incorrect gate type");
+    }
+    value[static_cast<size_t>(g)] = v;
+  }
+
+  // Top-down: the derivative of the root's value in each gate's,
+  // accumulated over all its parents.  An AND passes each child the
+  // product of its siblings, taken from prefix and suffix products so
+  // that a sibling of value 0 needs no division.
+  std::vector<double> adjoint(gates.size());
+  adjoint[static_cast<size_t>(root)] = 1;
+  std::vector<double> suffix;
+  for(auto it = order.rbegin(); it != order.rend(); ++it) {
+    const gate_t g = *it;
+    const double a = adjoint[static_cast<size_t>(g)];
+    const auto &w = getWires(g);
+    switch(getGateType(g)) {
+    case BooleanGate::IN:
+      result[g] = a;
+      break;
+    case BooleanGate::NOT:
+      adjoint[static_cast<size_t>(w[0])] -= a;
+      break;
+    case BooleanGate::OR:
+      for(auto c: w)
+        adjoint[static_cast<size_t>(c)] += a;
+      break;
+    case BooleanGate::AND:
+    {
+      if(a == 0)
+        break;
+      suffix.assign(w.size() + 1, 1.);
+      for(size_t i = w.size(); i-- > 0;)
+        suffix[i] = suffix[i+1] * value[static_cast<size_t>(w[i])];
+      double prefix = 1;
+      for(size_t i = 0; i < w.size(); ++i) {
+        adjoint[static_cast<size_t>(w[i])] += a * prefix * suffix[i+1];
+        prefix *= value[static_cast<size_t>(w[i])];
+      }
+    }
+    break;
+    default:
+      throw CircuitException("Incorrect gate type");
+    }
+  }
+
+  return result;
+}
+
+std::unordered_map<gate_t, double, hash_gate_t> dDNNF::probabilityGradient() const
+{
+  if (gates.size() == 0)
+    return {};
+
+  const std::vector<gate_t> order = postorder();
+  std::vector<double> value;
+  auto result = inputGradient(order, [&](gate_t g) {
+    return getProb(g);
+  }, value);
+  for(gate_t g: order)
+    probability_cache[g] = value[static_cast<size_t>(g)];
+
+  return result;
+}
+
+std::unordered_map<gate_t, double, hash_gate_t> dDNNF::banzhafAllVars() const
+{
+  std::unordered_map<gate_t, double, hash_gate_t> result;
+  if (gates.size() == 0)
+    return result;
+
+  // ENV(g) divided by the product of 1+p over the variables of g: inputs
+  // are then worth p/(1+p), and gates combine them as probabilities do
+  // (an OR's children, smooth, share their product).
+  std::vector<double> value;
+  auto gradient = inputGradient(postorder(), [&](gate_t g) {
+    return getProb(g) / (1 + getProb(g));
+  }, value);
+
+  // banzhaf(x) = p_x * (ENV(C_1) - ENV(C_0)), the conditioned circuits
+  // having the product over all variables but x as scale.  The product
+  // may overflow where the index itself does not: combine logarithms.
+  double log_scale = 0.;
+  for(const auto &[g, d]: gradient)
+    log_scale += std::log1p(getProb(g));
+  for(const auto &[g, d]: gradient) {
+    const double p = getProb(g);
+    if(d == 0. || p == 0.)
+      result[g] = 0.;
+    else
+      result[g] = std::copysign(
+        std::exp(std::log(p) + std::log(std::fabs(d)) + log_scale - std::log1p(p)), d);
+  }
+
+  return result;
+}
+
 double dDNNF::banzhaf_internal() const {
   std::unordered_map<gate_t, double> result;
   std::unordered_map<gate_t, double> prod_one_plus_p;
@@ -551,6 +710,324 @@ double dDNNF::shapley(gate_t var) const {
   return result;
 }
 
+namespace {
+
+/** @brief Entries of a table row per block handed to a thread. */
+constexpr unsigned kShapleyChunk = 64;
+
+/** @brief Products below which a gate's table is filled on the calling
+ *         thread alone. */
+constexpr double kShapleyParallelWork = 1 << 20;
+
+/**
+ * @brief Hypergeometric weights @f$\binom{a}{i}\binom{b}{j}/\binom{a+b}{i+j}@f$.
+ *
+ * Tables divided by binomial coefficients convolve with these weights,
+ * which are at most 1.  A run of them is filled from its largest term,
+ * the only one taken from logarithms, by ratios of consecutive terms:
+ * the terms that underflow are the negligible ones.
+ */
+class Hypergeometric {
+  std::vector<double> logfact;  ///< @c logfact[n] = log(n!)
+
+  double logBinom(unsigned n, unsigned k) const {
+    return logfact[n] - logfact[k] - logfact[n-k];
+  }
+
+  double weight(unsigned a, unsigned i, unsigned b, unsigned j) const {
+    return std::exp(logBinom(a, i) + logBinom(b, j) - logBinom(a+b, i+j));
+  }
+
+public:
+  /** @brief Weights for @c a+b up to @p n. */
+  explicit Hypergeometric(unsigned n) : logfact(n+1) {
+    for(unsigned i = 1; i <= n; ++i)
+      logfact[i] = logfact[i-1] + std::log(static_cast<double>(i));
+  }
+
+  /** @brief @c h[i-lo] = weight(a, i, b, l-i), for @c i in @c [lo, hi]. */
+  void alongSum(unsigned a, unsigned b, unsigned l, unsigned lo, unsigned hi,
+                std::vector<double> &h) const {
+    h.resize(hi-lo+1);
+    const unsigned m = std::clamp(a+b ? l*a/(a+b) : lo, lo, hi);
+    h[m-lo] = weight(a, m, b, l-m);
+    for(unsigned i = m; i < hi; ++i)
+      h[i+1-lo] = h[i-lo] * (a-i) * (l-i) / ((i+1.) * (b-l+i+1));
+    for(unsigned i = m; i > lo; --i)
+      h[i-1-lo] = h[i-lo] * i * (b-l+i) / ((a-i+1.) * (l-i+1));
+  }
+
+  /** @brief @c h[j-lo] = weight(a, i, b, j), for @c j in @c [lo, hi]. */
+  void alongSecond(unsigned a, unsigned i, unsigned b, unsigned lo, unsigned hi,
+                   std::vector<double> &h) const {
+    h.resize(hi-lo+1);
+    const unsigned k = a+b;
+    const unsigned m = std::clamp(a ? i*b/a : lo, lo, hi);
+    h[m-lo] = weight(a, i, b, m);
+    for(unsigned j = m; j < hi; ++j)
+      h[j+1-lo] = h[j-lo] * (b-j) * (i+j+1) / ((j+1.) * (k-i-j));
+    for(unsigned j = m; j > lo; --j)
+      h[j-1-lo] = h[j-lo] * j * (k-i-j+1) / ((b-j+1.) * (i+j));
+  }
+};
+
+/** @brief Entries @c [lo, hi) of row @c k of table @c t. */
+struct Chunk {
+  unsigned t, k, lo, hi;
+};
+
+/** @brief Append chunks covering rows @p from to @p to of table @p t. */
+void addRows(std::vector<Chunk> &chunks, unsigned t, unsigned from, unsigned to)
+{
+  for(unsigned k = from; k <= to; ++k)
+    for(unsigned lo = 0; lo <= k; lo += kShapleyChunk)
+      chunks.push_back({t, k, lo, std::min(k+1, lo+kShapleyChunk)});
+}
+
+/**
+ * @brief Run @p body on every chunk, on the sampling threads when
+ *        @p work (products to compute) makes it worth it.
+ */
+void runChunks(const std::vector<Chunk> &chunks, double work,
+               const std::function<void(const Chunk &, unsigned)> &body)
+{
+  if(work < kShapleyParallelWork) {
+    for(const auto &c: chunks)
+      body(c, 0);
+  } else if(!provsql::forEachBlock(chunks.size(), [&](unsigned long b, unsigned t) {
+    body(chunks[b], t);
+  }))
+    throw CircuitException("Interrupted");
+}
+
+}  // namespace
+
+std::unordered_map<gate_t, double, hash_gate_t> dDNNF::shapleyAllVars() const
+{
+  std::unordered_map<gate_t, double, hash_gate_t> result;
+  if(gates.size() == 0)
+    return result;
+
+  const std::vector<gate_t> order = postorder();
+  const bool prob = isProbabilistic();
+
+  // Tables alpha[g][k][l] hold shapley_alpha()'s coefficients divided by
+  // binomial(k,l), nb[g] being the number of variables under g (the
+  // circuit is smooth).  All probabilities being 1, only row nb[g] is
+  // non-zero, and only it is stored.
+  std::vector<unsigned> nb(gates.size());
+  std::vector<std::vector<double> > delta(gates.size());
+  std::vector<std::vector<std::vector<double> > > alpha(gates.size());
+  auto first = [&](gate_t g) {
+    return prob ? 0 : nb[static_cast<size_t>(g)];
+  };
+
+  for(gate_t g: order) {
+    const auto &w = getWires(g);
+    const size_t gi = static_cast<size_t>(g);
+    auto &d = delta[gi];
+    auto &a = alpha[gi];
+    switch(getGateType(g)) {
+    case BooleanGate::IN:
+      nb[gi] = 1;
+      d = {1-getProb(g), getProb(g)};
+      a = {{0}, {0, getProb(g)}};
+      if(!prob)
+        a[0].clear();
+      break;
+
+    case BooleanGate::NOT:
+    {
+      const size_t c = static_cast<size_t>(w[0]);
+      nb[gi] = nb[c];
+      d = delta[c];
+      a = alpha[c];
+      for(unsigned k = first(g); k <= nb[gi]; ++k)
+        for(auto &v: a[k])
+          v = (prob ? d[k] : 1.) - v;
+      break;
+    }
+
+    case BooleanGate::OR:
+      if(w.empty()) {
+        d = {1};
+        a = {{0}};
+        break;
+      }
+      nb[gi] = nb[static_cast<size_t>(w[0])];
+      d = delta[static_cast<size_t>(w[0])];
+      a = alpha[static_cast<size_t>(w[0])];
+      for(size_t i = 1; i < w.size(); ++i) {
+        const size_t c = static_cast<size_t>(w[i]);
+        if(nb[c] != nb[gi])
+          throw CircuitException("Shapley values require a smooth d-DNNF");
+        for(unsigned k = first(g); k <= nb[gi]; ++k)
+          for(unsigned l = 0; l <= k; ++l)
+            a[k][l] += alpha[c][k][l];
+      }
+      break;
+
+    case BooleanGate::AND:
+      if(w.empty()) {
+        d = {1};
+        a = {{1}};
+      } else if(w.size() == 1) {
+        nb[gi] = nb[static_cast<size_t>(w[0])];
+        d = delta[static_cast<size_t>(w[0])];
+        a = alpha[static_cast<size_t>(w[0])];
+      } else if(w.size() == 2) {
+        const auto &d1 = delta[static_cast<size_t>(w[0])];
+        const auto &d2 = delta[static_cast<size_t>(w[1])];
+        const auto &a1 = alpha[static_cast<size_t>(w[0])];
+        const auto &a2 = alpha[static_cast<size_t>(w[1])];
+        const unsigned n1 = nb[static_cast<size_t>(w[0])];
+        const unsigned n2 = nb[static_cast<size_t>(w[1])];
+        const unsigned f1 = first(w[0]), f2 = first(w[1]);
+        const unsigned n = nb[gi] = n1+n2;
+
+        if(prob) {
+          d.assign(n+1, 0.);
+          for(unsigned k1 = 0; k1 <= n1; ++k1)
+            for(unsigned k2 = 0; k2 <= n2; ++k2)
+              d[k1+k2] += d1[k1] * d2[k2];
+        }
+
+        a.resize(n+1);
+        for(unsigned k = first(g); k <= n; ++k)
+          a[k].resize(k+1);
+
+        const Hypergeometric hg(n);
+        std::vector<Chunk> chunks;
+        addRows(chunks, 0, first(g), n);
+        std::vector<std::vector<double> > h(provsql::samplerThreads());
+        runChunks(chunks,
+                  (n+1.) * (n+1-first(g)) * (std::min(n1, n2)+1) * (prob ? std::min(n1, n2)+1 : 1),
+                  [&](const Chunk &c, unsigned t) {
+          const unsigned k = c.k;
+          for(unsigned k1 = std::max(f1, k > n2 ? k-n2 : 0);
+              k1 <= n1 && k1+f2 <= k; ++k1) {
+            const unsigned k2 = k-k1;
+            for(unsigned l = c.lo; l < c.hi; ++l) {
+              const unsigned lo = l > k2 ? l-k2 : 0, hi = std::min(k1, l);
+              hg.alongSum(k1, k2, l, lo, hi, h[t]);
+              double r = 0.;
+              for(unsigned l1 = lo; l1 <= hi; ++l1)
+                r += h[t][l1-lo] * a1[k1][l1] * a2[k2][l-l1];
+              a[k][l] += r;
+            }
+          }
+        });
+      } else
+        throw CircuitException("Shapley values require binary AND gates");
+      break;
+
+    default:
+      throw CircuitException("Incorrect gate type");
+    }
+  }
+
+  const unsigned n = nb[static_cast<size_t>(root)];
+  if(n == 0)
+    return result;
+
+  // Top-down: adjoint[g][k][l] is the derivative of the score in
+  // alpha[g][k][l].  Conditioning a variable removes it from every table
+  // above it, so only rows below nb[g] are needed, and only row nb[g]-1
+  // when all probabilities are 1.  The score weighs the root's entries
+  // by 1/(k+1), the binomial being already divided out.
+  std::vector<std::vector<std::vector<double> > > adjoint(gates.size());
+  auto lowest = [&](gate_t g) {
+    return prob ? 0 : nb[static_cast<size_t>(g)]-1;
+  };
+  auto reach = [&](gate_t g) -> std::vector<std::vector<double> > & {
+    auto &r = adjoint[static_cast<size_t>(g)];
+    const unsigned m = nb[static_cast<size_t>(g)];
+    if(r.empty() && m > 0) {
+      r.resize(m);
+      for(unsigned k = lowest(g); k < m; ++k)
+        r[k].assign(k+1, 0.);
+    }
+    return r;
+  };
+
+  auto &top = reach(root);
+  for(unsigned k = lowest(root); k < n; ++k)
+    for(auto &v: top[k])
+      v = 1./(k+1);
+
+  for(auto it = order.rbegin(); it != order.rend(); ++it) {
+    const gate_t g = *it;
+    const size_t gi = static_cast<size_t>(g);
+    const auto &w = getWires(g);
+    const unsigned m = nb[gi];
+    auto &ag = adjoint[gi];
+
+    if(m > 0 && !ag.empty()) {
+      switch(getGateType(g)) {
+      case BooleanGate::IN:
+        result[g] = std::clamp(getProb(g) * ag[0][0], -1., 1.);
+        break;
+
+      case BooleanGate::NOT:
+      case BooleanGate::OR:
+      case BooleanGate::AND:
+        if(w.size() <= 1 || getGateType(g) == BooleanGate::OR) {
+          const double sign = getGateType(g) == BooleanGate::NOT ? -1. : 1.;
+          for(auto c: w) {
+            auto &ac = reach(c);
+            for(unsigned k = lowest(g); k < m; ++k)
+              for(unsigned l = 0; l <= k; ++l)
+                ac[k][l] += sign * ag[k][l];
+          }
+        } else {
+          // A binary AND: each child's adjoint sums over the other
+          // child's entries, row by row of the child's.
+          const gate_t c[2] = {w[0], w[1]};
+          const unsigned nc[2] = {nb[static_cast<size_t>(w[0])], nb[static_cast<size_t>(w[1])]};
+          std::vector<Chunk> chunks;
+          for(unsigned s = 0; s < 2; ++s)
+            if(nc[s] > 0) {
+              reach(c[s]);
+              addRows(chunks, s, lowest(c[s]), nc[s]-1);
+            }
+          const Hypergeometric hg(m);
+          std::vector<std::vector<double> > h(provsql::samplerThreads());
+          runChunks(chunks,
+                    (m+1.) * (prob ? (m+1.) * (nc[0]+1.) * (nc[1]+1.) : m+1.),
+                    [&](const Chunk &ch, unsigned t) {
+            const unsigned s = ch.t, o = 1-s;
+            const unsigned k1 = ch.k;
+            const auto &ao = alpha[static_cast<size_t>(c[o])];
+            auto &out = adjoint[static_cast<size_t>(c[s])][k1];
+            for(unsigned k2 = first(c[o]); k2 <= nc[o]; ++k2) {
+              const unsigned k = k1+k2;
+              if(k < lowest(g))
+                continue;
+              for(unsigned l1 = ch.lo; l1 < ch.hi; ++l1) {
+                hg.alongSecond(k1, l1, k2, 0, k2, h[t]);
+                double r = 0.;
+                for(unsigned l2 = 0; l2 <= k2; ++l2)
+                  r += ag[k][l1+l2] * h[t][l2] * ao[k2][l2];
+                out[l1] += r;
+              }
+            }
+          });
+        }
+        break;
+
+      default:
+        throw CircuitException("Incorrect gate type");
+      }
+    }
+
+    // Every parent of g came before it: neither table is needed again.
+    std::vector<std::vector<double> >().swap(ag);
+    std::vector<std::vector<double> >().swap(alpha[gi]);
+  }
+
+  return result;
+}
+
 double dDNNF::banzhaf(gate_t var) const {
   auto cond_pos = condition(var, true);
   auto cond_neg = condition(var, false);
@@ -900,6 +1377,129 @@ std::string dDNNF::toNNF(
   return out.str();
 }
 
+namespace {
+
+void putVarint(std::string &out, uint64_t v)
+{
+  while(v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+}  // anonymous namespace
+
+std::string dDNNF::toBinaryNNF(
+  const std::function<int(const std::string &)> &var_of_uuid,
+  bool probabilities) const
+{
+  // Same variable numbering as toNNF().
+  auto var_of = [&](gate_t g) -> long {
+    if(var_of_uuid) {
+      auto u = id2uuid.find(g);
+      if(u != id2uuid.end()) {
+        int v = var_of_uuid(u->second);
+        if(v > 0)
+          return v;
+      }
+    }
+    return static_cast<long>(
+      static_cast<std::underlying_type<gate_t>::type>(g)) + 1;
+  };
+
+  constexpr uint64_t none = std::numeric_limits<uint64_t>::max();
+  std::vector<uint64_t> index(gates.size(), none);  // gate -> node
+  std::vector<uint64_t> heads;                       // (value << 2) | kind
+  std::vector<uint64_t> children;                    // node - child, in CSR order
+  std::vector<long> literals;
+  std::vector<double> weights;
+  std::unordered_map<long, uint64_t> literal_index;
+  long max_var = 0;
+
+  auto literal = [&](long lit, double p) -> uint64_t {
+    auto [it, added] = literal_index.try_emplace(lit, literals.size());
+    if(added) {
+      literals.push_back(lit);
+      weights.push_back(p);
+      max_var = std::max(max_var, lit < 0 ? -lit : lit);
+    }
+    return it->second;
+  };
+
+  // Post-order without recursion (a d-DNNF can be millions of levels deep):
+  // a gate is emitted once all its children are.
+  std::vector<std::pair<gate_t, bool> > stack{{root, false}};
+  while(!stack.empty()) {
+    auto [g, expanded] = stack.back();
+    stack.pop_back();
+    const auto k = static_cast<std::underlying_type<gate_t>::type>(g);
+    if(index[k] != none)
+      continue;
+
+    const BooleanGate t = getGateType(g);
+    if((t == BooleanGate::AND || t == BooleanGate::OR) && !expanded) {
+      stack.emplace_back(g, true);
+      const auto &w = getWires(g);
+      for(auto it = w.rbegin(); it != w.rend(); ++it)
+        stack.emplace_back(*it, false);
+      continue;
+    }
+
+    const uint64_t my = heads.size();
+    switch(t) {
+    case BooleanGate::IN:
+      heads.push_back(literal(var_of(g), getProb(g)) << 2);
+      break;
+    case BooleanGate::NOT: {
+      gate_t c = *getWires(g).begin();
+      if(getGateType(c) != BooleanGate::IN)
+        throw CircuitException(
+          "toBinaryNNF: NOT over a non-input gate (circuit not in negation normal form)");
+      heads.push_back(literal(-var_of(c), 1. - getProb(c)) << 2);
+      break;
+    }
+    case BooleanGate::AND:
+    case BooleanGate::OR: {
+      const auto &w = getWires(g);
+      heads.push_back((w.size() << 2) | (t == BooleanGate::AND ? 1 : 2));
+      for(gate_t c : w)
+        children.push_back(
+          my - index[static_cast<std::underlying_type<gate_t>::type>(c)]);
+      break;
+    }
+    default:
+      throw CircuitException("toBinaryNNF: unexpected gate type in d-DNNF");
+    }
+    index[k] = my;
+  }
+
+  std::string out("DNNB", 4);
+  out.push_back(1);  // version
+  out.push_back(probabilities ? 1 : 0);
+  putVarint(out, max_var);
+  putVarint(out, literals.size());
+  putVarint(out, heads.size());
+  putVarint(out, children.size());
+  out.reserve(out.size() + 3 * literals.size() + 2 * heads.size()
+              + 3 * children.size() + (probabilities ? 8 * weights.size() : 0));
+  for(long l : literals)  // zigzag
+    putVarint(out, l < 0 ? 2 * static_cast<uint64_t>(-l) - 1
+                         : 2 * static_cast<uint64_t>(l));
+  for(uint64_t h : heads)
+    putVarint(out, h);
+  for(uint64_t c : children)
+    putVarint(out, c);
+  if(probabilities)
+    for(double p : weights) {
+      uint64_t bits;
+      std::memcpy(&bits, &p, sizeof bits);
+      for(int i = 0; i < 8; ++i)
+        out.push_back(static_cast<char>(bits >> (8 * i)));
+    }
+  return out;
+}
+
 std::string dDNNF::toDot() const
 {
   std::ostringstream out;
@@ -39,6 +39,7 @@
 // Forward declaration for friend
 class dDNNFTreeDecompositionBuilder;
 class StructuredDNNFBuilder;
+namespace provsql { class CompiledCircuitKey; }
 
 /**
  * @brief @c std::hash functor for @c gate_t.
@@ -102,6 +103,31 @@ std::vector<std::vector<double> > shapley_alpha() const;
  */
 double banzhaf_internal() const;
 
+/**
+ * @brief Gates reachable from @c root, children before parents.
+ *
+ * An iterative depth-first walk, d-DNNFs being possibly deep.
+ * @return Reachable gates in post-order, @c root last.
+ */
+std::vector<gate_t> postorder() const;
+
+/**
+ * @brief Derivative of the root's value in the value of each input.
+ *
+ * Evaluates the gates of @p order as probabilities are evaluated, input
+ * @c g having value @c leaf(g), then accumulates top-down the derivative
+ * of the root's value in each gate's.
+ *
+ * @param order  Gates reachable from the root, as @c postorder() lists them.
+ * @param leaf   Value of each input gate.
+ * @param value  Output: value of each gate, indexed by gate.
+ * @return       Map from each IN gate of @p order to the derivative.
+ */
+std::unordered_map<gate_t, double, hash_gate_t> inputGradient(
+  const std::vector<gate_t> &order,
+  const std::function<double(gate_t)> &leaf,
+  std::vector<double> &value) const;
+
 /**
  * @brief Compute a topological ordering of the circuit.
  *
@@ -195,6 +221,20 @@ dDNNF condition(gate_t var, bool value) const;
  */
 double probabilityEvaluation() const;
 
+/**
+ * @brief Compute the derivative of the probability of the d-DNNF with
+ *        respect to the probability of each of its input gates.
+ *
+ * The probability a d-DNNF computes is a multilinear polynomial in the
+ * probabilities of its inputs, so these derivatives are exact: the
+ * derivative in input @c x is @c Pr(root | x) - @c Pr(root | ¬x).  One
+ * bottom-up pass fills @c probability_cache and one top-down pass
+ * accumulates the derivatives, in time linear in the circuit size.
+ *
+ * @return Map from each IN gate reachable from the root to the derivative.
+ */
+std::unordered_map<gate_t, double, hash_gate_t> probabilityGradient() const;
+
 /**
  * @brief Compute the Shapley value of input gate @p var.
  *
@@ -216,6 +256,41 @@ double shapley(gate_t var) const;
  */
 double banzhaf(gate_t var) const;
 
+/**
+ * @brief Compute the Shapley value of every input gate at once.
+ *
+ * The α table of the root is linear in the table of any single input,
+ * so the difference between conditioning that input on @c true and on
+ * @c false is a derivative: one bottom-up pass computes the tables of
+ * all gates, one top-down pass carries the derivative of the final
+ * score down to every input.  This costs about as much as a single
+ * call to @c shapley(), whatever the number of inputs.  Tables are kept
+ * divided by binomial coefficients, so that no entry grows past 1 and
+ * circuits over thousands of variables do not overflow; large AND
+ * gates are split over @c provsql.sampler_threads threads.
+ *
+ * The d-DNNF must be smooth, with binary AND gates.
+ *
+ * @return Map from each IN gate reachable from the root to its Shapley
+ *         value, equal to what @c shapley() returns for it.
+ */
+std::unordered_map<gate_t, double, hash_gate_t> shapleyAllVars() const;
+
+/**
+ * @brief Compute the Banzhaf power index of every input gate at once.
+ *
+ * Dividing the ENV value of each gate by the product of @c 1+p over its
+ * variables turns its computation into a probability evaluation, with
+ * input probabilities @c p/(1+p), whose gradient (@c inputGradient)
+ * gives every index in one linear-time pass.
+ *
+ * The d-DNNF must be smooth.
+ *
+ * @return Map from each IN gate reachable from the root to its Banzhaf
+ *         index, equal to what @c banzhaf() returns for it.
+ */
+std::unordered_map<gate_t, double, hash_gate_t> banzhafAllVars() const;
+
 /**
  * @brief Structural statistics of a compiled d-DNNF.
  *
@@ -280,8 +355,37 @@ std::string toDot() const;
 std::string toNNF(
   const std::function<int(const std::string &)> &var_of_uuid = {}) const;
 
+/**
+ * @brief Serialise the d-DNNF in the binary @c ddnnf-bin format.
+ *
+ * The same nodes as @c toNNF(), in the same children-first order, without
+ * the text: a parser builds the d-DNNF straight from it, with no
+ * tokenising.  Integers are LEB128 varints.  After the magic @c "DNNB", a
+ * version byte (1) and a flags byte (bit 0: probabilities present), come
+ * the variable, literal, node and edge counts, then:
+ * - the literal table: each distinct literal, zigzag-encoded;
+ * - one head per node, @c (value << 2) | kind: kind 0 is a literal leaf
+ *   (value: its literal-table index), 1 an AND and 2 an OR (value: the
+ *   number of children);
+ * - the children of every AND and OR, node after node (CSR order), each
+ *   as the distance back from its parent's node number;
+ * - if flagged, each literal's probability, as a little-endian IEEE-754
+ *   double.
+ *
+ * The root is the last node; no node at all is an unsatisfiable formula.
+ *
+ * @param var_of_uuid   As for @c toNNF().
+ * @param probabilities Whether to append the literal probabilities.
+ * @return The binary d-DNNF.
+ * @throws CircuitException as @c toNNF().
+ */
+std::string toBinaryNNF(
+  const std::function<int(const std::string &)> &var_of_uuid = {},
+  bool probabilities = false) const;
+
 friend dDNNFTreeDecompositionBuilder; ///< Allowed to construct and populate this d-DNNF
 friend StructuredDNNFBuilder; ///< Inversion-free structured builder: constructs and populates this d-DNNF
+friend provsql::CompiledCircuitKey; ///< Restores cached d-DNNFs
 friend dDNNF BooleanCircuit::compilation(gate_t g, std::string compiler, std::string *resolved) const; ///< Allowed to access internal d-DNNF state
 };
 
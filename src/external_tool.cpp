@@ -15,6 +15,8 @@ extern "C" {
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/wait.h>
 }
@@ -23,6 +25,9 @@ extern "C" {
 #include "ToolRegistry.h"
 #include "provsql_config.h"
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 
@@ -110,13 +115,23 @@ static int run_in_own_pgroup(const std::string &cmdline)
 #endif /* PROVSQL_NO_SUBPROCESS */
 }
 
-int run_external_tool(const std::string &cmdline) {
-  bool override_path = (provsql_tool_search_path != NULL
-                        && provsql_tool_search_path[0] != '\0');
-  std::string saved_path;
+/*
+ * Prepend provsql.tool_search_path, if set, to $PATH for the lifetime of
+ * the object, so that a tool forked meanwhile resolves against it; the
+ * server's own PATH (or its absence) is restored afterwards.
+ */
+class ToolSearchPath {
+  bool override_path;
   bool had_path = false;
+  std::string saved_path;
 
-  if (override_path) {
+public:
+  ToolSearchPath()
+    : override_path(provsql_tool_search_path != NULL
+                    && provsql_tool_search_path[0] != '\0')
+  {
+    if (!override_path)
+      return;
     const char *cur = getenv("PATH");
     if (cur != NULL) {
       saved_path = cur;
@@ -128,14 +143,23 @@ int run_external_tool(const std::string &cmdline) {
     setenv("PATH", new_path.c_str(), 1);
   }
 
-  int rv = run_in_own_pgroup(cmdline);
-
-  if (override_path) {
+  ~ToolSearchPath()
+  {
+    if (!override_path)
+      return;
     if (had_path)
       setenv("PATH", saved_path.c_str(), 1);
     else
       unsetenv("PATH");
   }
+};
+
+int run_external_tool(const std::string &cmdline) {
+  int rv;
+  {
+    ToolSearchPath path;
+    rv = run_in_own_pgroup(cmdline);
+  }
 
   /* If a cancel/terminate fired while the tool ran, run_in_own_pgroup has
    * already killed and reaped it; raise the interrupt now (cleanly, with no
@@ -147,6 +171,245 @@ int run_external_tool(const std::string &cmdline) {
   return rv;
 }
 
+ExternalToolProcess::ExternalToolProcess(const std::string &cmdline,
+                                         bool pipe_stdin, bool pipe_stdout)
+  : child(-1), status(0), stdin_fd(-1), stdout_fd(-1), pending_pos(0),
+  in_buf(*this), out_buf(*this), in_stream(&in_buf), out_stream(&out_buf)
+{
+#ifdef PROVSQL_NO_SUBPROCESS
+  (void) cmdline;
+  (void) pipe_stdin;
+  (void) pipe_stdout;
+  throw std::runtime_error("external tools cannot be run in this build");
+#else
+  // No end may leak into the tool beyond its descriptors 0 and 1, nor into
+  // tools started later, hence FD_CLOEXEC (which dup2 clears on the copy).
+  int in_pipe[2] = {-1, -1}, out_pipe[2] = {-1, -1};
+  if ((pipe_stdin && pipe(in_pipe) != 0)
+      || (pipe_stdout && pipe(out_pipe) != 0)) {
+    int err = errno;
+    for (int fd : {in_pipe[0], in_pipe[1], out_pipe[0], out_pipe[1]})
+      if (fd >= 0)
+        close(fd);
+    throw std::runtime_error(std::string("could not create pipe: ")
+                             + strerror(err));
+  }
+  for (int fd : {in_pipe[0], in_pipe[1], out_pipe[0], out_pipe[1]})
+    if (fd >= 0)
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  fflush(NULL);
+  {
+    ToolSearchPath path;
+    child = fork();
+    if (child == 0) {
+      // Child: same process-group discipline as run_in_own_pgroup.
+      setpgid(0, 0);
+      if (pipe_stdin)
+        dup2(in_pipe[0], STDIN_FILENO);
+      if (pipe_stdout)
+        dup2(out_pipe[1], STDOUT_FILENO);
+      execl("/bin/sh", "sh", "-c", cmdline.c_str(), (char *) NULL);
+      _exit(127);
+    }
+  }
+
+  if (pipe_stdin) {
+    close(in_pipe[0]);
+    stdin_fd = in_pipe[1];
+  }
+  if (pipe_stdout) {
+    close(out_pipe[1]);
+    stdout_fd = out_pipe[0];
+  }
+
+  if (child < 0) {
+    int err = errno;
+    kill();
+    throw std::runtime_error(std::string("could not start tool: ")
+                             + strerror(err));
+  }
+  setpgid(child, child);
+
+  // Writes must never block: while the tool's pipe is full, we keep
+  // reading its output (see feed).
+  if (stdin_fd >= 0)
+    fcntl(stdin_fd, F_SETFL, fcntl(stdin_fd, F_GETFL) | O_NONBLOCK);
+
+  in_stream.exceptions(std::ios::badbit);
+  out_stream.exceptions(std::ios::badbit);
+#endif /* PROVSQL_NO_SUBPROCESS */
+}
+
+ExternalToolProcess::~ExternalToolProcess()
+{
+  kill();
+}
+
+void ExternalToolProcess::kill()
+{
+  if (child > 0) {
+    killpg(child, SIGKILL);
+    pid_t r;
+    do { r = waitpid(child, &status, 0); } while (r < 0 && errno == EINTR);
+    child = -1;
+  }
+  if (stdin_fd >= 0) {
+    close(stdin_fd);
+    stdin_fd = -1;
+  }
+  if (stdout_fd >= 0) {
+    close(stdout_fd);
+    stdout_fd = -1;
+  }
+}
+
+void ExternalToolProcess::checkInterrupts()
+{
+  // Same rule as run_in_own_pgroup: stop the tool, and leave raising the
+  // pending interrupt to the caller, once out of the stream machinery.
+  if (QueryCancelPending || ProcDiePending) {
+    kill();
+    throw std::runtime_error("interrupted");
+  }
+}
+
+bool ExternalToolProcess::readPending()
+{
+  char chunk[1<<16];
+  ssize_t r = read(stdout_fd, chunk, sizeof chunk);
+  if (r > 0) {
+    pending.append(chunk, r);
+    return true;
+  }
+  if (r == 0 || (errno != EINTR && errno != EAGAIN)) {
+    close(stdout_fd);
+    stdout_fd = -1;
+  }
+  return false;
+}
+
+void ExternalToolProcess::feed(const char *data, size_t n)
+{
+  while (n > 0 && stdin_fd >= 0) {
+    struct pollfd fds[2] = {{stdin_fd, POLLOUT, 0}, {stdout_fd, POLLIN, 0}};
+    int r = poll(fds, stdout_fd >= 0 ? 2 : 1, 100);
+    checkInterrupts();
+    if (r < 0 && errno != EINTR)
+      throw std::runtime_error(std::string("poll: ") + strerror(errno));
+    if (r <= 0)
+      continue;
+
+    if (stdout_fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+      readPending();
+
+    if (fds[0].revents & (POLLOUT | POLLHUP | POLLERR)) {
+      ssize_t w = write(stdin_fd, data, n);
+      if (w > 0) {
+        data += w;
+        n -= w;
+      } else if (w < 0 && errno != EINTR && errno != EAGAIN) {
+        // EPIPE: the tool stopped reading.  Drop the rest of the input;
+        // its exit status tells whether that was an error.
+        close(stdin_fd);
+        stdin_fd = -1;
+      }
+    }
+  }
+}
+
+size_t ExternalToolProcess::drain(char *data, size_t n)
+{
+  while (pending_pos == pending.size()) {
+    pending.clear();
+    pending_pos = 0;
+    if (stdout_fd < 0)
+      return 0;
+    struct pollfd fd = {stdout_fd, POLLIN, 0};
+    int r = poll(&fd, 1, 100);
+    checkInterrupts();
+    if (r < 0 && errno != EINTR)
+      throw std::runtime_error(std::string("poll: ") + strerror(errno));
+    if (r > 0) {
+      // Read straight into the caller's buffer: nothing is set aside.
+      ssize_t got = read(stdout_fd, data, n);
+      if (got > 0)
+        return got;
+      if (got == 0 || (errno != EINTR && errno != EAGAIN)) {
+        close(stdout_fd);
+        stdout_fd = -1;
+      }
+    }
+  }
+  size_t k = std::min(n, pending.size() - pending_pos);
+  memcpy(data, pending.data() + pending_pos, k);
+  pending_pos += k;
+  return k;
+}
+
+int ExternalToolProcess::InBuf::overflow(int c)
+{
+  p.feed(pbase(), pptr() - pbase());
+  setp(buf, buf + sizeof buf);
+  if (c != traits_type::eof()) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int ExternalToolProcess::InBuf::sync()
+{
+  p.feed(pbase(), pptr() - pbase());
+  setp(buf, buf + sizeof buf);
+  return 0;
+}
+
+int ExternalToolProcess::OutBuf::underflow()
+{
+  size_t n = p.drain(buf, sizeof buf);
+  if (n == 0)
+    return traits_type::eof();
+  setg(buf, buf, buf + n);
+  return traits_type::to_int_type(*gptr());
+}
+
+void ExternalToolProcess::closeInput()
+{
+  if (stdin_fd < 0)
+    return;
+  in_stream.flush();
+  if (stdin_fd >= 0) {
+    close(stdin_fd);
+    stdin_fd = -1;
+  }
+}
+
+int ExternalToolProcess::wait()
+{
+  closeInput();
+  char sink[1<<12];
+  while (drain(sink, sizeof sink) > 0)
+    ;
+
+  while (child > 0) {
+    pid_t w = waitpid(child, &status, WNOHANG);
+    if (w == child) {
+      child = -1;
+      break;
+    }
+    if (w < 0 && errno != EINTR) {
+      status = -1;
+      child = -1;
+      break;
+    }
+    checkInterrupts();
+    pg_usleep(10000);
+  }
+  CHECK_FOR_INTERRUPTS();
+  return status;
+}
+
 std::string find_external_tool(const std::string &name) {
   // Path-like names (containing '/') are tested directly without any
   // search-path walk; this matches POSIX execvp semantics.
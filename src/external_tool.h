@@ -14,6 +14,10 @@
  * given binary is present and executable, so callers can fail with an
  * actionable error before composing a command line.
  *
+ * @c ExternalToolProcess runs a command the same way, with pipes on its
+ * standard input and/or output, so that a problem can be streamed into a
+ * tool as it is generated and its result parsed as it is produced.
+ *
  * @c format_external_tool_status() decodes a @c system() return value
  * into a human-readable message that distinguishes "tool not found"
  * (shell exit 127), "tool not executable" (126), "killed by signal", and
@@ -41,6 +45,12 @@ inline std::string format_external_tool_status(int, const std::string &tool) {
   return "Error executing " + tool;
 }
 #else
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+#include <sys/types.h>
+
 /**
  * @brief Run a shell command line in its own process group, optionally
  *        extending @c PATH, interruptible by query cancel / statement_timeout.
@@ -73,6 +83,113 @@ int run_external_tool(const std::string &cmdline);
  */
 std::string find_external_tool(const std::string &name);
 
+/**
+ * @brief An external tool running with pipes on its standard streams.
+ *
+ * Started like @c run_external_tool() -- through @c /bin/sh @c -c, in its
+ * own process group, with @c provsql.tool_search_path prepended to
+ * @c PATH -- but with its standard input fed by @c in() and/or its
+ * standard output read through @c out(), instead of files.
+ *
+ * Writes to @c in() never deadlock against a tool that already produces
+ * output: whatever the tool writes meanwhile is set aside and served
+ * first by @c out().  A tool that exits without reading all its input just
+ * has the rest dropped; its exit status says whether that was an error.
+ * A query cancel or backend termination arriving while either stream
+ * waits on the tool kills the tool's process group and throws, leaving
+ * the interrupt pending for the caller's @c CHECK_FOR_INTERRUPTS().
+ *
+ * The destructor kills a tool that is still running, so an exception
+ * thrown while parsing its output never leaves it behind.
+ */
+class ExternalToolProcess {
+public:
+  /**
+   * @brief Start @p cmdline.
+   * @param cmdline      Shell command line, passed verbatim to @c /bin/sh -c.
+   * @param pipe_stdin   Feed the tool's standard input through @c in().
+   * @param pipe_stdout  Read the tool's standard output through @c out().
+   * @throws std::runtime_error if the pipes or the process cannot be created.
+   */
+  ExternalToolProcess(const std::string &cmdline, bool pipe_stdin,
+                      bool pipe_stdout);
+  ~ExternalToolProcess();
+
+  ExternalToolProcess(const ExternalToolProcess &) = delete;
+  ExternalToolProcess &operator=(const ExternalToolProcess &) = delete;
+
+  /** @brief The tool's standard input (requires @c pipe_stdin). */
+  std::ostream &in() {
+    return in_stream;
+  }
+
+  /** @brief The tool's standard output (requires @c pipe_stdout). */
+  std::istream &out() {
+    return out_stream;
+  }
+
+  /** @brief Flush and close the tool's standard input: end of its problem. */
+  void closeInput();
+
+  /**
+   * @brief Wait for the tool to exit.
+   *
+   * Closes its standard input and discards whatever of its standard output
+   * was not read.
+   *
+   * @return A @c wait(2) status, as @c run_external_tool() returns.
+   */
+  int wait();
+
+private:
+  /** @brief Write side of the tool's standard input. */
+  class InBuf : public std::streambuf {
+    ExternalToolProcess &p;
+    char buf[1<<16];
+  public:
+    explicit InBuf(ExternalToolProcess &p) : p(p) {
+      setp(buf, buf+sizeof buf);
+    }
+  protected:
+    int overflow(int c) override;
+    int sync() override;
+  };
+
+  /** @brief Read side of the tool's standard output. */
+  class OutBuf : public std::streambuf {
+    ExternalToolProcess &p;
+    char buf[1<<16];
+  public:
+    explicit OutBuf(ExternalToolProcess &p) : p(p) {
+      setg(buf, buf, buf);
+    }
+  protected:
+    int underflow() override;
+  };
+
+  /** @brief Write @p n bytes to the tool, setting its output aside meanwhile. */
+  void feed(const char *data, size_t n);
+  /** @brief Read up to @p n bytes of the tool's output; 0 at its end. */
+  size_t drain(char *data, size_t n);
+  /** @brief Read what the tool has written into @c pending, once. */
+  bool readPending();
+  /** @brief Kill and reap the tool, and throw, if a cancel is pending. */
+  void checkInterrupts();
+  /** @brief Kill the tool's process group, reap it, close the pipes. */
+  void kill();
+
+  pid_t child;                 ///< The tool's pid, or -1 once reaped
+  int status;                  ///< Its wait status, once reaped
+  int stdin_fd;                ///< Our end of its standard input, or -1
+  int stdout_fd;               ///< Our end of its standard output, or -1
+  std::string pending;         ///< Output read while feeding its input
+  size_t pending_pos;          ///< Part of @c pending already served
+  InBuf in_buf;
+  OutBuf out_buf;
+  std::ostream in_stream;
+  std::istream out_stream;
+};
+
 /**
  * @brief Decode a @c system() return value into a human-readable message.
  *
@@ -25,6 +25,10 @@ extern "C" {
 #include "kcmcp_protocol.h"
 #include "provsql_config.h"
 
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -38,6 +42,10 @@ constexpr uint32_t CLIENT_RECV_MAX = 256u * 1024 * 1024;
 // floor, so any conformant server accepts it without advertising a larger
 // max_payload (which we do not parse from its HELLO).
 constexpr uint32_t CLIENT_SEND_MAX = 1u * 1024 * 1024;
+// Problems at least this large are first named by their SHA-256 alone when
+// the server keeps a result cache: a hit then spares sending them at all,
+// and a miss costs one small round trip before the full REQUEST.
+constexpr size_t DIGEST_FIRST_MIN = 64u * 1024;
 
 // Connect to "unix:/path" or "host:port"; returns a connected fd or -1.
 int connect_endpoint(const std::string &endpoint)
@@ -101,9 +109,10 @@ uint16_t get_u16(const std::string &s, size_t off)
        | uint16_t(static_cast<unsigned char>(s[off + 1]));
 }
 
-// A job-level ERROR frame from the server (codes 1-6): a valid response on a
-// healthy, synchronised connection, distinct from an I/O / protocol failure --
-// so the caller propagates it without dropping or retrying the connection.
+// A job-level ERROR frame from the server (codes 1-6, or 10 when busy): a valid
+// response on a healthy, synchronised connection, distinct from an I/O /
+// protocol failure -- so the caller propagates it without dropping or retrying
+// the connection.
 struct ServerError : std::runtime_error {
   using std::runtime_error::runtime_error;
 };
@@ -116,6 +125,9 @@ struct ServerError : std::runtime_error {
 int g_fd = -1;                 // cached connection fd, or -1 when none
 std::string g_endpoint;        // endpoint g_fd is connected to
 uint32_t g_request_id = 0;     // monotonically increasing REQUEST id
+bool g_result_cache = false;   // server advertised the result-cache feature
+bool g_compress = false;       // zstd compression agreed at the handshake
+bool g_binary = false;         // server compiles to ddnnf-bin
 bool g_atexit_registered = false;
 
 void close_cached()
@@ -168,6 +180,37 @@ void wait_readable_or_cancel()
   }
 }
 
+// Whether the array at @p path (e.g. "features") of the server HELLO
+// @p hello lists @p item.
+bool hello_lists(const std::string &hello, const char *path, const char *item)
+{
+  try {
+    boost::property_tree::ptree pt;
+    std::istringstream is(hello);
+    boost::property_tree::read_json(is, pt);
+    auto array = pt.get_child_optional(path);
+    if (array)
+      for (const auto &f : *array)      // JSON array: elements have empty keys
+        if (f.second.get_value<std::string>() == item)
+          return true;
+  } catch (...) {
+  }
+  return false;
+}
+
+// The string member @p key of the server HELLO @p hello; empty if absent.
+std::string hello_string(const std::string &hello, const char *key)
+{
+  try {
+    boost::property_tree::ptree pt;
+    std::istringstream is(hello);
+    boost::property_tree::read_json(is, pt);
+    return pt.get<std::string>(key, std::string());
+  } catch (...) {
+    return std::string();
+  }
+}
+
 // Ensure g_fd is a handshaken connection to @p endpoint, reusing the cached one
 // when it matches.  Throws (and leaves g_fd == -1) if it cannot connect or
 // handshake.
@@ -182,7 +225,12 @@ void ensure_connection(const std::string &endpoint)
     throw std::runtime_error("cannot connect to KCMCP endpoint '" + endpoint + "'");
   try {
     Connection conn(fd, CLIENT_RECV_MAX, CLIENT_SEND_MAX);
-    conn.send(Type::HELLO, 0, "{\"kcmcp\":[1,0],\"client\":\"ProvSQL\"}");
+    // Offer compression over TCP only: through a Unix socket, copying the
+    // bytes is cheaper than compressing them.
+    bool offer = compression_available() && endpoint.rfind("unix:", 0) != 0;
+    conn.send(Type::HELLO, 0,
+              std::string("{\"kcmcp\":[1,0],\"client\":\"ProvSQL\"")
+              + (offer ? ",\"compression\":[\"zstd\"]}" : "}"));
     Message m;
     if (!conn.recv(m))
       throw std::runtime_error("KCMCP server closed during handshake");
@@ -191,6 +239,9 @@ void ensure_connection(const std::string &endpoint)
                                + (m.payload.size() > 2 ? m.payload.substr(2) : ""));
     if (m.type != Type::HELLO)
       throw std::runtime_error("KCMCP: expected HELLO from server");
+    g_result_cache = hello_lists(m.payload, "features", "result-cache");
+    g_binary = hello_lists(m.payload, "output_formats.compile", "ddnnf-bin");
+    g_compress = offer && hello_string(m.payload, "compression") == "zstd";
   } catch (...) {
     ::close(fd);
     throw;
@@ -199,23 +250,28 @@ void ensure_connection(const std::string &endpoint)
   g_endpoint = endpoint;
 }
 
-// Issue one compile REQUEST on the cached connection and return the d-DNNF.
-std::string do_compile(uint8_t input_format, const std::string &problem)
+// A compile REQUEST payload, wanting ddnnf-bin when the server offers it
+// (it spares us tokenising NNF text), ddnnf-nnf otherwise.
+std::string compile_request(uint8_t input_format, const std::string &options,
+                            const std::string &problem)
 {
-  Connection conn(g_fd, CLIENT_RECV_MAX, CLIENT_SEND_MAX);
-
+  const OutputFormat out = g_binary ? OutputFormat::DDNNF_BIN : OutputFormat::DDNNF_NNF;
   std::string req;
   req.push_back(static_cast<char>(2));             // operation: compile
   req.push_back(static_cast<char>(input_format));  // 0 dimacs-cnf / 1 circuit-bcs12
-  req.push_back(static_cast<char>(4));             // output_format: ddnnf-nnf
+  req.push_back(static_cast<char>(out));           // output_format
   req.push_back(0);                                // reserved
-  req.push_back(0);                                // options_len hi
-  req.push_back(0);                                // options_len lo
+  req.push_back(static_cast<char>(options.size() >> 8));    // options_len hi
+  req.push_back(static_cast<char>(options.size() & 0xff));  // options_len lo
+  req += options;
   req += problem;
-  conn.send(Type::REQUEST, ++g_request_id, req);
+  return req;
+}
 
-  // Read frames until the RESULT, skipping PROGRESS heartbeats; honour
-  // cancel/timeout while the server computes.
+// Read frames until the RESULT or ERROR answering the last REQUEST, skipping
+// PROGRESS heartbeats; honour cancel/timeout while the server computes.
+Message await_reply(Connection &conn)
+{
   Message m;
   for (;;) {
     wait_readable_or_cancel();
@@ -223,26 +279,59 @@ std::string do_compile(uint8_t input_format, const std::string &problem)
       throw std::runtime_error("KCMCP server closed before RESULT");
     if (m.type == Type::PROGRESS)
       continue;
-    if (m.type == Type::ERROR) {
-      uint16_t code = m.payload.size() >= 2 ? get_u16(m.payload, 0) : 0;
-      std::string msg = m.payload.size() > 2 ? m.payload.substr(2) : "";
-      throw ServerError("KCMCP server error " + std::to_string(code)
-                        + ": " + msg);
-    }
-    if (m.type == Type::RESULT)
-      break;
+    if (m.type == Type::RESULT || m.type == Type::ERROR)
+      return m;
     throw std::runtime_error("KCMCP: unexpected frame type in reply");
   }
+}
+
+// Issue one compile REQUEST on the cached connection and return the d-DNNF;
+// @p binary tells whether it is in ddnnf-bin rather than ddnnf-nnf.
+std::string do_compile(uint8_t input_format, const std::string &problem,
+                       bool &binary)
+{
+  Connection conn(g_fd, CLIENT_RECV_MAX, CLIENT_SEND_MAX);
+  conn.set_compression(g_compress);
+
+  // Name a large problem by its digest first: another backend may have had
+  // it compiled already.  ERROR 11 means the server does not hold it.
+  Message m;
+  bool answered = false;
+  if (g_result_cache && problem.size() >= DIGEST_FIRST_MIN) {
+    conn.send(Type::REQUEST, ++g_request_id,
+              compile_request(input_format,
+                              "{\"problem_sha256\":\"" + sha256_hex(problem) + "\"}",
+                              std::string()));
+    m = await_reply(conn);
+    answered = !(m.type == Type::ERROR && m.payload.size() >= 2
+                 && get_u16(m.payload, 0)
+                 == static_cast<uint16_t>(ErrorCode::UNKNOWN_PROBLEM));
+  }
+  if (!answered) {
+    conn.send(Type::REQUEST, ++g_request_id,
+              compile_request(input_format, std::string(), problem));
+    m = await_reply(conn);
+  }
+
+  if (m.type == Type::ERROR) {
+    uint16_t code = m.payload.size() >= 2 ? get_u16(m.payload, 0) : 0;
+    std::string msg = m.payload.size() > 2 ? m.payload.substr(2) : "";
+    throw ServerError("KCMCP server error " + std::to_string(code)
+                      + ": " + msg);
+  }
 
   // RESULT payload: result_format u8, reserved u8, meta_len u16, meta, result.
   if (m.payload.size() < 4)
     throw std::runtime_error("KCMCP: truncated RESULT");
-  if (static_cast<unsigned char>(m.payload[0]) != 4)
-    throw std::runtime_error("KCMCP: server returned a non-ddnnf-nnf result");
+  const auto format = static_cast<OutputFormat>(m.payload[0]);
+  if (format != OutputFormat::DDNNF_NNF && format != OutputFormat::DDNNF_BIN)
+    throw std::runtime_error("KCMCP: server returned a non-d-DNNF result");
+  binary = (format == OutputFormat::DDNNF_BIN);
   uint16_t meta_len = get_u16(m.payload, 2);
   if (4u + meta_len > m.payload.size())
     throw std::runtime_error("KCMCP: malformed RESULT meta");
-  return m.payload.substr(4 + meta_len);
+  m.payload.erase(0, 4 + meta_len);  // in place: a d-DNNF can be large
+  return std::move(m.payload);
 }
 
 }  // namespace
@@ -250,7 +339,7 @@ std::string do_compile(uint8_t input_format, const std::string &problem)
 namespace provsql {
 
 std::string kcmcp_compile(const std::string &endpoint, uint8_t input_format,
-                          const std::string &problem)
+                          const std::string &problem, bool &binary)
 {
   // SIGPIPE would otherwise kill the backend if the server vanishes mid-send.
   ::signal(SIGPIPE, SIG_IGN);
@@ -268,7 +357,7 @@ std::string kcmcp_compile(const std::string &endpoint, uint8_t input_format,
     bool reusing = (g_fd >= 0 && g_endpoint == endpoint);
     try {
       ensure_connection(endpoint);
-      return do_compile(input_format, problem);
+      return do_compile(input_format, problem, binary);
     } catch (const ServerError &) {
       throw;
     } catch (const std::exception &) {
@@ -18,14 +18,18 @@
 namespace provsql {
 
 /**
- * @brief Compile @p problem on a KCMCP server and return its d-DNNF NNF text.
+ * @brief Compile @p problem on a KCMCP server and return its d-DNNF.
  *
  * Connects to @p endpoint (@c "unix:/path" or @c "host:port"), performs the
  * HELLO handshake, issues one @c compile REQUEST for @p problem in the given
- * @p input_format (0 = @c dimacs-cnf, 1 = @c circuit-bcs12) wanting
- * @c ddnnf-nnf output, and returns the RESULT's NNF text verbatim (parsed by
- * @c BooleanCircuit::parseDDNNF, exactly as the CLI temp-file path is).  A
- * fresh connection per call.
+ * @p input_format (0 = @c dimacs-cnf, 1 = @c circuit-bcs12), and returns the
+ * RESULT's d-DNNF verbatim: @c ddnnf-bin when the server offers it (parsed
+ * by @c BooleanCircuit::parseBinaryDDNNF), @c ddnnf-nnf text otherwise
+ * (parsed by @c BooleanCircuit::parseDDNNF, exactly as the CLI temp-file
+ * path is), as @p binary tells.  The
+ * connection is kept for the backend's life.  When the server advertises
+ * @c result-cache, a large problem is first named by its SHA-256 alone and
+ * sent only if the server does not hold it.
  *
  * Honours PostgreSQL query-cancel / @c statement_timeout while waiting: a
  * pending cancel closes the socket (so the server abandons the job) and is
@@ -35,7 +39,8 @@ namespace provsql {
  */
 std::string kcmcp_compile(const std::string &endpoint,
                           uint8_t input_format,
-                          const std::string &problem);
+                          const std::string &problem,
+                          bool &binary);
 
 }  // namespace provsql
 
@@ -4,6 +4,7 @@
  */
 #include "kcmcp_protocol.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 
@@ -11,6 +12,10 @@ extern "C" {
 #include <unistd.h>
 }
 
+#ifdef PROVSQL_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 namespace kcmcp {
 
 const char *operation_name(Operation op)
@@ -40,6 +45,7 @@ const char *output_format_name(OutputFormat fmt)
     case OutputFormat::DOUBLE:    return "double";
     case OutputFormat::BIGINT:    return "bigint";
     case OutputFormat::DDNNF_NNF: return "ddnnf-nnf";
+    case OutputFormat::DDNNF_BIN: return "ddnnf-bin";
   }
   return "?";
 }
@@ -100,11 +106,75 @@ void write_all(int fd, const void *buf, size_t n)
 
 } // namespace
 
+#ifdef PROVSQL_HAVE_ZSTD
+struct Connection::Zstd {
+  ZSTD_CCtx *c = nullptr;
+  ZSTD_DCtx *d = nullptr;
+
+  Zstd() : c(ZSTD_createCCtx()), d(ZSTD_createDCtx())
+  {
+    if (!c || !d) {
+      ZSTD_freeCCtx(c);
+      ZSTD_freeDCtx(d);
+      throw std::bad_alloc();
+    }
+  }
+  ~Zstd()
+  {
+    ZSTD_freeCCtx(c);
+    ZSTD_freeDCtx(d);
+  }
+
+  // Decompress @p n bytes of a zstd frame, appending to @p out; returns
+  // false on corrupt input, and sets @p ended when the frame is complete.
+  bool decompress(const char *src, size_t n, std::string &out, bool &ended)
+  {
+    ZSTD_inBuffer in = { src, n, 0 };
+    const size_t chunk = ZSTD_DStreamOutSize();
+    for (;;) {
+      size_t base = out.size();
+      out.resize(base + chunk);
+      ZSTD_outBuffer ob = { &out[base], chunk, 0 };
+      size_t r = ZSTD_decompressStream(d, &ob, &in);
+      out.resize(base + ob.pos);
+      if (ZSTD_isError(r))
+        return false;
+      ended = (r == 0);
+      // Done with this input once it is consumed and the output buffer was
+      // not filled (a full one may leave decoded bytes to flush).
+      if (in.pos == in.size && ob.pos < chunk)
+        return true;
+    }
+  }
+};
+
+bool compression_available() { return true; }
+#else
+struct Connection::Zstd {};
+
+bool compression_available() { return false; }
+#endif
+
+Connection::Connection(int fd, uint32_t recv_max, uint32_t send_max)
+  : fd_(fd), recv_max_(recv_max), send_max_(send_max) {}
+
+Connection::~Connection() = default;
+
+void Connection::set_compression(bool on)
+{
+  compress_ = on && compression_available();
+  if (compress_ && !zstd_)
+    zstd_.reset(new Zstd);
+}
+
 bool Connection::recv(Message &out)
 {
   out.payload.clear();
   bool first = true;
-  bool compressed = false;
+  bool compressed = false;   // this message's frames carry FLAG_COMPRESSED
+  bool decoding = false;     // ... and we are decompressing them
+  bool decoded = false;      // the zstd frame ended cleanly
+  std::string frame;
   for (;;) {
     unsigned char hdr[HEADER_LEN];
     bool eof_at_start;
@@ -123,55 +193,104 @@ bool Connection::recv(Message &out)
         "KCMCP: frame payload " + std::to_string(payload_len)
         + " exceeds max_payload " + std::to_string(recv_max_));
 
-    // KCMCP v1 negotiates no compression, so a COMPRESSED payload cannot be
-    // decoded.  Its length is bounded by max_payload, so we still read it to
-    // keep the stream synchronised, then report a *non-fatal* error: the
-    // caller answers with an ERROR (code 9) and keeps serving, letting the
-    // peer retry uncompressed on the same connection.
-    if (flags & FLAG_COMPRESSED)
-      compressed = true;
-
     if (first) {
       out.type = type;
       out.request_id = request_id;
+      compressed = flags & FLAG_COMPRESSED;
+      // Without negotiated compression a COMPRESSED payload cannot be
+      // decoded.  Its length is bounded by max_payload, so we still read it
+      // to keep the stream synchronised, then report a *non-fatal* error:
+      // the caller answers with an ERROR (code 9) and keeps serving,
+      // letting the peer retry uncompressed on the same connection.
+      decoding = compressed && compress_;
+#ifdef PROVSQL_HAVE_ZSTD
+      if (decoding)
+        ZSTD_DCtx_reset(zstd_->d, ZSTD_reset_session_only);
+#endif
       first = false;
     } else if (type != out.type || request_id != out.request_id) {
       throw std::runtime_error("KCMCP: interleaved MORE frames");
+    } else if (bool(flags & FLAG_COMPRESSED) != compressed) {
+      throw std::runtime_error("KCMCP: COMPRESSED flag changed within a message");
     }
 
     if (payload_len > 0) {
-      size_t base = out.payload.size();
-      out.payload.resize(base + payload_len);
+      // A compressed frame is read aside and decompressed into the message.
+      std::string &dst = compressed ? frame : out.payload;
+      size_t base = compressed ? 0 : dst.size();
+      dst.resize(base + payload_len);
       bool eof2;
-      if (!read_exact(fd_, &out.payload[base], payload_len, eof2))
+      if (!read_exact(fd_, &dst[base], payload_len, eof2))
         throw std::runtime_error("KCMCP: truncated frame payload");
+#ifdef PROVSQL_HAVE_ZSTD
+      if (decoding && !zstd_->decompress(frame.data(), frame.size(),
+                                         out.payload, decoded))
+        decoding = false;   // corrupt: drain the rest, then report it
+#endif
     }
     if (!(flags & FLAG_MORE))
       break;
   }
-  if (compressed)
+  if (compressed && !decoding)
     throw ProtocolError(ErrorCode::COMPRESSION_UNSUPPORTED,
-      "KCMCP: COMPRESSED payloads are not supported by this server",
+      compress_ ? "KCMCP: corrupt COMPRESSED payload"
+                : "KCMCP: COMPRESSED payloads were not negotiated",
       /*fatal=*/false);
+  if (compressed && !decoded)
+    throw ProtocolError(ErrorCode::COMPRESSION_UNSUPPORTED,
+      "KCMCP: truncated COMPRESSED payload", /*fatal=*/false);
   return true;
 }
 
+void Connection::write_frame(Type type, uint8_t flags, uint32_t request_id,
+                             const char *data, size_t n)
+{
+  unsigned char hdr[HEADER_LEN];
+  hdr[0] = static_cast<uint8_t>(type);
+  hdr[1] = flags;
+  put_u32(hdr + 2, request_id);
+  put_u32(hdr + 6, static_cast<uint32_t>(n));
+  write_all(fd_, hdr, HEADER_LEN);
+  if (n > 0)
+    write_all(fd_, data, n);
+}
+
 void Connection::send(Type type, uint32_t request_id, const std::string &payload)
 {
+#ifdef PROVSQL_HAVE_ZSTD
+  if (compress_ && payload.size() >= COMPRESS_MIN) {
+    // Stream the payload through the compressor, shipping each full output
+    // buffer as a frame: the compressed message is never held whole.
+    ZSTD_CCtx_reset(zstd_->c, ZSTD_reset_session_only);
+    ZSTD_CCtx_setPledgedSrcSize(zstd_->c, payload.size());
+    const size_t chunk = std::min<size_t>(send_max_ ? send_max_ : 1u << 20,
+                                          ZSTD_CStreamOutSize() * 8);
+    std::string buf(chunk, '\0');
+    ZSTD_inBuffer in = { payload.data(), payload.size(), 0 };
+    for (;;) {
+      ZSTD_outBuffer ob = { &buf[0], chunk, 0 };
+      size_t left;
+      do {
+        left = ZSTD_compressStream2(zstd_->c, &ob, &in, ZSTD_e_end);
+        if (ZSTD_isError(left))
+          throw std::runtime_error(std::string("KCMCP: zstd: ")
+                                   + ZSTD_getErrorName(left));
+      } while (left != 0 && ob.pos < ob.size);
+      write_frame(type, FLAG_COMPRESSED | (left ? FLAG_MORE : 0), request_id,
+                  buf.data(), ob.pos);
+      if (left == 0)
+        return;
+    }
+  }
+#endif
+
   const size_t chunk = send_max_ ? send_max_ : payload.size() + 1;
   size_t off = 0;
   do {
     size_t n = payload.size() - off;
     if (n > chunk) n = chunk;
     bool more = (off + n) < payload.size();
-    unsigned char hdr[HEADER_LEN];
-    hdr[0] = static_cast<uint8_t>(type);
-    hdr[1] = more ? FLAG_MORE : 0;
-    put_u32(hdr + 2, request_id);
-    put_u32(hdr + 6, static_cast<uint32_t>(n));
-    write_all(fd_, hdr, HEADER_LEN);
-    if (n > 0)
-      write_all(fd_, payload.data() + off, n);
+    write_frame(type, more ? FLAG_MORE : 0, request_id, payload.data() + off, n);
     off += n;
   } while (off < payload.size());
 }
@@ -217,4 +336,74 @@ std::string build_error(ErrorCode code, const std::string &message)
   return out;
 }
 
+// SHA-256 (FIPS 180-4).  A cryptographic digest, not a cheaper hash: a
+// server's result cache is shared by all its clients, and a crafted
+// collision would hand one client's answer to another's problem.
+std::string sha256_hex(const std::string &data)
+{
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+  uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+  auto block = [&](const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+      w[i] = get_u32(p + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+      uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+      w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3],
+             e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25))
+                  + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22))
+                  + ((a & b) ^ (a & c) ^ (b & c));
+      hh = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+  };
+
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data.data());
+  size_t n = data.size(), full = n / 64 * 64;
+  for (size_t i = 0; i < full; i += 64)
+    block(p + i);
+
+  // Padding: 0x80, zeros, then the bit length as a big-endian u64.
+  unsigned char tail[128] = {0};
+  size_t rest = n - full;
+  memcpy(tail, p + full, rest);
+  tail[rest] = 0x80;
+  size_t tail_len = rest < 56 ? 64 : 128;
+  uint64_t bits = static_cast<uint64_t>(n) * 8;
+  for (int i = 0; i < 8; ++i)
+    tail[tail_len - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+  for (size_t i = 0; i < tail_len; i += 64)
+    block(tail + i);
+
+  static const char hex[] = "0123456789abcdef";
+  std::string out;
+  out.reserve(64);
+  for (uint32_t v : h)
+    for (int i = 28; i >= 0; i -= 4)
+      out.push_back(hex[(v >> i) & 0xf]);
+  return out;
+}
+
 } // namespace kcmcp
@@ -8,11 +8,16 @@
  * the REQUEST / RESULT / ERROR payloads and the operation / format / error
  * registries.  It is used by the @c tdkc reference server and is written to
  * be reusable by a future ProvSQL client.  No PostgreSQL dependency.
+ *
+ * When built with @c PROVSQL_HAVE_ZSTD (libzstd found at build time), a
+ * Connection can also compress its messages with zstd, once both sides
+ * agreed on it in the HELLO exchange (see compression_available()).
  */
 #ifndef PROVSQL_KCMCP_PROTOCOL_H
 #define PROVSQL_KCMCP_PROTOCOL_H
 
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -34,7 +39,7 @@ enum class Type : uint8_t {
 /// Frame flags (header byte 1).
 enum Flag : uint8_t {
   FLAG_MORE       = 0x01,  ///< payload continues in the next frame
-  FLAG_COMPRESSED = 0x02,  ///< payload is zstd-compressed (unused here)
+  FLAG_COMPRESSED = 0x02,  ///< payload is zstd-compressed (once negotiated)
 };
 
 /// Operation registry (REQUEST byte 0 / HELLO @c operations names).
@@ -45,7 +50,9 @@ enum class InputFormat : uint8_t { DIMACS_CNF = 0, CIRCUIT_BCS12 = 1 };
 
 /// Output-format registry (REQUEST byte 2 / RESULT byte 0; one shared space).
 enum class OutputFormat : uint8_t {
-  DECIMAL = 0, RATIONAL = 1, DOUBLE = 2, BIGINT = 3, DDNNF_NNF = 4 };
+  DECIMAL = 0, RATIONAL = 1, DOUBLE = 2, BIGINT = 3, DDNNF_NNF = 4,
+  DDNNF_BIN = 7  ///< binary d-DNNF (see dDNNF::toBinaryNNF); 5, 6 reserved
+};
 
 /// ERROR codes.
 enum class ErrorCode : uint16_t {
@@ -58,6 +65,8 @@ enum class ErrorCode : uint16_t {
   PAYLOAD_TOO_LARGE       = 7,
   UNSUPPORTED_VERSION     = 8,  ///< client requires a KCMCP major this server lacks
   COMPRESSION_UNSUPPORTED = 9,  ///< COMPRESSED frame flag set, but unsupported
+  BUSY                    = 10, ///< server at capacity; retry later or elsewhere
+  UNKNOWN_PROBLEM         = 11, ///< problem_sha256 names no problem held; resend it
 };
 
 const char *operation_name(Operation op);
@@ -99,15 +108,23 @@ struct Request {
  * @c recv_max is the largest single-frame payload this side accepts (its
  * advertised @c max_payload); @c send_max is the peer's accept limit, used to
  * split outbound payloads into MORE-flagged frames.  Blocking I/O.
+ *
+ * With compression on, a payload of at least @c COMPRESS_MIN bytes is sent
+ * as one zstd frame, compressed as it is written and split across
+ * COMPRESSED|MORE frames; received compressed messages are decompressed as
+ * their frames arrive.
  */
 class Connection {
 public:
-  Connection(int fd, uint32_t recv_max, uint32_t send_max)
-    : fd_(fd), recv_max_(recv_max), send_max_(send_max) {}
+  Connection(int fd, uint32_t recv_max, uint32_t send_max);
+  ~Connection();
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
 
   /// Read one logical message (concatenating MORE frames).  Returns false on
   /// a clean peer close at a frame boundary.  Throws ProtocolError on an
-  /// oversize frame, std::runtime_error on an I/O error or truncation.
+  /// oversize frame or an undecodable COMPRESSED message, std::runtime_error
+  /// on an I/O error or truncation.
   bool recv(Message &out);
 
   /// Send a message, splitting @p payload across MORE-flagged frames no larger
@@ -115,14 +132,33 @@ public:
   void send(Type type, uint32_t request_id, const std::string &payload);
   void send(Type type, uint32_t request_id) { send(type, request_id, std::string()); }
 
+  /// Compress large outbound payloads, and accept compressed inbound ones.
+  /// Only call once the HELLO exchange settled on @c zstd; a no-op in a
+  /// build without compression.
+  void set_compression(bool on);
+
   int fd() const { return fd_; }
 
+  /// Smallest payload worth compressing.
+  static constexpr size_t COMPRESS_MIN = 4096;
+
 private:
+  struct Zstd;  ///< streaming zstd contexts, created on first use
+
   int fd_;
   uint32_t recv_max_;
   uint32_t send_max_;
+  bool compress_ = false;
+  std::unique_ptr<Zstd> zstd_;
+
+  void write_frame(Type type, uint8_t flags, uint32_t request_id,
+                   const char *data, size_t n);
 };
 
+/// Whether this build can compress frames, i.e., may offer or accept
+/// @c "compression":"zstd" in the HELLO exchange.
+bool compression_available();
+
 /// Decode a REQUEST payload; returns false if structurally malformed.
 bool parse_request(const std::string &payload, Request &out);
 
@@ -133,6 +169,10 @@ std::string build_result(OutputFormat fmt, const std::string &meta_json,
 /// Build an ERROR payload (u16 code + UTF-8 message).
 std::string build_error(ErrorCode code, const std::string &message);
 
+/// Lower-case hexadecimal SHA-256 of @p data: the digest by which a REQUEST
+/// names, in its @c problem_sha256 option, a problem the server already holds.
+std::string sha256_hex(const std::string &data);
+
 } // namespace kcmcp
 
 #endif
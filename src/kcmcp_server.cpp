@@ -18,12 +18,21 @@
 #include <boost/property_tree/json_parser.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
 #include <iomanip>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 extern "C" {
 #include <sys/socket.h>
@@ -31,6 +40,7 @@ extern "C" {
 #include <netdb.h>
 #include <poll.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
@@ -48,12 +58,17 @@ struct TimedOut {};
 constexpr uint32_t SERVER_MAX_PAYLOAD = 256u * 1024 * 1024;  // advertised
 constexpr uint32_t CLIENT_FLOOR       = 1u * 1024 * 1024;    // client's 1 MiB
 constexpr long     KCMCP_MAJOR        = 1;   // protocol major this server speaks
+// Builds recurse along the decomposition and the d-DNNF, and a stack
+// overflow would take every session down with it: give session threads far
+// more stack than the default (it is only reserved, not committed).
+constexpr size_t   SESSION_STACK_SIZE = 256u * 1024 * 1024;
 
-// Context of the request currently being served, consulted by
+// Context of the request a session thread is serving, consulted by
 // provsql_tdkc_poll() (which the build loops call via CHECK_FOR_INTERRUPTS).
 struct ActiveJob {
   Connection *conn = nullptr;
   uint32_t request_id = 0;
+  const char *phase = "compile";   // reported in PROGRESS
   bool cancel = false;
   steady::time_point start;
   steady::time_point last_progress;
@@ -61,7 +76,205 @@ struct ActiveJob {
   bool has_deadline = false;
   std::chrono::milliseconds progress_interval{2000};
 };
-ActiveJob *g_job = nullptr;
+thread_local ActiveJob *g_job = nullptr;
+
+// Admission control shared by all sessions: at most `workers` builds run at
+// once, at most `queue_max` more wait for a worker, first come first served,
+// and any further request is refused.
+class JobScheduler {
+  std::mutex m;
+  std::condition_variable cv;
+  unsigned workers = 1;
+  unsigned queue_max = 0;
+  unsigned running = 0;
+  std::deque<uint64_t> waiting;    // tickets, in arrival order
+  uint64_t next_ticket = 0;
+
+public:
+  void configure(unsigned w, unsigned q)
+  {
+    std::lock_guard<std::mutex> lock(m);
+    workers = std::max(1u, w);
+    queue_max = q;
+  }
+
+  unsigned nbWorkers()
+  {
+    std::lock_guard<std::mutex> lock(m);
+    return workers;
+  }
+
+  // One request's claim on a worker, released (or withdrawn from the queue)
+  // on destruction, whichever way the request ends.
+  class Slot {
+    JobScheduler &s;
+    uint64_t ticket = 0;
+    enum { RUNNING, QUEUED, REFUSED } state;
+
+  public:
+    explicit Slot(JobScheduler &sched) : s(sched)
+    {
+      std::lock_guard<std::mutex> lock(s.m);
+      if (s.running < s.workers && s.waiting.empty()) {
+        ++s.running;
+        state = RUNNING;
+      } else if (s.waiting.size() < s.queue_max) {
+        ticket = s.next_ticket++;
+        s.waiting.push_back(ticket);
+        state = QUEUED;
+      } else {
+        state = REFUSED;
+      }
+    }
+    Slot(const Slot &) = delete;
+    Slot &operator=(const Slot &) = delete;
+
+    bool refused() const { return state == REFUSED; }
+
+    // Wait up to @p d for a worker; true once this request holds one.
+    bool acquire(std::chrono::milliseconds d)
+    {
+      if (state != QUEUED)
+        return state == RUNNING;
+      std::unique_lock<std::mutex> lock(s.m);
+      auto ready = [&] {
+        return s.running < s.workers && s.waiting.front() == ticket;
+      };
+      if (!s.cv.wait_for(lock, d, ready))
+        return false;
+      s.waiting.pop_front();
+      ++s.running;
+      state = RUNNING;
+      s.cv.notify_all();   // the next in line may find a worker free too
+      return true;
+    }
+
+    ~Slot()
+    {
+      std::lock_guard<std::mutex> lock(s.m);
+      if (state == RUNNING)
+        --s.running;
+      else if (state == QUEUED)
+        s.waiting.erase(std::find(s.waiting.begin(), s.waiting.end(), ticket));
+      else
+        return;
+      s.cv.notify_all();
+    }
+  };
+};
+
+JobScheduler g_scheduler;
+std::atomic<unsigned> g_sessions{0};
+
+// What a build answers: a RESULT, or an ERROR any identical request would
+// get as well (a parse error, an excessive treewidth).
+struct Outcome {
+  bool ok = false;
+  OutputFormat format{};
+  std::string meta, result;        // when ok
+  ErrorCode code{};
+  std::string message;             // when not ok
+};
+
+// A build in progress, which identical requests attach to instead of
+// starting their own.  `retry` is set when it ends without an Outcome it
+// may share (cancelled, timed out, refused): the attached requests then go
+// through the cache again, one of them becoming the new leader.
+struct Flight {
+  bool done = false;
+  bool retry = false;
+  std::shared_ptr<const Outcome> outcome;
+};
+
+// Results of past builds, keyed by operation, formats and the problem's
+// SHA-256, in a least-recently-used list bounded in bytes; and the builds
+// in flight, under the same keys.
+class ResultCache {
+  using Entry = std::pair<std::string, std::shared_ptr<const Outcome>>;
+
+  std::mutex m;
+  std::condition_variable cv;
+  size_t max_bytes = 0;
+  size_t bytes = 0;
+  std::list<Entry> lru;            // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  std::unordered_map<std::string, std::shared_ptr<Flight>> flights;
+
+  static size_t cost(const Entry &e)
+  {
+    return e.first.size() + e.second->meta.size() + e.second->result.size()
+           + 128;
+  }
+
+public:
+  void configure(size_t max) { max_bytes = max; }
+  bool enabled() const { return max_bytes > 0; }
+
+  struct Lookup {
+    std::shared_ptr<const Outcome> hit;   // a cached result, or
+    std::shared_ptr<Flight> flight;       // the build to attach to or lead
+    bool leader = false;
+  };
+
+  // The cached result for @p key, else the build in flight for it, else (if
+  // @p may_lead) a new flight this request leads; else nothing.
+  Lookup lookup(const std::string &key, bool may_lead)
+  {
+    std::lock_guard<std::mutex> lock(m);
+    Lookup l;
+    auto it = index.find(key);
+    if (it != index.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      l.hit = it->second->second;
+      return l;
+    }
+    auto f = flights.find(key);
+    if (f != flights.end()) {
+      l.flight = f->second;
+    } else if (may_lead) {
+      l.flight = flights[key] = std::make_shared<Flight>();
+      l.leader = true;
+    }
+    return l;
+  }
+
+  // Wait up to @p d for @p f to end; true once it has.
+  bool wait(const Flight &f, std::chrono::milliseconds d)
+  {
+    std::unique_lock<std::mutex> lock(m);
+    return cv.wait_for(lock, d, [&] { return f.done; });
+  }
+
+  // End the flight for @p key, handing @p outcome (or, if null, a retry) to
+  // the attached requests, and keep a successful outcome for later ones.
+  void land(const std::string &key, const std::shared_ptr<Flight> &f,
+            std::shared_ptr<const Outcome> outcome)
+  {
+    std::lock_guard<std::mutex> lock(m);
+    f->done = true;
+    f->retry = !outcome;
+    f->outcome = outcome;
+    flights.erase(key);
+    cv.notify_all();
+
+    if (!outcome || !outcome->ok || !enabled())
+      return;
+    Entry e(key, std::move(outcome));
+    size_t c = cost(e);
+    if (c > max_bytes || index.count(key))
+      return;
+    lru.push_front(std::move(e));
+    index[key] = lru.begin();
+    bytes += c;
+    while (bytes > max_bytes) {
+      bytes -= cost(lru.back());
+      index.erase(lru.back().first);
+      lru.pop_back();
+    }
+  }
+};
+
+ResultCache g_results;
 
 // The major version from a client HELLO's "kcmcp":[major,minor]; -1 if the
 // field is absent or unparseable (treated leniently as compatible).
@@ -82,14 +295,38 @@ long client_major(const std::string &hello_json)
   }
 }
 
-std::string server_hello()
+// Whether a client HELLO lists "zstd" among the codecs of its
+// "compression" array (and this build can compress).
+bool client_offers_zstd(const std::string &hello_json)
+{
+  if (!compression_available())
+    return false;
+  try {
+    boost::property_tree::ptree pt;
+    std::istringstream is(hello_json);
+    boost::property_tree::read_json(is, pt);
+    auto codecs = pt.get_child_optional("compression");
+    if (codecs)
+      for (const auto &elem : *codecs)
+        if (elem.second.get_value<std::string>() == "zstd")
+          return true;
+  } catch (...) {
+  }
+  return false;
+}
+
+std::string server_hello(bool zstd)
 {
   std::ostringstream o;
   o << "{\"kcmcp\":1,\"engine\":\"tdkc\",\"max_payload\":" << SERVER_MAX_PAYLOAD
     << ",\"operations\":[\"compile\",\"wmc\"]"
     << ",\"input_formats\":[\"dimacs-cnf\"]"
-    << ",\"output_formats\":{\"compile\":[\"ddnnf-nnf\"],\"wmc\":[\"decimal\"]}"
-    << ",\"features\":[\"cancel\",\"progress\"]}";
+    << ",\"output_formats\":{\"compile\":[\"ddnnf-nnf\",\"ddnnf-bin\"],\"wmc\":[\"decimal\"]}"
+    << ",\"features\":[\"cancel\",\"progress\""
+    << (g_results.enabled() ? ",\"result-cache\"" : "") << "]";
+  if (zstd)
+    o << ",\"compression\":\"zstd\"";
+  o << "}";
   return o.str();
 }
 
@@ -116,6 +353,21 @@ void send_error(Connection &conn, uint32_t rid, ErrorCode code,
 }
 
 // Map an input gate's UUID ("v<n>") back to its CNF variable index.
+// String counterpart of option_long().
+std::string option_string(const std::string &options, const char *key)
+{
+  if (options.empty())
+    return std::string();
+  try {
+    boost::property_tree::ptree pt;
+    std::istringstream is(options);
+    boost::property_tree::read_json(is, pt);
+    return pt.get<std::string>(key, std::string());
+  } catch (...) {
+    return std::string();
+  }
+}
+
 int var_of_input_uuid(const std::string &u)
 {
   if (u.size() > 1 && u[0] == 'v') {
@@ -124,6 +376,97 @@ int var_of_input_uuid(const std::string &u)
   return -1;  // unknown -> toNNF falls back to the gate id
 }
 
+// Send @p o as the answer to request @p rid; @p cache, if any, tells in the
+// RESULT meta where the answer came from.
+void reply(Connection &conn, uint32_t rid, const Outcome &o, const char *cache)
+{
+  if (!o.ok) {
+    send_error(conn, rid, o.code, o.message);
+    return;
+  }
+  std::string meta = o.meta;
+  if (cache)
+    meta.insert(meta.size() - 1, std::string(",\"cache\":\"") + cache + "\"");
+  conn.send(Type::RESULT, rid, build_result(o.format, meta, o.result));
+}
+
+// Build the answer to @p req once @p slot holds a worker, servicing the
+// connection meanwhile.  Throws Cancelled or TimedOut.
+Outcome build(const Request &req, JobScheduler::Slot &slot, ActiveJob &job)
+{
+  // A ddnnf-bin answer carries the literal weights of a weighted problem.
+  const bool with_weights = req.output_format == OutputFormat::DDNNF_BIN
+                            && req.problem.find("c p weight") != std::string::npos;
+  const bool weighted = (req.operation == Operation::WMC) || with_weights;
+  Outcome out;
+
+  BooleanCircuit c;
+  gate_t root;
+  try {
+    root = parse_dimacs_cnf(req.problem, c, weighted);
+  } catch (const std::exception &e) {
+    out.code = ErrorCode::PARSE;
+    out.message = e.what();
+    return out;
+  }
+
+  // Queued: keep servicing the connection (CANCEL, PING, deadline,
+  // PROGRESS) until a worker frees up.  Poll once more before building, so
+  // a CANCEL sent right behind the REQUEST never costs a whole build.
+  job.phase = "queued";
+  while (!slot.acquire(std::chrono::milliseconds(20)))
+    provsql_tdkc_poll();
+  job.phase = "compile";
+  provsql_tdkc_poll();
+
+  try {
+    TreeDecomposition td(c);
+    auto dnnf = dDNNFTreeDecompositionBuilder{c, root, td}.build();
+
+    std::ostringstream meta;
+    out.ok = true;
+    if (req.operation == Operation::COMPILE) {
+      out.format = req.output_format;
+      out.result = req.output_format == OutputFormat::DDNNF_BIN
+                   ? dnnf.toBinaryNNF(var_of_input_uuid, with_weights)
+                   : dnnf.toNNF(var_of_input_uuid);
+      meta << "{\"treewidth\":" << td.getTreewidth()
+           << ",\"nodes\":" << dnnf.getNbGates() << ",\"exact\":true}";
+    } else {
+      out.format = OutputFormat::DECIMAL;
+      double p = dnnf.probabilityEvaluation();
+      meta << "{\"treewidth\":" << td.getTreewidth() << ",\"exact\":true}";
+      std::ostringstream val;
+      val << std::setprecision(15) << p;
+      out.result = val.str();
+    }
+    out.meta = meta.str();
+  } catch (const TreeDecompositionException &) {
+    out.ok = false;
+    out.code = ErrorCode::INTERNAL;
+    out.message = "treewidth exceeds the supported bound";
+  }
+  return out;
+}
+
+// The flight a request leads, landed as a retry for the requests attached
+// to it unless the build lands it with an Outcome.
+struct Lead {
+  const std::string &key;
+  std::shared_ptr<Flight> flight;
+
+  void land(std::shared_ptr<const Outcome> o)
+  {
+    g_results.land(key, flight, std::move(o));
+    flight.reset();
+  }
+  ~Lead()
+  {
+    if (flight)
+      g_results.land(key, flight, nullptr);
+  }
+};
+
 void handle_request(Connection &conn, const Message &msg)
 {
   Request req;
@@ -143,23 +486,32 @@ void handle_request(Connection &conn, const Message &msg)
                + "'; this engine reads dimacs-cnf");
     return;
   }
-  const bool weighted = (req.operation == Operation::WMC);
-  const OutputFormat want = weighted ? OutputFormat::DECIMAL : OutputFormat::DDNNF_NNF;
-  if (req.output_format != want) {
+  const bool format_ok = req.operation == Operation::WMC
+                         ? req.output_format == OutputFormat::DECIMAL
+                         : (req.output_format == OutputFormat::DDNNF_NNF
+                            || req.output_format == OutputFormat::DDNNF_BIN);
+  if (!format_ok) {
     send_error(conn, msg.request_id, ErrorCode::UNSUPPORTED_FORMAT,
                std::string("operation '") + operation_name(req.operation)
-               + "' produces '" + output_format_name(want) + "' here");
+               + (req.operation == Operation::WMC
+                  ? "' produces 'decimal' here"
+                  : "' produces 'ddnnf-nnf' or 'ddnnf-bin' here"));
     return;
   }
 
-  BooleanCircuit c;
-  gate_t root;
-  try {
-    root = parse_dimacs_cnf(req.problem, c, weighted);
-  } catch (const std::exception &e) {
-    send_error(conn, msg.request_id, ErrorCode::PARSE, e.what());
-    return;
-  }
+  // Identical requests share one answer: the key is the operation, the
+  // formats and the problem's SHA-256 -- computed here, or sent by a client
+  // that expects us to hold the problem already (an empty problem with a
+  // problem_sha256 option).  The options tdkc reads do not change results.
+  std::string digest = option_string(req.options, "problem_sha256");
+  const bool by_digest = req.problem.empty() && !digest.empty();
+  if (!by_digest)
+    digest = sha256_hex(req.problem);
+  std::string key;
+  key.push_back(static_cast<char>(req.operation));
+  key.push_back(static_cast<char>(req.input_format));
+  key.push_back(static_cast<char>(req.output_format));
+  key += digest;
 
   ActiveJob job;
   job.conn = &conn;
@@ -176,26 +528,49 @@ void handle_request(Connection &conn, const Message &msg)
                                                          "progress_every_ms", 2000)));
   g_job = &job;
 
+  Lead lead{key, nullptr};
   try {
-    TreeDecomposition td(c);
-    auto dnnf = dDNNFTreeDecompositionBuilder{c, root, td}.build();
-    g_job = nullptr;
+    // A cached answer, else the identical build in flight, else our own.
+    for (;;) {
+      auto l = g_results.lookup(key, !by_digest);
+      if (l.hit) {
+        g_job = nullptr;
+        reply(conn, msg.request_id, *l.hit, "hit");
+        return;
+      }
+      if (!l.flight) {
+        g_job = nullptr;
+        send_error(conn, msg.request_id, ErrorCode::UNKNOWN_PROBLEM,
+                   "no problem with SHA-256 " + digest + " is held here");
+        return;
+      }
+      if (l.leader) {
+        lead.flight = l.flight;
+        break;
+      }
+      // Attached: wait for the leader, still servicing our connection.
+      job.phase = "attached";
+      while (!g_results.wait(*l.flight, std::chrono::milliseconds(20)))
+        provsql_tdkc_poll();
+      if (!l.flight->retry) {
+        g_job = nullptr;
+        reply(conn, msg.request_id, *l.flight->outcome, "shared");
+        return;
+      }
+    }
 
-    std::ostringstream meta;
-    if (req.operation == Operation::COMPILE) {
-      std::string nnf = dnnf.toNNF(var_of_input_uuid);
-      meta << "{\"treewidth\":" << td.getTreewidth()
-           << ",\"nodes\":" << dnnf.getNbGates() << ",\"exact\":true}";
-      conn.send(Type::RESULT, msg.request_id,
-                build_result(OutputFormat::DDNNF_NNF, meta.str(), nnf));
-    } else {
-      double p = dnnf.probabilityEvaluation();
-      meta << "{\"treewidth\":" << td.getTreewidth() << ",\"exact\":true}";
-      std::ostringstream val;
-      val << std::setprecision(15) << p;
-      conn.send(Type::RESULT, msg.request_id,
-                build_result(OutputFormat::DECIMAL, meta.str(), val.str()));
+    JobScheduler::Slot slot(g_scheduler);
+    if (slot.refused()) {
+      g_job = nullptr;
+      send_error(conn, msg.request_id, ErrorCode::BUSY,
+                 "all " + std::to_string(g_scheduler.nbWorkers())
+                 + " workers busy and the queue is full");
+      return;
     }
+    auto outcome = std::make_shared<const Outcome>(build(req, slot, job));
+    g_job = nullptr;
+    lead.land(outcome);
+    reply(conn, msg.request_id, *outcome, nullptr);
   } catch (const Cancelled &) {
     g_job = nullptr;
     send_error(conn, msg.request_id, ErrorCode::CANCELLED, "cancelled at client request");
@@ -203,10 +578,6 @@ void handle_request(Connection &conn, const Message &msg)
     g_job = nullptr;
     send_error(conn, msg.request_id, ErrorCode::TIMEOUT,
                "time budget exceeded (timeout_ms)");
-  } catch (const TreeDecompositionException &) {
-    g_job = nullptr;
-    send_error(conn, msg.request_id, ErrorCode::INTERNAL,
-               "treewidth exceeds the supported bound");
   } catch (const std::exception &e) {
     g_job = nullptr;
     send_error(conn, msg.request_id, ErrorCode::INTERNAL, e.what());
@@ -245,7 +616,11 @@ void run_session(int fd)
     return;
   }
   try {
-    conn.send(Type::HELLO, 0, server_hello());
+    // Compress from here on if the client offered zstd: it is the only
+    // codec, so selecting it is echoing it.
+    bool zstd = client_offers_zstd(m.payload);
+    conn.send(Type::HELLO, 0, server_hello(zstd));
+    conn.set_compression(zstd);
   } catch (...) {
     return;
   }
@@ -286,6 +661,19 @@ void run_session(int fd)
   }
 }
 
+void *session_thread(void *arg)
+{
+  int cfd = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+  try {
+    run_session(cfd);
+  } catch (...) {
+    // a send to a vanished peer: only this session is lost
+  }
+  ::close(cfd);
+  --g_sessions;
+  return nullptr;
+}
+
 int listen_unix(const std::string &path)
 {
   int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
@@ -376,7 +764,8 @@ void provsql_tdkc_poll()
                 now - job->start).count();
     try {
       job->conn->send(Type::PROGRESS, job->request_id,
-                      "{\"phase\":\"compile\",\"elapsed_ms\":" + std::to_string(ms) + "}");
+                      std::string("{\"phase\":\"") + job->phase
+                      + "\",\"elapsed_ms\":" + std::to_string(ms) + "}");
     } catch (...) {
       job->cancel = true;
       throw Cancelled{};
@@ -385,7 +774,7 @@ void provsql_tdkc_poll()
   }
 }
 
-int kcmcp_serve(const std::string &endpoint)
+int kcmcp_serve(const std::string &endpoint, const KcmcpServerOptions &options)
 {
   ::signal(SIGPIPE, SIG_IGN);  // a peer vanishing mid-send must not kill us
 
@@ -402,23 +791,61 @@ int kcmcp_serve(const std::string &endpoint)
   }
   if (lfd < 0)
     return 1;
-  if (::listen(lfd, 16) < 0) {
+  if (::listen(lfd, SOMAXCONN) < 0) {
     perror("listen"); ::close(lfd); return 1;
   }
-  fprintf(stderr, "tdkc: KCMCP server listening on %s\n", endpoint.c_str());
+
+  unsigned workers = options.workers;
+  if (workers == 0)
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  g_scheduler.configure(workers, options.queue);
+  g_results.configure(size_t(options.cache_mb) * 1024 * 1024);
+  const unsigned max_sessions = std::max(1u, options.max_sessions);
+
+  fprintf(stderr, "tdkc: KCMCP server listening on %s "
+          "(%u workers, queue %u, %u sessions, %u MB result cache)\n",
+          endpoint.c_str(), workers, options.queue, max_sessions,
+          options.cache_mb);
   fflush(stderr);
 
+  // One thread per session: sessions mostly sit idle between requests, and
+  // the scheduler, not the thread count, bounds how many builds run.
+  pthread_attr_t attr;
+  ::pthread_attr_init(&attr);
+  ::pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ::pthread_attr_setstacksize(&attr, SESSION_STACK_SIZE);
   for (;;) {
     int cfd = ::accept(lfd, nullptr, nullptr);
     if (cfd < 0) {
-      if (errno == EINTR) continue;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno == EMFILE || errno == ENFILE) {
+        // Out of descriptors: wait for a session to end rather than spin.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
       perror("accept");
       break;
     }
-    run_session(cfd);
-    ::close(cfd);
-    g_job = nullptr;  // defensive: never leak a stale job across sessions
+    if (g_sessions.load() >= max_sessions) {
+      // Refuse without reading the client HELLO: the ERROR takes the place
+      // of ours, and the short write cannot block the accept loop.
+      try {
+        Connection conn(cfd, SERVER_MAX_PAYLOAD, CLIENT_FLOOR);
+        send_error(conn, 0, ErrorCode::BUSY,
+                   "too many sessions (" + std::to_string(max_sessions) + ")");
+      } catch (...) {}
+      ::close(cfd);
+      continue;
+    }
+    ++g_sessions;
+    pthread_t th;
+    if (::pthread_create(&th, &attr, session_thread,
+                         reinterpret_cast<void *>(static_cast<intptr_t>(cfd))) != 0) {
+      --g_sessions;
+      ::close(cfd);   // no thread available: the client falls back
+    }
   }
+  ::pthread_attr_destroy(&attr);
   ::close(lfd);
   return 0;
 }
@@ -9,18 +9,44 @@
  * d-DNNF through ProvSQL's in-process tree decomposition.  It is a reference /
  * conformance implementation of the protocol; ProvSQL itself keeps tree
  * decomposition in-process rather than talking to it over a socket.
+ *
+ * Each session runs on its own thread, so an idle warm connection costs
+ * nothing and many backends can stay connected at once.  Builds are
+ * admitted by a shared scheduler: at most @c workers run at a time, up to
+ * @c queue more wait for a worker in arrival order (still answering
+ * @c PING and @c CANCEL, and reporting a @c "queued" phase in
+ * @c PROGRESS), and any further request is refused with @c ERROR code 10
+ * (server busy), upon which a ProvSQL client falls back to its command-line
+ * path.
+ *
+ * Requests are keyed by operation, formats and the SHA-256 of their
+ * problem.  A request identical to a build in flight attaches to it rather
+ * than starting another, and answers are kept in an LRU of @c cache_mb
+ * megabytes (the @c result-cache feature), so a repeated problem is served
+ * without a build -- or even without being sent again, when the client
+ * names it by its @c problem_sha256.
  */
 #ifndef PROVSQL_KCMCP_SERVER_H
 #define PROVSQL_KCMCP_SERVER_H
 
 #include <string>
 
+/// Concurrency limits of the KCMCP server (@c tdkc @c --kcmcp options).
+struct KcmcpServerOptions {
+  unsigned workers = 0;         ///< Builds run at once; 0 = hardware threads
+  unsigned queue = 64;          ///< Requests allowed to wait for a worker
+  unsigned max_sessions = 256;  ///< Connections served at once
+  unsigned cache_mb = 256;      ///< Result cache size in MB; 0 = no cache
+};
+
 /**
  * @brief Serve KCMCP on @p endpoint until terminated.
  * @param endpoint  @c "unix:/path/to.sock" or @c "host:port" (e.g.
  *                  @c "127.0.0.1:9000").
+ * @param options   Concurrency limits.
  * @return process exit code (non-zero on a setup failure).
  */
-int kcmcp_serve(const std::string &endpoint);
+int kcmcp_serve(const std::string &endpoint,
+                const KcmcpServerOptions &options = KcmcpServerOptions());
 
 #endif
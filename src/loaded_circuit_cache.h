@@ -0,0 +1,30 @@
+/**
+ * @file loaded_circuit_cache.h
+ * @brief C-linkage interface to the per-backend cache of loaded circuits.
+ *
+ * Evaluation functions load the circuit under their token on every call,
+ * so a query that calls one per row loads many heavily overlapping
+ * circuits, and one that calls several on the same token loads the same
+ * circuit again and again.  The loaded-circuit cache (@c
+ * LoadedCircuitCache.h) keeps the circuits loaded during a statement and
+ * answers a later load from them when it can.
+ *
+ * A gate does not change once created, but three things around it can
+ * within a session: its probability, @c info1 / @c info2 and extra string
+ * are written after it, once each; a clean-up rebuilds the store; and a
+ * placeholder input gate takes the type of the gate it stood for.  The
+ * cache therefore lives no longer than a statement, and is dropped as
+ * soon as this backend writes one of the three.
+ */
+#ifndef LOADED_CIRCUIT_CACHE_H
+#define LOADED_CIRCUIT_CACHE_H
+
+/**
+ * @brief Forget every cached circuit.
+ *
+ * Called at the start and at the end of each top-level statement, after
+ * this backend writes a probability or annotation, and after a clean-up.
+ */
+void loaded_circuit_cache_reset(void);
+
+#endif /* LOADED_CIRCUIT_CACHE_H */
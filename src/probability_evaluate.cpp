@@ -32,11 +32,13 @@ extern "C" {
 #include "executor/spi.h"
 #include "funcapi.h"               // get_call_result_type, BlessTupleDesc
 #include "access/htup_details.h"   // heap_form_tuple
+#include "utils/array.h"
 #include "provsql_shmem.h"
 #include "provsql_utils.h"
 #include "utils/guc.h"
 
 PG_FUNCTION_INFO_V1(probability_evaluate);
+PG_FUNCTION_INFO_V1(probability_evaluate_all);
 PG_FUNCTION_INFO_V1(probability_bounds);
 }
 
@@ -66,6 +68,7 @@ PG_FUNCTION_INFO_V1(probability_bounds);
 #include "HybridEvaluator.h"
 #include "RangeCheck.h"
 #include "MonteCarloSampler.h"
+#include "CompiledCircuitCache.h"
 #include "dDNNFTreeDecompositionBuilder.h"
 #include "TreeDecomposition.h"
 #include "StructuredDNNF.h"
@@ -829,7 +832,8 @@ static const size_t kSieveSanityMaxClauses = 24;
 // calibration instrumentation (provsql.verbose_level >= 50) and doc.
 static const double kCostIndependent     = 5e-5;  // O(S):                ~5e-5 * S
 static const double kCostInversionFree   = 5e-5;  // O(S + N log N)       (~ independent)
-static const double kCostPossibleWorlds  = 3e-6;  // O(S * 2^N):          ~3e-6 * S*2^N
+static const double kCostPossibleWorlds  = 3e-6;  // O(S * 2^min(N,6)):   ~3e-6 * S*2^min(N,6) for the first 64 worlds ...
+static const double kCostPossibleWorldsStep = 1e-6; // ... then ~1e-6 * S per Gray-code step of 64 more (2^(N-6) steps)
 static const double kCostSieve           = 1e-5;  // O(S * 2^m): ~1e-5 (rarely optimal)
 // NB: w is the degeneracy LOWER bound, so 2^w under-costs tree-decomposition when
 // the true treewidth exceeds it (a dense, low-degeneracy circuit can run far
@@ -1258,23 +1262,27 @@ public:
   }
   dDNNF buildDD(EvalContext &ctx) const override {
     try {
-      TreeDecomposition td(ctx.c);
-      // Speculative execution: the (poly) min-fill build has now discovered the
-      // EXACT treewidth, where the cost estimate above used only the degeneracy
-      // LOWER bound (which under-costs).  Before paying the exponential d-DNNF
-      // build, recompute the real cost from the discovered width; if it exceeds
-      // the next-best method's cost, bail so the chooser escalates -- the
-      // build's own MAX_TREEWIDTH cap is the hard ceiling, this is the
-      // competitive refinement.  A by-name call runs unbounded.
-      if(!ctx.explicitly_named && std::isfinite(ctx.cost_budget)) {
-        const double real_cost = kCostTreeDecomp
-          * static_cast<double>(ctx.circuit_size)
-          * pow2_clamped(td.getTreewidth());
-        if(real_cost > ctx.cost_budget)
-          throw CircuitException(
-            "tree-decomposition: discovered treewidth exceeds the budget");
-      }
-      dDNNF dd = dDNNFTreeDecompositionBuilder{ctx.c, ctx.gate, td}.build();
+      // A d-DNNF built for this very circuit before, by this session or
+      // another, is read back from the compiled-circuit cache instead.
+      dDNNF dd = cachedDD(ctx.c, ctx.gate, "tree-decomposition", [&] {
+        TreeDecomposition td(ctx.c);
+        // Speculative execution: the (poly) min-fill build has now discovered the
+        // EXACT treewidth, where the cost estimate above used only the degeneracy
+        // LOWER bound (which under-costs).  Before paying the exponential d-DNNF
+        // build, recompute the real cost from the discovered width; if it exceeds
+        // the next-best method's cost, bail so the chooser escalates -- the
+        // build's own MAX_TREEWIDTH cap is the hard ceiling, this is the
+        // competitive refinement.  A by-name call runs unbounded.
+        if(!ctx.explicitly_named && std::isfinite(ctx.cost_budget)) {
+          const double real_cost = kCostTreeDecomp
+            * static_cast<double>(ctx.circuit_size)
+            * pow2_clamped(td.getTreewidth());
+          if(real_cost > ctx.cost_budget)
+            throw CircuitException(
+              "tree-decomposition: discovered treewidth exceeds the budget");
+        }
+        return dDNNFTreeDecompositionBuilder{ctx.c, ctx.gate, td}.build();
+      });
       ctx.actual_method = "tree-decomposition";
       return dd;
     } catch(TreeDecompositionException &) {
@@ -1332,18 +1340,22 @@ public:
   }
 };
 
-/// Exact, naive 2^N enumeration.  In the default chain for small circuits only
-/// (cheap exact, preferred over tree-decomposition / compilation when N is
-/// small); always available by name.
+/// Exact 2^N enumeration, in Gray-code order and 64 worlds per evaluation.  In
+/// the default chain for small circuits only (cheap exact, preferred over
+/// tree-decomposition / compilation when N is small); always available by name.
 class PossibleWorldsMethod : public ProbabilityMethod {
 public:
   std::string name() const override { return "possible-worlds"; }
   ToleranceKind guaranteeKind() const override { return ToleranceKind::Exact; }
   bool inDefaultChain() const override { return true; }
-  // O(S * 2^N): enumerate 2^N worlds, evaluate the circuit (O(S)) in each.
+  // O(S * 2^N / 64): one evaluation covers the 64 worlds of six inputs, then
+  // each Gray-code step over the other N-6 flips one input and recomputes, at
+  // worst, the whole circuit above it.
   double estimatedCost(const EvalContext &ctx, const Tolerance &) const override {
-    return kCostPossibleWorlds * static_cast<double>(ctx.circuit_size)
-           * pow2_clamped(ctx.n_inputs);
+    const double S = static_cast<double>(ctx.circuit_size);
+    const size_t n = ctx.n_inputs;
+    return kCostPossibleWorlds * S * pow2_clamped(std::min<size_t>(n, 6))
+           + (n > 6 ? kCostPossibleWorldsStep * S * pow2_clamped(n - 6) : 0.);
   }
   bool applicable(const EvalContext &ctx, const Tolerance &) const override {
     return ctx.n_inputs > 0 && ctx.n_inputs <= kPossibleWorldsSanityMax;
@@ -2443,6 +2455,259 @@ Datum probability_evaluate(PG_FUNCTION_ARGS)
   PG_RETURN_NULL();
 }
 
+/**
+ * @brief Probabilities of the Boolean roots @p roots of @p gc, from one
+ *        d-DNNF shared by all of them.
+ *
+ * The roots' Boolean images @c b_1 … @c b_k are joined under a fresh
+ * root @c G = OR_i (s_i ∧ b_i), each @c s_i a fresh input of
+ * probability 0, and @c G is compiled once by the d-D route chooser
+ * (@c MethodCatalog::chooseAndBuildDD).  Since @c s_i is independent of
+ * everything else, @c Pr(G) restricted to @c s_i alone is
+ * @c Pr(s_i)·Pr(b_i), so the derivative of @c Pr(G) in @c Pr(s_i) at 0 is
+ * @c Pr(b_i): one @c dDNNF::probabilityGradient pass reads off every root.
+ * The selectors add one gate of width to the union of the roots'
+ * sub-circuits, so a tree decomposition of the union serves.
+ *
+ * @param c        Boolean circuit holding the images of the roots
+ *                 (selectors and @c G are added to it).
+ * @param roots    The images, @c b_1 … @c b_k.
+ * @param result   Output: @c Pr(b_i), in the order of @p roots.
+ * @param actual_method  Output: the d-D route that ran.
+ * @throw CircuitException if no route could compile @c G.
+ */
+static void sharedDDProbabilities(BooleanCircuit &c,
+                                  const std::vector<gate_t> &roots,
+                                  std::vector<double> &result,
+                                  std::string &actual_method)
+{
+  std::unordered_map<std::string, size_t> selector;
+  gate_t joint = c.setGate(BooleanGate::OR);
+  for(size_t i = 0; i < roots.size(); ++i) {
+    const std::string name = "probability_evaluate_all:" + std::to_string(i);
+    selector[name] = i;
+    gate_t s = c.setGate(name, BooleanGate::IN, 0.);
+    gate_t a = c.setGate(BooleanGate::AND);
+    c.addWire(a, s);
+    c.addWire(a, roots[i]);
+    c.addWire(joint, a);
+  }
+
+  std::string no_args;
+  provsql::EvalContext ctx{/*gc=*/nullptr, /*gc_root=*/gate_t{},
+                           /*token=*/pg_uuid_t{}, c, joint,
+                           /*gc_to_bc=*/nullptr, /*inv_free_cert=*/false,
+                           no_args, /*explicitly_named=*/false,
+                           /*n_inputs=*/c.getInputs().size(),
+                           /*circuit_size=*/c.getNbGates()};
+  ctx.ensureMultivaluedRewritten();
+  dDNNF dd = provsql::MethodCatalog::instance().chooseAndBuildDD(
+    ctx, provsql::Tolerance{});
+  actual_method = ctx.actual_method;
+
+  // A selector the compiler dropped (its root is false) keeps 0.
+  result.assign(roots.size(), 0.);
+  for(const auto &[g, d] : dd.probabilityGradient()) {
+    auto it = selector.find(dd.getUUID(g));
+    if(it != selector.end())
+      result[it->second] += d;
+  }
+}
+
+/**
+ * @brief Probabilities of the distinct tokens @p tokens, loading their
+ *        circuits once.
+ *
+ * The union circuit is loaded in one go.  A root needing one of
+ * @c probability_evaluate's special routes -- conditioning, the Möbius
+ * route, an inversion-free certificate, random variables or sampled
+ * aggregates -- is handed to @c probability_evaluate_internal, which
+ * finds its circuit in the loaded-circuit cache.  The Boolean images of
+ * the other roots are built in one @c BooleanCircuit; those that are
+ * independent circuits are evaluated as such, and the rest share one
+ * d-DNNF (@c sharedDDProbabilities), or fall back to one evaluation each
+ * if it cannot be built.
+ *
+ * @param tokens  Distinct root UUIDs.
+ * @param result  Output: their probabilities.
+ * @param isnull  Output: whether each is SQL NULL.
+ */
+static void probability_evaluate_many(const std::vector<pg_uuid_t> &tokens,
+                                      std::vector<double> &result,
+                                      std::vector<bool> &isnull)
+{
+  const size_t n = tokens.size();
+  result.assign(n, 0.);
+  isnull.assign(n, false);
+  std::vector<bool> done(n, false);
+
+  std::vector<gate_t> gc_roots;
+  GenericCircuit gc = getJointCircuit(tokens, gc_roots);
+
+  std::vector<size_t> plain;
+  for(size_t i = 0; i < n; ++i) {
+    const gate_t r = gc_roots[i];
+    const gate_type t = gc.getGateType(r);
+    if(t == gate_conditioned || t == gate_mobius)
+      continue;
+    const std::string ex = gc.getExtra(r);
+    if(!ex.empty() && ex[0] == SAFE_CERT_EXTRA_PREFIX_RECIPE)
+      continue;
+    provsql::resolveComparators(gc, r, /*simplify=*/true, /*decompose=*/true);
+    if(provsql::circuitHasRV(gc, r)
+       || provsql::circuitHasUnresolvedSampleableAgg(gc, r))
+      continue;
+    plain.push_back(i);
+  }
+
+  if(plain.size() > 1) {
+    std::set<std::string> methods;
+
+    provsql_interrupted = false;
+    void (*prev_sigint_handler)(int);
+    prev_sigint_handler = signal(SIGINT, provsql_sigint_handler);
+
+    try {
+      std::vector<gate_t> roots;
+      for(size_t i : plain)
+        roots.push_back(gc_roots[i]);
+      std::vector<gate_t> bc_roots;
+      std::unordered_map<gate_t, gate_t> gc_to_bc;
+      BooleanCircuit c = getBooleanCircuit(gc, roots, bc_roots, gc_to_bc);
+
+      std::vector<size_t> rest;
+      std::vector<gate_t> rest_roots;
+      for(size_t k = 0; k < plain.size(); ++k) {
+        try {
+          result[plain[k]] = c.independentEvaluation(bc_roots[k]);
+          done[plain[k]] = true;
+          methods.insert("independent");
+        } catch(CircuitException &) {
+          rest.push_back(plain[k]);
+          rest_roots.push_back(bc_roots[k]);
+        }
+      }
+
+      if(rest.size() > 1) {
+        std::vector<double> p;
+        std::string am;
+        try {
+          sharedDDProbabilities(c, rest_roots, p, am);
+          for(size_t k = 0; k < rest.size(); ++k) {
+            result[rest[k]] = p[k];
+            done[rest[k]] = true;
+          }
+          methods.insert(am);
+        } catch(CircuitException &) {
+          // No route compiled the joint circuit: one evaluation per root.
+          CHECK_FOR_INTERRUPTS();
+        }
+      }
+    } catch(const semiring::SemiringException &) {
+      // No Boolean view: one evaluation per root, which reports why.
+    } catch(CircuitException &e) {
+      CHECK_FOR_INTERRUPTS();
+      provsql_error("%s", e.what());
+    }
+
+    provsql_interrupted = false;
+    signal(SIGINT, prev_sigint_handler);
+
+    for(const auto &m : methods)
+      record_last_eval_method(m);
+  }
+
+  for(size_t i = 0; i < n; ++i) {
+    if(done[i])
+      continue;
+    bool null = false;
+    Datum d = probability_evaluate_internal(tokens[i], "", "", &null);
+    isnull[i] = null;
+    if(!null)
+      result[i] = DatumGetFloat8(d);
+  }
+
+  // Avoid rounding errors that make probability outside of [0,1]
+  for(auto &p : result)
+    p = std::min(1., std::max(0., p));
+}
+
+/**
+ * @brief PostgreSQL-callable wrapper for
+ *        @c probability_evaluate_all(tokens uuid[]) @c returns @c float8[].
+ *
+ * The probability of each token of the array, as
+ * @c probability_evaluate(token) with the default method computes it, in
+ * the same positions; a @c NULL token, or a conditioned token with
+ * impossible evidence, gives @c NULL.  Repeated tokens are evaluated
+ * once.  See @c probability_evaluate_many for how the work is shared.
+ */
+Datum probability_evaluate_all(PG_FUNCTION_ARGS)
+{
+  provsql_sync_tool_registry();
+  try {
+    if(PG_ARGISNULL(0))
+      PG_RETURN_NULL();
+
+    ArrayType *arr = PG_GETARG_ARRAYTYPE_P(0);
+    Datum *elems;
+    bool *nulls;
+    int nelems;
+
+    if(ARR_NDIM(arr) > 1)
+      provsql_error("probability_evaluate_all: tokens must be a 1-D array");
+
+    deconstruct_array(arr, UUIDOID, UUID_LEN, false, 'c',
+                      &elems, &nulls, &nelems);
+
+    std::vector<pg_uuid_t> tokens;
+    std::map<std::string, size_t> index;
+    std::vector<size_t> where(nelems);
+    for(int i = 0; i < nelems; ++i) {
+      if(nulls[i])
+        continue;
+      const pg_uuid_t &u = *DatumGetUUIDP(elems[i]);
+      auto [it, inserted] = index.emplace(
+        std::string(reinterpret_cast<const char *>(u.data), UUID_LEN),
+        tokens.size());
+      if(inserted)
+        tokens.push_back(u);
+      where[i] = it->second;
+    }
+
+    std::vector<double> probs;
+    std::vector<bool> probs_null;
+    if(tokens.size() == 1) {
+      bool null = false;
+      Datum d = probability_evaluate_internal(tokens[0], "", "", &null);
+      probs.assign(1, null ? 0. : DatumGetFloat8(d));
+      probs_null.assign(1, null);
+    } else if(!tokens.empty()) {
+      probability_evaluate_many(tokens, probs, probs_null);
+    }
+
+    Datum *values = static_cast<Datum *>(palloc(Max(nelems, 1) * sizeof(Datum)));
+    bool *out_nulls = static_cast<bool *>(palloc(Max(nelems, 1) * sizeof(bool)));
+    for(int i = 0; i < nelems; ++i) {
+      out_nulls[i] = nulls[i] || probs_null[where[i]];
+      values[i] = out_nulls[i] ? (Datum) 0 : Float8GetDatum(probs[where[i]]);
+    }
+
+    int dims[1] = { nelems };
+    int lbs[1] = { 1 };
+    ArrayType *result = construct_md_array(values, out_nulls, 1, dims, lbs,
+                                           FLOAT8OID, sizeof(float8),
+                                           FLOAT8PASSBYVAL, 'd');
+    PG_RETURN_ARRAYTYPE_P(result);
+  } catch(const std::exception &e) {
+    provsql_error("probability_evaluate_all: %s", e.what());
+  } catch(...) {
+    provsql_error("probability_evaluate_all: Unknown exception");
+  }
+
+  PG_RETURN_NULL();
+}
+
 /**
  * @brief PostgreSQL-callable wrapper for the d-tree leaf bound:
  *        @c probability_bounds(token uuid, OUT lower float8, OUT upper float8).
@@ -22,7 +22,8 @@
  *    subtransaction nesting level, and an aborted (sub)transaction
  *    clears the probabilities it wrote.  No old value is kept, because
  *    there never was one: this is an undo list of tokens, not of
- *    values;
+ *    values.  @c set_prob_from writes, and a rollback clears, a batch
+ *    of tokens per message to the worker;
  *  - changing a probability means minting a fresh input gate with the
  *    new probability and rewriting the rows that carry the old token,
  *    which @c provsql.replace_input does; the base table's token
@@ -40,8 +41,13 @@
 #include <math.h>
 
 #include "access/xact.h"
+#include "executor/spi.h"
 #include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
 #include "utils/uuid.h"
 
 #include "probability_store.h"
@@ -72,20 +78,44 @@ static pg_uuid_t *fresh_leaves = NULL;
 static int fresh_leaves_len = 0;
 static int fresh_leaves_cap = 0;
 
+/** @brief Clear the probabilities of @p nb tokens, at most
+ *  @c PROVSQL_SET_PROB_BATCH, in one message. */
+static void prob_clear_batch(const pg_uuid_t *tokens, int nb)
+{
+  static double nans[PROVSQL_SET_PROB_BATCH];
+  static provsql_set_prob_result results[PROVSQL_SET_PROB_BATCH];
+
+  if(!isnan(nans[0]))
+    for(int i = 0; i < PROVSQL_SET_PROB_BATCH; ++i)
+      nans[i] = NAN;
+
+  provsql_internal_set_probs(tokens, nans, nb, false, results, NULL);
+}
+
 /** @brief Drop the recorded writes at nesting level @p level or deeper,
- *  clearing each one's probability in the store when @p undo. */
+ *  clearing each one's probability in the store when @p undo -- a
+ *  message per @c PROVSQL_SET_PROB_BATCH writes, so that rolling back a
+ *  bulk load costs what the load did. */
 static void prob_writes_unwind(int level, bool undo)
 {
-  int keep = 0;
+  static pg_uuid_t batch[PROVSQL_SET_PROB_BATCH];
+  int keep = 0, nb = 0;
 
   for(int i = 0; i < prob_writes_len; ++i) {
     if(prob_writes[i].nest_level >= level) {
-      if(undo)
-        provsql_internal_clear_prob(&prob_writes[i].token);
+      if(undo) {
+        batch[nb++] = prob_writes[i].token;
+        if(nb == PROVSQL_SET_PROB_BATCH) {
+          prob_clear_batch(batch, nb);
+          nb = 0;
+        }
+      }
     } else {
       prob_writes[keep++] = prob_writes[i];
     }
   }
+  if(nb > 0)
+    prob_clear_batch(batch, nb);
   prob_writes_len = keep;
 }
 
@@ -180,8 +210,8 @@ static void prob_subxact_callback(SubXactEvent event,
   }
 }
 
-/** @brief Record that this transaction wrote @p token's probability. */
-static void prob_writes_record(const pg_uuid_t *token)
+/** @brief Make room in the list for @p more writes. */
+static void prob_writes_reserve(int more)
 {
   if(!prob_callbacks_registered) {
     RegisterXactCallback(prob_xact_callback, NULL);
@@ -189,14 +219,23 @@ static void prob_writes_record(const pg_uuid_t *token)
     prob_callbacks_registered = true;
   }
 
-  if(prob_writes_len == prob_writes_cap) {
-    int newcap = prob_writes_cap ? prob_writes_cap * 2 : 64;
-    prob_write *grown = realloc(prob_writes, newcap * sizeof(prob_write));
+  if(prob_writes_len + more > prob_writes_cap) {
+    int newcap = prob_writes_cap ? prob_writes_cap : 64;
+    prob_write *grown;
+    while(newcap < prob_writes_len + more)
+      newcap *= 2;
+    grown = realloc(prob_writes, newcap * sizeof(prob_write));
     if(!grown)
       provsql_error("ProvSQL: out of memory recording a probability write");
     prob_writes = grown;
     prob_writes_cap = newcap;
   }
+}
+
+/** @brief Record that this transaction wrote @p token's probability. */
+static void prob_writes_record(const pg_uuid_t *token)
+{
+  prob_writes_reserve(1);
   prob_writes[prob_writes_len].token = *token;
   prob_writes[prob_writes_len].nest_level = GetCurrentTransactionNestLevel();
   ++prob_writes_len;
@@ -253,34 +292,35 @@ PG_FUNCTION_INFO_V1(is_fresh_leaf);
  *  transaction (see @c note_fresh_leaf). */
 Datum is_fresh_leaf(PG_FUNCTION_ARGS)
 {
-  pg_uuid_t *token;
-
   if(PG_ARGISNULL(0))
     PG_RETURN_BOOL(false);
+  PG_RETURN_BOOL(provsql_is_fresh_leaf(DatumGetUUIDP(PG_GETARG_DATUM(0))));
+}
 
-  token = DatumGetUUIDP(PG_GETARG_DATUM(0));
+bool provsql_is_fresh_leaf(const pg_uuid_t *token)
+{
   for(int i = 0; i < fresh_leaves_len; ++i)
     if(memcmp(&fresh_leaves[i], token, sizeof(pg_uuid_t)) == 0)
-      PG_RETURN_BOOL(true);
-  PG_RETURN_BOOL(false);
+      return true;
+  return false;
 }
 
-void provsql_set_prob_tracked(const pg_uuid_t *token, double prob)
+/** @brief Refuse a probability that is not one. */
+static void prob_check_value(double prob)
 {
-  double existing = 0.;
-  provsql_set_prob_result result;
-
   if(isnan(prob))
     provsql_error("set_prob: NaN is not a probability");
   if(prob < 0. || prob > 1.)
     provsql_error("set_prob: probability %g is outside [0, 1]", prob);
+}
 
-  result = provsql_internal_set_prob(token, prob, &existing);
-
+/** @brief Raise the error for a write the store refused. */
+static void prob_write_refused(const pg_uuid_t *token,
+                               provsql_set_prob_result result,
+                               double existing)
+{
   switch(result) {
   case PROVSQL_SET_PROB_WRITTEN:
-    prob_writes_record(token);
-    break;
   case PROVSQL_SET_PROB_UNCHANGED:
     break;
   case PROVSQL_SET_PROB_NOT_PROB_GATE:
@@ -303,6 +343,50 @@ void provsql_set_prob_tracked(const pg_uuid_t *token, double prob)
   }
 }
 
+void provsql_set_prob_tracked(const pg_uuid_t *token, double prob)
+{
+  double existing = 0.;
+  provsql_set_prob_result result;
+
+  prob_check_value(prob);
+
+  result = provsql_internal_set_prob(token, prob, &existing);
+
+  if(result == PROVSQL_SET_PROB_WRITTEN)
+    prob_writes_record(token);
+  else
+    prob_write_refused(token, result, existing);
+}
+
+/**
+ * @brief Write a batch of probabilities, recording the writes.
+ *
+ * One message to the worker for the whole batch.  The writes it made are
+ * recorded before a refusal is raised, so that the abort clears them.
+ */
+static void prob_set_batch(const pg_uuid_t *tokens, const double *probs,
+                           unsigned nb)
+{
+  static provsql_set_prob_result results[PROVSQL_SET_PROB_BATCH];
+  double existing = 0.;
+  unsigned done;
+  int level = GetCurrentTransactionNestLevel();
+
+  done = provsql_internal_set_probs(tokens, probs, nb, true, results,
+                                    &existing);
+
+  prob_writes_reserve(done);
+  for(unsigned i = 0; i < done; ++i)
+    if(results[i] == PROVSQL_SET_PROB_WRITTEN) {
+      prob_writes[prob_writes_len].token = tokens[i];
+      prob_writes[prob_writes_len].nest_level = level;
+      ++prob_writes_len;
+    }
+
+  if(done > 0)
+    prob_write_refused(&tokens[done - 1], results[done - 1], existing);
+}
+
 PG_FUNCTION_INFO_V1(set_prob);
 /**
  * @brief Write a gate's probability, once.
@@ -344,6 +428,113 @@ Datum set_prob(PG_FUNCTION_ARGS)
   PG_RETURN_VOID();
 }
 
+PG_FUNCTION_INFO_V1(set_prob_from);
+/**
+ * @brief Write the probabilities a relation lists, once each.
+ *
+ * The bulk form of @c set_prob: reads (@p token_att, @p prob_att) from
+ * every row of @p relid through an SPI cursor, checks each probability
+ * here, and sends them to the worker @c PROVSQL_SET_PROB_BATCH at a time
+ * -- one message and one reply per batch, where @c set_prob costs a round
+ * trip per token.  The writes follow @c set_prob's rules, and are undone
+ * with the transaction that made them like any other.  Tokens are taken
+ * as they are, without peeling annotation wrappers: a relation's token
+ * column holds input gates.  Rows with a @c NULL token or probability are
+ * skipped.
+ *
+ * Provenance tracking is off during the scan, so that reading a
+ * provenance-tracked relation's own @c provsql column does not rewrite it.
+ *
+ * @return The number of rows whose probability was written or already
+ *         held that value.
+ */
+Datum set_prob_from(PG_FUNCTION_ARGS)
+{
+  Oid            relid;
+  const char    *prob_att, *token_att;
+  StringInfoData sql;
+  Portal         portal;
+  pg_uuid_t     *tokens;
+  double        *probs;
+  unsigned       nb = 0;
+  int64          total = 0;
+  int            save_nestlevel;
+
+  if(PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
+    provsql_error("Invalid NULL value passed to set_prob_from");
+
+  relid     = PG_GETARG_OID(0);
+  prob_att  = text_to_cstring(PG_GETARG_TEXT_PP(1));
+  token_att = text_to_cstring(PG_GETARG_TEXT_PP(2));
+
+  if(get_attnum(relid, prob_att) == InvalidAttrNumber)
+    provsql_error("set_prob_from: column \"%s\" of relation \"%s\" "
+                  "does not exist", prob_att, get_rel_name(relid));
+  if(get_attnum(relid, token_att) == InvalidAttrNumber)
+    provsql_error("set_prob_from: column \"%s\" of relation \"%s\" "
+                  "does not exist", token_att, get_rel_name(relid));
+
+  initStringInfo(&sql);
+  token_att = quote_identifier(token_att);
+  prob_att  = quote_identifier(prob_att);
+  appendStringInfo(&sql,
+                   "SELECT %s::uuid, %s::float8 FROM %s "
+                   "WHERE %s IS NOT NULL AND %s IS NOT NULL",
+                   token_att, prob_att,
+                   quote_qualified_identifier(
+                     get_namespace_name(get_rel_namespace(relid)),
+                     get_rel_name(relid)),
+                   token_att, prob_att);
+
+  tokens = palloc(PROVSQL_SET_PROB_BATCH * sizeof(pg_uuid_t));
+  probs  = palloc(PROVSQL_SET_PROB_BATCH * sizeof(double));
+
+  save_nestlevel = NewGUCNestLevel();
+  SetConfigOption("provsql.active", "off", PGC_USERSET, PGC_S_SESSION);
+
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI in set_prob_from");
+  portal = SPI_cursor_open_with_args(NULL, sql.data, 0, NULL, NULL, NULL,
+                                     true, 0);
+
+  for(;;) {
+    SPI_cursor_fetch(portal, true, PROVSQL_SET_PROB_BATCH - nb);
+    if(SPI_processed == 0)
+      break;
+
+    for(uint64 i = 0; i < SPI_processed; ++i) {
+      HeapTuple tuple = SPI_tuptable->vals[i];
+      TupleDesc desc = SPI_tuptable->tupdesc;
+      bool      isnull;
+
+      tokens[nb] = *DatumGetUUIDP(SPI_getbinval(tuple, desc, 1, &isnull));
+      probs[nb]  = DatumGetFloat8(SPI_getbinval(tuple, desc, 2, &isnull));
+      prob_check_value(probs[nb]);
+      ++nb;
+    }
+    SPI_freetuptable(SPI_tuptable);
+
+    if(nb == PROVSQL_SET_PROB_BATCH) {
+      prob_set_batch(tokens, probs, nb);
+      total += nb;
+      nb = 0;
+    }
+    CHECK_FOR_INTERRUPTS();
+  }
+  if(nb > 0) {
+    prob_set_batch(tokens, probs, nb);
+    total += nb;
+  }
+
+  SPI_cursor_close(portal);
+  SPI_finish();
+  AtEOXact_GUC(false, save_nestlevel);
+
+  pfree(tokens);
+  pfree(probs);
+  PG_RETURN_INT64(total);
+}
+
 PG_FUNCTION_INFO_V1(probability_is_set);
 /**
  * @brief Report whether a probability has been written on a gate.
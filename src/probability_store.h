@@ -21,4 +21,10 @@
  */
 void provsql_set_prob_tracked(const pg_uuid_t *token, double prob);
 
+/**
+ * @brief Whether @p token was minted as a replacement leaf by the current
+ *        transaction (see @c note_fresh_leaf).
+ */
+bool provsql_is_fresh_leaf(const pg_uuid_t *token);
+
 #endif /* PROVSQL_PROBABILITY_STORE_H */
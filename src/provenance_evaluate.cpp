@@ -0,0 +1,619 @@
+/**
+ * @file provenance_evaluate.cpp
+ * @brief SQL function @c provsql.provenance_evaluate() – semiring evaluation.
+ *
+ * Implements the SQL-callable function that evaluates a provenance circuit
+ * over a user-supplied (m-)semiring.  The semiring is described by the
+ * OIDs of PostgreSQL objects passed as arguments: the @c plus and
+ * @c times aggregates, and optionally the @c monus and @c delta
+ * functions; leaves take their value from the @c token2value mapping
+ * table, or from @c element_one when the mapping does not name them.
+ *
+ * The circuit is loaded once (as for @c provenance_evaluate_compiled(),
+ * but without the load-time simplification passes) and evaluated in memory by an iterative post-order traversal in which
+ * every gate is memoised, so shared sub-circuits are evaluated once.  The
+ * user's operations are called directly through @c FmgrInfo handles,
+ * cached across calls in @c fn_extra: an aggregate is run by calling its
+ * transition and final functions the way the executor would, and the
+ * mapping is fetched by a single join over the circuit's leaves.
+ *
+ * Semirings whose operations cannot be called outside the executor --
+ * aggregates with an @c internal or polymorphic state, ordered-set
+ * aggregates, operations whose signature does not match the element
+ * type, which would need an implicit cast -- are evaluated by the
+ * PL/pgSQL version of @c provenance_evaluate instead, reached through
+ * SPI.
+ *
+ * For the built-in C++ semirings, see @c provenance_evaluate_compiled.cpp.
+ */
+extern "C" {
+#include "postgres.h"
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+#include "utils/uuid.h"
+
+#include "provsql_mmap.h"
+#include "provsql_shmem.h"
+#include "provsql_utils.h"
+
+PG_FUNCTION_INFO_V1(provenance_evaluate);
+}
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "provenance_evaluate_compiled.hpp"
+
+/* From provenance_evaluate_compiled.cpp */
+bool join_with_temp_uuids(Oid table, const std::vector<std::string> &uuids);
+
+namespace {
+
+/** @brief A semiring value: a Datum of the element type, or SQL NULL. */
+struct value_t {
+  Datum d;      ///< The value, when not NULL
+  bool isnull;  ///< Whether the value is SQL NULL
+};
+
+/** @brief Cached handles to run one user aggregate (@c plus or @c times). */
+struct user_aggregate {
+  FmgrInfo transfn;     ///< Transition function
+  FmgrInfo finalfn;     ///< Final function, if @c has_finalfn
+  bool has_finalfn;     ///< Whether the aggregate has a final function
+  Datum initval;        ///< Initial state, if not @c initval_isnull
+  bool initval_isnull;  ///< Whether the initial state is NULL
+};
+
+/**
+ * @brief Everything needed to evaluate over one user-defined semiring.
+ *
+ * Built on the first call and kept in @c fn_extra, so that a query
+ * evaluating every row of a table looks the operations up once.  The
+ * first five fields are the cache key.
+ */
+struct user_semiring {
+  Oid element_type;     ///< Type of the semiring values
+  Oid plus_oid;         ///< The @c plus aggregate
+  Oid times_oid;        ///< The @c times aggregate
+  Oid monus_oid;        ///< The @c monus function, or @c InvalidOid
+  Oid delta_oid;        ///< The @c delta function, or @c InvalidOid
+  bool native;          ///< @c false if the PL/pgSQL version must be used
+  user_aggregate plus;  ///< Handles for @c plus
+  user_aggregate times; ///< Handles for @c times
+  FmgrInfo monus;       ///< Handle for @c monus, if valid
+  FmgrInfo delta;       ///< Handle for @c delta, if valid
+  Oid collation;        ///< Collation the operations are called with
+  int16 typlen;         ///< @c typlen of the element type
+  bool typbyval;        ///< @c typbyval of the element type
+  Oid typinput;         ///< Input function of the element type
+  Oid typioparam;       ///< Type parameter of the input function
+};
+
+/** @brief Whether @p type can stand for an argument or result of type @p element_type. */
+bool matches(Oid type, Oid element_type)
+{
+  return type == element_type || IsPolymorphicType(type);
+}
+
+/**
+ * @brief Raise the executor's permission error unless @p role may
+ *        execute function (or aggregate) @p fn.
+ *
+ * The user's operations are called directly rather than through a query,
+ * so the EXECUTE privileges the executor would check have to be checked
+ * here.
+ */
+void check_execute(Oid fn, Oid role, bool aggregate)
+{
+#if PG_VERSION_NUM >= 160000
+  AclResult aclresult = object_aclcheck(ProcedureRelationId, fn, role,
+                                        ACL_EXECUTE);
+#else
+  AclResult aclresult = pg_proc_aclcheck(fn, role, ACL_EXECUTE);
+#endif
+  if(aclresult != ACLCHECK_OK)
+#if PG_VERSION_NUM >= 110000
+    aclcheck_error(aclresult, aggregate ? OBJECT_AGGREGATE : OBJECT_FUNCTION,
+                   get_func_name(fn));
+#else
+    aclcheck_error(aclresult, ACL_KIND_PROC, get_func_name(fn));
+#endif
+}
+
+/**
+ * @brief Look up function @p fn into @p f, allocated in @p cxt.
+ *
+ * The handle is given a call expression over constants of the actual
+ * argument types, so that polymorphic functions, and procedural language
+ * functions declared with polymorphic arguments, can resolve them as
+ * they would in a query.
+ */
+void init_handle(Oid fn, const std::vector<Oid> &argtypes, Oid rettype,
+                 FmgrInfo *f, MemoryContext cxt)
+{
+  fmgr_info_cxt(fn, f, cxt);
+
+  MemoryContext old = MemoryContextSwitchTo(cxt);
+  List *args = NIL;
+  for(Oid t : argtypes)
+    args = lappend(args, makeNullConst(t, -1, InvalidOid));
+  fmgr_info_set_expr((Node *) makeFuncExpr(fn, rettype, args, InvalidOid,
+                                           InvalidOid, COERCE_EXPLICIT_CALL),
+                     f);
+  MemoryContextSwitchTo(old);
+}
+
+/**
+ * @brief Prepare the handles running aggregate @p aggfn over @p type.
+ *
+ * @return @c false if @p aggfn cannot be run outside the executor (or is
+ *         not a plain aggregate over @p type), in which case the PL/pgSQL
+ *         version is to be used.
+ */
+bool init_aggregate(Oid aggfn, Oid type, user_aggregate &agg, MemoryContext cxt)
+{
+  Oid *argtypes;
+  int nargs;
+  Oid rettype = get_func_signature(aggfn, &argtypes, &nargs);
+  bool ok = nargs == 1 && matches(argtypes[0], type) && matches(rettype, type);
+  pfree(argtypes);
+  if(!ok)
+    return false;
+
+  HeapTuple tup = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggfn));
+  if(!HeapTupleIsValid(tup))
+    return false;
+  Form_pg_aggregate form = (Form_pg_aggregate) GETSTRUCT(tup);
+
+  /* An internal state is only ever manipulated through AggCheckCallContext,
+   * which refuses to run outside an aggregate node; a polymorphic state
+   * would have to be resolved against the input type. */
+  if(form->aggkind != AGGKIND_NORMAL || form->aggfinalextra
+     || form->aggtranstype == INTERNALOID
+     || IsPolymorphicType(form->aggtranstype)) {
+    ReleaseSysCache(tup);
+    return false;
+  }
+
+  /* As in ExecInitAgg: the caller needs EXECUTE on the aggregate, its
+   * owner on the transition and final functions. */
+  check_execute(aggfn, GetUserId(), true);
+  {
+    HeapTuple proctup = SearchSysCache1(PROCOID, ObjectIdGetDatum(aggfn));
+    if(!HeapTupleIsValid(proctup))
+      provsql_error("cache lookup failed for function %u", aggfn);
+    Oid owner = ((Form_pg_proc) GETSTRUCT(proctup))->proowner;
+    ReleaseSysCache(proctup);
+    check_execute(form->aggtransfn, owner, false);
+    if(OidIsValid(form->aggfinalfn))
+      check_execute(form->aggfinalfn, owner, false);
+  }
+
+  Oid transtype = form->aggtranstype;
+  init_handle(form->aggtransfn, {transtype, type}, transtype, &agg.transfn, cxt);
+  agg.has_finalfn = OidIsValid(form->aggfinalfn);
+  if(agg.has_finalfn)
+    init_handle(form->aggfinalfn, {transtype}, type, &agg.finalfn, cxt);
+
+  bool isnull;
+  Datum initval = SysCacheGetAttr(AGGFNOID, tup, Anum_pg_aggregate_agginitval,
+                                  &isnull);
+  agg.initval_isnull = isnull;
+  agg.initval = (Datum) 0;
+  if(!isnull) {
+    char *str = TextDatumGetCString(initval);
+    Oid typinput, typioparam;
+    getTypeInputInfo(transtype, &typinput, &typioparam);
+    MemoryContext old = MemoryContextSwitchTo(cxt);
+    agg.initval = OidInputFunctionCall(typinput, str, typioparam, -1);
+    MemoryContextSwitchTo(old);
+    pfree(str);
+  }
+
+  ReleaseSysCache(tup);
+  return true;
+}
+
+/**
+ * @brief Prepare the handle calling @p fn on @p nargs values of @p type.
+ *
+ * @return @c false if the signature of @p fn does not match.
+ */
+bool init_function(Oid fn, int nargs, Oid type, FmgrInfo *f, MemoryContext cxt)
+{
+  Oid *argtypes;
+  int n;
+  Oid rettype = get_func_signature(fn, &argtypes, &n);
+  bool ok = n == nargs && matches(rettype, type);
+  for(int i = 0; ok && i < n; ++i)
+    ok = matches(argtypes[i], type);
+  pfree(argtypes);
+  if(ok) {
+    check_execute(fn, GetUserId(), false);
+    init_handle(fn, std::vector<Oid>(nargs, type), type, f, cxt);
+  }
+  return ok;
+}
+
+/**
+ * @brief Return the semiring described by the arguments of the current
+ *        call, from the @c fn_extra cache when the arguments have not
+ *        changed.
+ */
+user_semiring &get_semiring(FunctionCallInfo fcinfo, Oid element_type,
+                            Oid plus_oid, Oid times_oid,
+                            Oid monus_oid, Oid delta_oid)
+{
+  user_semiring *sr = (user_semiring *) fcinfo->flinfo->fn_extra;
+
+  if(sr && sr->element_type == element_type && sr->plus_oid == plus_oid
+     && sr->times_oid == times_oid && sr->monus_oid == monus_oid
+     && sr->delta_oid == delta_oid)
+    return *sr;
+
+  MemoryContext cxt = fcinfo->flinfo->fn_mcxt;
+  if(!sr) {
+    sr = (user_semiring *) MemoryContextAllocZero(cxt, sizeof(user_semiring));
+    fcinfo->flinfo->fn_extra = sr;
+  }
+
+  /* The key is only filled in once every lookup and permission check
+   * has succeeded, so that an error halfway leaves no usable entry. */
+  sr->element_type = InvalidOid;
+  sr->collation = get_typcollation(element_type);
+  get_typlenbyval(element_type, &sr->typlen, &sr->typbyval);
+  getTypeInputInfo(element_type, &sr->typinput, &sr->typioparam);
+
+  sr->native =
+    init_aggregate(plus_oid, element_type, sr->plus, cxt) &&
+    init_aggregate(times_oid, element_type, sr->times, cxt) &&
+    (!OidIsValid(monus_oid) ||
+     init_function(monus_oid, 2, element_type, &sr->monus, cxt)) &&
+    (!OidIsValid(delta_oid) ||
+     init_function(delta_oid, 1, element_type, &sr->delta, cxt));
+
+  sr->element_type = element_type;
+  sr->plus_oid = plus_oid;
+  sr->times_oid = times_oid;
+  sr->monus_oid = monus_oid;
+  sr->delta_oid = delta_oid;
+
+  return *sr;
+}
+
+/**
+ * @brief Call @p f on @p nargs (at most 2) possibly NULL arguments.
+ *
+ * Unlike @c FunctionCall2Coll, a NULL result is returned rather than
+ * refused; a strict function is not called on a NULL argument.
+ */
+value_t call(FmgrInfo *f, Oid collation, int nargs,
+             const value_t *args)
+{
+  if(f->fn_strict)
+    for(int i = 0; i < nargs; ++i)
+      if(args[i].isnull)
+        return {(Datum) 0, true};
+
+#if PG_VERSION_NUM >= 120000
+  LOCAL_FCINFO(fcinfo, 2);
+  InitFunctionCallInfoData(*fcinfo, f, nargs, collation, NULL, NULL);
+  for(int i = 0; i < nargs; ++i) {
+    fcinfo->args[i].value = args[i].d;
+    fcinfo->args[i].isnull = args[i].isnull;
+  }
+#else
+  FunctionCallInfoData fcinfodata;
+  FunctionCallInfo fcinfo = &fcinfodata;
+  InitFunctionCallInfoData(*fcinfo, f, nargs, collation, NULL, NULL);
+  for(int i = 0; i < nargs; ++i) {
+    fcinfo->arg[i] = args[i].d;
+    fcinfo->argnull[i] = args[i].isnull;
+  }
+#endif
+
+  Datum result = FunctionCallInvoke(fcinfo);
+  return {result, fcinfo->isnull};
+}
+
+/**
+ * @brief Run aggregate @p agg over @p inputs, as the executor would
+ *        over rows holding these values.
+ *
+ * A strict transition function skips NULL inputs, and, when there is no
+ * initial state, takes the first non-NULL input as the state.
+ */
+value_t aggregate(const user_semiring &sr, user_aggregate &agg,
+                  const std::vector<value_t> &inputs)
+{
+  value_t state{agg.initval, agg.initval_isnull};
+  bool no_trans_value = agg.initval_isnull;
+
+  for(const auto &v : inputs) {
+    if(agg.transfn.fn_strict) {
+      if(v.isnull)
+        continue;
+      if(no_trans_value) {
+        state = {datumCopy(v.d, sr.typbyval, sr.typlen), false};
+        no_trans_value = false;
+        continue;
+      }
+      if(state.isnull)
+        continue;
+    }
+    value_t args[2] = {state, v};
+    state = call(&agg.transfn, sr.collation, 2, args);
+  }
+
+  if(agg.has_finalfn)
+    return call(&agg.finalfn, sr.collation, 1, &state);
+  return state;
+}
+
+/** @brief Parse @p s as a value of the element type. */
+value_t parse(const user_semiring &sr, const char *s)
+{
+  return {OidInputFunctionCall(sr.typinput, const_cast<char *>(s),
+                               sr.typioparam, -1), false};
+}
+
+/**
+ * @brief Evaluate the circuit of @p token over the semiring @p sr.
+ *
+ * Gates are evaluated exactly as by the PL/pgSQL version of
+ * provenance_evaluate: input and update gates take their mapped value (or
+ * @p element_one), a mulinput gate the text <tt>{key=value index}</tt>,
+ * plus and times gates run the corresponding aggregate over their
+ * children, monus and delta gates call the corresponding function,
+ * and the where-provenance and annotation wrappers are transparent.
+ */
+value_t evaluate(user_semiring &sr, pg_uuid_t token, Oid table,
+                 value_t element_one)
+{
+  /* The circuit as stored: the load-time simplifications drop identity
+   * wires and fold comparisons, which a user-defined semiring, whose
+   * laws are not checked, would observe. */
+  GenericCircuit c = getStoredGenericCircuit(token);
+  const gate_t root = c.getGate(uuid2string(token));
+
+  std::vector<std::string> leaves;
+  for(size_t i = 0; i < c.getNbGates(); ++i) {
+    gate_t g = static_cast<gate_t>(i);
+    gate_type t = c.getGateType(g);
+    if(t == gate_input || t == gate_update) {
+      std::string u = c.getUUID(g);
+      if(!u.empty())
+        leaves.push_back(u);
+    }
+  }
+
+  constants_t constants = get_constants(true);
+  std::unordered_map<gate_t, value_t> mapping;
+  bool drop_table = join_with_temp_uuids(table, leaves);
+  initialize_provenance_mapping<value_t>(constants, c, mapping,
+    [&sr](const char *v) { return parse(sr, v); }, drop_table);
+
+  /* Iterative post-order, memoised per gate: a gate is pushed back on
+   * the stack until every child has a value.  The circuit is a DAG, so
+   * this terminates, and shared sub-circuits are evaluated once. */
+  std::vector<value_t> values(c.getNbGates());
+  std::vector<bool> done(c.getNbGates(), false);
+  std::vector<gate_t> stack{root};
+
+  while(!stack.empty()) {
+    const gate_t u = stack.back();
+    const size_t ui = static_cast<size_t>(u);
+
+    if(done[ui]) {
+      stack.pop_back();
+      continue;
+    }
+
+    const gate_type t = c.getGateType(u);
+    const auto &wires = c.getWires(u);
+
+    switch(t) {
+    case gate_input:
+    case gate_update: {
+      auto it = mapping.find(u);
+      values[ui] = it == mapping.end() ? element_one : it->second;
+      break;
+    }
+
+    case gate_mulinput: {
+      std::string s = "{" + c.getUUID(wires[0]) + "="
+                      + std::to_string(c.getInfos(u).first) + "}";
+      values[ui] = parse(sr, s.c_str());
+      break;
+    }
+
+    case gate_one:
+      values[ui] = element_one;
+      break;
+
+    case gate_zero:
+      values[ui] = aggregate(sr, sr.plus, {});
+      break;
+
+    case gate_plus:
+    case gate_times:
+    case gate_monus:
+    case gate_delta:
+    case gate_eq:
+    case gate_project:
+    case gate_annotation: {
+      bool ready = true;
+      for(gate_t w : wires)
+        if(!done[static_cast<size_t>(w)]) {
+          stack.push_back(w);
+          ready = false;
+        }
+      if(!ready)
+        continue;
+
+      const auto child = [&](size_t i) -> value_t {
+                           return i < wires.size()
+                             ? values[static_cast<size_t>(wires[i])]
+                             : value_t{(Datum) 0, true};
+                         };
+
+      if(t == gate_plus || t == gate_times) {
+        std::vector<value_t> inputs;
+        inputs.reserve(wires.size());
+        for(gate_t w : wires)
+          inputs.push_back(values[static_cast<size_t>(w)]);
+        values[ui] = aggregate(sr, t == gate_plus ? sr.plus : sr.times, inputs);
+      } else if(t == gate_monus) {
+        if(!OidIsValid(sr.monus_oid))
+          throw CircuitException(
+                  "Provenance with negation evaluated over a semiring "
+                  "without monus function");
+        value_t args[2] = {child(0), child(1)};
+        values[ui] = call(&sr.monus, sr.collation, 2, args);
+      } else if(t == gate_delta) {
+        if(!OidIsValid(sr.delta_oid))
+          throw CircuitException(
+                  "Provenance with aggregation evaluated over a semiring "
+                  "without delta function");
+        value_t arg = child(0);
+        values[ui] = call(&sr.delta, sr.collation, 1, &arg);
+      } else
+        values[ui] = child(0);
+      break;
+    }
+
+    default:
+      throw CircuitException(
+              std::string("provenance_evaluate cannot be called on formulas using ")
+              + gate_type_name[t] + " gates; use compiled semirings instead");
+    }
+
+    done[ui] = true;
+    stack.pop_back();
+  }
+
+  return values[static_cast<size_t>(root)];
+}
+
+/**
+ * @brief Evaluate through the PL/pgSQL version of provenance_evaluate.
+ *
+ * Used for the semirings the native evaluation cannot call; the
+ * arguments are those of the current call.
+ */
+Datum provenance_evaluate_plpgsql(FunctionCallInfo fcinfo, Oid element_type)
+{
+  Datum token = PG_GETARG_DATUM(0);
+  Datum token2value = PG_GETARG_DATUM(1);
+  Datum element_one = PG_GETARG_DATUM(2);
+  Datum plus_function = PG_GETARG_DATUM(3);
+  Datum times_function = PG_GETARG_DATUM(4);
+  Datum monus_function = PG_GETARG_DATUM(5);
+  Datum delta_function = PG_GETARG_DATUM(6);
+  constants_t constants = get_constants(true);
+
+  bool isnull;
+  Datum result;
+  char nulls[8]={' ',' ',' ',' ',' ',' ',' ',' '};
+
+  HeapTuple tuple;
+
+  Datum arguments[8]={token,token2value,element_one,ObjectIdGetDatum(element_type),plus_function,times_function,monus_function,delta_function};
+  Oid argtypes[8];
+
+  if(PG_ARGISNULL(5)) // No monus function provided
+    nulls[6]='n';
+
+  if(PG_ARGISNULL(6)) // No delta function provided
+    nulls[7]='n';
+
+  argtypes[0]=constants.OID_TYPE_UUID;
+  argtypes[1]=REGCLASSOID;
+  argtypes[2]=element_type;
+  argtypes[3]=REGTYPEOID;
+  argtypes[4]=REGPROCOID;
+  argtypes[5]=REGPROCOID;
+  argtypes[6]=REGPROCOID;
+  argtypes[7]=REGPROCOID;
+
+  SPI_connect();
+
+  if(SPI_execute_with_args(
+       "SELECT provsql.provenance_evaluate($1,$2,$3,$4,$5,$6,$7,$8)",
+       8,
+       argtypes,
+       arguments,
+       nulls,
+       true,
+       1) != SPI_OK_SELECT) {
+    provsql_error("Cannot execute real provenance_evaluate function");
+  }
+
+  tuple = SPI_copytuple(SPI_tuptable->vals[0]);
+  result = heap_getattr(tuple, 1, SPI_tuptable->tupdesc, &isnull);
+
+  SPI_finish();
+
+  if(isnull)
+    PG_RETURN_NULL();
+  else
+    PG_RETURN_DATUM(result);
+}
+
+} // namespace
+
+/** @brief PostgreSQL-callable wrapper for provenance_evaluate(). */
+Datum provenance_evaluate(PG_FUNCTION_ARGS)
+{
+  if(PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3)
+     || PG_ARGISNULL(4))
+    PG_RETURN_NULL();
+
+  pg_uuid_t token = *DatumGetUUIDP(PG_GETARG_DATUM(0));
+  Oid element_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+
+  /* A token naming no gate evaluates to NULL. */
+  {
+    unsigned nb_children;
+    pg_uuid_t *children;
+    gate_type type = provsql_fetch_gate(&token, &nb_children, &children);
+    if(children)
+      free(children);
+    if(type == gate_invalid)
+      PG_RETURN_NULL();
+  }
+
+  user_semiring &sr = get_semiring(
+    fcinfo, element_type, PG_GETARG_OID(3), PG_GETARG_OID(4),
+    PG_ARGISNULL(5) ? InvalidOid : PG_GETARG_OID(5),
+    PG_ARGISNULL(6) ? InvalidOid : PG_GETARG_OID(6));
+
+  if(!sr.native)
+    return provenance_evaluate_plpgsql(fcinfo, element_type);
+
+  try {
+    value_t result = evaluate(sr, token, PG_GETARG_OID(1),
+                              {PG_GETARG_DATUM(2), false});
+    if(result.isnull)
+      PG_RETURN_NULL();
+    PG_RETURN_DATUM(result.d);
+  } catch(const std::exception &e) {
+    provsql_error("%s", e.what());
+  } catch(...) {
+    provsql_error("provenance_evaluate: Unknown exception");
+  }
+
+  PG_RETURN_NULL();
+}
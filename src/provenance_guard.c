@@ -0,0 +1,693 @@
+/**
+ * @file provenance_guard.c
+ * @brief The @c provenance_guard trigger and maintained provenance mappings.
+ *
+ * Every provenance-tracked table carries a @c BEFORE @c INSERT @c OR
+ * @c UPDATE @c OF @c provsql row trigger, @c provenance_guard, installed by
+ * @c add_provenance and @c repair_key.  It fires for every inserted row, so
+ * it is on the path of every bulk load into a tracked table, and it does
+ * three things:
+ *
+ *  - a row inserted without a token gets a fresh random leaf (a column
+ *    @c DEFAULT would not do: it fires before the trigger sees the row,
+ *    so "omitted" could not be told from "supplied");
+ *  - a row inserted with a token, or whose token is changed by an
+ *    @c UPDATE, flips the table to @c OPAQUE -- unless the new token is a
+ *    replacement leaf @c provsql.replace_input minted in this transaction,
+ *    in which case every mapping of the table follows the token to its
+ *    replacement;
+ *  - rows that got a fresh leaf are added to the table's maintained
+ *    mappings (see @c create_provenance_mapping).
+ *
+ * The table's entries of @c provsql.provenance_mapping_registry are cached
+ * per backend, keyed by relation and dropped on a relcache invalidation of
+ * the source table, which the @c provsql.table_info_invalidate trigger on
+ * the registry broadcasts.  A row with nothing to maintain thus costs a
+ * cache probe and a random UUID, with no SPI and no PL/pgSQL frame.
+ *
+ * The maintained mappings are not extended row by row.  The
+ * @c provenance_mapping_begin / @c provenance_mapping_maintain statement
+ * triggers @c create_provenance_mapping installs bracket each @c INSERT or
+ * @c COPY on the source: the row trigger only notes in the statement's
+ * frame whether it minted a token and which tokens were supplied, and the
+ * @c AFTER trigger extends each maintained mapping with one
+ * @c INSERT ... @c SELECT over the statement's transition table, which
+ * anti-joins the supplied tokens away only when the statement mixed both
+ * kinds of rows.  Frames are stacked, so an insert into the same table
+ * from within a trigger or a function gets its own, and are found by
+ * table, so statements into several tables may close in any order.  A
+ * table without the statement triggers (a foreign table, which cannot have
+ * transition tables) is maintained row by row, as before.
+ */
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/tupdesc.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/queryenvironment.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/tuplestore.h"
+#include "utils/uuid.h"
+
+#include "compatibility.h"
+#include "probability_store.h"
+#include "provsql_uuid.h"
+#include "provsql_utils.h"
+
+/** Name of the transition table of the @c provenance_mapping_maintain
+ *  trigger. */
+#define PROVSQL_NEW_ROWS "provsql_new_rows"
+
+extern Datum set_table_info(PG_FUNCTION_ARGS);
+
+/** @brief One @c provsql.provenance_mapping_registry entry of a table. */
+typedef struct guard_mapping {
+  Oid      mapping;                    ///< OID of the mapping table
+  NameData attribute;                  ///< Source column it maps
+  bool     maintained;                 ///< Extended by inserts into the source
+} guard_mapping;
+
+/** @brief What the guard knows of one tracked table. */
+typedef struct guard_cache_entry {
+  Oid            relid;                ///< pg_class OID (sort key)
+  bool           valid;                ///< false => refresh on next access
+  bool           opaque;               ///< Known to be @c OPAQUE already
+  int            mapping_n;            ///< Number of entries in @c mappings
+  int            maintained_n;         ///< How many of them are maintained
+  guard_mapping *mappings;             ///< The table's registry entries
+} guard_cache_entry;
+
+/** Sorted by @c relid.  Entries are allocated one by one, so that a
+ *  pointer to one stays valid while a nested trigger adds others. */
+static guard_cache_entry **guard_cache = NULL;
+static unsigned guard_cache_len = 0;
+static bool guard_callback_registered = false;
+
+/** Find @p relid in the cache.  Returns the index on hit; otherwise
+ *  @c -1 and writes the insertion point to @p *insert_at. */
+static int guard_cache_find(Oid relid, int *insert_at)
+{
+  int start = 0, end = (int)guard_cache_len - 1;
+  while(end >= start) {
+    int mid = (start + end) / 2;
+    if(guard_cache[mid]->relid < relid)
+      start = mid + 1;
+    else if(guard_cache[mid]->relid > relid)
+      end = mid - 1;
+    else
+      return mid;
+  }
+  if(insert_at) *insert_at = start;
+  return -1;
+}
+
+/** Relcache callback: forget the registry entries of @p relid, or of
+ *  every table when @p relid is @c InvalidOid. */
+static void invalidate_guard_cache_callback(Datum arg, Oid relid)
+{
+  int pos;
+  (void) arg;
+  if(relid == InvalidOid) {
+    for(unsigned i = 0; i < guard_cache_len; ++i)
+      guard_cache[i]->valid = false;
+    return;
+  }
+  pos = guard_cache_find(relid, NULL);
+  if(pos >= 0)
+    guard_cache[pos]->valid = false;
+}
+
+/** @brief Read the table's entries of @c provsql.provenance_mapping_registry
+ *  into @p e. */
+static void guard_cache_fill(guard_cache_entry *e)
+{
+  Oid   argtypes[1] = { OIDOID };
+  Datum values[1];
+  int   rc;
+
+  free(e->mappings);
+  e->mappings = NULL;
+  e->mapping_n = e->maintained_n = 0;
+  e->opaque = false;
+
+  /* Marked valid before the query: an invalidation the query itself
+   * processes then marks it stale again, rather than being lost. */
+  e->valid = true;
+
+  values[0] = ObjectIdGetDatum(e->relid);
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI while reading "
+                  "provsql.provenance_mapping_registry");
+  rc = SPI_execute_with_args(
+    "SELECT mapping, attribute, maintained "
+    "FROM provsql.provenance_mapping_registry WHERE source = $1",
+    1, argtypes, values, NULL, true, 0);
+  if(rc != SPI_OK_SELECT)
+    provsql_error("Cannot read provsql.provenance_mapping_registry "
+                  "(SPI code %d)", rc);
+
+  if(SPI_processed > 0) {
+    TupleDesc desc = SPI_tuptable->tupdesc;
+
+    e->mappings = calloc(SPI_processed, sizeof(guard_mapping));
+    if(!e->mappings)
+      provsql_error("ProvSQL: out of memory caching provenance mappings");
+    for(uint64 i = 0; i < SPI_processed; ++i) {
+      HeapTuple      tuple = SPI_tuptable->vals[i];
+      guard_mapping *m = &e->mappings[e->mapping_n++];
+      bool           isnull;
+
+      m->mapping = DatumGetObjectId(SPI_getbinval(tuple, desc, 1, &isnull));
+      namestrcpy(&m->attribute,
+                 NameStr(*DatumGetName(SPI_getbinval(tuple, desc, 2, &isnull))));
+      m->maintained = DatumGetBool(SPI_getbinval(tuple, desc, 3, &isnull));
+      if(m->maintained)
+        ++e->maintained_n;
+    }
+  }
+  SPI_finish();
+}
+
+/** @brief The cache entry of @p rel, refreshed if stale. */
+static guard_cache_entry *guard_cache_lookup(Relation rel)
+{
+  Oid relid = RelationGetRelid(rel);
+  int insert_at = 0;
+  int pos;
+
+  if(!guard_callback_registered) {
+    CacheRegisterRelcacheCallback(invalidate_guard_cache_callback, (Datum) 0);
+    guard_callback_registered = true;
+  }
+
+  pos = guard_cache_find(relid, &insert_at);
+  if(pos < 0) {
+    guard_cache_entry **new_buf = calloc(guard_cache_len + 1,
+                                         sizeof(guard_cache_entry *));
+    guard_cache_entry  *entry = calloc(1, sizeof(guard_cache_entry));
+    if(!new_buf || !entry)
+      provsql_error("ProvSQL: out of memory caching provenance mappings");
+    for(int i = 0; i < insert_at; ++i)
+      new_buf[i] = guard_cache[i];
+    entry->relid = relid;
+    new_buf[insert_at] = entry;
+    for(unsigned i = (unsigned)insert_at; i < guard_cache_len; ++i)
+      new_buf[i + 1] = guard_cache[i];
+    free(guard_cache);
+    guard_cache = new_buf;
+    ++guard_cache_len;
+    pos = insert_at;
+  }
+
+  if(!guard_cache[pos]->valid)
+    guard_cache_fill(guard_cache[pos]);
+  return guard_cache[pos];
+}
+
+/* -------------------------------------------------------------------------
+ * Statement frames
+ *
+ * One frame per INSERT or COPY into a table with maintained mappings that
+ * is in flight, pushed by the BEFORE STATEMENT trigger and removed by the
+ * AFTER STATEMENT one.  Statements into different tables need not close
+ * in the order they opened (a data-modifying WITH fires the AFTER
+ * STATEMENT triggers of the outer INSERT first), so frames are looked up
+ * and removed by table, not taken from the top.  Frames live in
+ * TopTransactionContext; a statement that fails leaves its frame behind,
+ * and the (sub)transaction abort that follows discards it.
+ * ------------------------------------------------------------------------- */
+
+/** @brief Tokens seen by the row trigger during one statement. */
+typedef struct guard_frame {
+  Oid              relid;              ///< Table the statement inserts into
+  int              nest_level;         ///< Subtransaction that pushed it
+  bool             minted;             ///< Some row got a fresh leaf
+  Tuplestorestate *supplied;           ///< Tokens rows came with, or @c NULL
+} guard_frame;
+
+static guard_frame *guard_frames = NULL;
+static int guard_frames_len = 0;
+static int guard_frames_cap = 0;
+static bool guard_frame_callbacks_registered = false;
+
+/** @brief Remove frame @p i, keeping the others in order. */
+static void guard_frame_remove(int i)
+{
+  if(guard_frames[i].supplied)
+    tuplestore_end(guard_frames[i].supplied);
+  memmove(&guard_frames[i], &guard_frames[i + 1],
+          (guard_frames_len - i - 1) * sizeof(guard_frame));
+  --guard_frames_len;
+}
+
+static void guard_xact_callback(XactEvent event, void *arg)
+{
+  (void) arg;
+  switch(event) {
+  case XACT_EVENT_COMMIT:
+  case XACT_EVENT_PARALLEL_COMMIT:
+  case XACT_EVENT_PREPARE:
+  case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_ABORT:
+    /* The frames went with TopTransactionContext, and their tuplestores'
+     * files with the transaction's resource owner. */
+    guard_frames = NULL;
+    guard_frames_len = guard_frames_cap = 0;
+    break;
+  default:
+    break;
+  }
+}
+
+static void guard_subxact_callback(SubXactEvent event,
+                                   SubTransactionId mySubid,
+                                   SubTransactionId parentSubid,
+                                   void *arg)
+{
+  (void) mySubid; (void) parentSubid; (void) arg;
+  if(event == SUBXACT_EVENT_ABORT_SUB) {
+    int level = GetCurrentTransactionNestLevel();
+    for(int i = guard_frames_len - 1; i >= 0; --i)
+      if(guard_frames[i].nest_level >= level)
+        guard_frame_remove(i);
+  }
+}
+
+/** @brief Open the frame of a statement inserting into @p relid. */
+static void guard_frame_push(Oid relid)
+{
+  guard_frame *f;
+
+  if(!guard_frame_callbacks_registered) {
+    RegisterXactCallback(guard_xact_callback, NULL);
+    RegisterSubXactCallback(guard_subxact_callback, NULL);
+    guard_frame_callbacks_registered = true;
+  }
+
+  if(guard_frames_len == guard_frames_cap) {
+    int newcap = guard_frames_cap ? guard_frames_cap * 2 : 8;
+    if(guard_frames)
+      guard_frames = repalloc(guard_frames, newcap * sizeof(guard_frame));
+    else
+      guard_frames = MemoryContextAlloc(TopTransactionContext,
+                                        newcap * sizeof(guard_frame));
+    guard_frames_cap = newcap;
+  }
+  f = &guard_frames[guard_frames_len++];
+  memset(f, 0, sizeof(*f));
+  f->relid = relid;
+  f->nest_level = GetCurrentTransactionNestLevel();
+}
+
+/** @brief Index of the innermost open frame inserting into @p relid, or
+ *  @c -1. */
+static int guard_frame_find(Oid relid)
+{
+  for(int i = guard_frames_len - 1; i >= 0; --i)
+    if(guard_frames[i].relid == relid)
+      return i;
+  return -1;
+}
+
+/** @brief Row type of the @c supplied tuplestores: one @c uuid column. */
+static TupleDesc guard_supplied_desc(void)
+{
+  static TupleDesc desc = NULL;
+
+  if(desc == NULL) {
+    MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+#if PG_VERSION_NUM >= 120000
+    desc = CreateTemplateTupleDesc(1);
+#else
+    desc = CreateTemplateTupleDesc(1, false);
+#endif
+    TupleDescInitEntry(desc, (AttrNumber) 1, "token", UUIDOID, -1, 0);
+    MemoryContextSwitchTo(oldcxt);
+  }
+  return desc;
+}
+
+/**
+ * @brief Note in @p f that a row came with token @p token.
+ *
+ * The tokens go to a tuplestore, which spills to a temporary file past
+ * @c work_mem: a bulk re-insertion of tokenized rows is not bounded by
+ * what fits in memory.  It belongs to the transaction, like the frame,
+ * whatever subtransaction the row is inserted in.
+ */
+static void guard_frame_supplied(guard_frame *f, Datum token)
+{
+  bool isnull = false;
+
+  if(!f->supplied) {
+    MemoryContext oldcxt = MemoryContextSwitchTo(TopTransactionContext);
+    ResourceOwner oldowner = CurrentResourceOwner;
+
+    CurrentResourceOwner = TopTransactionResourceOwner;
+    f->supplied = tuplestore_begin_heap(false, false, work_mem);
+    CurrentResourceOwner = oldowner;
+    MemoryContextSwitchTo(oldcxt);
+  }
+  tuplestore_putvalues(f->supplied, guard_supplied_desc(), &token, &isnull);
+}
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ------------------------------------------------------------------------- */
+
+/** @brief Schema-qualified, quoted name of relation @p relid. */
+static char *qualified_relation_name(Oid relid)
+{
+  char *relname = get_rel_name(relid);
+
+  if(!relname)
+    provsql_error("provenance mapping table with OID %u does not exist", relid);
+  return quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+                                    relname);
+}
+
+/** @brief Run @p sql, an @c INSERT into a mapping table, through SPI;
+ *  the caller is connected. */
+static void guard_exec(const char *sql, int nargs, Oid *argtypes,
+                       Datum *values, const char *nulls)
+{
+  int rc = SPI_execute_with_args(sql, nargs, argtypes, values, nulls, false, 0);
+  if(rc != SPI_OK_INSERT)
+    provsql_error("Cannot update a provenance mapping (SPI code %d)", rc);
+}
+
+/** @brief Flip @p relid to @c OPAQUE, unless @p e knows it already is. */
+static void guard_set_opaque(guard_cache_entry *e, Oid relid)
+{
+  ProvenanceTableInfo info;
+
+  if(e->opaque)
+    return;
+  if(!provsql_lookup_table_info(relid, &info) ||
+     info.kind != PROVSQL_TABLE_OPAQUE)
+    DirectFunctionCall3(set_table_info, ObjectIdGetDatum(relid),
+                        CStringGetTextDatum("opaque"),
+                        PointerGetDatum(construct_empty_array(INT2OID)));
+  /* Refreshing @p e (set_table_info's invalidation will stale it) clears
+   * the flag again; the table_info cache then answers. */
+  e->opaque = true;
+}
+
+/** @brief Add row @p tuple of @p rel, with token @p token, to every
+ *  maintained mapping of @p e: the row-by-row path, for tables without
+ *  the statement triggers. */
+static void guard_maintain_row(guard_cache_entry *e, Relation rel,
+                               HeapTuple tuple, Datum token)
+{
+  TupleDesc desc = RelationGetDescr(rel);
+
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI while maintaining a provenance mapping");
+  for(int i = 0; i < e->mapping_n; ++i) {
+    const guard_mapping *m = &e->mappings[i];
+    int            attno;
+    Oid            argtypes[2];
+    Datum          values[2];
+    char           nulls[2] = { ' ', ' ' };
+    bool           isnull;
+    StringInfoData sql;
+
+    if(!m->maintained)
+      continue;
+    attno = SPI_fnumber(desc, NameStr(m->attribute));
+    if(attno <= 0)
+      provsql_error("maintained provenance mapping %s: no column \"%s\" in %s",
+                    get_rel_name(m->mapping), NameStr(m->attribute),
+                    RelationGetRelationName(rel));
+    argtypes[0] = SPI_gettypeid(desc, attno);
+    values[0]   = SPI_getbinval(tuple, desc, attno, &isnull);
+    if(isnull)
+      nulls[0] = 'n';
+    argtypes[1] = UUIDOID;
+    values[1]   = token;
+
+    initStringInfo(&sql);
+    appendStringInfo(&sql, "INSERT INTO %s(value, provenance) VALUES ($1, $2)",
+                     qualified_relation_name(m->mapping));
+    guard_exec(sql.data, 2, argtypes, values, nulls);
+    pfree(sql.data);
+  }
+  SPI_finish();
+}
+
+/** @brief Copy the value of @p old_token to @p new_token in every mapping
+ *  of @p e. */
+static void guard_carry_over(guard_cache_entry *e, Datum old_token,
+                             Datum new_token)
+{
+  Oid   argtypes[2] = { UUIDOID, UUIDOID };
+  Datum values[2];
+
+  values[0] = old_token;
+  values[1] = new_token;
+
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI while maintaining a provenance mapping");
+  for(int i = 0; i < e->mapping_n; ++i) {
+    char          *name = qualified_relation_name(e->mappings[i].mapping);
+    StringInfoData sql;
+
+    initStringInfo(&sql);
+    appendStringInfo(&sql,
+                     "INSERT INTO %s(value, provenance) "
+                     "SELECT value, $2 FROM %s WHERE provenance = $1",
+                     name, name);
+    guard_exec(sql.data, 2, argtypes, values, NULL);
+    pfree(sql.data);
+  }
+  SPI_finish();
+}
+
+PG_FUNCTION_INFO_V1(provenance_guard);
+/**
+ * @brief @c BEFORE @c INSERT @c OR @c UPDATE @c OF @c provsql row trigger
+ *        of a provenance-tracked table (see the file comment).
+ */
+Datum provenance_guard(PG_FUNCTION_ARGS)
+{
+  TriggerData       *trigdata = (TriggerData *) fcinfo->context;
+  Relation           rel;
+  TupleDesc          desc;
+  Oid                relid;
+  int                attno;
+  HeapTuple          tuple;
+  Datum              token;
+  bool               isnull;
+  guard_cache_entry *e;
+
+  if(!CALLED_AS_TRIGGER(fcinfo) ||
+     !TRIGGER_FIRED_BEFORE(trigdata->tg_event) ||
+     !TRIGGER_FIRED_FOR_ROW(trigdata->tg_event))
+    provsql_error("provenance_guard: not called as a BEFORE row trigger");
+
+  rel   = trigdata->tg_relation;
+  desc  = RelationGetDescr(rel);
+  relid = RelationGetRelid(rel);
+  attno = SPI_fnumber(desc, PROVSQL_COLUMN_NAME);
+  if(attno <= 0)
+    provsql_error("provenance_guard: %s has no provsql column",
+                  RelationGetRelationName(rel));
+
+  if(TRIGGER_FIRED_BY_INSERT(trigdata->tg_event)) {
+    tuple = trigdata->tg_trigtuple;
+    token = heap_getattr(tuple, attno, desc, &isnull);
+    e = guard_cache_lookup(rel);
+
+    if(isnull) {
+      /* A genuine insert: this is the one place a new input token is born,
+       * so it is also where the maintained mappings are extended (keyed to
+       * that token).  Data-modification re-insertions (INSERT ... SELECT *
+       * FROM OLD_TABLE) carry a supplied token and are correctly skipped:
+       * the validity stays keyed to the original input. */
+      HeapTuple  newtuple;
+      pg_uuid_t *fresh = palloc(sizeof(pg_uuid_t));
+
+      provsql_uuid_v4(fresh);
+      token = UUIDPGetDatum(fresh);
+      isnull = false;
+      newtuple = heap_modify_tuple_by_cols(tuple, desc, 1, &attno,
+                                           &token, &isnull);
+      if(e->maintained_n > 0) {
+        int i = guard_frame_find(relid);
+        if(i >= 0)
+          guard_frames[i].minted = true;
+        else
+          guard_maintain_row(e, rel, newtuple, token);
+      }
+      return PointerGetDatum(newtuple);
+    }
+
+    if(e->maintained_n > 0) {
+      int i = guard_frame_find(relid);
+      if(i >= 0)
+        guard_frame_supplied(&guard_frames[i], token);
+    }
+    guard_set_opaque(e, relid);
+    return PointerGetDatum(tuple);
+  }
+
+  if(TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event)) {
+    bool  oldnull;
+    Datum oldtoken = heap_getattr(trigdata->tg_trigtuple, attno, desc, &oldnull);
+
+    tuple = trigdata->tg_newtuple;
+    token = heap_getattr(tuple, attno, desc, &isnull);
+    if(isnull != oldnull ||
+       (!isnull && memcmp(DatumGetUUIDP(token), DatumGetUUIDP(oldtoken),
+                          sizeof(pg_uuid_t)) != 0)) {
+      e = guard_cache_lookup(rel);
+      if(!isnull && provsql_is_fresh_leaf(DatumGetUUIDP(token))) {
+        /* A replacement leaf minted by provsql.replace_input /
+         * replace_block in this transaction: an independent fresh leaf
+         * by construction, so the table's kind survives.  Carry the
+         * mappings over from the token it replaces. */
+        if(!oldnull && e->mapping_n > 0)
+          guard_carry_over(e, oldtoken, token);
+      } else {
+        guard_set_opaque(e, relid);
+      }
+    }
+    return PointerGetDatum(tuple);
+  }
+
+  return PointerGetDatum(trigdata->tg_trigtuple);
+}
+
+/** @brief Name under which the tokens supplied in a mixed statement are
+ *  handed to SPI (see @c guard_maintain_statement). */
+#define PROVSQL_SUPPLIED_ROWS "provsql_supplied_rows"
+
+/**
+ * @brief Extend every maintained mapping of the table of @p trigdata with
+ *        the rows of its statement that got a fresh leaf.
+ *
+ * @p f is the statement's frame, which some row minted a token in.  When
+ * no row came with a token, that is every row of the transition table;
+ * otherwise the supplied tokens are handed to SPI as an ephemeral
+ * relation and anti-joined away, which the planner can hash.
+ */
+static void guard_maintain_statement(TriggerData *trigdata,
+                                     const guard_frame *f)
+{
+  Relation           rel = trigdata->tg_relation;
+  guard_cache_entry *e;
+
+  if(trigdata->tg_newtable == NULL)
+    provsql_error("provenance_mapping_maintain: trigger on %s has no "
+                  "transition table", RelationGetRelationName(rel));
+
+  e = guard_cache_lookup(rel);
+  if(e->maintained_n == 0)
+    return;
+
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI while maintaining a provenance mapping");
+  if(SPI_register_trigger_data(trigdata) != SPI_OK_TD_REGISTER)
+    provsql_error("provenance_mapping_maintain: cannot register the "
+                  "transition table");
+  if(f->supplied) {
+    EphemeralNamedRelation enr = palloc0(sizeof(EphemeralNamedRelationData));
+
+    enr->md.name      = PROVSQL_SUPPLIED_ROWS;
+    enr->md.reliddesc = InvalidOid;
+    enr->md.tupdesc   = guard_supplied_desc();
+    enr->md.enrtype   = ENR_NAMED_TUPLESTORE;
+    enr->md.enrtuples = tuplestore_tuple_count(f->supplied);
+    enr->reldata      = f->supplied;
+    if(SPI_register_relation(enr) != SPI_OK_REL_REGISTER)
+      provsql_error("provenance_mapping_maintain: cannot register the "
+                    "supplied tokens");
+  }
+
+  for(int i = 0; i < e->mapping_n; ++i) {
+    const guard_mapping *m = &e->mappings[i];
+    StringInfoData sql;
+
+    if(!m->maintained)
+      continue;
+    initStringInfo(&sql);
+    appendStringInfo(&sql,
+                     "INSERT INTO %s(value, provenance) "
+                     "SELECT n.%s, n." PROVSQL_COLUMN_NAME
+                     " FROM " PROVSQL_NEW_ROWS " n",
+                     qualified_relation_name(m->mapping),
+                     quote_identifier(NameStr(m->attribute)));
+    if(f->supplied)
+      /* A mixed statement: rows that came with a token are not new inputs. */
+      appendStringInfoString(&sql,
+                             " WHERE NOT EXISTS (SELECT 1 FROM "
+                             PROVSQL_SUPPLIED_ROWS " s WHERE s.token = n."
+                             PROVSQL_COLUMN_NAME ")");
+    guard_exec(sql.data, 0, NULL, NULL, NULL);
+    pfree(sql.data);
+  }
+  SPI_finish();
+}
+
+PG_FUNCTION_INFO_V1(provenance_mapping_maintain);
+/**
+ * @brief Statement triggers extending the maintained mappings of a table.
+ *
+ * As @c BEFORE @c INSERT @c FOR @c EACH @c STATEMENT (the
+ * @c provenance_mapping_begin trigger), opens the statement's frame.  As
+ * @c AFTER @c INSERT @c FOR @c EACH @c STATEMENT with a
+ * @c provsql_new_rows transition table (@c provenance_mapping_maintain),
+ * closes it and, when a row got a fresh leaf, extends every maintained
+ * mapping with the statement's rows, minus the ones that came with a token.
+ */
+Datum provenance_mapping_maintain(PG_FUNCTION_ARGS)
+{
+  TriggerData       *trigdata = (TriggerData *) fcinfo->context;
+  Relation           rel;
+  Oid                relid;
+  guard_frame        f;
+  int                i;
+
+  if(!CALLED_AS_TRIGGER(fcinfo) ||
+     !TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event) ||
+     !TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+    provsql_error("provenance_mapping_maintain: not called as an INSERT "
+                  "statement trigger");
+
+  rel   = trigdata->tg_relation;
+  relid = RelationGetRelid(rel);
+
+  if(TRIGGER_FIRED_BEFORE(trigdata->tg_event)) {
+    guard_frame_push(relid);
+    return PointerGetDatum(NULL);
+  }
+
+  /* Only this statement's frame is closed: the frames of statements into
+   * other tables may still be open, below it or above it. */
+  i = guard_frame_find(relid);
+  if(i < 0)
+    return PointerGetDatum(NULL);
+  f = guard_frames[i];
+  guard_frames[i].supplied = NULL;
+  guard_frame_remove(i);
+
+  /* On an error, the tuplestore goes with the transaction. */
+  if(f.minted)
+    guard_maintain_statement(trigdata, &f);
+  if(f.supplied)
+    tuplestore_end(f.supplied);
+
+  return PointerGetDatum(NULL);
+}
@@ -69,10 +69,12 @@
 
 #include "classify_query.h"
 #include "joint_width_query.h"
+#include "loaded_circuit_cache.h"
 #include "provsql_mmap.h"
 #include "provsql_rmgr.h"
 #include "provsql_shmem.h"
 #include "provsql_utils.h"
+#include "store_reader.h"
 #include "safe_query.h"
 
 #if PG_VERSION_NUM < 100000
@@ -99,6 +101,7 @@ char *provsql_tool_search_path = NULL; ///< Colon-separated directory list prepe
 char *provsql_fallback_compiler = NULL; ///< Compiler used by @c BooleanCircuit::makeDD as the final fallback after @c interpretAsDD and tree-decomposition both fail; controlled by the @c provsql.fallback_compiler GUC (default @c "d4")
 char *provsql_kcmcp_server = NULL; ///< Launch command for the managed KCMCP server (with a @c {endpoint} placeholder); controlled by the @c provsql.kcmcp_server GUC. Empty means no managed server is launched.
 int provsql_monte_carlo_seed = -1; ///< Seed for the Monte Carlo sampler; -1 means non-deterministic (std::random_device); controlled by the @c provsql.monte_carlo_seed GUC
+int provsql_sampler_threads = 1; ///< Threads the Boolean and Karp-Luby samplers spread their samples over; controlled by the @c provsql.sampler_threads GUC
 int provsql_rv_mc_samples = 10000; ///< Default sample count for analytical-evaluator MC fallbacks; 0 disables fallback (callers raise instead); controlled by the @c provsql.rv_mc_samples GUC
 double provsql_ess_warn_fraction = 0.1; ///< Effective-sample-size warning threshold for likelihood weighting: warn when the posterior ESS falls below this fraction of the accepted draws; controlled by the @c provsql.ess_warn_fraction GUC
 int provsql_dtree_max_subproblems = 0; ///< Debug/safety hard cap on d-tree subproblems before it bails (0 = off; the chooser auto-budgets at the next-best method's cost regardless); @c provsql.dtree_max_subproblems GUC
@@ -108,6 +111,9 @@ bool provsql_joint_width = true; ///< Recognise unsafe UCQs at planner time and
 bool provsql_mobius = true; ///< Try the safe-UCQ Möbius-inversion route (a guaranteed-PTIME exact route for its class) BEFORE the joint-width compiler, which it short-circuits on success (on by default); the @c provsql.mobius GUC is a debug-only switch to disable it
 int provsql_mobius_max_gates = 4000000; ///< Data-cost cap of the Möbius route: it declines (falling through to joint-width / the ladder) once its compile has built more than this many gates, bounding the \f$O(|D|^k)\f$ blow-up of a high-level safe query on large data; @c provsql.mobius_max_gates GUC
 int provsql_mobius_max_cnf = 8; ///< Query-cost cap of the Möbius route: it declines when a sentence's CNF has more than this many conjuncts, since the inclusion-exclusion lattice it walks has \f$2^M\f$ elements; ranking / shattering can inflate the conjunct count, which is what raising it buys; @c provsql.mobius_max_cnf GUC
+int provsql_loaded_circuit_cache = 100000; ///< Gate budget of the per-backend, per-statement cache of loaded circuits; 0 disables it; controlled by the @c provsql.loaded_circuit_cache GUC
+int provsql_compiled_circuit_cache = 65536; ///< Size budget, in kB, of the per-database cache of compiled d-DNNFs; 0 disables it; controlled by the @c provsql.compiled_circuit_cache GUC
+int provsql_compiled_circuit_cache_min_time = 1; ///< Shortest build, in ms, whose d-DNNF is stored in the compiled-circuit cache; controlled by the @c provsql.compiled_circuit_cache_min_time GUC
 bool provsql_simplify_on_load = true; ///< Run universal cmp-resolution passes when @c getGenericCircuit returns; controlled by the @c provsql.simplify_on_load GUC
 bool provsql_hybrid_evaluation = true; ///< Run the hybrid-evaluator simplifier inside @c probability_evaluate; controlled by the @c provsql.hybrid_evaluation GUC
 bool provsql_cmp_probability_evaluation = true; ///< Run closed-form / analytic probability evaluators for @c gate_cmps inside @c probability_evaluate (currently the Poisson-binomial pre-pass for HAVING-COUNT; future MIN / MAX / SUM evaluators will gate on the same GUC); controlled by the @c provsql.cmp_probability_evaluation GUC
@@ -1320,11 +1326,29 @@ static bool lower_recursive_cte(CommonTableExpr *cte, RangeTblEntry *r,
                          shape.hops_position);
       appendStringInfoString(&call, ")");
     } else {
-      appendStringInfo(&call, "SELECT provsql.eval_recursive(%s, %s, %s, %s)",
+      SetOperationStmt *so = (SetOperationStmt *) cteq->setOperations;
+
+      appendStringInfo(&call, "SELECT provsql.eval_recursive(%s, %s, %s, %s",
                        quote_literal_cstr(body_text),
                        quote_literal_cstr(cte->ctename),
                        quote_literal_cstr(cols.data),
                        quote_literal_cstr(coldef.data));
+      /* The two terms on their own, for the semi-naive rounds; a base term
+       * that is itself a set operation leaves the evaluation naive. */
+      if (IsA(so->larg, RangeTblRef) && IsA(so->rarg, RangeTblRef)) {
+        RangeTblEntry *base =
+          rt_fetch(((RangeTblRef *) so->larg)->rtindex, cteq->rtable);
+        RangeTblEntry *rec =
+          rt_fetch(((RangeTblRef *) so->rarg)->rtindex, cteq->rtable);
+        if (base->rtekind == RTE_SUBQUERY && base->subquery != NULL &&
+            rec->rtekind == RTE_SUBQUERY && rec->subquery != NULL)
+          appendStringInfo(&call, ", base_sql => %s, recursive_sql => %s",
+                           quote_literal_cstr(
+                             pg_get_querydef(base->subquery, false)),
+                           quote_literal_cstr(
+                             pg_get_querydef(rec->subquery, false)));
+      }
+      appendStringInfoString(&call, ")");
     }
   }
   if ((rc = SPI_connect()) != SPI_OK_CONNECT)
@@ -15444,15 +15468,24 @@ static PlannedStmt *provsql_planner(Query *q,
 /* -------------------------------------------------------------------------
  * Executor hooks (depth tracking only)
  *
- * We install ExecutorStart / ExecutorEnd hooks solely to maintain
+ * We install ExecutorStart / ExecutorEnd hooks to maintain
  * @c provsql_executor_depth, which the classifier in @c provsql_planner
  * consults to distinguish the user's outermost statement from nested
- * PL/pgSQL bodies the rewriter calls into.  No other behaviour changes.
+ * PL/pgSQL bodies the rewriter calls into.  The end of the outermost
+ * statement is also where the gates this backend has batched up are
+ * sent to the mmap worker (see @c provsql_gate_batch_flush), and its
+ * start and end are where the circuits it loaded are forgotten (see
+ * @c loaded_circuit_cache.h).  The start of every statement, nested or
+ * not, also bounds which gates its lookups must find in the store (see
+ * @c store_reader.h).
  * ------------------------------------------------------------------------- */
 static ExecutorStart_hook_type prev_ExecutorStart = NULL;
 static ExecutorEnd_hook_type   prev_ExecutorEnd   = NULL;
 
 static void provsql_executor_start(QueryDesc *queryDesc, int eflags) {
+  if (provsql_executor_depth == 0)
+    loaded_circuit_cache_reset();
+  store_reader_statement_start();
   provsql_executor_depth++;
   PG_TRY();
   {
@@ -15483,6 +15516,10 @@ static void provsql_executor_end(QueryDesc *queryDesc) {
     provsql_executor_depth--;
   }
   PG_END_TRY();
+  if (provsql_executor_depth == 0) {
+    provsql_gate_batch_flush();
+    loaded_circuit_cache_reset();
+  }
 #else
   /* PG < 13 lacks PG_FINALLY: emulate by running the cleanup on the
    * error path (via PG_CATCH + PG_RE_THROW) and on the success path
@@ -15501,6 +15538,10 @@ static void provsql_executor_end(QueryDesc *queryDesc) {
   }
   PG_END_TRY();
   provsql_executor_depth--;
+  if (provsql_executor_depth == 0) {
+    provsql_gate_batch_flush();
+    loaded_circuit_cache_reset();
+  }
 #endif
 }
 
@@ -16048,6 +16089,89 @@ void _PG_init(void) {
                            NULL,
                            NULL,
                            NULL);
+  DefineCustomBoolVariable("provsql.batch_gate_creation",
+                           "Send the gates a statement creates to the "
+                           "circuit store in batches.",
+                           "Gate creations need no reply, so a backend "
+                           "combines them into multi-gate messages, sent when "
+                           "full, at the end of the statement, before commit, "
+                           "or before any lookup. Off sends each gate on its "
+                           "own, as earlier versions did; meant for "
+                           "benchmarking and troubleshooting.",
+                           &provsql_batch_gate_creation,
+                           true,
+                           PGC_USERSET,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+  DefineCustomBoolVariable("provsql.direct_store_reads",
+                           "Answer circuit lookups from a read-only mapping "
+                           "of the circuit store.",
+                           "When the background worker has no request "
+                           "pending, a backend reads gates from its own "
+                           "mapping of the store files instead of asking the "
+                           "worker. Off always asks the worker, as earlier "
+                           "versions did; meant for benchmarking and "
+                           "troubleshooting.",
+                           &provsql_direct_store_reads,
+                           true,
+                           PGC_USERSET,
+                           0,
+                           NULL,
+                           NULL,
+                           NULL);
+  DefineCustomIntVariable("provsql.loaded_circuit_cache",
+                          "Number of gates of the circuits a statement keeps "
+                          "loaded for reuse.",
+                          "A statement that evaluates provenance repeatedly "
+                          "reuses the circuits it has already loaded, "
+                          "including for a token inside one of them, up to "
+                          "this many gates in all; the cache is emptied at "
+                          "the end of the statement. 0 loads every circuit "
+                          "from the store, as earlier versions did.",
+                          &provsql_loaded_circuit_cache,
+                          100000,
+                          0,
+                          INT_MAX,
+                          PGC_USERSET,
+                          0,
+                          NULL,
+                          NULL,
+                          NULL);
+  DefineCustomIntVariable("provsql.compiled_circuit_cache",
+                          "Size of the per-database cache of compiled "
+                          "d-DNNFs.",
+                          "The d-DNNFs built by knowledge compilers and tree "
+                          "decompositions are kept on disk, next to the "
+                          "circuit store, and reused by later evaluations of "
+                          "the same circuit in any session; the least "
+                          "recently used are removed beyond this size. 0 "
+                          "compiles every circuit anew.",
+                          &provsql_compiled_circuit_cache,
+                          65536,
+                          0,
+                          INT_MAX,
+                          PGC_SUSET,
+                          GUC_UNIT_KB,
+                          NULL,
+                          NULL,
+                          NULL);
+  DefineCustomIntVariable("provsql.compiled_circuit_cache_min_time",
+                          "Shortest build whose d-DNNF is stored in the "
+                          "compiled-circuit cache.",
+                          "d-DNNFs built faster than this are not stored, "
+                          "reading them back being no cheaper. 0 stores "
+                          "every build.",
+                          &provsql_compiled_circuit_cache_min_time,
+                          1,
+                          0,
+                          INT_MAX,
+                          PGC_SUSET,
+                          GUC_UNIT_MS,
+                          NULL,
+                          NULL,
+                          NULL);
   DefineCustomBoolVariable("provsql.update_provenance",
                            "Should ProvSQL track update provenance?",
                            "1 turns update provenance on, 0 off.",
@@ -16302,6 +16426,23 @@ void _PG_init(void) {
                           NULL,
                           NULL,
                           NULL);
+  DefineCustomIntVariable("provsql.sampler_threads",
+                          "Threads used by the Monte Carlo samplers.",
+                          "Number of threads, this backend's included, over "
+                          "which the monte-carlo, stopping-rule and "
+                          "karp-luby methods spread their samples on "
+                          "Boolean circuits. Results do not depend on it: "
+                          "under a pinned provsql.monte_carlo_seed every "
+                          "thread count gives the same estimate.",
+                          &provsql_sampler_threads,
+                          1,
+                          1,
+                          64,
+                          PGC_USERSET,
+                          0,
+                          NULL,
+                          NULL,
+                          NULL);
   DefineCustomIntVariable("provsql.rv_mc_samples",
                           "Default sample count for analytical-evaluator MC fallbacks.",
                           "Used when an analytical evaluator (Expectation, "
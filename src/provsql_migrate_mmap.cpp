@@ -241,7 +241,8 @@ struct OldCircuit {
 //   unsigned long nb_elements; unsigned long capacity;
 //   T d[];
 //
-// New MMappedUUIDHashTable on-disk:
+// New MMappedUUIDHashTable on-disk, version 1 (the worker rewrites it to
+// the current version the first time it opens it):
 //   uint64_t magic; uint16_t version; uint16_t elem_size; uint32_t _reserved;
 //   unsigned log_size; (4-byte implicit padding)
 //   unsigned long nb_elements; unsigned long next_value;
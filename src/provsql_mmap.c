@@ -13,13 +13,18 @@
  * @c MMappedCircuit.cpp.  This file provides the PostgreSQL-specific glue
  * (background worker API, signal handling).
  *
- * Also declares the shared write buffer @c buffer[] and position counter
+ * Also declares the growable write buffer @c buffer and position counter
  * @c bufferpos used by the @c STARTWRITEM / @c ADDWRITEM / @c SENDWRITEM
  * macros in @c provsql_mmap.h.
  *
  * The gate-creation SQL functions (e.g. @c create_gate()) that backends
- * call are also implemented here; they acquire the IPC lock, write a
- * message to the background worker, and wait for an acknowledgment.
+ * call are also implemented here; they send a message to the background
+ * worker and wait for an acknowledgment, or,
+ * for gate creations, append the gate to the backend's pending batch.  So
+ * are the per-row semiring combinators the query rewriter injects
+ * (@c provenance_times(), @c provenance_plus(), @c provenance_monus()),
+ * which mint their content-addressed tokens natively and create the gate
+ * directly.
  */
 #include "provsql_mmap.h"
 #include "provsql_rmgr.h"
@@ -33,6 +38,7 @@
 #include <assert.h>
 
 #include "postgres.h"
+#include "access/parallel.h"
 #include "access/xact.h"
 #include "postmaster/bgworker.h"
 #include "fmgr.h"
@@ -40,10 +46,12 @@
 #include "utils/array.h"
 #include "access/htup_details.h"
 #include "utils/builtins.h"
+#include "catalog/pg_type.h"
 
 #include "circuit_cache.h"
-
-#ifdef PROVSQL_INPROCESS_STORE
+#include "loaded_circuit_cache.h"
+#include "provsql_uuid.h"
+#include "store_reader.h"
 
 char *buffer = NULL; // flawfinder: ignore
 unsigned bufferpos = 0;
@@ -62,33 +70,18 @@ void provsql_buffer_ensure(size_t need)
   }
 }
 
+#ifdef PROVSQL_INPROCESS_STORE
+
 /* No background worker in the single-process build. */
 
 #else
 
-char buffer[PIPE_BUF]={}; // flawfinder: ignore
-unsigned bufferpos=0;
-
-bool provsql_read_all(int fd, void *dst, size_t n)
-{
-  char *p = dst;
-  size_t remaining = n;
-  while(remaining > 0) {
-    ssize_t r = read(fd, p, remaining); // flawfinder: ignore
-    if(r <= 0)
-      return false;
-    remaining -= r;
-    p += r;
-  }
-  return true;
-}
-
 #if PG_VERSION_NUM >= 190000
 /* PostgreSQL 19 changed the default background-worker SIGTERM handler
  * from bgworker_die() (immediate FATAL from the signal handler) to the
  * flag-based die(), which only acts at the next CHECK_FOR_INTERRUPTS().
- * This worker blocks in read() on the IPC pipe (restarted by
- * SA_RESTART), so it would never observe the flag and a fast shutdown
+ * This worker sleeps on its latch waiting for requests without processing
+ * interrupts, so it would never observe the flag and a fast shutdown
  * would hang on it.  Restore the pre-19 semantics: the worker holds no
  * transaction state, and being interrupted between messages leaves the
  * store consistent, so exiting mid-read is fine.  (Being interrupted
@@ -111,8 +104,7 @@ PGDLLEXPORT void provsql_mmap_worker(Datum ignored)
 #endif
   BackgroundWorkerUnblockSignals();
   initialize_provsql_mmap();
-  close(provsql_shared_state->pipebmw);
-  close(provsql_shared_state->pipembr);
+  provsql_ring_attach_worker();
   provsql_log("%s initialized", MyBgworkerEntry->bgw_name);
 
   provsql_mmap_main_loop();
@@ -150,8 +142,8 @@ void RegisterProvSQLMMapWorker(void)
 /* -------------------------------------------------------------------------
  * Durability of the store across a machine crash
  *
- * A backend's writes reach the worker over a FIFO pipe and the worker
- * applies them to the mmap files, but nothing forces those files to disk
+ * A backend's writes reach the worker in order over the request ring and
+ * the worker applies them to the mmap files, but nothing forces those files to disk
  * at the moment the writing transaction commits: the heap's WAL record is
  * fsynced, the circuit's bytes are not.  After a crash of the machine
  * (PostgreSQL crashing is harmless -- the page cache outlives it) a
@@ -172,6 +164,8 @@ bool provsql_synchronous_commit = false;
 static bool store_written = false;
 static bool store_callbacks_registered = false;
 
+static void gate_batch_discard(void);
+
 /** @brief Send the sync barrier and wait for the worker's acknowledgement. */
 static void provsql_store_sync_barrier(void)
 {
@@ -181,12 +175,8 @@ static void provsql_store_sync_barrier(void)
   ADDWRITEM("S", char);
   ADDWRITEDB();
 
-  provsql_shmem_lock_exclusive();
-  if(!SENDWRITEM() || !READB(ack, char)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(ack, char))
     provsql_error("Cannot communicate with pipe (message type S)");
-  }
-  provsql_shmem_unlock();
 }
 
 static void provsql_store_xact_callback(XactEvent event, void *arg)
@@ -197,14 +187,18 @@ static void provsql_store_xact_callback(XactEvent event, void *arg)
   case XACT_EVENT_PRE_PREPARE:
     /* Still inside the transaction, so raising here aborts the commit
        rather than leaving it half-durable. */
+    provsql_gate_batch_flush();
     if(store_written && provsql_synchronous_commit)
       provsql_store_sync_barrier();
     break;
-  case XACT_EVENT_COMMIT:
   case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_ABORT:
+    gate_batch_discard();
+    store_written = false;
+    break;
+  case XACT_EVENT_COMMIT:
   case XACT_EVENT_PREPARE:
   case XACT_EVENT_PARALLEL_COMMIT:
-  case XACT_EVENT_PARALLEL_ABORT:
     store_written = false;
     break;
   default:
@@ -212,7 +206,7 @@ static void provsql_store_xact_callback(XactEvent event, void *arg)
   }
 }
 
-/** @brief What every store mutation does before it reaches the pipe:
+/** @brief What every store mutation does before it reaches the worker:
  *  refuse it on a standby, and write it to the WAL.  @p data is the
  *  complete message, opcode first. */
 static void provsql_log_store_write(const char *data, size_t len)
@@ -251,6 +245,137 @@ bool provsql_store_written(void)
   return store_written;
 }
 
+/* -------------------------------------------------------------------------
+ * Gate-creation batching
+ *
+ * A query that builds a large circuit creates gates by the million, and a
+ * gate creation needs no reply.  Sending each one as its own 'C' message
+ * costs a lock acquisition, a write() and a worker wakeup per gate;
+ * instead, a backend appends them to a pending 'B' message:
+ *
+ *   'B' db_oid db_tablespace payload_len nb_gates
+ *       { token type nb_children child... } x nb_gates
+ *
+ * which the worker reads in one go and applies gate by gate.  The batch
+ * is sent when full, at the end of the outermost statement, before
+ * commit, and before any other message this backend sends (STARTWRITEM),
+ * so the backend never looks at the store without the gates it believes
+ * it has created.  It is
+ * WAL-logged as a whole when sent, so a standby replays the same message.
+ *
+ * Probability and annotation writes are not batched: both are write-once
+ * and answer whether the write was refused, which the caller turns into
+ * an error on the spot.
+ *
+ * Not in parallel workers, which have no outermost statement of their own
+ * and whose gates the leader may need before the worker exits; and not in
+ * the single-process build, where there is no worker to save round trips to.
+ * ------------------------------------------------------------------------- */
+
+bool provsql_batch_gate_creation = true;
+
+/** Backs @c provsql.direct_store_reads; see @c store_reader.h. */
+bool provsql_direct_store_reads = true;
+
+#ifndef PROVSQL_INPROCESS_STORE
+
+/** @brief Size of the @c 'B' message header: opcode, database, length,
+ *  gate count. */
+#define GATE_BATCH_HEADER (sizeof(char) + 2 * sizeof(Oid) + 2 * sizeof(unsigned))
+
+/** Pending @c 'B' message; gate records start at @c GATE_BATCH_HEADER. */
+static char gate_batch[PROVSQL_GATE_BATCH_SIZE];
+/** Bytes used in @c gate_batch, header included. */
+static size_t gate_batch_len = GATE_BATCH_HEADER;
+/** Number of gates in @c gate_batch. */
+static unsigned gate_batch_nb = 0;
+
+/**
+ * @brief Append a gate creation to the pending batch, sending the batch
+ *        first if the gate does not fit in what is left of it.
+ *
+ * @return @c false, with nothing appended, for a gate with too many
+ *         children to fit in any batch.
+ */
+static bool gate_batch_add(const pg_uuid_t *token, gate_type type,
+                           unsigned nb_children,
+                           const pg_uuid_t *children_data)
+{
+  size_t record = sizeof(pg_uuid_t) + sizeof(gate_type) + sizeof(unsigned)
+                  + (size_t) nb_children * sizeof(pg_uuid_t);
+  char *p;
+
+  if(record > PROVSQL_GATE_BATCH_SIZE - GATE_BATCH_HEADER)
+    return false;
+  if(gate_batch_len + record > PROVSQL_GATE_BATCH_SIZE)
+    provsql_gate_batch_flush();
+
+  p = gate_batch + gate_batch_len;
+  memcpy(p, token, sizeof(pg_uuid_t)); p += sizeof(pg_uuid_t);
+  memcpy(p, &type, sizeof(gate_type)); p += sizeof(gate_type);
+  memcpy(p, &nb_children, sizeof(unsigned)); p += sizeof(unsigned);
+  if(nb_children > 0)
+    memcpy(p, children_data, nb_children * sizeof(pg_uuid_t));
+
+  gate_batch_len += record;
+  ++gate_batch_nb;
+
+  /* Registers the callbacks that flush the batch before commit. */
+  provsql_store_note_write();
+  return true;
+}
+
+static void gate_batch_discard(void)
+{
+  if(gate_batch_nb == 0)
+    return;
+
+  gate_batch_len = GATE_BATCH_HEADER;
+  gate_batch_nb = 0;
+
+  /* The session cache was written through when the gates were batched;
+     it must not go on vouching for gates the worker never saw. */
+  circuit_cache_reset();
+}
+
+void provsql_gate_batch_flush(void)
+{
+  size_t len = gate_batch_len;
+  unsigned payload = (unsigned) (gate_batch_len - GATE_BATCH_HEADER);
+  char *p = gate_batch;
+
+  if(gate_batch_nb == 0)
+    return;
+
+  *p++ = 'B';
+  memcpy(p, &MyDatabaseId, sizeof(Oid)); p += sizeof(Oid);
+  memcpy(p, &MyDatabaseTableSpace, sizeof(Oid)); p += sizeof(Oid);
+  memcpy(p, &payload, sizeof(unsigned)); p += sizeof(unsigned);
+  memcpy(p, &gate_batch_nb, sizeof(unsigned));
+
+  /* Empty the batch before anything below can raise, so that an error
+     does not leave it to be sent again by the next message. */
+  gate_batch_len = GATE_BATCH_HEADER;
+  gate_batch_nb = 0;
+
+  provsql_before_store_write(gate_batch, len);
+
+  if(!provsql_ring_send(gate_batch, len))
+    provsql_error("Cannot write to pipe (message type B)");
+}
+
+#else
+
+static void gate_batch_discard(void)
+{
+}
+
+void provsql_gate_batch_flush(void)
+{
+}
+
+#endif /* PROVSQL_INPROCESS_STORE */
+
 void provsql_circuit_cleanup_request(bool dry_run, const pg_uuid_t *roots,
                                      int64 nb_roots,
                                      provsql_cleanup_result *out)
@@ -258,50 +383,35 @@ void provsql_circuit_cleanup_request(bool dry_run, const pg_uuid_t *roots,
   char flag = dry_run ? 1 : 0;
   unsigned long n = (unsigned long) nb_roots;
 
-  /* The root set is as large as the number of distinct tokens stored in
-     the database, so it does not fit one atomic pipe write.  The lock is
-     held across the whole exchange, which is what makes the sequence of
-     writes one message; nothing else can be talking to the worker anyway,
-     since the caller holds the database exclusively. */
-  provsql_shmem_lock_exclusive();
-
   STARTWRITEM();
   ADDWRITEM("X", char);
   ADDWRITEDB();
   ADDWRITEM(&flag, char);
   ADDWRITEM(&n, unsigned long);
-  if(!SENDWRITEM()) {
-    provsql_shmem_unlock();
-    provsql_error("Cannot write to pipe (message type X)");
-  }
 
 #ifdef PROVSQL_INPROCESS_STORE
-  /* The in-memory FIFO has no atomicity limit and the dispatch runs
-     inside SENDWRITEM, so the roots must accompany the header. */
-  provsql_shmem_unlock();
+  /* The dispatch runs inside SENDWRITEM, and the store it would rebuild
+     is this process's own heap copy. */
+  (void) roots; (void) out;
   provsql_error("circuit_cleanup is not available in the single-process build");
 #else
-  {
-    unsigned long per_batch = PIPE_BUF / sizeof(pg_uuid_t);
-    for(unsigned long i = 0; i < n; ) {
-      unsigned long j;
-      STARTWRITEM();
-      for(j = 0; j < per_batch && i < n; ++j, ++i)
-        ADDWRITEM(&roots[i], pg_uuid_t);
-      if(!SENDWRITEM()) {
-        provsql_shmem_unlock();
-        provsql_error("Cannot write to pipe (message type X)");
-      }
-    }
-  }
+  /* The root set is as large as the number of distinct tokens stored in
+     the database; it goes with the header as one message, streamed
+     through the request ring. */
+  for(unsigned long i = 0; i < n; ++i)
+    ADDWRITEM(&roots[i], pg_uuid_t);
+
+  if(!SENDWRITEM())
+    provsql_error("Cannot write to pipe (message type X)");
 
   if(!READB(out->gates_before, uint64) || !READB(out->gates_after, uint64)
      || !READB(out->wires_before, uint64) || !READB(out->wires_after, uint64)
-     || !READB(out->extra_before, uint64) || !READB(out->extra_after, uint64)) {
-    provsql_shmem_unlock();
+     || !READB(out->extra_before, uint64) || !READB(out->extra_after, uint64))
     provsql_error("Cannot read response from pipe (message type X)");
-  }
-  provsql_shmem_unlock();
+
+  /* The four files this backend may have mapped have just been replaced. */
+  if(!dry_run)
+    store_reader_reset();
 #endif
 }
 
@@ -310,40 +420,15 @@ void provsql_replay_store_message(const char *data, size_t len)
 #ifdef PROVSQL_INPROCESS_STORE
   (void) data; (void) len;
 #else
-  const char *p = data;
-  size_t left = len;
-
   if(len == 0)
     return;
 
   /* The worker is the single writer, in recovery as in normal running:
-     the message goes back down the same pipe a backend would use.  The
-     lock is held across the whole write so the (possibly chunked)
-     message stays one message. */
-  provsql_shmem_lock_exclusive();
-
-  while(left > 0) {
-    size_t chunk = left > PIPE_BUF ? PIPE_BUF : left;
-    if(write(provsql_shared_state->pipebmw, p, chunk) == -1) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot replay a store message to the pipe");
-    }
-    p += chunk;
-    left -= chunk;
-  }
-
-  /* Opcodes that answer must be drained, or the reply would be read as
-     the answer to somebody else's later question. */
-  if(data[0] == 'P') {
-    char result;
-    double stored;
-    if(!READB(result, char) || !READB(stored, double)) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot read the reply to a replayed store message");
-    }
-  }
-
-  provsql_shmem_unlock();
+     the message goes through the same request ring a backend would use.
+     Opcodes that answer (P) leave their reply in this process's own reply
+     slot, where the next request discards it unread. */
+  if(!provsql_ring_send(data, len))
+    provsql_error("Cannot replay a store message to the pipe");
 #endif
 }
 
@@ -371,7 +456,6 @@ Datum check_store(PG_FUNCTION_ARGS)
   ADDWRITEM("k", char);
   ADDWRITEDB();
 
-  provsql_shmem_lock_exclusive();
   if(!SENDWRITEM()
      || !READB(unclean, char)
      || !READB(nb_gates, unsigned long)
@@ -380,11 +464,8 @@ Datum check_store(PG_FUNCTION_ARGS)
      || !READB(dangling, unsigned long)
      || !READB(unreferenced, unsigned long)
      || !READB(bad_wires, unsigned long)
-     || !READB(bad_extra, unsigned long)) {
-    provsql_shmem_unlock();
+     || !READB(bad_extra, unsigned long))
     provsql_error("Cannot communicate with pipe (message type k)");
-  }
-  provsql_shmem_unlock();
 
   if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
     provsql_error("check_store: expected composite return type");
@@ -406,7 +487,7 @@ PG_FUNCTION_INFO_V1(get_gate_type);
 /** @brief PostgreSQL-callable wrapper for get_gate_type().
  *
  * On cache miss this fetches BOTH the gate type and its children from
- * the worker, in one critical section, then caches them together. If
+ * the worker, in two back-to-back round trips, then caches them together. If
  * we cached only the type (with an empty children list), a subsequent
  * get_children() call for the same token would consult the cache, find
  * the entry, and return 0 children : never querying the worker for the
@@ -434,44 +515,36 @@ gate_type provsql_fetch_gate(const pg_uuid_t *token,
     return type;
   }
 
-  /* Type fetch (message 't'). */
-  STARTWRITEM();
-  ADDWRITEM("t", char);
-  ADDWRITEDB();
-  ADDWRITEM(token, pg_uuid_t);
-
-  provsql_shmem_lock_exclusive();
-
-  if(!SENDWRITEM() || !READB(type, gate_type)) {
-    provsql_shmem_unlock();
-    provsql_error("Cannot communicate on pipe (message type t)");
-  }
-
-  /* Children fetch (message 'c'), batched in the same critical
-   * section so the cache entry below is complete. Skipped when the
-   * token is unknown (worker reports gate_invalid). */
-  if(type != gate_invalid) {
+  if(!store_reader_get_gate(*token, &type, &nb_children, &children)) {
+    /* Type fetch (message 't'). */
     STARTWRITEM();
-    ADDWRITEM("c", char);
+    ADDWRITEM("t", char);
     ADDWRITEDB();
     ADDWRITEM(token, pg_uuid_t);
 
-    if(!SENDWRITEM() || !READB(nb_children, unsigned)) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot communicate on pipe (message type c during get_gate_type)");
-    }
+    if(!SENDWRITEM() || !READB(type, gate_type))
+      provsql_error("Cannot communicate on pipe (message type t)");
 
-    if(nb_children > 0) {
-      children = calloc(nb_children, sizeof(pg_uuid_t));
-      if(!READB_BYTES(children, nb_children * sizeof(pg_uuid_t))) {
-        provsql_shmem_unlock();
-        provsql_error("Cannot read children from pipe (during get_gate_type)");
+    /* Children fetch (message 'c'), right after the type so the cache
+     * entry below is complete. Skipped when the
+     * token is unknown (worker reports gate_invalid). */
+    if(type != gate_invalid) {
+      STARTWRITEM();
+      ADDWRITEM("c", char);
+      ADDWRITEDB();
+      ADDWRITEM(token, pg_uuid_t);
+
+      if(!SENDWRITEM() || !READB(nb_children, unsigned))
+        provsql_error("Cannot communicate on pipe (message type c during get_gate_type)");
+
+      if(nb_children > 0) {
+        children = calloc(nb_children, sizeof(pg_uuid_t));
+        if(!READB_BYTES(children, nb_children * sizeof(pg_uuid_t)))
+          provsql_error("Cannot read children from pipe (during get_gate_type)");
       }
     }
   }
 
-  provsql_shmem_unlock();
-
   /* Skip caching the gate_input lazy default: MMappedCircuit::getGateType
    * returns gate_input both for real input gates and for tokens that are
    * not yet in the mapping. Caching the latter would poison subsequent
@@ -522,8 +595,16 @@ void provsql_internal_create_gate(const pg_uuid_t *token, gate_type type,
    * MMappedCircuit::createGate is idempotent on already-mapped tokens. */
   circuit_cache_create_gate(*token, type, nb_children, children_data);
 
-  /* The WAL record is the whole logical message, children included, even
-     though the pipe may need several writes for it. */
+#ifndef PROVSQL_INPROCESS_STORE
+  if(provsql_batch_gate_creation && !IsParallelWorker()
+     && gate_batch_add(token, type, nb_children, children_data))
+    return;
+
+  /* Sent on its own: whatever was batched before it goes first. */
+  provsql_gate_batch_flush();
+#endif
+
+  /* The WAL record is the whole logical message, children included. */
   {
     size_t header = sizeof(char) + 2 * sizeof(Oid) + sizeof(pg_uuid_t)
                     + sizeof(gate_type) + sizeof(unsigned);
@@ -551,65 +632,16 @@ void provsql_internal_create_gate(const pg_uuid_t *token, gate_type type,
   ADDWRITEM(&type, gate_type);
   ADDWRITEM(&nb_children, unsigned);
 
-#ifdef PROVSQL_INPROCESS_STORE
-  /* The in-memory FIFO has no PIPE_BUF atomicity limit: always send the
-     gate and all its children as a single message. */
-  if(1) {
-#else
-  if(PIPE_BUF-bufferpos>nb_children*sizeof(pg_uuid_t)) {
-#endif
-    // Enough space in the buffer for an atomic write, no need of
-    // exclusive locks
-
-    for(unsigned i=0; i<nb_children; ++i)
-      ADDWRITEM(&children_data[i], pg_uuid_t);
-
-    provsql_shmem_lock_shared();
-    if(!SENDWRITEM()) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot write to pipe (message type C)");
-    }
-    provsql_shmem_unlock();
-  }
-#ifndef PROVSQL_INPROCESS_STORE
-  else {
-    // Not enough space in buffer, pipe write won't be atomic, we need to
-    // make several writes and use locks
-    unsigned children_per_batch = PIPE_BUF/sizeof(pg_uuid_t);
-
-    provsql_shmem_lock_exclusive();
-
-    if(!SENDWRITEM()) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot write to pipe (message type C)");
-    }
-
-    for(unsigned j=0; j<1+(nb_children-1)/children_per_batch; ++j) {
-      STARTWRITEM();
-
-      for(unsigned i=j*children_per_batch; i<(j+1)*children_per_batch && i<nb_children; ++i) {
-        ADDWRITEM(&children_data[i], pg_uuid_t);
-      }
-
-      if(!SENDWRITEM()) {
-        provsql_shmem_unlock();
-        provsql_error("Cannot write to pipe (message type C)");
-      }
-    }
+  for(unsigned i=0; i<nb_children; ++i)
+    ADDWRITEM(&children_data[i], pg_uuid_t);
 
-    provsql_shmem_unlock();
-  }
-#endif
+  if(!SENDWRITEM())
+    provsql_error("Cannot write to pipe (message type C)");
 }
 
-/** @brief Send a probability write and read back what the store made of
- *  it.  @p tracked arms the at-commit sync barrier; the one caller that
- *  passes false is the rollback path, which runs when the transaction
- *  that would have committed is already gone. */
-static provsql_set_prob_result provsql_send_set_prob(const pg_uuid_t *token,
-                                                     double prob,
-                                                     double *existing,
-                                                     bool tracked)
+provsql_set_prob_result provsql_internal_set_prob(const pg_uuid_t *token,
+                                                  double prob,
+                                                  double *existing)
 {
   char result;
   double stored;
@@ -619,51 +651,79 @@ static provsql_set_prob_result provsql_send_set_prob(const pg_uuid_t *token,
   ADDWRITEDB();
   ADDWRITEM(token, pg_uuid_t);
   ADDWRITEM(&prob, double);
-  if(tracked)
-    provsql_before_store_write(buffer, bufferpos);
-  else
-    provsql_log_store_write(buffer, bufferpos);
+  provsql_before_store_write(buffer, bufferpos);
 
-  provsql_shmem_lock_exclusive();
-  if(!SENDWRITEM() || !READB(result, char) || !READB(stored, double)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(result, char) || !READB(stored, double))
     provsql_error("Cannot communicate with pipe (message type P)");
-  }
-  provsql_shmem_unlock();
+
+  /* Circuits loaded before the write hold the gate as it was. */
+  loaded_circuit_cache_reset();
 
   if(existing)
     *existing = stored;
   return (provsql_set_prob_result) result;
 }
 
-provsql_set_prob_result provsql_internal_set_prob(const pg_uuid_t *token,
-                                                  double prob,
-                                                  double *existing)
+unsigned provsql_internal_set_probs(const pg_uuid_t *tokens,
+                                    const double *probs, unsigned nb,
+                                    bool tracked,
+                                    provsql_set_prob_result *results,
+                                    double *existing)
 {
-  return provsql_send_set_prob(token, prob, existing, true);
-}
+  unsigned done;
+  char reply[PROVSQL_SET_PROB_BATCH];
+  double stored;
 
-void provsql_internal_clear_prob(const pg_uuid_t *token)
-{
-  provsql_send_set_prob(token, NAN, NULL, false);
+  if(nb == 0)
+    return 0;
+  Assert(nb <= PROVSQL_SET_PROB_BATCH);
+
+  STARTWRITEM();
+  ADDWRITEM("Q", char);
+  ADDWRITEDB();
+  ADDWRITEM(&nb, unsigned);
+  provsql_buffer_ensure(bufferpos + nb * (sizeof(pg_uuid_t) + sizeof(double)));
+  for(unsigned i=0; i<nb; ++i) {
+    ADDWRITEM(&tokens[i], pg_uuid_t);
+    ADDWRITEM(&probs[i], double);
+  }
+  if(tracked)
+    provsql_before_store_write(buffer, bufferpos);
+  else
+    provsql_log_store_write(buffer, bufferpos);
+
+  if(!SENDWRITEM() || !READB(done, unsigned) || done > nb
+     || (done > 0 && !READB_BYTES(reply, done)) || !READB(stored, double))
+    provsql_error("Cannot communicate with pipe (message type Q)");
+
+  loaded_circuit_cache_reset();
+
+  for(unsigned i=0; i<done; ++i)
+    results[i] = (provsql_set_prob_result) reply[i];
+  if(existing)
+    *existing = stored;
+  return done;
 }
 
 bool provsql_internal_get_prob_written(const pg_uuid_t *token, double *prob)
 {
   char has;
+  bool local_has;
   double stored;
 
+  if(store_reader_get_prob_written(*token, &local_has, &stored)) {
+    if(prob)
+      *prob = stored;
+    return local_has;
+  }
+
   STARTWRITEM();
   ADDWRITEM("q", char);
   ADDWRITEDB();
   ADDWRITEM(token, pg_uuid_t);
 
-  provsql_shmem_lock_exclusive();
-  if(!SENDWRITEM() || !READB(has, char) || !READB(stored, double)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(has, char) || !READB(stored, double))
     provsql_error("Cannot communicate with pipe (message type q)");
-  }
-  provsql_shmem_unlock();
 
   if(prob)
     *prob = stored;
@@ -685,13 +745,11 @@ void provsql_internal_set_infos(const pg_uuid_t *token, unsigned info1,
   ADDWRITEM(&info2, unsigned);
   provsql_before_store_write(buffer, bufferpos);
 
-  provsql_shmem_lock_exclusive();
   if(!SENDWRITEM() || !READB(result, char) || !READB(had1, unsigned)
-     || !READB(had2, unsigned)) {
-    provsql_shmem_unlock();
+     || !READB(had2, unsigned))
     provsql_error("Cannot communicate with pipe (message type I)");
-  }
-  provsql_shmem_unlock();
+
+  loaded_circuit_cache_reset();
 
   if((provsql_set_annotation_result) result == PROVSQL_SET_ANNOTATION_ALREADY_SET)
     ereport(ERROR,
@@ -705,6 +763,46 @@ void provsql_internal_set_infos(const pg_uuid_t *token, unsigned info1,
                        "that rolls back leaves the circuit as it found it.")));
 }
 
+void provsql_internal_repair_key(const provsql_repair_key_row *rows,
+                                 unsigned nb_rows)
+{
+  char result;
+  pg_uuid_t conflict;
+  unsigned had1, had2;
+
+  if(nb_rows == 0)
+    return;
+
+  STARTWRITEM();
+  ADDWRITEM("R", char);
+  ADDWRITEDB();
+  ADDWRITEM(&nb_rows, unsigned);
+  provsql_buffer_ensure(bufferpos + nb_rows * sizeof(provsql_repair_key_row));
+  for(unsigned i=0; i<nb_rows; ++i) {
+    ADDWRITEM(&rows[i].token, pg_uuid_t);
+    ADDWRITEM(&rows[i].key_token, pg_uuid_t);
+    ADDWRITEM(&rows[i].position, unsigned);
+    ADDWRITEM(&rows[i].block_size, unsigned);
+  }
+  provsql_before_store_write(buffer, bufferpos);
+
+  if(!SENDWRITEM() || !READB(result, char) || !READB(conflict, pg_uuid_t)
+     || !READB(had1, unsigned) || !READB(had2, unsigned))
+    provsql_error("Cannot communicate with pipe (message type R)");
+
+  loaded_circuit_cache_reset();
+
+  if((provsql_set_annotation_result) result == PROVSQL_SET_ANNOTATION_ALREADY_SET)
+    ereport(ERROR,
+            (errmsg("gate %s already records the annotation (%u, %u)",
+                    DatumGetCString(DirectFunctionCall1(
+                                      uuid_out, UUIDPGetDatum(&conflict))),
+                    had1, had2),
+             errdetail("A gate's annotation is written once, like the gate "
+                       "itself and its probability, so that a transaction "
+                       "that rolls back leaves the circuit as it found it.")));
+}
+
 PG_FUNCTION_INFO_V1(create_gate);
 /** @brief PostgreSQL-callable wrapper for create_gate(). */
 Datum create_gate(PG_FUNCTION_ARGS)
@@ -752,6 +850,239 @@ Datum create_gate(PG_FUNCTION_ARGS)
   PG_RETURN_VOID();
 }
 
+/* -------------------------------------------------------------------------
+ * Semiring combinators
+ *
+ * provenance_times, provenance_plus and provenance_monus are called once
+ * per row of every rewritten query.  They used to be PL/pgSQL, and the
+ * interpreter -- the array filtering, the textual concat fed to
+ * uuid_generate_v5, the separate get_gate_type and create_gate calls --
+ * was the largest cost of a join-heavy provenance query.  The versions
+ * below mint exactly the same tokens: the v5 recipe is hashed with the
+ * same bytes (see provsql_uuid.h), only without ever building the string.
+ * ------------------------------------------------------------------------- */
+
+/** @brief @c qsort comparator ordering UUIDs as PostgreSQL's @c uuid_cmp. */
+static int uuid_cmp_qsort(const void *a, const void *b)
+{
+  return memcmp(a, b, UUID_LEN);
+}
+
+/** @brief Hash the recipe @p prefix @c {c_1,...,c_n} into @p out. */
+static void uuid_v5_of_array(const char *prefix, const pg_uuid_t *tokens,
+                             int n, pg_uuid_t *out)
+{
+  provsql_uuid_v5_ctx ctx;
+
+  provsql_uuid_v5_begin(&ctx);
+  provsql_uuid_v5_add_str(&ctx, prefix);
+  /* concat() renders a NULL array as nothing at all, and array_agg over
+     no row is NULL rather than '{}'. */
+  if(n > 0) {
+    provsql_uuid_v5_add(&ctx, "{", 1);
+    for(int i=0; i<n; ++i) {
+      if(i > 0)
+        provsql_uuid_v5_add(&ctx, ",", 1);
+      provsql_uuid_v5_add_uuid(&ctx, &tokens[i]);
+    }
+    provsql_uuid_v5_add(&ctx, "}", 1);
+  }
+  provsql_uuid_v5_end(&ctx, out);
+}
+
+/**
+ * @brief Copy the elements of @p tokens into a palloc'd array, dropping
+ *        NULLs and every occurrence of @p neutral.
+ *
+ * Any dimensionality is accepted and flattened, as @c unnest does.
+ */
+static pg_uuid_t *filter_tokens(ArrayType *tokens, const pg_uuid_t *neutral,
+                                int *nb_out)
+{
+  Datum *elems;
+  bool *nulls;
+  int nelems, n = 0;
+  pg_uuid_t *result;
+
+  deconstruct_array(tokens, UUIDOID, UUID_LEN, false, 'c',
+                    &elems, &nulls, &nelems);
+
+  result = palloc(Max(nelems, 1) * sizeof(pg_uuid_t));
+  for(int i=0; i<nelems; ++i) {
+    const pg_uuid_t *t;
+    if(nulls[i])
+      continue;
+    t = DatumGetUUIDP(elems[i]);
+    if(memcmp(t, neutral, UUID_LEN) == 0)
+      continue;
+    result[n++] = *t;
+  }
+
+  pfree(elems);
+  pfree(nulls);
+  *nb_out = n;
+  return result;
+}
+
+/**
+ * @brief Common tail of @c provenance_times and @c provenance_plus over at
+ *        least two (or, for plus, possibly zero) surviving tokens.
+ *
+ * The *canonical* address -- the recipe @p canonical_prefix over the
+ * sorted multiset -- is probed first: planner-time routes pre-create a
+ * certified equivalent there, and ordinary creation never writes under
+ * that recipe, so a gate of type @p type found there is always a
+ * deliberate plant computing the same result.  Otherwise the ordinary,
+ * order-dependent recipe @p prefix addresses a fresh gate over the
+ * tokens in their given order.
+ */
+static void combine_tokens(const char *prefix, const char *canonical_prefix,
+                           gate_type type, pg_uuid_t *tokens, int n,
+                           pg_uuid_t *out)
+{
+  pg_uuid_t canonical;
+  pg_uuid_t *sorted;
+  pg_uuid_t *children = NULL;
+  unsigned nb_children = 0;
+  gate_type found;
+
+  sorted = palloc(Max(n, 1) * sizeof(pg_uuid_t));
+  memcpy(sorted, tokens, n * sizeof(pg_uuid_t));
+  qsort(sorted, n, sizeof(pg_uuid_t), uuid_cmp_qsort);
+  uuid_v5_of_array(canonical_prefix, sorted, n, &canonical);
+  pfree(sorted);
+
+  found = provsql_fetch_gate(&canonical, &nb_children, &children);
+  if(children)
+    free(children);
+  if(found == type) {
+    *out = canonical;
+    return;
+  }
+
+  uuid_v5_of_array(prefix, tokens, n, out);
+  provsql_internal_create_gate(out, type, n, n > 0 ? tokens : NULL);
+}
+
+PG_FUNCTION_INFO_V1(provenance_times);
+/**
+ * @brief PostgreSQL-callable @c provenance_times(VARIADIC uuid[]).
+ *
+ * A NULL element reads as the ⊗-neutral 1 (the token slot of an
+ * untracked source), and is dropped along with @c gate_one().  No
+ * survivor collapses to @c gate_one(), a single survivor is returned
+ * as is, and two or more make a @c times gate.
+ */
+Datum provenance_times(PG_FUNCTION_ARGS)
+{
+  pg_uuid_t *filtered;
+  pg_uuid_t *result = palloc(sizeof(pg_uuid_t));
+  int n = 0;
+
+  if(PG_ARGISNULL(0)) {
+    *result = *provsql_gate_one_token();
+    PG_RETURN_UUID_P(result);
+  }
+
+  filtered = filter_tokens(PG_GETARG_ARRAYTYPE_P(0),
+                           provsql_gate_one_token(), &n);
+
+  if(n == 0)
+    *result = *provsql_gate_one_token();
+  else if(n == 1)
+    *result = filtered[0];
+  else
+    combine_tokens("times", "times-canonical", gate_times, filtered, n,
+                   result);
+
+  pfree(filtered);
+  PG_RETURN_UUID_P(result);
+}
+
+PG_FUNCTION_INFO_V1(provenance_plus);
+/**
+ * @brief PostgreSQL-callable @c provenance_plus(uuid[]) (@c STRICT).
+ *
+ * A NULL element reads as the ⊕-neutral 0 (a row absent from the
+ * disjunction), and is dropped along with @c gate_zero().  A single
+ * survivor is returned as is.
+ *
+ * No survivor at all does *not* collapse to @c gate_zero(): the
+ * PL/pgSQL version this replaces tested the survivor count with
+ * @c array_length, which is NULL rather than 0 on an empty aggregate,
+ * and so fell through to creating a childless @c plus gate at
+ * @c uuid5('plus').  That gate evaluates to zero in every semiring, and
+ * existing stores reference it, so the same token is produced here.
+ */
+Datum provenance_plus(PG_FUNCTION_ARGS)
+{
+  pg_uuid_t *filtered;
+  pg_uuid_t *result = palloc(sizeof(pg_uuid_t));
+  int n = 0;
+
+  filtered = filter_tokens(PG_GETARG_ARRAYTYPE_P(0),
+                           provsql_gate_zero_token(), &n);
+
+  if(n == 1)
+    *result = filtered[0];
+  else
+    combine_tokens("plus", "plus-canonical", gate_plus, filtered, n,
+                   result);
+
+  pfree(filtered);
+  PG_RETURN_UUID_P(result);
+}
+
+PG_FUNCTION_INFO_V1(provenance_monus);
+/**
+ * @brief PostgreSQL-callable @c provenance_monus(uuid, uuid).
+ *
+ * A NULL second argument is the ⊖-right-neutral 0 -- the no-match case
+ * of the difference operator's @c LEFT @c OUTER @c JOIN -- so
+ * @c X ⊖ NULL = @c X.  @c X ⊖ @c X, @c 0 ⊖ @c X and @c X ⊖ @c 0 are
+ * simplified without creating a gate.
+ */
+Datum provenance_monus(PG_FUNCTION_ARGS)
+{
+  pg_uuid_t *token1, *token2;
+  pg_uuid_t *result;
+  const pg_uuid_t *zero = provsql_gate_zero_token();
+
+  if(PG_ARGISNULL(0))
+    ereport(ERROR,
+            (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+             errmsg("provenance_monus is called with first argument NULL")));
+
+  token1 = PG_GETARG_UUID_P(0);
+  if(PG_ARGISNULL(1))
+    PG_RETURN_UUID_P(token1);
+  token2 = PG_GETARG_UUID_P(1);
+
+  result = palloc(sizeof(pg_uuid_t));
+
+  if(memcmp(token1, token2, UUID_LEN) == 0
+     || memcmp(token1, zero, UUID_LEN) == 0)
+    *result = *zero;
+  else if(memcmp(token2, zero, UUID_LEN) == 0)
+    *result = *token1;
+  else {
+    provsql_uuid_v5_ctx ctx;
+    pg_uuid_t children[2];
+
+    provsql_uuid_v5_begin(&ctx);
+    provsql_uuid_v5_add(&ctx, "monus", 5);
+    provsql_uuid_v5_add_uuid(&ctx, token1);
+    provsql_uuid_v5_add_uuid(&ctx, token2);
+    provsql_uuid_v5_end(&ctx, result);
+
+    children[0] = *token1;
+    children[1] = *token2;
+    provsql_internal_create_gate(result, gate_monus, 2, children);
+  }
+
+  PG_RETURN_UUID_P(result);
+}
+
 PG_FUNCTION_INFO_V1(set_infos);
 /** @brief PostgreSQL-callable wrapper for set_infos(). */
 Datum set_infos(PG_FUNCTION_ARGS)
@@ -760,7 +1091,6 @@ Datum set_infos(PG_FUNCTION_ARGS)
   unsigned info1 = PG_GETARG_INT32(1);
   unsigned info2 = PG_GETARG_INT32(2);
 
-
   if(PG_ARGISNULL(1))
     info1=0;
   if(PG_ARGISNULL(2))
@@ -785,28 +1115,20 @@ void provsql_internal_set_extra(const pg_uuid_t *token, const char *str)
   ADDWRITEM(token, pg_uuid_t);
   ADDWRITEM(&len, unsigned);
 
-#ifdef PROVSQL_INPROCESS_STORE
   provsql_buffer_ensure(bufferpos+len);
-#else
-  assert(PIPE_BUF-bufferpos>len);
-#endif
   memcpy(buffer+bufferpos, str, len), bufferpos+=len;
   provsql_before_store_write(buffer, bufferpos);
 
-  provsql_shmem_lock_exclusive();
-  if(!SENDWRITEM() || !READB(result, char) || !READB(had_len, unsigned)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(result, char) || !READB(had_len, unsigned))
     provsql_error("Cannot communicate with pipe (message type E)");
-  }
   if(had_len > 0) {
     had = palloc(had_len + 1);
-    if(!READB_BYTES(had, had_len)) {
-      provsql_shmem_unlock();
+    if(!READB_BYTES(had, had_len))
       provsql_error("Cannot communicate with pipe (message type E)");
-    }
     had[had_len] = '\0';
   }
-  provsql_shmem_unlock();
+
+  loaded_circuit_cache_reset();
 
   if((provsql_set_annotation_result) result == PROVSQL_SET_ANNOTATION_ALREADY_SET)
     ereport(ERROR,
@@ -840,31 +1162,30 @@ Datum get_extra(PG_FUNCTION_ARGS)
   pg_uuid_t *token = DatumGetUUIDP(PG_GETARG_DATUM(0));
   text *result;
   unsigned len;
+  char *data;
 
   if(PG_ARGISNULL(0))
     PG_RETURN_NULL();
 
+  if(store_reader_get_extra(*token, &data, &len)) {
+    result = cstring_to_text_with_len(data, len);
+    pfree(data);
+    PG_RETURN_TEXT_P(result);
+  }
+
   STARTWRITEM();
   ADDWRITEM("e", char);
   ADDWRITEDB();
   ADDWRITEM(token, pg_uuid_t);
 
-  provsql_shmem_lock_exclusive();
-
-  if(!SENDWRITEM() || !READB(len, unsigned)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(len, unsigned))
     provsql_error("Cannot communicate with pipe (message type e)");
-  }
 
   result = palloc(len + VARHDRSZ);
   SET_VARSIZE(result, VARHDRSZ + len);
 
-  if(!READB_BYTES(VARDATA(result), len)) {
-    provsql_shmem_unlock();
+  if(!READB_BYTES(VARDATA(result), len))
     provsql_error("Cannot communicate with pipe (message type e)");
-  }
-
-  provsql_shmem_unlock();
 
   PG_RETURN_TEXT_P(result);
 }
@@ -879,14 +1200,8 @@ Datum get_nb_gates(PG_FUNCTION_ARGS)
   ADDWRITEM("n", char);
   ADDWRITEDB();
 
-  provsql_shmem_lock_exclusive();
-
-  if(!SENDWRITEM() || !READB(nb, unsigned long)) {
-    provsql_shmem_unlock();
+  if(!SENDWRITEM() || !READB(nb, unsigned long))
     provsql_error("Cannot communicate with pipe (message type n)");
-  }
-
-  provsql_shmem_unlock();
 
   PG_RETURN_INT64((long) nb);
 }
@@ -908,37 +1223,32 @@ Datum get_children(PG_FUNCTION_ARGS)
   nb_children = circuit_cache_get_children(*token, &children);
 
   if(!children) {
-    STARTWRITEM();
-    ADDWRITEM("c", char);
-    ADDWRITEDB();
-    ADDWRITEM(token, pg_uuid_t);
+    gate_type type = gate_invalid;
 
-    provsql_shmem_lock_exclusive();
+    if(!store_reader_get_gate(*token, &type, &nb_children, &children)) {
+      STARTWRITEM();
+      ADDWRITEM("c", char);
+      ADDWRITEDB();
+      ADDWRITEM(token, pg_uuid_t);
 
-    if(!SENDWRITEM()) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot write to pipe (message type c)");
-    }
+      if(!SENDWRITEM())
+        provsql_error("Cannot write to pipe (message type c)");
 
-    if(!READB(nb_children, unsigned)) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot read response from pipe (message type c)");
-    }
+      if(!READB(nb_children, unsigned))
+        provsql_error("Cannot read response from pipe (message type c)");
 
-    children=calloc(nb_children, sizeof(pg_uuid_t));
+      children=calloc(nb_children, sizeof(pg_uuid_t));
 
-    if(!READB_BYTES(children, nb_children*sizeof(pg_uuid_t))) {
-      provsql_shmem_unlock();
-      provsql_error("Cannot read from pipe (message type c)");
+      if(!READB_BYTES(children, nb_children*sizeof(pg_uuid_t)))
+        provsql_error("Cannot read from pipe (message type c)");
     }
-    provsql_shmem_unlock();
 
     /* Skip caching when the worker reports zero children: we cannot
      * distinguish a real zero-child gate (input/zero/one/...) from a
      * token unknown to the worker, and caching the latter poisons
      * subsequent create_gate() calls in this session. */
     if(nb_children > 0)
-      circuit_cache_create_gate(*token, gate_invalid, nb_children, children);
+      circuit_cache_create_gate(*token, type, nb_children, children);
   }
 
   children_ptr = palloc(nb_children * sizeof(Datum));
@@ -969,20 +1279,16 @@ Datum get_prob(PG_FUNCTION_ARGS)
   if(PG_ARGISNULL(0))
     PG_RETURN_NULL();
 
-  STARTWRITEM();
-  ADDWRITEM("p", char);
-  ADDWRITEDB();
-  ADDWRITEM(token, pg_uuid_t);
-
-  provsql_shmem_lock_exclusive();
+  if(!store_reader_get_prob(*token, &result)) {
+    STARTWRITEM();
+    ADDWRITEM("p", char);
+    ADDWRITEDB();
+    ADDWRITEM(token, pg_uuid_t);
 
-  if(!SENDWRITEM() || !READB(result, double)) {
-    provsql_shmem_unlock();
-    provsql_error("Cannot communicate with pipe (message type p)");
+    if(!SENDWRITEM() || !READB(result, double))
+      provsql_error("Cannot communicate with pipe (message type p)");
   }
 
-  provsql_shmem_unlock();
-
   if(isnan(result))
     PG_RETURN_NULL();
   else
@@ -999,20 +1305,16 @@ Datum get_infos(PG_FUNCTION_ARGS)
   if(PG_ARGISNULL(0))
     PG_RETURN_NULL();
 
-  STARTWRITEM();
-  ADDWRITEM("i", char);
-  ADDWRITEDB();
-  ADDWRITEM(token, pg_uuid_t);
-
-  provsql_shmem_lock_exclusive();
+  if(!store_reader_get_infos(*token, &info1, &info2)) {
+    STARTWRITEM();
+    ADDWRITEM("i", char);
+    ADDWRITEDB();
+    ADDWRITEM(token, pg_uuid_t);
 
-  if(!SENDWRITEM() || !READB(info1, int) || !READB(info2, int)) {
-    provsql_shmem_unlock();
-    provsql_error("Cannot communicate with pipe (message type i)");
+    if(!SENDWRITEM() || !READB(info1, int) || !READB(info2, int))
+      provsql_error("Cannot communicate with pipe (message type i)");
   }
 
-  provsql_shmem_unlock();
-
   {
     TupleDesc tupdesc;
     Datum values[2];
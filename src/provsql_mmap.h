@@ -7,15 +7,16 @@
  * processes.  Because multiple backends may create gates concurrently, a
  * dedicated PostgreSQL background worker (@c provsql_mmap_worker) is the
  * sole writer to those files; normal backends communicate with it through
- * a pair of anonymous pipes described in @c provsqlSharedState.
+ * the shared-memory request ring and reply slots of @c provsql_ring.h.
  *
  * This header exposes:
  * - Functions to register, start, and manage the background worker.
- * - A set of pipe I/O macros (@c READM, @c READB, @c WRITEB, @c WRITEM)
- *   that wrap @c read()/@c write() calls on the inter-process pipes.
+ * - A set of I/O macros (@c READM, @c READB, @c WRITEB) that read and
+ *   write the fields of a request or reply.
  * - A buffered-write interface (@c STARTWRITEM, @c ADDWRITEM, @c SENDWRITEM)
- *   that batches multiple fields into a single @c write() to stay within
- *   the atomic @c PIPE_BUF guarantee.
+ *   that assembles the fields of a request and sends it as one message.
+ * - A per-backend gate-creation batch (@c provsql_gate_batch_flush) that
+ *   combines many gate creations into a single message.
  */
 #ifndef PROVSQL_MMAP_H
 #define PROVSQL_MMAP_H
@@ -162,6 +163,28 @@ typedef enum provsql_set_prob_result {
   PROVSQL_SET_PROB_ALREADY_SET   = 3  ///< Holds a different value; refused
 } provsql_set_prob_result;
 
+/**
+ * @brief Capacity in bytes of a backend's gate-creation batch.
+ *
+ * Gate creations are fire-and-forget, so a backend accumulates them in a
+ * single @c 'B' message of at most this size rather than sending one
+ * @c 'C' message per gate: one request-ring lock acquisition and one
+ * worker wake-up for some thousands of gates.
+ */
+#define PROVSQL_GATE_BATCH_SIZE (64 * 1024)
+
+/**
+ * @brief Send the gate creations this backend has batched up, if any.
+ *
+ * Called at the end of every outermost statement and before commit.
+ * Starting any other message (@c STARTWRITEM) calls it first too, so a
+ * backend's messages reach the worker in the order it issued them: a
+ * lookup or a probability write never overtakes the creation of the gate
+ * it is about.  A batch still pending when the transaction aborts is
+ * dropped, along with the session's circuit cache.
+ */
+void provsql_gate_batch_flush(void);
+
 /**
  * @brief Write a gate's probability from in-extension C/C++ code.
  *
@@ -178,7 +201,7 @@ typedef enum provsql_set_prob_result {
  * drops what they wrote.
  *
  * @param token     UUID of the gate.
- * @param prob      Probability value in [0,1], or @c NaN to clear.
+ * @param prob      Probability value in [0,1].
  * @param existing  On @c PROVSQL_SET_PROB_ALREADY_SET, the stored value.
  */
 provsql_set_prob_result provsql_internal_set_prob(const pg_uuid_t *token,
@@ -186,15 +209,40 @@ provsql_set_prob_result provsql_internal_set_prob(const pg_uuid_t *token,
                                                   double *existing);
 
 /**
- * @brief Drop a gate's probability, leaving it as it was before anyone
- *        wrote one.
+ * @brief Largest number of probabilities a backend sends in one @c 'Q'
+ *        message (see @c provsql_internal_set_probs).
+ */
+#define PROVSQL_SET_PROB_BATCH 8192
+
+/**
+ * @brief Write the probabilities of @p nb tokens in one message.
+ *
+ * The batch counterpart of @c provsql_internal_set_prob: one request and
+ * one reply for the whole batch.  The worker applies the writes in order
+ * and stops at the first it refuses (@c PROVSQL_SET_PROB_NOT_PROB_GATE or
+ * @c PROVSQL_SET_PROB_ALREADY_SET), so that nothing after a refused row
+ * is written.
  *
- * The rollback path of @c probability_store.c, and the only way to unset
- * a probability: there is none from SQL.  Unlike a write it does not arm
- * the at-commit sync barrier -- it runs when the transaction that would
- * have committed is already gone.
+ * @param tokens    UUIDs of the gates.
+ * @param probs     Their probabilities, each in [0,1], or @c NaN to clear.
+ * @param nb        Number of rows, at most @c PROVSQL_SET_PROB_BATCH.
+ * @param tracked   Whether this is a live transaction's write, which arms
+ *                  the at-commit sync barrier.  The rollback path of
+ *                  @c probability_store.c, which clears what an aborted
+ *                  transaction wrote by passing @c NaN, passes @c false:
+ *                  it runs when the transaction that would have committed
+ *                  is already gone.
+ * @param results   Out: the outcome of each row the worker got to.
+ * @param existing  On a @c PROVSQL_SET_PROB_ALREADY_SET refusal, the
+ *                  stored value.
+ * @return The number of rows the worker got to: @p nb, or one more than
+ *         the index of the refused row.
  */
-void provsql_internal_clear_prob(const pg_uuid_t *token);
+unsigned provsql_internal_set_probs(const pg_uuid_t *tokens,
+                                    const double *probs, unsigned nb,
+                                    bool tracked,
+                                    provsql_set_prob_result *results,
+                                    double *existing);
 
 /**
  * @brief Report whether a probability has been written on a gate.
@@ -258,16 +306,35 @@ void provsql_internal_set_infos(const pg_uuid_t *token, unsigned info1,
  */
 void provsql_internal_set_extra(const pg_uuid_t *token, const char *str);
 
-#ifdef PROVSQL_INPROCESS_STORE
+/** @brief One row of a relation @c repair_key turns into a block of
+ *  mutually exclusive alternatives. */
+typedef struct provsql_repair_key_row {
+  pg_uuid_t token;      ///< The row's token: becomes a @c mulinput gate
+  pg_uuid_t key_token;  ///< Its block's key: an @c input gate
+  unsigned  position;   ///< 1-based position within the block (@c info1)
+  unsigned  block_size; ///< Number of rows in the block (@c info2)
+} provsql_repair_key_row;
 
 /**
- * @brief In-process replacement for a pipe write of a complete request.
+ * @brief Create the gates of @p nb_rows repaired rows in one message.
  *
- * Appends the message in @p buf (@p len bytes) to the request FIFO and runs
- * @c provsql_mmap_dispatch once, leaving any reply in the response FIFO for
- * the caller's @c READB / @c READB_BYTES to consume.
+ * For each row, the worker creates the key's @c input gate, the row's
+ * @c mulinput gate over it, and records the row's position and the
+ * block's size in its infos -- what @c create_gate and @c set_infos do
+ * one round trip at a time.  Rows of a block are expected to be
+ * consecutive.  Raises, after the whole message has been applied, when
+ * a row's gate already records different infos.
  */
-bool provsql_inproc_send(const char *buf, size_t len);
+void provsql_internal_repair_key(const provsql_repair_key_row *rows,
+                                 unsigned nb_rows);
+
+/**
+ * @brief Number of rows @c repair_key sends to the worker per message.
+ *
+ * 40 bytes each: a message of a few hundred kilobytes, and one round trip
+ * per this many rows rather than two or more per row.
+ */
+#define PROVSQL_REPAIR_KEY_BATCH 8192
 
 /** Growable shared write buffer used with @c STARTWRITEM / @c ADDWRITEM. */
 extern char *buffer;
@@ -278,10 +345,20 @@ extern size_t buffercap;
 /** @brief Ensure @c buffer can hold at least @p need bytes. */
 void provsql_buffer_ensure(size_t need);
 
+#ifdef PROVSQL_INPROCESS_STORE
+
+/**
+ * @brief In-process replacement for sending a complete request.
+ *
+ * Appends the message in @p buf (@p len bytes) to the request FIFO and runs
+ * @c provsql_mmap_dispatch once, leaving any reply in the response FIFO for
+ * the caller's @c READB / @c READB_BYTES to consume.
+ */
+bool provsql_inproc_send(const char *buf, size_t len);
+
 #define READM(var, type)   provsql_fifo_pop (&provsql_shared_state->req,  &(var), sizeof(type))
 #define READB(var, type)   provsql_fifo_pop (&provsql_shared_state->resp, &(var), sizeof(type))
 #define WRITEB(pvar, type) provsql_fifo_push(&provsql_shared_state->resp, (pvar), sizeof(type))
-#define WRITEM(pvar, type) provsql_fifo_push(&provsql_shared_state->req,  (pvar), sizeof(type))
 
 #define READB_BYTES(ptr, n) provsql_fifo_pop (&provsql_shared_state->resp, (ptr), (n))
 #define READM_BYTES(ptr, n) provsql_fifo_pop (&provsql_shared_state->req,  (ptr), (n))
@@ -293,36 +370,29 @@ void provsql_buffer_ensure(size_t need);
 
 #else
 
-/** @brief Read exactly @p n bytes from @p fd into @p dst; @c false on EOF/error. */
-bool provsql_read_all(int fd, void *dst, size_t n);
-
-/** Shared write buffer used with @c STARTWRITEM / @c ADDWRITEM / @c SENDWRITEM. */
-extern char buffer[PIPE_BUF];
-/** Current write position within @c buffer. */
-extern unsigned bufferpos;
-
-/** @brief Read one value of @p type from the background-to-main pipe. */
-#define READM(var, type) (read(provsql_shared_state->pipebmr, &var, sizeof(type))==(ssize_t)sizeof(type)) // flawfinder: ignore
-/** @brief Read one value of @p type from the main-to-background pipe. */
-#define READB(var, type) (read(provsql_shared_state->pipembr, &var, sizeof(type))==(ssize_t)sizeof(type)) // flawfinder: ignore
-/** @brief Write one value of @p type to the main-to-background pipe. */
-#define WRITEB(pvar, type) (write(provsql_shared_state->pipembw, pvar, sizeof(type))!=-1)
-/** @brief Write one value of @p type to the background-to-main pipe. */
-#define WRITEM(pvar, type) (write(provsql_shared_state->pipebmw, pvar, sizeof(type))!=-1)
-
-/** @brief Read exactly @p n bytes of a reply from the main-to-background pipe. */
-#define READB_BYTES(ptr, n) provsql_read_all(provsql_shared_state->pipembr, (ptr), (n)) // flawfinder: ignore
-/** @brief Read exactly @p n bytes of a request from the background-to-main pipe. */
-#define READM_BYTES(ptr, n) provsql_read_all(provsql_shared_state->pipebmr, (ptr), (n)) // flawfinder: ignore
-/** @brief Write @p n reply bytes to the main-to-background pipe. */
-#define WRITEB_BYTES(ptr, n) (write(provsql_shared_state->pipembw, (ptr), (n))!=-1)
-
-/** @brief Reset the shared write buffer for a new batched write. */
-#define STARTWRITEM() (bufferpos=0)
+#include "provsql_ring.h"
+
+/** @brief Read one value of @p type from the current request (worker side). */
+#define READM(var, type) provsql_ring_read_request(&(var), sizeof(type))
+/** @brief Read one value of @p type from the reply to this backend's last request. */
+#define READB(var, type) provsql_ring_read_reply(&(var), sizeof(type))
+/** @brief Append one value of @p type to the current request's reply (worker side). */
+#define WRITEB(pvar, type) provsql_ring_write_reply((pvar), sizeof(type))
+
+/** @brief Read exactly @p n bytes of the reply to this backend's last request. */
+#define READB_BYTES(ptr, n) provsql_ring_read_reply((ptr), (n))
+/** @brief Read exactly @p n bytes of the current request (worker side). */
+#define READM_BYTES(ptr, n) provsql_ring_read_request((ptr), (n))
+/** @brief Append @p n bytes to the current request's reply (worker side). */
+#define WRITEB_BYTES(ptr, n) provsql_ring_write_reply((ptr), (n))
+
+/** @brief Reset the shared write buffer for a new message, after
+ *  sending any pending gate-creation batch. */
+#define STARTWRITEM() (provsql_gate_batch_flush(), bufferpos=0)
 /** @brief Append one value of @p type to the shared write buffer. */
-#define ADDWRITEM(pvar, type) (memcpy(buffer+bufferpos, pvar, sizeof(type)), bufferpos+=sizeof(type))
-/** @brief Flush the shared write buffer to the background-to-main pipe atomically. */
-#define SENDWRITEM() (write(provsql_shared_state->pipebmw, buffer, bufferpos)!=-1)
+#define ADDWRITEM(pvar, type) (provsql_buffer_ensure(bufferpos+sizeof(type)), memcpy(buffer+bufferpos, pvar, sizeof(type)), bufferpos+=sizeof(type))
+/** @brief Send the shared write buffer to the worker as one message. */
+#define SENDWRITEM() provsql_ring_send(buffer, bufferpos)
 
 #endif /* PROVSQL_INPROCESS_STORE */
 
@@ -0,0 +1,493 @@
+/**
+ * @file provsql_ring.c
+ * @brief Shared-memory request ring and reply slots (see @c provsql_ring.h).
+ *
+ * Memory ordering follows the usual single-producer/single-consumer
+ * discipline on each ring: the producer copies the bytes in, issues a
+ * write barrier and only then advances @c tail; the consumer reads
+ * @c tail, issues a read barrier before copying the bytes out, and a full
+ * barrier before advancing @c head, so the producer never overwrites
+ * bytes still being read.  The request ring has many producers, but they
+ * take turns under the ring's @c LWLock, so at any instant it has one.
+ *
+ * Sleeping is on latches.  A side that finds the ring it needs empty (or
+ * full) records that it is waiting, re-checks, and sleeps; the other side
+ * sets its latch after every transfer that might have changed the
+ * answer.  Neither side processes interrupts while it waits, exactly as
+ * neither did blocked in @c read() on the pipes this replaced: a request
+ * is always sent whole, and a reply is only given up on through the
+ * abort path described in @c provsql_ring.h.
+ */
+#include "postgres.h"
+
+#include "provsql_config.h"
+
+#ifndef PROVSQL_INPROCESS_STORE
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "pgstat.h"                  /* PG_WAIT_EXTENSION */
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+
+#include "provsql_ring.h"
+#include "provsql_utils.h"
+
+#if PG_VERSION_NUM < 120000
+/* See kcmcp_supervisor.c: before PostgreSQL 12, WaitLatch reports
+ * postmaster death instead of exiting; the waits below turn the report
+ * into an exit. */
+#define WL_EXIT_ON_PM_DEATH WL_POSTMASTER_DEATH
+#endif
+
+/** @brief Number of this process's @c PGPROC, which indexes reply slots. */
+#if PG_VERSION_NUM >= 170000
+#define MY_PROC_NUMBER MyProcNumber
+#else
+#define MY_PROC_NUMBER (MyProc->pgprocno)
+#endif
+
+/** @brief What precedes every message in the request ring. */
+typedef struct provsql_request_prefix {
+  int32 slot;              ///< Reply slot of the sender
+  uint32 seq;              ///< Sender's request number
+} provsql_request_prefix;
+
+/** @brief The shared segment of the rings: control fields, the request
+ *  ring, and @c nb_slots reply slots. */
+typedef struct provsql_ring_control {
+  LWLock *lock;            ///< Held by a producer for one whole message
+  Latch *worker_latch;     ///< The worker's latch, once it runs
+  int nb_slots;            ///< Number of reply slots
+  provsql_request_ring requests; ///< Backends to worker
+  provsql_reply_slot slots[FLEXIBLE_ARRAY_MEMBER]; ///< Worker to each process
+} provsql_ring_control;
+
+static provsql_ring_control *ring = NULL;
+
+/** @brief Reply slot and request number of the request being dispatched
+ *  (worker side). */
+static int32 reply_slot = -1;
+static uint32 reply_seq = 0;
+
+/** @brief Number of this process's last request (backend side). */
+static uint32 request_seq = 0;
+/** @brief Offset in the request ring of the end of this process's last
+ *  request (backend side). */
+static uint64 request_end = 0;
+static bool abandon_callbacks_registered = false;
+
+/**
+ * @brief Number of @c PGPROC entries that can talk to the worker.
+ *
+ * Regular backends, autovacuum and background workers, WAL senders, and
+ * auxiliary processes (the startup process replays WAL records through
+ * the worker).  Before PostgreSQL 15 this runs in @c _PG_init, before
+ * @c MaxBackends is computed, so it is recomputed the same way from the
+ * settings it derives from.
+ */
+static int ring_nb_slots(void)
+{
+#if PG_VERSION_NUM >= 150000
+  return MaxBackends + NUM_AUXILIARY_PROCS;
+#elif PG_VERSION_NUM >= 120000
+  return MaxConnections + autovacuum_max_workers + 1 + max_worker_processes
+         + max_wal_senders + NUM_AUXILIARY_PROCS;
+#else
+  return MaxConnections + autovacuum_max_workers + 1 + max_worker_processes
+         + NUM_AUXILIARY_PROCS;
+#endif
+}
+
+Size provsql_ring_memsize(void)
+{
+  return MAXALIGN(add_size(offsetof(provsql_ring_control, slots),
+                           mul_size(ring_nb_slots(),
+                                    sizeof(provsql_reply_slot))));
+}
+
+void provsql_ring_shmem_init(void)
+{
+  bool found;
+
+  ring = ShmemInitStruct("provsql rings", provsql_ring_memsize(), &found);
+  if(found)
+    return;
+
+  ring->lock = &(GetNamedLWLockTranche("provsql"))[1].lock;
+  ring->worker_latch = NULL;
+  ring->nb_slots = ring_nb_slots();
+
+  pg_atomic_init_u64(&ring->requests.head, 0);
+  pg_atomic_init_u64(&ring->requests.tail, 0);
+  pg_atomic_init_u64(&ring->requests.done, 0);
+  ring->requests.space_waiter = NULL;
+
+  for(int i=0; i<ring->nb_slots; ++i) {
+    provsql_reply_slot *s = &ring->slots[i];
+    SpinLockInit(&s->mutex);
+    s->seq = 0;
+    s->worker_waiting = false;
+    s->latch = NULL;
+    pg_atomic_init_u64(&s->head, 0);
+    pg_atomic_init_u64(&s->tail, 0);
+  }
+}
+
+/** @brief Sleep on this process's latch until something sets it. */
+static void ring_sleep(long timeout_ms, bool *timed_out)
+{
+  int events = WL_LATCH_SET | WL_EXIT_ON_PM_DEATH;
+  int rc;
+
+  if(timeout_ms >= 0)
+    events |= WL_TIMEOUT;
+  rc = WaitLatch(MyLatch, events, timeout_ms, PG_WAIT_EXTENSION);
+  ResetLatch(MyLatch);
+  if(rc & WL_POSTMASTER_DEATH)
+    proc_exit(1);
+  if(timed_out)
+    *timed_out = (rc & WL_TIMEOUT) != 0;
+}
+
+static void wake_worker(void)
+{
+  Latch *latch = ring->worker_latch;
+  if(latch)
+    SetLatch(latch);
+}
+
+/* -------------------------------------------------------------------------
+ * Request ring
+ * ------------------------------------------------------------------------- */
+
+/** @brief Copy @p n bytes into the request ring; caller holds the lock. */
+static void request_push(const void *src, size_t n)
+{
+  provsql_request_ring *r = &ring->requests;
+  const char *p = src;
+
+  while(n > 0) {
+    uint64 tail = pg_atomic_read_u64(&r->tail);
+    uint64 head = pg_atomic_read_u64(&r->head);
+    size_t room = PROVSQL_REQUEST_RING_SIZE - (size_t) (tail - head);
+    size_t off, chunk;
+
+    if(room == 0) {
+      r->space_waiter = MyLatch;
+      pg_memory_barrier();
+      if(pg_atomic_read_u64(&r->head) == head)
+        ring_sleep(-1, NULL);
+      r->space_waiter = NULL;
+      continue;
+    }
+
+    off = (size_t) (tail % PROVSQL_REQUEST_RING_SIZE);
+    chunk = Min(n, Min(room, PROVSQL_REQUEST_RING_SIZE - off));
+    memcpy(r->data + off, p, chunk);
+    pg_write_barrier();
+    pg_atomic_write_u64(&r->tail, tail + chunk);
+    wake_worker();
+
+    p += chunk;
+    n -= chunk;
+  }
+}
+
+/** @brief Wait until at least @p n bytes can be read from the request
+ *  ring; @c false if @p timeout_ms elapsed first. */
+static bool request_wait(size_t n, long timeout_ms)
+{
+  provsql_request_ring *r = &ring->requests;
+
+  for(;;) {
+    bool timed_out;
+    if(pg_atomic_read_u64(&r->tail) - pg_atomic_read_u64(&r->head) >= n)
+      return true;
+    ring_sleep(timeout_ms, &timed_out);
+    if(timed_out
+       && pg_atomic_read_u64(&r->tail) - pg_atomic_read_u64(&r->head) < n)
+      return false;
+  }
+}
+
+bool provsql_ring_read_request(void *dst, size_t n)
+{
+  provsql_request_ring *r = &ring->requests;
+  char *p = dst;
+
+  while(n > 0) {
+    uint64 head = pg_atomic_read_u64(&r->head);
+    uint64 tail = pg_atomic_read_u64(&r->tail);
+    size_t off, chunk;
+    Latch *waiter;
+
+    if(tail == head) {
+      request_wait(1, -1);
+      continue;
+    }
+
+    pg_read_barrier();
+    off = (size_t) (head % PROVSQL_REQUEST_RING_SIZE);
+    chunk = Min(n, Min((size_t) (tail - head), PROVSQL_REQUEST_RING_SIZE - off));
+    memcpy(p, r->data + off, chunk);
+    pg_memory_barrier();
+    pg_atomic_write_u64(&r->head, head + chunk);
+    pg_memory_barrier();
+    waiter = r->space_waiter;
+    if(waiter)
+      SetLatch(waiter);
+
+    p += chunk;
+    n -= chunk;
+  }
+
+  return true;
+}
+
+void provsql_ring_attach_worker(void)
+{
+  ring->worker_latch = MyLatch;
+  pg_memory_barrier();
+}
+
+bool provsql_ring_next_request(long timeout_ms)
+{
+  provsql_request_prefix prefix;
+
+  if(!request_wait(sizeof(prefix), timeout_ms))
+    return false;
+  provsql_ring_read_request(&prefix, sizeof(prefix));
+
+  if(prefix.slot < 0 || prefix.slot >= ring->nb_slots)
+    provsql_error("Request from an unknown reply slot %d", prefix.slot);
+  reply_slot = prefix.slot;
+  reply_seq = prefix.seq;
+  return true;
+}
+
+void provsql_ring_request_done(void)
+{
+  provsql_request_ring *r = &ring->requests;
+
+  /* The store writes the request made must be visible before the count
+     that says they were made: the reader checks the count first. */
+  pg_write_barrier();
+  pg_atomic_write_u64(&r->done, pg_atomic_read_u64(&r->head));
+}
+
+uint64 provsql_ring_sent(void)
+{
+  if(ring == NULL)
+    return 0;
+  return pg_atomic_read_u64(&ring->requests.tail);
+}
+
+bool provsql_ring_handled(uint64 sent)
+{
+  if(ring == NULL || ring->worker_latch == NULL)
+    return false;
+  if(pg_atomic_read_u64(&ring->requests.done) < sent)
+    return false;
+  /* Pairs with the write barrier of provsql_ring_request_done: the store
+     reads that follow see what the requests handled wrote. */
+  pg_read_barrier();
+  return true;
+}
+
+bool provsql_ring_handled_mine(void)
+{
+  return provsql_ring_handled(request_end);
+}
+
+/* -------------------------------------------------------------------------
+ * Reply slots
+ * ------------------------------------------------------------------------- */
+
+bool provsql_ring_write_reply(const void *src, size_t n)
+{
+  provsql_reply_slot *s;
+  const char *p = src;
+
+  if(reply_slot < 0)
+    return false;
+  s = &ring->slots[reply_slot];
+
+  while(n > 0) {
+    uint64 head, tail;
+    size_t room, off, chunk;
+    bool live;
+    Latch *latch;
+
+    SpinLockAcquire(&s->mutex);
+    live = s->seq == reply_seq;
+    SpinLockRelease(&s->mutex);
+    /* The backend has given up on this reply: drop the rest of it. */
+    if(!live)
+      return true;
+
+    tail = pg_atomic_read_u64(&s->tail);
+    head = pg_atomic_read_u64(&s->head);
+    room = PROVSQL_REPLY_SLOT_SIZE - (size_t) (tail - head);
+
+    if(room == 0) {
+      s->worker_waiting = true;
+      pg_memory_barrier();
+      if(pg_atomic_read_u64(&s->head) == head) {
+        SpinLockAcquire(&s->mutex);
+        live = s->seq == reply_seq;
+        SpinLockRelease(&s->mutex);
+        if(live)
+          ring_sleep(-1, NULL);
+      }
+      s->worker_waiting = false;
+      continue;
+    }
+
+    off = (size_t) (tail % PROVSQL_REPLY_SLOT_SIZE);
+    chunk = Min(n, Min(room, PROVSQL_REPLY_SLOT_SIZE - off));
+    memcpy(s->data + off, p, chunk);
+    pg_write_barrier();
+
+    /* Published only if the backend is still waiting for this reply: a
+       backend that moved on has reset head to tail, and the bytes just
+       copied past tail are simply never seen. */
+    SpinLockAcquire(&s->mutex);
+    if(s->seq == reply_seq)
+      pg_atomic_write_u64(&s->tail, tail + chunk);
+    latch = s->latch;
+    SpinLockRelease(&s->mutex);
+    if(latch)
+      SetLatch(latch);
+
+    p += chunk;
+    n -= chunk;
+  }
+
+  return true;
+}
+
+/** @brief This process's reply slot. */
+static provsql_reply_slot *my_slot(void)
+{
+  int n = MY_PROC_NUMBER;
+
+  if(n < 0 || n >= ring->nb_slots)
+    provsql_error("No reply slot for process number %d", n);
+  return &ring->slots[n];
+}
+
+/**
+ * @brief Start request number @p seq in this process's reply slot,
+ *        discarding whatever is left of the previous reply.
+ */
+static void slot_start_request(uint32 seq)
+{
+  provsql_reply_slot *s = my_slot();
+  bool worker_waiting;
+
+  SpinLockAcquire(&s->mutex);
+  s->seq = seq;
+  s->latch = MyLatch;
+  pg_atomic_write_u64(&s->head, pg_atomic_read_u64(&s->tail));
+  worker_waiting = s->worker_waiting;
+  SpinLockRelease(&s->mutex);
+
+  /* A worker blocked on a full slot for the request given up on must
+     notice it has been given up on. */
+  if(worker_waiting)
+    wake_worker();
+}
+
+/** @brief Give up on any reply still in flight: the error that
+ *  interrupted its reading will not come back for the rest. */
+static void abandon_reply(void)
+{
+  if(ring != NULL && request_seq != 0)
+    slot_start_request(++request_seq);
+}
+
+static void ring_xact_callback(XactEvent event, void *arg)
+{
+  (void) arg;
+  if(event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    abandon_reply();
+}
+
+static void ring_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                  SubTransactionId parentSubid, void *arg)
+{
+  (void) mySubid; (void) parentSubid; (void) arg;
+  if(event == SUBXACT_EVENT_ABORT_SUB)
+    abandon_reply();
+}
+
+static void ring_exit_callback(int code, Datum arg)
+{
+  (void) code; (void) arg;
+  abandon_reply();
+}
+
+bool provsql_ring_send(const void *msg, size_t len)
+{
+  provsql_request_prefix prefix;
+
+  if(!abandon_callbacks_registered) {
+    RegisterXactCallback(ring_xact_callback, NULL);
+    RegisterSubXactCallback(ring_subxact_callback, NULL);
+    before_shmem_exit(ring_exit_callback, (Datum) 0);
+    abandon_callbacks_registered = true;
+  }
+
+  prefix.slot = MY_PROC_NUMBER;
+  prefix.seq = ++request_seq;
+  slot_start_request(prefix.seq);
+
+  LWLockAcquire(ring->lock, LW_EXCLUSIVE);
+  request_push(&prefix, sizeof(prefix));
+  request_push(msg, len);
+  request_end = pg_atomic_read_u64(&ring->requests.tail);
+  LWLockRelease(ring->lock);
+
+  return true;
+}
+
+bool provsql_ring_read_reply(void *dst, size_t n)
+{
+  provsql_reply_slot *s = my_slot();
+  char *p = dst;
+
+  while(n > 0) {
+    uint64 head = pg_atomic_read_u64(&s->head);
+    uint64 tail = pg_atomic_read_u64(&s->tail);
+    size_t off, chunk;
+    bool worker_waiting;
+
+    if(tail == head) {
+      ring_sleep(-1, NULL);
+      continue;
+    }
+
+    pg_read_barrier();
+    off = (size_t) (head % PROVSQL_REPLY_SLOT_SIZE);
+    chunk = Min(n, Min((size_t) (tail - head), PROVSQL_REPLY_SLOT_SIZE - off));
+    memcpy(p, s->data + off, chunk);
+    pg_memory_barrier();
+    pg_atomic_write_u64(&s->head, head + chunk);
+    pg_memory_barrier();
+    worker_waiting = s->worker_waiting;
+    if(worker_waiting)
+      wake_worker();
+
+    p += chunk;
+    n -= chunk;
+  }
+
+  return true;
+}
+
+#endif /* PROVSQL_INPROCESS_STORE */
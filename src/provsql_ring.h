@@ -0,0 +1,162 @@
+/**
+ * @file provsql_ring.h
+ * @brief Shared-memory transport between backends and the mmap worker.
+ *
+ * Backends talk to the mmap background worker through two kinds of
+ * byte rings living in ProvSQL's shared-memory segment:
+ *
+ * - a single *request ring*, written by every backend and read by the
+ *   worker.  Producers take a dedicated @c LWLock for the duration of one
+ *   message, so messages never interleave; the worker reads without it.
+ * - one *reply slot* per process (indexed by @c PGPROC number), written by
+ *   the worker and read by the process that owns it.  Nothing is shared
+ *   between two backends' replies, so a backend waiting for its answer
+ *   holds no lock and any number of round trips can be in flight at once.
+ *
+ * Both sides sleep on their latch when the ring they need is empty or
+ * full, and set the other side's latch after every transfer.  Every
+ * request is prefixed with the number of the sender's reply slot and a
+ * per-backend request number: the worker routes what the dispatcher
+ * writes (@c WRITEB) to that slot, and drops it once the backend has
+ * given up on the request.  A backend gives up on a reply it has not
+ * read to the end only when an error interrupted it; the (sub)transaction
+ * abort, or the process exit, that follows bumps its request number, so
+ * the worker is never left waiting for room in a slot nobody reads.
+ *
+ * The message format carried over the rings is unchanged from the pipe
+ * transport this replaced; only the framing prefix is added, and it is
+ * invisible to @c provsql_mmap_dispatch.  Neither ring bounds the size
+ * of a message: a message larger than the ring streams through it.
+ */
+#ifndef PROVSQL_RING_H
+#define PROVSQL_RING_H
+
+#include "postgres.h"
+
+#include "provsql_config.h"
+
+#ifndef PROVSQL_INPROCESS_STORE
+
+#include "port/atomics.h"
+#include "storage/latch.h"
+#include "storage/spin.h"
+
+/** @brief Capacity in bytes of the request ring. */
+#define PROVSQL_REQUEST_RING_SIZE (1024 * 1024)
+
+/** @brief Capacity in bytes of each process's reply slot. */
+#define PROVSQL_REPLY_SLOT_SIZE (32 * 1024)
+
+/**
+ * @brief The multi-producer, single-consumer request ring.
+ *
+ * @c head and @c tail count bytes since startup and only grow; the byte
+ * at offset @c o lives at <tt>data[o % PROVSQL_REQUEST_RING_SIZE]</tt>.
+ */
+typedef struct provsql_request_ring {
+  pg_atomic_uint64 head;   ///< Bytes consumed by the worker
+  pg_atomic_uint64 tail;   ///< Bytes published by producers
+  pg_atomic_uint64 done;   ///< Bytes of requests the worker has handled
+  Latch *space_waiter;     ///< Producer sleeping for room, or @c NULL
+  char data[PROVSQL_REQUEST_RING_SIZE]; ///< Ring storage
+} provsql_request_ring;
+
+/**
+ * @brief One process's reply slot: a single-producer, single-consumer ring.
+ *
+ * @c mutex makes the worker's publication of new bytes and the owner's
+ * switch to a new request (@c seq) mutually atomic, which is what lets
+ * the owner discard an abandoned reply without the worker appending to
+ * it afterwards.
+ */
+typedef struct provsql_reply_slot {
+  slock_t mutex;           ///< Protects @c seq, @c latch and @c tail updates
+  uint32 seq;              ///< Request currently being answered
+  bool worker_waiting;     ///< Whether the worker sleeps for room
+  Latch *latch;            ///< Latch of the owning process
+  pg_atomic_uint64 head;   ///< Bytes consumed by the owner
+  pg_atomic_uint64 tail;   ///< Bytes published by the worker
+  char data[PROVSQL_REPLY_SLOT_SIZE]; ///< Ring storage
+} provsql_reply_slot;
+
+/** @brief Shared-memory size needed by the rings. */
+Size provsql_ring_memsize(void);
+
+/**
+ * @brief Allocate or attach the rings in the shared segment.
+ *
+ * Called from @c provsql_shmem_startup with @c AddinShmemInitLock held.
+ */
+void provsql_ring_shmem_init(void);
+
+/** @brief Make this process the rings' consumer: the mmap worker. */
+void provsql_ring_attach_worker(void);
+
+/**
+ * @brief Wait for the next request and read its framing prefix.
+ *
+ * Worker side.  Subsequent @c provsql_ring_read_request calls read the
+ * message itself, and @c provsql_ring_write_reply calls answer its
+ * sender.
+ *
+ * @param timeout_ms  How long to wait, or -1 to wait indefinitely.
+ * @return @c false if the timeout elapsed first.
+ */
+bool provsql_ring_next_request(long timeout_ms);
+
+/**
+ * @brief Worker side: declare the current request handled.
+ *
+ * Everything it wrote to the store is visible to any process that then
+ * finds @c provsql_ring_handled() true of an offset up to the request's
+ * end.
+ */
+void provsql_ring_request_done(void);
+
+/** @brief Worker side: read @p n bytes of the current request. */
+bool provsql_ring_read_request(void *dst, size_t n);
+
+/** @brief Worker side: append @p n bytes to the current request's reply. */
+bool provsql_ring_write_reply(const void *src, size_t n);
+
+/**
+ * @brief Backend side: send one complete message to the worker.
+ *
+ * Starts a new request: whatever an earlier, abandoned request left in
+ * this process's reply slot is discarded first.
+ */
+bool provsql_ring_send(const void *msg, size_t len);
+
+/** @brief Backend side: read @p n bytes of the reply to the last request. */
+bool provsql_ring_read_reply(void *dst, size_t n);
+
+/**
+ * @brief Offset in the request ring up to which requests have been sent.
+ *
+ * Every request any process had finished sending when this is called
+ * ends at or before the returned offset.
+ */
+uint64 provsql_ring_sent(void);
+
+/**
+ * @brief Whether the worker has handled every request ending at or
+ *        before offset @p sent (as returned by @c provsql_ring_sent).
+ *
+ * When it has, the store files hold everything those requests asked the
+ * worker to write, and a lookup answered from them is the answer the
+ * worker would give; see @c store_reader.h.  The reads that follow a
+ * @c true return are ordered after it.
+ */
+bool provsql_ring_handled(uint64 sent);
+
+/**
+ * @brief Whether the worker has handled every request this process sent.
+ *
+ * Unlike waiting for the whole ring to drain, this does not depend on
+ * what other backends keep sending.
+ */
+bool provsql_ring_handled_mine(void);
+
+#endif /* PROVSQL_INPROCESS_STORE */
+
+#endif /* PROVSQL_RING_H */
@@ -5,21 +5,20 @@
  * Implements the functions declared in @c provsql_shmem.h:
  * - @c provsql_shmem_startup(): allocates (or attaches to) the
  *   @c provsqlSharedState segment, initialises the @c LWLock, and
- *   calls @c pipe(2) to create the two inter-process pipes.  Chains
- *   to @c prev_shmem_startup if set.
+ *   sets up the request ring and reply slots of @c provsql_ring.h.
+ *   Chains to @c prev_shmem_startup if set.
  * - @c provsql_memsize(): returns the size of the shared segment.
  * - @c provsql_shmem_request(): requests shared memory on PG ≥ 15.
  * - @c provsql_shmem_lock_exclusive() / @c provsql_shmem_lock_shared() /
  *   @c provsql_shmem_unlock(): thin wrappers around
  *   @c LWLockAcquire() / @c LWLockRelease().
  */
-#include <unistd.h>
-
 #include "postgres.h"
 #include "storage/shmem.h"
 
 #include "provsql_shmem.h"
 #include "provsql_mmap.h"
+#include "provsql_ring.h"
 
 shmem_startup_hook_type prev_shmem_startup = NULL;
 #if (PG_VERSION_NUM >= 150000)
@@ -127,8 +126,6 @@ void provsql_shmem_unlock(void) {}
 void provsql_shmem_startup(void)
 {
   bool found;
-  int pipes_b_to_m[2];
-  int pipes_m_to_b[2];
 
   if(prev_shmem_startup)
     prev_shmem_startup();
@@ -145,27 +142,18 @@ void provsql_shmem_startup(void)
 
   if(!found) {
     provsql_shared_state->lock =&(GetNamedLWLockTranche("provsql"))->lock;
+    provsql_shared_state->kcmcp_endpoint[0]='\0';
   }
 
-  LWLockRelease(AddinShmemInitLock);
-
-  // Already initialized
-  if(found)
-    return;
+  provsql_ring_shmem_init();
 
-  if(pipe(pipes_b_to_m) || pipe(pipes_m_to_b))
-    provsql_error("Cannot create pipe to communicate with MMap worker");
-
-  provsql_shared_state->pipebmr=pipes_b_to_m[0];
-  provsql_shared_state->pipebmw=pipes_b_to_m[1];
-  provsql_shared_state->pipembr=pipes_m_to_b[0];
-  provsql_shared_state->pipembw=pipes_m_to_b[1];
-  provsql_shared_state->kcmcp_endpoint[0]='\0';
+  LWLockRelease(AddinShmemInitLock);
 }
 
 Size provsql_memsize(void)
 {
-  return MAXALIGN(sizeof(provsqlSharedState));
+  return add_size(MAXALIGN(sizeof(provsqlSharedState)),
+                  provsql_ring_memsize());
 }
 
 void provsql_shmem_request(void)
@@ -177,7 +165,8 @@ void provsql_shmem_request(void)
 
   RequestAddinShmemSpace(provsql_memsize());
 
-  RequestNamedLWLockTranche("provsql", 1);
+  /* [0]: provsql_shared_state->lock; [1]: the request ring's */
+  RequestNamedLWLockTranche("provsql", 2);
 }
 
 void provsql_shmem_lock_exclusive(void)
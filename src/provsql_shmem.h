@@ -1,11 +1,12 @@
 /**
  * @file provsql_shmem.h
- * @brief Shared-memory segment and inter-process pipe management.
+ * @brief Shared-memory segment management.
  *
  * ProvSQL uses a small PostgreSQL shared-memory segment (@c provsqlSharedState)
- * to hold the file descriptors of the anonymous pipes that connect
- * normal backends to the mmap background worker, together with a
- * lightweight lock that serialises concurrent gate-creation requests.
+ * holding a lightweight lock and the endpoint of the managed KCMCP server.
+ * The same shared-memory request also carries the request ring and reply
+ * slots that connect normal backends to the mmap background worker
+ * (see @c provsql_ring.h).
  *
  * This header declares:
  * - @c provsqlSharedState, the layout of the shared segment.
@@ -37,8 +38,8 @@ extern shmem_request_hook_type prev_shmem_request;
  * @brief Initialise the ProvSQL shared-memory segment.
  *
  * Called from the @c shmem_startup_hook.  Creates (or attaches to) the
- * @c provsqlSharedState segment and initialises the embedded @c LWLock
- * and pipe file descriptors.  Chains to @c prev_shmem_startup if set.
+ * @c provsqlSharedState segment and initialises the embedded @c LWLock,
+ * then does the same for the rings of @c provsql_ring.h.  Chains to @c prev_shmem_startup if set.
  */
 void provsql_shmem_startup(void);
 
@@ -47,7 +48,8 @@ void provsql_shmem_startup(void);
  *
  * Used by PostgreSQL's shared-memory allocator during startup.
  *
- * @return Size in bytes of the @c provsqlSharedState structure.
+ * @return Size in bytes of the @c provsqlSharedState structure and the
+ *         rings.
  */
 Size provsql_memsize(void);
 
@@ -67,18 +69,16 @@ void provsql_shmem_request(void);
  * All backends and the background worker access this structure through
  * the @c provsql_shared_state global pointer.
  *
- * @c lock serialises gate-creation messages so that only one backend
- * writes to the pipe at a time.  The four @c long fields hold OS file
- * descriptors for the two anonymous pipes:
- * - @c pipebmr / @c pipebmw: requests, backend → worker (backends write)
- * - @c pipembr / @c pipembw: replies, worker → backend (worker writes)
+ * @c lock protects @c kcmcp_endpoint.  Traffic with the mmap worker
+ * does not go through it: the request ring has a lock of its own, and
+ * replies need none (see @c provsql_ring.h).
  */
 #ifdef PROVSQL_INPROCESS_STORE
 
 /**
  * @brief Growable byte FIFO backing the in-process request/response channel.
  *
- * Replaces the inter-process pipes when there is a single PostgreSQL
+ * Replaces the shared-memory rings when there is a single PostgreSQL
  * process (browser/WASM target).  Bytes are appended at @c tail and
  * consumed from @c head; the buffer is reclaimed (head reset to 0) once
  * fully drained and grown on demand.
@@ -111,11 +111,7 @@ void provsql_inproc_init(void);
 
 typedef struct provsqlSharedState
 {
-  LWLock *lock;           ///< Mutual-exclusion lock for pipe writes
-  long pipebmr;           ///< Backend-to-worker pipe: read end (worker reads)
-  long pipebmw;           ///< Backend-to-worker pipe: write end (backends write)
-  long pipembr;           ///< Worker-to-backend pipe: read end (backends read)
-  long pipembw;           ///< Worker-to-backend pipe: write end (worker writes)
+  LWLock *lock;           ///< Protects @c kcmcp_endpoint
   char kcmcp_endpoint[256]; ///< Live endpoint of the managed KCMCP server
                             ///< ("" when none): written by the supervisor
                             ///< worker, read by the in-extension client.
@@ -429,6 +429,35 @@ extern char *provsql_transaction_token;
  * commits. */
 extern bool provsql_synchronous_commit;
 
+/** Global variable set by the provsql.batch_gate_creation run-time
+ * configuration parameter: when true, a backend combines the gates it
+ * creates into multi-gate messages to the mmap worker instead of
+ * sending them one at a time. */
+extern bool provsql_batch_gate_creation;
+
+/** Global variable set by the provsql.direct_store_reads run-time
+ * configuration parameter: when true, a backend answers circuit lookups
+ * from a read-only mapping of the store whenever the mmap worker has
+ * nothing pending, instead of asking the worker. */
+extern bool provsql_direct_store_reads;
+
+/** Global variable set by the provsql.loaded_circuit_cache run-time
+ * configuration parameter: the number of gates of the circuits a backend
+ * keeps, for the duration of a statement, to answer later loads of the
+ * same circuits or of circuits inside them; 0 disables the cache. */
+extern int provsql_loaded_circuit_cache;
+
+/** Global variable set by the provsql.compiled_circuit_cache run-time
+ * configuration parameter: the size, in kB, past which the least recently
+ * used d-DNNFs of the per-database compiled-circuit cache are removed; 0
+ * disables the cache. */
+extern int provsql_compiled_circuit_cache;
+
+/** Global variable set by the provsql.compiled_circuit_cache_min_time
+ * run-time configuration parameter: the shortest build, in milliseconds,
+ * whose d-DNNF the compiled-circuit cache stores. */
+extern int provsql_compiled_circuit_cache_min_time;
+
 /** Global variable holding the probability evaluation method(s) used by the
  * most recent probability_evaluate call, exposed via the
  * provsql.last_eval_method run-time configuration parameter. */
@@ -478,6 +507,12 @@ void RegisterProvSQLKCMCPWorker(void);
  * end-to-end. */
 extern int provsql_monte_carlo_seed;
 
+/** Number of threads, the backend's own included, over which the
+ * Boolean and Karp-Luby samplers spread their samples, set by the
+ * provsql.sampler_threads run-time configuration parameter (default 1).
+ * The estimates do not depend on it. */
+extern int provsql_sampler_threads;
+
 /** Default sample count for Monte Carlo fallbacks when an analytical
  * evaluator (Expectation, future hybrid evaluator, ...) cannot
  * decompose a sub-circuit structurally.  Unlike
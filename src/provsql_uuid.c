@@ -0,0 +1,209 @@
+/**
+ * @file provsql_uuid.c
+ * @brief Native version-5 UUIDs in the ProvSQL namespace.
+ *
+ * Implements the functions declared in @c provsql_uuid.h: a streaming
+ * SHA-1 (RFC 3174) primed with the namespace bytes, and the RFC 4122
+ * version / variant stamping that @c uuid-ossp applies on top of it;
+ * plus the random (version 4) tokens fresh input gates are minted with.
+ *
+ * Self-contained, rather than built on PostgreSQL's cryptohash API, so the
+ * content addressing behaves identically on every supported PostgreSQL
+ * version and in the single-process build.
+ */
+#include "postgres.h"
+
+#include <string.h>
+
+#include "provsql_uuid.h"
+
+/** @brief @c uuid_ns_provsql() = 920d4f02-8718-5319-9532-d4ab83a64489 */
+static const unsigned char provsql_namespace[16] = {
+  0x92, 0x0d, 0x4f, 0x02, 0x87, 0x18, 0x53, 0x19,
+  0x95, 0x32, 0xd4, 0xab, 0x83, 0xa6, 0x44, 0x89
+};
+
+/** @brief Left-rotate a 32-bit word. */
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/** @brief Run the SHA-1 compression function over one 64-byte block. */
+static void sha1_block(uint32 h[5], const unsigned char *p)
+{
+  uint32 w[80];
+  uint32 a, b, c, d, e;
+
+  for(int i=0; i<16; ++i)
+    w[i] = ((uint32) p[4*i] << 24) | ((uint32) p[4*i+1] << 16)
+           | ((uint32) p[4*i+2] << 8) | (uint32) p[4*i+3];
+  for(int i=16; i<80; ++i)
+    w[i] = ROL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+  for(int i=0; i<80; ++i) {
+    uint32 f, k, tmp;
+    if(i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999u;
+    } else if(i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1u;
+    } else if(i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDCu;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6u;
+    }
+    tmp = ROL32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROL32(b, 30);
+    b = a;
+    a = tmp;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+void provsql_uuid_v5_add(provsql_uuid_v5_ctx *ctx, const void *data,
+                         size_t len)
+{
+  const unsigned char *p = data;
+
+  ctx->length += len;
+
+  if(ctx->fill > 0) {
+    size_t take = 64 - ctx->fill;
+    if(take > len)
+      take = len;
+    memcpy(ctx->block + ctx->fill, p, take);
+    ctx->fill += take;
+    p += take;
+    len -= take;
+    if(ctx->fill < 64)
+      return;
+    sha1_block(ctx->h, ctx->block);
+    ctx->fill = 0;
+  }
+
+  while(len >= 64) {
+    sha1_block(ctx->h, p);
+    p += 64;
+    len -= 64;
+  }
+
+  if(len > 0) {
+    memcpy(ctx->block, p, len);
+    ctx->fill = len;
+  }
+}
+
+void provsql_uuid_v5_begin(provsql_uuid_v5_ctx *ctx)
+{
+  ctx->h[0] = 0x67452301u;
+  ctx->h[1] = 0xEFCDAB89u;
+  ctx->h[2] = 0x98BADCFEu;
+  ctx->h[3] = 0x10325476u;
+  ctx->h[4] = 0xC3D2E1F0u;
+  ctx->length = 0;
+  ctx->fill = 0;
+  provsql_uuid_v5_add(ctx, provsql_namespace, sizeof(provsql_namespace));
+}
+
+void provsql_uuid_v5_add_str(provsql_uuid_v5_ctx *ctx, const char *str)
+{
+  provsql_uuid_v5_add(ctx, str, strlen(str));
+}
+
+void provsql_uuid_format(const pg_uuid_t *uuid,
+                         char out[PROVSQL_UUID_TEXT_LEN])
+{
+  static const char hex[] = "0123456789abcdef";
+  char *q = out;
+
+  for(int i=0; i<UUID_LEN; ++i) {
+    if(i == 4 || i == 6 || i == 8 || i == 10)
+      *q++ = '-';
+    *q++ = hex[uuid->data[i] >> 4];
+    *q++ = hex[uuid->data[i] & 0x0F];
+  }
+}
+
+void provsql_uuid_v5_add_uuid(provsql_uuid_v5_ctx *ctx,
+                              const pg_uuid_t *uuid)
+{
+  char text[PROVSQL_UUID_TEXT_LEN];
+
+  provsql_uuid_format(uuid, text);
+  provsql_uuid_v5_add(ctx, text, PROVSQL_UUID_TEXT_LEN);
+}
+
+void provsql_uuid_v5_end(provsql_uuid_v5_ctx *ctx, pg_uuid_t *out)
+{
+  const uint64 bits = ctx->length * 8;
+  unsigned char digest[20];
+
+  /* Padding: a single 1 bit, zeros up to 56 mod 64, then the message
+     length in bits, big-endian. */
+  ctx->block[ctx->fill++] = 0x80;
+  if(ctx->fill > 56) {
+    memset(ctx->block + ctx->fill, 0, 64 - ctx->fill);
+    sha1_block(ctx->h, ctx->block);
+    ctx->fill = 0;
+  }
+  memset(ctx->block + ctx->fill, 0, 56 - ctx->fill);
+  for(int i=0; i<8; ++i)
+    ctx->block[56 + i] = (unsigned char) (bits >> (56 - 8*i));
+  sha1_block(ctx->h, ctx->block);
+
+  for(int i=0; i<5; ++i) {
+    digest[4*i]   = (unsigned char) (ctx->h[i] >> 24);
+    digest[4*i+1] = (unsigned char) (ctx->h[i] >> 16);
+    digest[4*i+2] = (unsigned char) (ctx->h[i] >> 8);
+    digest[4*i+3] = (unsigned char) ctx->h[i];
+  }
+
+  memcpy(out->data, digest, UUID_LEN);
+  out->data[6] = (unsigned char) ((out->data[6] & 0x0F) | 0x50);
+  out->data[8] = (unsigned char) ((out->data[8] & 0x3F) | 0x80);
+}
+
+void provsql_uuid_v5(const char *name, size_t len, pg_uuid_t *out)
+{
+  provsql_uuid_v5_ctx ctx;
+
+  provsql_uuid_v5_begin(&ctx);
+  provsql_uuid_v5_add(&ctx, name, len);
+  provsql_uuid_v5_end(&ctx, out);
+}
+
+const pg_uuid_t *provsql_gate_zero_token(void)
+{
+  static pg_uuid_t zero;
+  static bool computed = false;
+
+  if(!computed) {
+    provsql_uuid_v5("zero", 4, &zero);
+    computed = true;
+  }
+  return &zero;
+}
+
+const pg_uuid_t *provsql_gate_one_token(void)
+{
+  static pg_uuid_t one;
+  static bool computed = false;
+
+  if(!computed) {
+    provsql_uuid_v5("one", 3, &one);
+    computed = true;
+  }
+  return &one;
+}
+
+void provsql_uuid_v4(pg_uuid_t *out)
+{
+  if(!pg_strong_random(out->data, UUID_LEN))
+    provsql_error("could not generate a random provenance token");
+  out->data[6] = (out->data[6] & 0x0f) | 0x40;  /* version 4 */
+  out->data[8] = (out->data[8] & 0x3f) | 0x80;  /* RFC 4122 variant */
+}
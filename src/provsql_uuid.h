@@ -0,0 +1,94 @@
+/**
+ * @file provsql_uuid.h
+ * @brief Content-addressed gate tokens: RFC 4122 version-5 UUIDs in the
+ *        ProvSQL namespace, computed natively.
+ *
+ * Every gate the query rewriter mints is addressed by
+ * @c uuid_generate_v5(uuid_ns_provsql(), name), where @c name is the
+ * textual recipe of the gate (e.g. @c "times{<uuid>,<uuid>}").  This
+ * header lets C and C++ code compute the same token without going
+ * through @c uuid-ossp and without first assembling @c name as a string:
+ * the SHA-1 is fed incrementally, and a child token is fed as its
+ * 36-character textual form directly from its 16 binary bytes.
+ *
+ * The result is bit-for-bit the value @c uuid-ossp computes, which is
+ * what keeps tokens minted here interchangeable with those minted by the
+ * SQL functions (and with the ones already in existing stores).
+ */
+#ifndef PROVSQL_UUID_H
+#define PROVSQL_UUID_H
+
+#include "postgres.h"
+#include "provsql_utils.h"
+
+/** @brief Length of the textual form of a UUID, without terminator. */
+#define PROVSQL_UUID_TEXT_LEN 36
+
+/**
+ * @brief Incremental state of a version-5 UUID computation.
+ *
+ * A SHA-1 context already primed with the ProvSQL namespace; feed it the
+ * name with @c provsql_uuid_v5_add / @c provsql_uuid_v5_add_uuid and
+ * read the token off with @c provsql_uuid_v5_end.
+ */
+typedef struct provsql_uuid_v5_ctx {
+  uint32 h[5];              ///< SHA-1 chaining state
+  uint64 length;            ///< Bytes hashed so far
+  unsigned char block[64];  ///< Partial input block
+  unsigned fill;            ///< Bytes used in @c block
+} provsql_uuid_v5_ctx;
+
+/** @brief Start a version-5 UUID in the ProvSQL namespace. */
+void provsql_uuid_v5_begin(provsql_uuid_v5_ctx *ctx);
+
+/** @brief Append @p len raw bytes of @p data to the name. */
+void provsql_uuid_v5_add(provsql_uuid_v5_ctx *ctx, const void *data,
+                         size_t len);
+
+/** @brief Append a NUL-terminated string to the name. */
+void provsql_uuid_v5_add_str(provsql_uuid_v5_ctx *ctx, const char *str);
+
+/**
+ * @brief Append the textual form of @p uuid to the name.
+ *
+ * Same 36 characters as @c uuid_out -- lowercase hex, hyphenated
+ * 8-4-4-4-12 -- which is also how @c concat() and @c array_out render a
+ * UUID inside a recipe.
+ */
+void provsql_uuid_v5_add_uuid(provsql_uuid_v5_ctx *ctx,
+                              const pg_uuid_t *uuid);
+
+/** @brief Finish the computation and store the token in @p out. */
+void provsql_uuid_v5_end(provsql_uuid_v5_ctx *ctx, pg_uuid_t *out);
+
+/**
+ * @brief One-shot version-5 UUID of a name held in memory.
+ *
+ * Same value as @c uuid_generate_v5(uuid_ns_provsql(), name).
+ */
+void provsql_uuid_v5(const char *name, size_t len, pg_uuid_t *out);
+
+/**
+ * @brief Render @p uuid in its textual form.
+ *
+ * Writes exactly @c PROVSQL_UUID_TEXT_LEN characters, without terminator.
+ */
+void provsql_uuid_format(const pg_uuid_t *uuid,
+                         char out[PROVSQL_UUID_TEXT_LEN]);
+
+/**
+ * @brief A fresh random (version 4) UUID, as @c uuid_generate_v4 mints.
+ *
+ * What a new input gate is named by: the guard trigger of a tracked
+ * table and @c repair_key mint their tokens with it, without a call
+ * into @c uuid-ossp.
+ */
+void provsql_uuid_v4(pg_uuid_t *out);
+
+/** @brief The token of the semiring zero gate, @c gate_zero(). */
+const pg_uuid_t *provsql_gate_zero_token(void);
+
+/** @brief The token of the semiring one gate, @c gate_one(). */
+const pg_uuid_t *provsql_gate_one_token(void);
+
+#endif /* PROVSQL_UUID_H */
@@ -0,0 +1,171 @@
+/**
+ * @file repair_key.c
+ * @brief The gate-building pass of @c repair_key, in one scan.
+ *
+ * @c repair_key turns a relation into a block-independent one: the rows
+ * sharing a key form a block of mutually exclusive alternatives, each
+ * row's token becoming a @c mulinput gate over an @c input gate for its
+ * block's key, and recording its position in the block and the block's
+ * size in its infos.  Done from PL/pgSQL, that was a temporary table of
+ * the blocks, a join of it back to the relation, and, per row, a
+ * @c create_gate and a @c set_infos call -- two calls into C and at
+ * least one round trip to the mmap worker per tuple.
+ *
+ * @c repair_key_gates reads the relation once, through an SPI cursor on a
+ * window query that numbers each row within its block and counts the
+ * block, so that the rows of a block arrive together and the first one
+ * opens it.  Rows are sent to the worker @c PROVSQL_REPAIR_KEY_BATCH at
+ * a time, in an @c 'R' message that creates the key gate, the row's gate
+ * and its infos (see @c provsql_internal_repair_key).  Memory is bounded
+ * by one fetch and one batch: the window's own buffering of a block
+ * spills to disk past @c work_mem like any other query's.
+ */
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/uuid.h"
+
+#include "provsql_mmap.h"
+#include "provsql_utils.h"
+#include "provsql_uuid.h"
+
+/** Column @c repair_key stages the new tokens in before renaming it to
+ *  @c provsql. */
+#define REPAIR_KEY_TOKEN_COLUMN "provsql_temp"
+
+/** @brief Quoted name of column @p attnum of @p relid. */
+static const char *key_column_name(Oid relid, AttrNumber attnum)
+{
+#if PG_VERSION_NUM >= 110000
+  char *name = get_attname(relid, attnum, true);
+#else
+  char *name = get_attname(relid, attnum);
+#endif
+  if(!name)
+    provsql_error("repair_key: relation %u has no column %d", relid, attnum);
+  return quote_identifier(name);
+}
+
+PG_FUNCTION_INFO_V1(repair_key_gates);
+/**
+ * @brief Create the gates of every row of @p relid, grouped in blocks by
+ *        the columns of @p block_key.
+ *
+ * Reads the tokens @c repair_key has just staged in the
+ * @c provsql_temp column.  An empty @p block_key makes the whole relation
+ * one block.  Rows with a @c NULL key column belong to no block and keep
+ * their token as a plain input.
+ *
+ * @return The number of rows given a @c mulinput gate.
+ */
+Datum repair_key_gates(PG_FUNCTION_ARGS)
+{
+  Oid                     relid;
+  ArrayType              *block_key;
+  int                     nb_keys = 0;
+  AttrNumber             *keys;
+  StringInfoData          sql, partition, filter;
+  Portal                  portal;
+  provsql_repair_key_row *rows;
+  unsigned                nb_rows = 0;
+  pg_uuid_t               key_token = {{0}};
+  int64                   total = 0;
+  int                     i;
+  uint64                  j;
+
+  if(PG_ARGISNULL(0) || PG_ARGISNULL(1))
+    provsql_error("Invalid NULL value passed to repair_key_gates");
+
+  relid     = PG_GETARG_OID(0);
+  block_key = PG_GETARG_ARRAYTYPE_P(1);
+  if(ARR_NDIM(block_key) > 1)
+    provsql_error("Invalid multi-dimensional array passed to repair_key_gates");
+  if(ARR_NDIM(block_key) == 1)
+    nb_keys = ARR_DIMS(block_key)[0];
+  if(nb_keys > 0 && array_contains_nulls(block_key))
+    provsql_error("repair_key_gates: block key must not contain NULL");
+  keys = (AttrNumber *) ARR_DATA_PTR(block_key);
+
+  initStringInfo(&partition);
+  initStringInfo(&filter);
+  for(i = 0; i < nb_keys; ++i) {
+    const char *col = key_column_name(relid, keys[i]);
+    appendStringInfo(&partition, "%s%s", i == 0 ? "PARTITION BY " : ", ", col);
+    appendStringInfo(&filter, "%s%s IS NOT NULL", i == 0 ? " WHERE " : " AND ",
+                     col);
+  }
+
+  /* Rows of a block come out of the window together, numbered from 1 in
+   * physical order, each with the size of its block. */
+  initStringInfo(&sql);
+  appendStringInfo(&sql,
+                   "SELECT " REPAIR_KEY_TOKEN_COLUMN ", row_number() OVER w, "
+                   "count(*) OVER (w ROWS BETWEEN UNBOUNDED PRECEDING "
+                   "AND UNBOUNDED FOLLOWING) "
+                   "FROM %s%s WINDOW w AS (%s ORDER BY ctid)",
+                   quote_qualified_identifier(
+                     get_namespace_name(get_rel_namespace(relid)),
+                     get_rel_name(relid)),
+                   filter.data, partition.data);
+
+  rows = palloc(PROVSQL_REPAIR_KEY_BATCH * sizeof(provsql_repair_key_row));
+
+  if(SPI_connect() != SPI_OK_CONNECT)
+    provsql_error("Cannot connect to SPI in repair_key");
+  portal = SPI_cursor_open_with_args(NULL, sql.data, 0, NULL, NULL, NULL,
+                                     false, 0);
+
+  for(;;) {
+    SPI_cursor_fetch(portal, true, PROVSQL_REPAIR_KEY_BATCH);
+    if(SPI_processed == 0)
+      break;
+
+    for(j = 0; j < SPI_processed; ++j) {
+      HeapTuple tuple = SPI_tuptable->vals[j];
+      TupleDesc desc = SPI_tuptable->tupdesc;
+      bool      isnull;
+      Datum     token;
+      int64     position, block_size;
+
+      token = SPI_getbinval(tuple, desc, 1, &isnull);
+      if(isnull)
+        provsql_error("repair_key: row without a staged token");
+      position   = DatumGetInt64(SPI_getbinval(tuple, desc, 2, &isnull));
+      block_size = DatumGetInt64(SPI_getbinval(tuple, desc, 3, &isnull));
+      if(block_size > PG_INT32_MAX)
+        provsql_error("repair_key: block of " INT64_FORMAT " rows is too "
+                      "large (at most %d rows per key)",
+                      block_size, PG_INT32_MAX);
+
+      if(position == 1)
+        provsql_uuid_v4(&key_token);
+
+      rows[nb_rows].token      = *DatumGetUUIDP(token);
+      rows[nb_rows].key_token  = key_token;
+      rows[nb_rows].position   = (unsigned) position;
+      rows[nb_rows].block_size = (unsigned) block_size;
+      if(++nb_rows == PROVSQL_REPAIR_KEY_BATCH) {
+        provsql_internal_repair_key(rows, nb_rows);
+        nb_rows = 0;
+      }
+      ++total;
+    }
+
+    SPI_freetuptable(SPI_tuptable);
+    CHECK_FOR_INTERRUPTS();
+  }
+  provsql_internal_repair_key(rows, nb_rows);
+
+  SPI_cursor_close(portal);
+  SPI_finish();
+
+  pfree(rows);
+  PG_RETURN_INT64(total);
+}
@@ -6,8 +6,9 @@
  * - @c provsql.shapley(token, variable, method, args): Shapley value of
  *   a given input gate (tuple) in the provenance circuit rooted at @p token.
  * - @c provsql.shapley_all_vars(token, method, args): Shapley values for
- *   all input gates simultaneously (more efficient than calling @c shapley()
- *   once per variable).
+ *   all input gates simultaneously, in one pass over the d-DNNF
+ *   (@c dDNNF::shapleyAllVars), at about the cost of a single @c shapley()
+ *   call.
  *
  * The @p method argument selects the d-DNNF construction:
  * - empty / @c "default" / @c "auto": cost-select the cheapest route via the
@@ -202,18 +203,21 @@ Datum shapley_all_vars(PG_FUNCTION_ARGS)
     if(!banzhaf)
       dd.makeGatesBinary(BooleanGate::AND);
 
+    // One pass over the d-DNNF gives every variable's value; variables
+    // the d-DNNF does not mention have none to contribute.
+    const auto var_values = banzhaf ? dd.banzhafAllVars() : dd.shapleyAllVars();
+
     for(auto &v_circuit_gate: c.getInputs()) {
       auto var_uuid_string = c.getUUID(v_circuit_gate);
-      auto var_gate=dd.getGate(var_uuid_string);
       pg_uuid_t *uuidp = reinterpret_cast<pg_uuid_t*>(palloc(UUID_LEN));
       *uuidp = string2uuid(var_uuid_string);
 
-      double result;
-
-      if(!banzhaf)
-        result = dd.shapley(var_gate);
-      else
-        result = dd.banzhaf(var_gate);
+      double result = 0.;
+      if(dd.hasGate(var_uuid_string)) {
+        auto it = var_values.find(dd.getGate(var_uuid_string));
+        if(it != var_values.end())
+          result = it->second;
+      }
 
       Datum values[2] = {
         UUIDPGetDatum(uuidp), Float8GetDatum(result)
@@ -0,0 +1,110 @@
+/**
+ * @file store_reader.h
+ * @brief C-linkage interface to the backend's read-only view of the
+ *        circuit store.
+ *
+ * The mmap worker is the only process that writes the circuit store, and
+ * every lookup used to be a round trip to it.  Lookups do not need the
+ * worker, though: the store files are append-only, so a backend can map
+ * them read-only and answer from its own mapping, concurrently with the
+ * worker and with every other backend.  The functions below do that.
+ * Each returns @c false when it cannot answer -- the view is disabled
+ * (@c provsql.direct_store_reads), cannot be opened, or may be behind --
+ * and the caller then asks the worker as before.
+ *
+ * Two things make an answer from the mapping the answer the worker would
+ * give:
+ *
+ * - **It is not behind.**  The view is only consulted once the worker has
+ *   handled every request this backend sent (@c provsql_ring_handled_mine),
+ *   after its pending gate batch has been sent, so this backend's own
+ *   gates are in the files.  A gate found there is right whatever other
+ *   backends are still sending: what the worker writes is ordered so that
+ *   a reader sees it either whole or not at all (see @c MMappedCircuit.h).
+ *   A gate *not* found there is only taken to be absent from the store
+ *   if the worker has also handled everything sent by the start of the
+ *   current statement (@c store_reader_statement_start), which covers
+ *   every gate another backend committed before the statement could see
+ *   it; otherwise the worker is asked.
+ * - **It is not stale.**  The worker grows the vectors in place, which a
+ *   reader follows by remapping when an index runs past its mapping
+ *   (@c MMappedVector), and rehashes the UUID table into a new file,
+ *   which a reader notices when a lookup misses: the old file has been
+ *   unlinked.  The view is then reopened, and a circuit being loaded
+ *   is loaded again from the new view, whichever of its gates missed.  @c provsql.circuit_cleanup
+ *   replaces all four files, and its caller drops its view with
+ *   @c store_reader_reset.
+ *
+ * A token the mapping does not hold is answered as the worker answers
+ * it: with the defaults of an input gate.
+ *
+ * The single-process build has no worker, and the functions always
+ * return @c false there.
+ */
+#ifndef STORE_READER_H
+#define STORE_READER_H
+
+#include "provsql_utils.h"
+
+/**
+ * @brief Look up a gate's type and children.
+ *
+ * @param token        UUID of the gate.
+ * @param type         Output: the gate's type.
+ * @param nb_children  Output: its number of children.
+ * @param children     Output: a @c calloc'd array of the children, or
+ *                     @c NULL when there are none.
+ * @return @c false if the worker must be asked instead.
+ */
+bool store_reader_get_gate(pg_uuid_t token, gate_type *type,
+                           unsigned *nb_children, pg_uuid_t **children);
+
+/**
+ * @brief Look up the probability an evaluation would use for a gate
+ *        (@c MMappedCircuit::getProb).
+ * @return @c false if the worker must be asked instead.
+ */
+bool store_reader_get_prob(pg_uuid_t token, double *prob);
+
+/**
+ * @brief Look up whether a probability was written to a gate, and which
+ *        (@c MMappedCircuit::hasProb).
+ * @return @c false if the worker must be asked instead.
+ */
+bool store_reader_get_prob_written(pg_uuid_t token, bool *has, double *prob);
+
+/**
+ * @brief Look up a gate's @c info1 / @c info2 pair.
+ * @return @c false if the worker must be asked instead.
+ */
+bool store_reader_get_infos(pg_uuid_t token, unsigned *info1, unsigned *info2);
+
+/**
+ * @brief Look up a gate's variable-length string annotation.
+ *
+ * @param token  UUID of the gate.
+ * @param data   Output: a @c palloc'd copy of the bytes (not
+ *               NUL-terminated).
+ * @param len    Output: their number.
+ * @return @c false if the worker must be asked instead.
+ */
+bool store_reader_get_extra(pg_uuid_t token, char **data, unsigned *len);
+
+/**
+ * @brief Drop this backend's view of the store.
+ *
+ * Called once the store has been rebuilt under it; the next lookup opens
+ * the new files.
+ */
+void store_reader_reset(void);
+
+/**
+ * @brief Record how far the request ring has been sent, at the start of
+ *        a statement.
+ *
+ * Called from the @c ExecutorStart hook, after the statement's snapshot
+ * was taken; see "It is not behind" above.
+ */
+void store_reader_statement_start(void);
+
+#endif /* STORE_READER_H */
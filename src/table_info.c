@@ -458,6 +458,11 @@ PG_FUNCTION_INFO_V1(provsql_table_info_invalidate);
  * The @c pg_class probe skips relations that are already gone, which is
  * the normal case for the @c DELETE the @c sql_drop event trigger
  * performs.
+ *
+ * An optional trigger argument names the column holding the relation's
+ * OID, so that other per-relation metadata tables can reuse the trigger:
+ * @c provsql.provenance_mapping_registry installs it with @c 'source',
+ * which is what drops the registry entries the provenance guard caches.
  */
 Datum provsql_table_info_invalidate(PG_FUNCTION_ARGS)
 {
@@ -465,12 +470,21 @@ Datum provsql_table_info_invalidate(PG_FUNCTION_ARGS)
   TupleDesc    tupdesc;
   HeapTuple    tuples[2];
   int          n = 0;
+  AttrNumber   attno = PROVSQL_TABLE_INFO_ATT_RELID;
 
   if(!CALLED_AS_TRIGGER(fcinfo))
     provsql_error("provsql_table_info_invalidate: not called as a trigger");
 
   tupdesc = trigdata->tg_relation->rd_att;
 
+  if(trigdata->tg_trigger->tgnargs > 0) {
+    attno = SPI_fnumber(tupdesc, trigdata->tg_trigger->tgargs[0]);
+    if(attno <= 0)
+      provsql_error("provsql_table_info_invalidate: no column \"%s\" in %s",
+                    trigdata->tg_trigger->tgargs[0],
+                    RelationGetRelationName(trigdata->tg_relation));
+  }
+
   if(TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
     tuples[n++] = trigdata->tg_trigtuple;
   else if(TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
@@ -488,7 +502,7 @@ Datum provsql_table_info_invalidate(PG_FUNCTION_ARGS)
 
     if(!HeapTupleIsValid(tuples[i]))
       continue;
-    d = heap_getattr(tuples[i], PROVSQL_TABLE_INFO_ATT_RELID, tupdesc, &isnull);
+    d = heap_getattr(tuples[i], attno, tupdesc, &isnull);
     if(isnull)
       continue;
     relid = DatumGetObjectId(d);
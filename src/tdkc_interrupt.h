@@ -5,7 +5,8 @@
  * In the @c tdkc build, @c CHECK_FOR_INTERRUPTS() (called from the hot loops
  * of the tree-decomposition and d-DNNF construction) resolves to
  * @c provsql_tdkc_poll() instead of a no-op.  When @c tdkc runs as a KCMCP
- * server, the poll services the active connection mid-job: it answers
+ * server, the poll services the connection of the calling thread's job
+ * (each session runs on its own thread) mid-job: it answers
  * @c PING with @c PONG, emits rate-limited @c PROGRESS frames, and throws to
  * abort the build on @c CANCEL or a @c timeout_ms deadline.  When no session
  * is active (the plain command-line mode), it is a no-op.
@@ -20,7 +20,10 @@
 -- the additive / deterministic cells (m=12 -> 2^12 sieve beats the d-tree's
 -- S*m there), so kl_fav picks sieve everywhere except the loose-relative cell
 -- (karp-luby) and the exact cell, where the d-tree's memoised exact recursion
--- still comes in under the sieve's 2^m.
+-- still comes in under the sieve's 2^m -- and (d) the Gray-code possible-worlds
+-- enumerator, 64 worlds per step, which takes every cell of clique14 and
+-- cliqueCNF14 and the exact cell of cliqueCNF18 (sieve_fav and kl_fav were
+-- spread over more variables to keep their niches).
 --
 --  circuit       exact           rel eps=.1      rel eps=.3      additive      det delta=0
 --  readonce      independent     independent     independent     independent   independent
@@ -28,14 +31,14 @@
 --  cycle_common  tree-decomp     d-tree          d-tree          monte-carlo   d-tree
 --  cycle_rare    tree-decomp     d-tree          karp-luby       monte-carlo   d-tree
 --  clique8       possible-worlds possible-worlds possible-worlds possible-worlds possible-worlds
---  clique14      d-tree          d-tree          d-tree          monte-carlo   d-tree
+--  clique14      possible-worlds possible-worlds possible-worlds possible-worlds possible-worlds
 --  big_cycle     tree-decomp     d-tree          d-tree          monte-carlo   d-tree
 --  big_rare      tree-decomp     compilation:d4  tree-decomp     monte-carlo   d-tree   [*]
 --  cnf           tree-decomp     d-tree          d-tree          monte-carlo   d-tree
 --  ladder        tree-decomp     tree-decomp     d-tree          tree-decomp   tree-decomp
 --  nested/monus/cnf12 independent independent    independent     independent   independent
---  cliqueCNF14   possible-worlds d-tree          stopping-rule   monte-carlo   d-tree
---  cliqueCNF18   compilation:d4  d-tree          stopping-rule   monte-carlo   d-tree
+--  cliqueCNF14   possible-worlds possible-worlds possible-worlds possible-worlds possible-worlds
+--  cliqueCNF18   possible-worlds d-tree          stopping-rule   monte-carlo   d-tree
 --  sieve_fav     sieve           sieve           karp-luby       sieve         sieve
 --  kl_fav        d-tree          sieve           karp-luby       sieve         sieve
 --  invfree       inversion-free  inversion-free  inversion-free  inversion-free inversion-free
@@ -52,7 +55,7 @@
 --
 -- Reachability of every method: independent / possible-worlds / tree-decomp /
 -- d-tree / monte-carlo are common; sieve (sieve_fav), karp-luby + stopping-rule
--- (loose eps), compilation (cliqueCNF18 exact), inversion-free (invfree).  The
+-- (loose eps), compilation (big_rare rel eps=.1), inversion-free (invfree).  The
 -- stopping-rule picks at loose eps are the documented 1/p corner (it is cheaper
 -- in the model but slow at runtime); at tight eps the chooser avoids it.
 \timing off
@@ -158,13 +161,14 @@ BEGIN
   -- The primal graph is a complete graph, so treewidth = n-1 (> td's cap), and
   -- it is non-DNF, so d-tree / sieve / karp-luby decline too: the hard corner
   -- where only possible-worlds (2^N) / compilation / the samplers remain.
-  -- 14. 14 vars (tw=13; possible-worlds 2^14 still cheap)
+  -- 14. 14 vars (tw=13; possible-worlds 2^14 cheap)
   ors := ARRAY[]::uuid[];
   FOR i IN 1..14 LOOP FOR j IN i+1..14 LOOP ors := ors || provenance_plus(ARRAY[c[i],c[j]]); END LOOP; END LOOP;
   acc := ors[1];
   FOR i IN 2..array_length(ors,1) LOOP acc := provenance_times(acc, ors[i]); END LOOP;
   INSERT INTO bench_tok(name,descr,tok) VALUES ('cliqueCNF14','AND of all pairwise ORs of 14 (high-tw non-DNF)', acc);
-  -- 15. 18 vars (tw=17; possible-worlds 2^18 dearer than the compiler -> compilation)
+  -- 15. 18 vars (tw=17; possible-worlds 2^18, 4096 steps of 64 worlds, still
+  --     undercuts the compiler's startup)
   ors := ARRAY[]::uuid[];
   FOR i IN 1..18 LOOP FOR j IN i+1..18 LOOP ors := ors || provenance_plus(ARRAY[c[i],c[j]]); END LOOP; END LOOP;
   acc := ors[1];
@@ -176,20 +180,20 @@ BEGIN
   cl := ARRAY[]::uuid[];
   FOR i IN 1..6 LOOP
     cv := ARRAY[]::uuid[];
-    FOR k IN 0..6 LOOP cv := cv || c[1 + ((i+k) % 12)]; END LOOP;
+    FOR k IN 0..6 LOOP cv := cv || c[1 + ((4*i+k) % 24)]; END LOOP;
     cl := cl || provenance_times(VARIADIC cv);
   END LOOP;
-  INSERT INTO bench_tok(name,descr,tok) VALUES ('sieve_fav','6 clauses x 7 vars over 12 (few-clause DNF)', provenance_plus(cl));
+  INSERT INTO bench_tok(name,descr,tok) VALUES ('sieve_fav','6 clauses x 7 vars over 24 (few-clause DNF)', provenance_plus(cl));
 
   -- 17. karp-luby's niche: an entangled DNF (m=12) where exact is dear; under a
   -- LOOSE relative tolerance its m*ln(1/delta)/eps^2 finally undercuts the d-tree.
   cl := ARRAY[]::uuid[];
   FOR i IN 1..12 LOOP
     cv := ARRAY[]::uuid[];
-    FOR k IN 0..5 LOOP cv := cv || c[1 + ((2*i+3*k) % 16)]; END LOOP;
+    FOR k IN 0..5 LOOP cv := cv || c[1 + ((2*i+3*k) % 28)]; END LOOP;
     cl := cl || provenance_times(VARIADIC cv);
   END LOOP;
-  INSERT INTO bench_tok(name,descr,tok) VALUES ('kl_fav','12 clauses x 6 vars over 16 (entangled DNF)', provenance_plus(cl));
+  INSERT INTO bench_tok(name,descr,tok) VALUES ('kl_fav','12 clauses x 6 vars over 28 (entangled DNF)', provenance_plus(cl));
 END $$;
 RESET provsql.active;
 
@@ -280,6 +284,48 @@ SELECT circuit,
        max(ms) FILTER (WHERE method='monte-carlo')        AS mc
 FROM bench_res GROUP BY seq, circuit ORDER BY seq;
 
+-- Sampler throughput: the 'monte-carlo' and 'stopping-rule' methods draw 64
+-- worlds per pass over a flattened copy of the circuit, with bitwise AND / OR /
+-- NOT / monus (src/BitParallelSampler.cpp).  A fixed 10^6 worlds per circuit,
+-- reported in ns per world, and the stopping rule at a tight relative target.
+-- For reference, on the sampling loop alone (10^6 worlds, this machine), the
+-- world-at-a-time sampler it replaces took 1.8 s on big_cycle and 9.6 s on
+-- cliqueCNF18, against 0.28 s and 0.06 s now: the old cost was hashing and
+-- allocating per world, and short-circuiting only helped the circuits that are
+-- true almost always.  The mc_4_threads column reruns the 10^6 worlds with
+-- provsql.sampler_threads = 4 (src/ParallelSampler.cpp); the estimate is the
+-- same, the time should fall with the cores available.
+DO $$
+DECLARE rec record; t0 timestamptz; v double precision;
+BEGIN
+  FOR rec IN SELECT * FROM bench_tok
+             WHERE name IN ('big_cycle','cnf','monus','cliqueCNF14','cliqueCNF18')
+             ORDER BY seq LOOP
+    t0 := clock_timestamp();
+    v := probability_evaluate(rec.tok, 'monte-carlo', '1000000');
+    -- ms for 10^6 worlds reads as ns per world
+    INSERT INTO bench_res VALUES (rec.seq, rec.name, rec.descr, 'MC 1e6',
+      round((extract(epoch FROM clock_timestamp()-t0)*1000)::numeric,2), NULL);
+    t0 := clock_timestamp();
+    v := probability_evaluate(rec.tok, 'stopping-rule', 'epsilon=0.02,delta=0.05,max_samples=10000000');
+    INSERT INTO bench_res VALUES (rec.seq, rec.name, rec.descr, 'SR eps=.02',
+      round((extract(epoch FROM clock_timestamp()-t0)*1000)::numeric,2), NULL);
+    PERFORM set_config('provsql.sampler_threads', '4', false);
+    t0 := clock_timestamp();
+    v := probability_evaluate(rec.tok, 'monte-carlo', '1000000');
+    INSERT INTO bench_res VALUES (rec.seq, rec.name, rec.descr, 'MC 1e6 x4',
+      round((extract(epoch FROM clock_timestamp()-t0)*1000)::numeric,2), NULL);
+    PERFORM set_config('provsql.sampler_threads', '1', false);
+  END LOOP;
+END $$;
+
+SELECT circuit,
+       max(ms) FILTER (WHERE method='MC 1e6')     AS mc_ns_per_world,
+       max(ms) FILTER (WHERE method='MC 1e6 x4')  AS mc_4_threads,
+       max(ms) FILTER (WHERE method='SR eps=.02') AS sr_ms
+FROM bench_res WHERE method IN ('MC 1e6','MC 1e6 x4','SR eps=.02')
+GROUP BY seq, circuit ORDER BY seq;
+
 -- What the chooser auto-selected (resolved method) per request.
 SELECT circuit,
        max(resolved) FILTER (WHERE method='AUTO exact')      AS exact,
@@ -0,0 +1,125 @@
+-- ----------------------------------------------------------------------
+-- test/bench/gate_batch_bench.sql
+--
+-- Benchmark for batched gate creation (provsql.batch_gate_creation):
+-- the rate at which a query can hand gates over to the mmap worker.
+--
+-- The workload is a self-join whose every result row mints one fresh
+-- times gate,
+--
+--   SELECT a.id FROM gb_r a JOIN gb_r b ON a.id % k = b.id % k
+--
+-- so the number of gates created is known, and the query does little
+-- else : the time is dominated by getting the gates into the store.
+--
+-- For each (n_rows, k) shape we compare :
+--   * provsql.batch_gate_creation = off : one 'C' message, one lock
+--     acquisition and one worker wake-up per gate
+--   * provsql.batch_gate_creation = on  : gates combined into 'B'
+--     messages of up to PROVSQL_GATE_BATCH_SIZE bytes
+--
+-- Each side runs on its own freshly provenance-tracked copy of the
+-- table, so the tokens -- and hence the gates -- are new to the store
+-- every time.  The timed region ends with a get_nb_gates() round trip,
+-- which cannot be answered before the worker has received every gate
+-- sent before it, batched or not.
+--
+-- Run :
+--   createdb gbbench && psql gbbench -X -f test/bench/gate_batch_bench.sql
+-- ----------------------------------------------------------------------
+
+\set ECHO none
+\pset format aligned
+\pset pager off
+
+CREATE EXTENSION IF NOT EXISTS provsql CASCADE;
+SET search_path TO public, provsql;
+
+DROP TABLE IF EXISTS gb_r CASCADE;
+DROP TABLE IF EXISTS gb_out CASCADE;
+DROP TABLE IF EXISTS gb_results CASCADE;
+
+CREATE TEMP TABLE gb_results(
+  n_rows       int,
+  k            int,
+  batched      boolean,
+  gates        bigint,
+  ms           numeric,
+  gates_per_s  numeric
+);
+
+-- Set up a fresh gb_r table, with fresh input tokens.
+CREATE OR REPLACE FUNCTION gb_setup(_n_rows int)
+  RETURNS void AS $$
+BEGIN
+  DROP TABLE IF EXISTS gb_r CASCADE;
+  CREATE TABLE gb_r(id int);
+  INSERT INTO gb_r SELECT i FROM generate_series(1, _n_rows) i;
+  PERFORM add_provenance('gb_r');
+END
+$$ LANGUAGE plpgsql;
+
+-- Run the join once with batching set to _batched, and record the
+-- number of gates it added to the store and how fast.  Called as a
+-- separate top-level statement per setting, so SET LOCAL applies to
+-- exactly one measurement.
+CREATE OR REPLACE FUNCTION gb_run(_n_rows int, _k int, _batched boolean)
+  RETURNS void AS $$
+DECLARE
+  t0 timestamptz; t1 timestamptz;
+  g0 bigint; g1 bigint;
+  m  numeric;
+BEGIN
+  PERFORM gb_setup(_n_rows);
+  PERFORM set_config('provsql.batch_gate_creation',
+                     CASE WHEN _batched THEN 'on' ELSE 'off' END, true);
+
+  g0 := get_nb_gates();
+  t0 := clock_timestamp();
+  CREATE TEMP TABLE gb_out AS
+    SELECT a.id, provenance() AS p
+      FROM gb_r a JOIN gb_r b ON a.id % _k = b.id % _k;
+  g1 := get_nb_gates();
+  t1 := clock_timestamp();
+
+  m := round((EXTRACT(EPOCH FROM (t1 - t0)) * 1000)::numeric, 3);
+  INSERT INTO gb_results VALUES (
+    _n_rows, _k, _batched, g1 - g0, m,
+    round(((g1 - g0) / NULLIF(EXTRACT(EPOCH FROM (t1 - t0)), 0))::numeric, 0)
+  );
+
+  PERFORM remove_provenance('gb_out');
+  DROP TABLE gb_out;
+END
+$$ LANGUAGE plpgsql;
+
+
+-- ----------------------------------------------------------------------
+-- Bench grid.  n_rows^2 / k result rows, hence times gates, per run.
+-- ----------------------------------------------------------------------
+SELECT gb_run(2000,  40, false);
+SELECT gb_run(2000,  40, true);
+SELECT gb_run(4000,  40, false);
+SELECT gb_run(4000,  40, true);
+SELECT gb_run(8000,  40, false);
+SELECT gb_run(8000,  40, true);
+SELECT gb_run(8000,  10, false);
+SELECT gb_run(8000,  10, true);
+
+\echo
+\echo '== Gate-creation throughput, unbatched vs. batched =='
+SELECT off.n_rows, off.k, off.gates,
+       off.ms              AS off_ms,
+       bat.ms              AS on_ms,
+       off.gates_per_s     AS off_gates_per_s,
+       bat.gates_per_s     AS on_gates_per_s,
+       round(off.ms / NULLIF(bat.ms, 0), 2) AS speedup
+  FROM gb_results off
+  JOIN gb_results bat
+    ON off.n_rows = bat.n_rows AND off.k = bat.k
+   AND NOT off.batched AND bat.batched
+ ORDER BY off.n_rows, off.k DESC;
+
+DROP FUNCTION gb_run(int, int, boolean);
+DROP FUNCTION gb_setup(int);
+DROP TABLE IF EXISTS gb_r CASCADE;
@@ -0,0 +1,143 @@
+/*
+ * test/bench/mapping_bench.cpp
+ *
+ * Microbenchmark for MMappedUUIDHashTable, the UUID -> gate-index table
+ * behind every gate fetch and creation in the circuit store.
+ *
+ * Inserts n keys (10^8 by default) into a fresh mapping file, timing
+ * the inserts, then looks up every key again (hits) and n keys never
+ * inserted (misses), in random order so that the cache, not the
+ * prefetcher, is what is measured.  Half the keys are version-4 UUIDs
+ * and half version-5, with the version and variant bits set as
+ * gen_random_uuid() and uuid_generate_v5() set them, since these fixed
+ * bits are what a hash of part of the UUID trips over.
+ *
+ * Reports ns per operation, the mapped bytes per key, and the slowest
+ * run of 64 consecutive inserts -- what a growth of the table costs the
+ * insert that triggers or finishes it, and what must not grow with n.
+ *
+ * Build and run :
+ *   make mapping_bench && ./mapping_bench [n] [directory]
+ *
+ * The file, about 3.4 GB for 10^8 keys, is created in the directory
+ * (default /tmp) and removed at the end.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "MMappedUUIDHashTable.h"
+
+namespace {
+
+/** splitmix64: a fast, reproducible stream of 64-bit values. */
+uint64_t next(uint64_t &state)
+{
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/** The @p i-th key of the stream seeded by @p seed. */
+pg_uuid_t key(uint64_t seed, uint64_t i)
+{
+  uint64_t state = seed ^ (i * 0xd1342543de82ef95ULL);
+  pg_uuid_t u;
+  uint64_t a = next(state), b = next(state);
+  memcpy(u.data, &a, 8);
+  memcpy(u.data + 8, &b, 8);
+  u.data[6] = static_cast<uint8_t>((u.data[6] & 0x0f) | ((i & 1) ? 0x50 : 0x40));
+  u.data[8] = static_cast<uint8_t>((u.data[8] & 0x3f) | 0x80);
+  return u;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point t)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  const uint64_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000ULL;
+  const std::string dir = argc > 2 ? argv[2] : "/tmp";
+  const std::string path = dir + "/provsql_mapping_bench_" + std::to_string(getpid()) + ".mmap";
+  constexpr uint64_t MAGIC = 0x68636e6542707650ULL; // "PvpBench"
+  const uint64_t SEED_IN = 1, SEED_OUT = 2;
+
+  /* A random permutation of [0, n) for the lookup order, built before
+     the table so that its cost is not timed. */
+  std::vector<uint64_t> order(n);
+  {
+    uint64_t state = 3;
+    for(uint64_t i=0; i<n; ++i)
+      order[i] = i;
+    for(uint64_t i=n; i>1; --i)
+      std::swap(order[i-1], order[next(state) % i]);
+  }
+
+  unlink(path.c_str());
+  {
+    MMappedUUIDHashTable t(path.c_str(), false, MAGIC);
+
+    constexpr uint64_t BATCH = 64;
+    double slowest = 0.;
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i=0; i<n; i+=BATCH) {
+      const auto batch_start = std::chrono::steady_clock::now();
+      for(uint64_t j=i; j<n && j<i+BATCH; ++j)
+        t.add(key(SEED_IN, j));
+      slowest = std::max(slowest, seconds_since(batch_start));
+    }
+    const double insert = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t hits = 0;
+    for(uint64_t i=0; i<n; ++i)
+      hits += t[key(SEED_IN, order[i])] == order[i];
+    const double hit = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t misses = 0;
+    for(uint64_t i=0; i<n; ++i)
+      misses += t[key(SEED_OUT, order[i])] == MMappedUUIDHashTable::NOTHING;
+    const double miss = seconds_since(start);
+
+    /* The cost of generating the keys alone, to subtract. */
+    start = std::chrono::steady_clock::now();
+    uint64_t sink = 0;
+    for(uint64_t i=0; i<n; ++i)
+      sink += key(SEED_IN, order[i]).data[0];
+    const double gen = seconds_since(start);
+
+    if(hits != n || misses != n) {
+      std::fprintf(stderr, "wrong answers: %llu hits, %llu misses of %llu\n",
+                   (unsigned long long) hits, (unsigned long long) misses,
+                   (unsigned long long) n);
+      return 1;
+    }
+
+    const double bytes = 64. + t.capacity() * (1. + 16. + sizeof(unsigned long));
+    std::printf("keys          %llu (capacity %lu, load %.3f)\n",
+                (unsigned long long) n, t.capacity(),
+                static_cast<double>(n) / t.capacity());
+    std::printf("insert        %8.1f ns/key\n", (insert - gen) * 1e9 / n);
+    std::printf("lookup (hit)  %8.1f ns/key\n", (hit - gen) * 1e9 / n);
+    std::printf("lookup (miss) %8.1f ns/key\n", (miss - gen) * 1e9 / n);
+    std::printf("mapped        %8.1f bytes/key\n", bytes / n);
+    std::printf("slowest %llu inserts %8.1f us\n",
+                (unsigned long long) BATCH, slowest * 1e6);
+    std::printf("(key generation, subtracted above: %.1f ns/key; %llu)\n",
+                gen * 1e9 / n, (unsigned long long) (sink & 1));
+  }
+  unlink(path.c_str());
+  return 0;
+}
@@ -2,13 +2,20 @@
 """KCMCP conformance check for the tdkc reference server.
 
 Launches `tdkc --kcmcp unix:<sock>`, then drives the protocol end to end:
-handshake, a `compile` request (-> ddnnf-nnf), a `wmc` request (-> decimal),
-PING/PONG, and two error cases (unsupported operation / output format).  No
-third-party dependencies; uses only the standard library.
+handshake, `compile` requests (-> ddnnf-nnf, -> ddnnf-bin), a `wmc` request
+(-> decimal), PING/PONG, two error cases (unsupported operation / output
+format), the result cache (a repeated request, one naming its problem by
+SHA-256, and one attaching to an identical build in flight), and zstd
+compression when both ends support it.  A second server, limited to one worker, checks
+admission control: a request waits for the busy worker, one more is refused
+as busy, and so is a session beyond --max-sessions.  Uses only the standard
+library; the compression check also needs a zstd codec (Python 3.14's
+compression.zstd, or the zstandard package) and is skipped without one.
 
 Usage:  conformance.py /path/to/tdkc
 Exit code 0 on success, 1 on any conformance failure.
 """
+import hashlib
 import json
 import os
 import shutil
@@ -25,21 +32,55 @@ FLAG_MORE = 0x01
 # Registries
 OP_COUNT, OP_WMC, OP_COMPILE = 0, 1, 2
 IN_DIMACS = 0
-OUT_DECIMAL, OUT_DDNNF_NNF = 0, 4
+OUT_DECIMAL, OUT_DDNNF_NNF, OUT_DDNNF_BIN = 0, 4, 7
 # Error codes
 ERR_UNSUPPORTED_OP, ERR_UNSUPPORTED_FMT, ERR_CANCELLED = 1, 2, 5
-ERR_UNSUPPORTED_VERSION, ERR_COMPRESSION = 8, 9
+ERR_UNSUPPORTED_VERSION, ERR_COMPRESSION, ERR_BUSY, ERR_UNKNOWN_PROBLEM = 8, 9, 10, 11
 FLAG_COMPRESSED = 0x02
 
 HEADER = struct.Struct(">BBII")  # type, flags, request_id, payload_len
+COMPRESS_MIN = 4096               # smaller payloads are sent as they are
+
+try:
+    from compression import zstd as _zstd
+
+    def zstd_compress(data):
+        return _zstd.compress(data)
+
+    def zstd_decompress(data):
+        return _zstd.decompress(data)
+except ImportError:
+    try:
+        import zstandard as _zstd
+
+        def zstd_compress(data):
+            return _zstd.ZstdCompressor().compress(data)
+
+        def zstd_decompress(data):
+            return _zstd.ZstdDecompressor().decompressobj().decompress(data)
+    except ImportError:
+        zstd_compress = zstd_decompress = None
+
+
+def frame(typ, rid, payload=b"", flags=0):
+    return HEADER.pack(typ, flags, rid, len(payload)) + payload
 
 
 class Conn:
     def __init__(self, sock):
         self.s = sock
-
-    def send(self, typ, rid, payload=b"", flags=0):
-        self.s.sendall(HEADER.pack(typ, flags, rid, len(payload)) + payload)
+        self.compress = False   # zstd negotiated at the handshake
+
+    def send(self, typ, rid, payload=b"", flags=0, chunk=None):
+        """Send one message; once compression is negotiated, a large payload
+        is compressed, and split across MORE frames of @chunk bytes if given."""
+        if self.compress and len(payload) >= COMPRESS_MIN:
+            payload, flags = zstd_compress(payload), flags | FLAG_COMPRESSED
+        chunk = chunk or max(len(payload), 1)
+        parts = [payload[i:i + chunk] for i in range(0, len(payload), chunk)] or [b""]
+        self.s.sendall(b"".join(
+            frame(typ, rid, p, flags | (FLAG_MORE if i + 1 < len(parts) else 0))
+            for i, p in enumerate(parts)))
 
     def _readn(self, n):
         buf = b""
@@ -57,6 +98,8 @@ class Conn:
             typ, flags, rid, plen = HEADER.unpack(self._readn(HEADER.size))
             payload += self._readn(plen) if plen else b""
             if not (flags & FLAG_MORE):
+                if flags & FLAG_COMPRESSED:
+                    payload = zstd_decompress(payload)
                 return typ, rid, payload
 
 
@@ -66,6 +109,53 @@ def request_payload(op, infmt, outfmt, options, problem):
             + struct.pack(">H", len(opt)) + opt + problem.encode())
 
 
+def split_result(payload):
+    """(meta dict, result bytes) of a RESULT payload."""
+    meta_len = struct.unpack(">H", payload[2:4])[0]
+    return json.loads(payload[4:4 + meta_len]), payload[4 + meta_len:]
+
+
+def ddnnf_bin_probability(data):
+    """Probability of the root of a ddnnf-bin d-DNNF, under the literal
+    probabilities it carries: decodes the whole format on the way."""
+    pos = 6
+
+    def varint():
+        nonlocal pos
+        v = shift = 0
+        while True:
+            b = data[pos]
+            pos += 1
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    assert data[:5] == b"DNNB\x01" and data[5] & 1, "header"
+    _, nlits, nnodes, nedges = varint(), varint(), varint(), varint()
+    lits = [varint() for _ in range(nlits)]
+    heads = [varint() for _ in range(nnodes)]
+    children = [varint() for _ in range(nedges)]
+    weights = struct.unpack("<%dd" % nlits, data[pos:pos + 8 * nlits])
+    assert pos + 8 * nlits == len(data) and len(set(lits)) == nlits, "layout"
+    value, edge = [], 0
+    for i, h in enumerate(heads):
+        kind, n = h & 3, h >> 2
+        if kind == 0:
+            value.append(weights[n])
+            continue
+        ch = [value[i - d] for d in children[edge:edge + n]]
+        edge += n
+        if kind == 1:
+            p = 1.0
+            for x in ch:
+                p *= x
+        else:
+            p = sum(ch)
+        value.append(p)
+    return value[-1]
+
+
 def chain_cnf(nvars):
     """A path of binary clauses (x_i v x_{i+1}): low treewidth (so it compiles)
     but many gates, hence many interrupt-check points during the build."""
@@ -87,6 +177,107 @@ def connect(sockpath):
     return s, Conn(s)
 
 
+def handshake(sockpath, compress=False):
+    """Connect and exchange HELLOs, offering zstd if @compress; the
+    connection compresses from then on if the server selected it."""
+    s, c = connect(sockpath)
+    hello = {"kcmcp": [1, 0], "client": "conf/1"}
+    if compress:
+        hello["compression"] = ["zstd"]
+    c.send(HELLO, 0, json.dumps(hello).encode())
+    typ, rid, payload = c.recv()
+    if typ == HELLO and compress:
+        c.compress = json.loads(payload).get("compression") == "zstd"
+    return s, c, (typ, rid, payload)
+
+
+def start_server(tdkc, sockpath, *options):
+    proc = subprocess.Popen([tdkc, "--kcmcp", "unix:" + sockpath] + list(options),
+                            stderr=subprocess.PIPE)
+    deadline = time.time() + 10
+    while time.time() < deadline and not os.path.exists(sockpath):
+        time.sleep(0.02)
+    return proc
+
+
+def stop_server(proc):
+    proc.terminate()
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+
+
+def check_admission(tdkc, sockpath):
+    """One worker, a queue of one, three sessions: A holds the worker, B
+    waits for it (reporting a "queued" phase), C is refused as busy, and a
+    fourth session is refused at the handshake."""
+    proc = start_server(tdkc, sockpath, "--workers", "1", "--queue", "1",
+                        "--max-sessions", "3")
+    try:
+        expect(os.path.exists(sockpath), "limited server created the socket")
+        conns = [handshake(sockpath) for _ in range(3)]
+        for _, _, (typ, _, _) in conns:
+            expect(typ == HELLO, "sessions within --max-sessions are accepted")
+        (sa, a, _), (sb, b, _), (sc, c, _) = conns
+
+        # A: a long build; its first PROGRESS proves it holds the worker.
+        a.send(REQUEST, 1, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               '{"progress_every_ms":0}', chain_cnf(50000)))
+        typ, rid, payload = a.recv()
+        expect(typ == PROGRESS and json.loads(payload).get("phase") == "compile",
+               "first job runs on the only worker")
+
+        # B: queued behind A, still reporting progress.
+        cnf = "p cnf 2 1\n1 2 0\n"
+        b.send(REQUEST, 2, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               '{"progress_every_ms":0}', cnf))
+        typ, rid, payload = b.recv()
+        expect(typ == PROGRESS and rid == 2
+               and json.loads(payload).get("phase") == "queued",
+               "second job waits in the queue with a queued PROGRESS")
+
+        # C: worker busy and queue full (and not B's problem, which C would
+        # simply share).
+        c.send(REQUEST, 3, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               "", "p cnf 2 1\n-1 2 0\n"))
+        typ, rid, payload = c.recv()
+        code = struct.unpack(">H", payload[:2])[0]
+        expect(typ == ERROR and rid == 3 and code == ERR_BUSY,
+               f"third job -> ERROR code {ERR_BUSY} (busy); got {code}")
+
+        # A fourth session is over --max-sessions.
+        sd, d, (typ, _, payload) = handshake(sockpath)
+        code = struct.unpack(">H", payload[:2])[0]
+        expect(typ == ERROR and code == ERR_BUSY,
+               f"session beyond --max-sessions -> ERROR code {ERR_BUSY}")
+        sd.close()
+
+        # Cancelling A hands the worker to B.
+        a.send(CANCEL, 1)
+        while True:
+            typ, rid, payload = a.recv()
+            if typ != PROGRESS:
+                break
+        expect(typ == ERROR and struct.unpack(">H", payload[:2])[0] == ERR_CANCELLED,
+               "the running job is cancelled")
+        while True:
+            typ, rid, payload = b.recv()
+            if typ != PROGRESS:
+                break
+        expect(typ == RESULT and rid == 2, "the queued job then runs to a RESULT")
+
+        # C's session survived the refusal.
+        c.send(REQUEST, 4, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               "", cnf))
+        typ, rid, _ = c.recv()
+        expect(typ == RESULT and rid == 4, "a refused session keeps serving")
+        for s in (sa, sb, sc):
+            s.close()
+    finally:
+        stop_server(proc)
+
+
 def main():
     if len(sys.argv) != 2:
         print("usage: conformance.py /path/to/tdkc", file=sys.stderr)
@@ -99,13 +290,8 @@ def main():
     d = tempfile.mkdtemp(prefix="kcmcp_", dir=base)
     sockpath = os.path.join(d, "s.sock")
 
-    proc = subprocess.Popen([tdkc, "--kcmcp", "unix:" + sockpath],
-                            stderr=subprocess.PIPE)
+    proc = start_server(tdkc, sockpath)
     try:
-        # Wait for the listening line (or the socket to appear).
-        deadline = time.time() + 10
-        while time.time() < deadline and not os.path.exists(sockpath):
-            time.sleep(0.02)
         expect(os.path.exists(sockpath), "server created the socket")
 
         s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
@@ -120,8 +306,8 @@ def main():
         expect(desc.get("kcmcp") == 1, "negotiated kcmcp version 1")
         expect(set(["compile", "wmc"]) <= set(desc.get("operations", [])),
                "advertises compile + wmc")
-        expect(desc.get("output_formats", {}).get("compile") == ["ddnnf-nnf"],
-               "compile -> ddnnf-nnf advertised")
+        expect(desc.get("output_formats", {}).get("compile") == ["ddnnf-nnf", "ddnnf-bin"],
+               "compile -> ddnnf-nnf and ddnnf-bin advertised")
         expect("cancel" in desc.get("features", []) and "progress" in desc["features"],
                "advertises cancel + progress features")
         expect(desc.get("max_payload", 0) >= 1 << 20, "max_payload >= 1 MiB")
@@ -152,6 +338,16 @@ def main():
         expect(payload[0] == OUT_DECIMAL, "wmc result_format is decimal")
         expect(abs(value - 0.58) < 1e-9, f"wmc value 0.58 (got {value})")
 
+        # --- compile to ddnnf-bin: the binary d-DNNF of the same weighted
+        #     CNF carries its literal weights, and evaluates to 0.58 ---
+        c.send(REQUEST, 21, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_BIN,
+                                            "", wcnf))
+        typ, rid, payload = c.recv()
+        expect(typ == RESULT and rid == 21 and payload[0] == OUT_DDNNF_BIN,
+               "compile -> ddnnf-bin returns a ddnnf-bin RESULT")
+        value = ddnnf_bin_probability(split_result(payload)[1])
+        expect(abs(value - 0.58) < 1e-9, f"ddnnf-bin evaluates to 0.58 (got {value})")
+
         # --- ping / pong ---
         c.send(PING, 7)
         typ, rid, _ = c.recv()
@@ -176,6 +372,59 @@ def main():
         typ, rid, payload = c.recv()
         expect(typ == RESULT and rid == 5, "server keeps serving after errors")
 
+        # --- result cache: a repeated request is answered from the cache;
+        #     so is one naming its problem by SHA-256 alone, while an unknown
+        #     digest asks for the problem (ERROR 11). ---
+        expect("result-cache" in desc["features"], "advertises result-cache")
+        cnf3 = "p cnf 3 2\n1 2 0\n-2 3 0\n"
+        for rid in (20, 21):
+            c.send(REQUEST, rid, request_payload(OP_COMPILE, IN_DIMACS,
+                   OUT_DDNNF_NNF, "", cnf3))
+            typ, r, payload = c.recv()
+            expect(typ == RESULT and r == rid, f"compile {rid} returns a RESULT")
+        expect(split_result(payload)[0].get("cache") == "hit",
+               "a repeated request is a cache hit")
+        first = payload
+        digest = hashlib.sha256(cnf3.encode()).hexdigest()
+        c.send(REQUEST, 22, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               json.dumps({"problem_sha256": digest}), ""))
+        typ, rid, payload = c.recv()
+        expect(typ == RESULT and rid == 22 and payload == first,
+               "a request naming a held problem by SHA-256 gets its result")
+        c.send(REQUEST, 23, request_payload(OP_WMC, IN_DIMACS, OUT_DECIMAL,
+               json.dumps({"problem_sha256": digest}), ""))
+        typ, rid, payload = c.recv()
+        code = struct.unpack(">H", payload[:2])[0]
+        expect(typ == ERROR and rid == 23 and code == ERR_UNKNOWN_PROBLEM,
+               f"an unknown problem digest -> ERROR code {ERR_UNKNOWN_PROBLEM}")
+
+        # --- deduplication: a second session sending the problem a first one
+        #     is building attaches to that build and shares its result. ---
+        s3, c3, _ = handshake(sockpath)
+        long_cnf = chain_cnf(20000)
+        c.send(REQUEST, 24, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+               '{"progress_every_ms":0}', long_cnf))
+        typ, rid, payload = c.recv()
+        expect(typ == PROGRESS and json.loads(payload).get("phase") == "compile",
+               "the first of two identical requests builds")
+        c3.send(REQUEST, 1, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
+                '{"progress_every_ms":0}', long_cnf))
+        typ, rid, payload = c3.recv()
+        expect(typ == PROGRESS and json.loads(payload).get("phase") == "attached",
+               "the second attaches to the build in flight")
+        results = []
+        for conn, want in ((c, 24), (c3, 1)):
+            while True:
+                typ, rid, payload = conn.recv()
+                if typ != PROGRESS:
+                    break
+            expect(typ == RESULT and rid == want, "both get a RESULT")
+            results.append(split_result(payload))
+        expect(results[1][0].get("cache") == "shared"
+               and results[1][1] == results[0][1],
+               "the attached request shares the built d-DNNF")
+        s3.close()
+
         # --- progress: progress_every_ms=0 makes the server emit a PROGRESS on
         #     the first interrupt poll, so we observe it deterministically
         #     without depending on a multi-second build. ---
@@ -196,10 +445,12 @@ def main():
 
         # --- cancel: pipeline CANCEL right behind the REQUEST so it is already
         #     buffered when the build's first interrupt poll runs; the build is
-        #     aborted regardless of how fast it would otherwise complete. ---
-        c.send(REQUEST, 11, request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF,
-               "", chain_cnf(60)))
-        c.send(CANCEL, 11)
+        #     aborted regardless of how fast it would otherwise complete.  Both
+        #     frames go out in one write, so the server cannot finish the
+        #     build before the CANCEL reaches it. ---
+        s.sendall(frame(REQUEST, 11, request_payload(OP_COMPILE, IN_DIMACS,
+                        OUT_DDNNF_NNF, "", chain_cnf(60)))
+                  + frame(CANCEL, 11))
         while True:
             typ, rid, payload = c.recv()
             if typ == PROGRESS:   # tolerate a stray progress frame before the abort
@@ -235,6 +486,36 @@ def main():
         c.send(BYE, 0)
         s.close()
 
+        # --- compression, negotiated: a client offering zstd gets it if the
+        #     server was built with it; a compressed REQUEST, split across
+        #     MORE frames, then gets a compressed RESULT. ---
+        if zstd_compress is None:
+            print("skip: compression (no zstd codec in this Python)")
+        else:
+            s3, c3, (typ, _, payload) = handshake(sockpath, compress=True)
+            expect(typ == HELLO, "HELLO offering zstd is accepted")
+            if not c3.compress:
+                print("skip: compression (server built without zstd)")
+            else:
+                big = chain_cnf(3000)
+                c3.send(REQUEST, 15,
+                        request_payload(OP_COMPILE, IN_DIMACS, OUT_DDNNF_NNF, "", big),
+                        chunk=512)
+                typ, flags, rid, plen = HEADER.unpack(c3._readn(HEADER.size))
+                body = c3._readn(plen)
+                while flags & FLAG_MORE:
+                    _, more, _, n = HEADER.unpack(c3._readn(HEADER.size))
+                    body += c3._readn(n)
+                    flags = more | (flags & FLAG_COMPRESSED)
+                expect(typ == RESULT and rid == 15 and flags & FLAG_COMPRESSED,
+                       "compressed REQUEST -> compressed RESULT")
+                meta, result = split_result(zstd_decompress(body))
+                expect(result.startswith(b"nnf "),
+                       "compressed RESULT decodes to the d-DNNF")
+                c3.send(PING, 16)   # small frames stay uncompressed
+                expect(c3.recv()[0] == PONG, "PING/PONG on a compressed connection")
+            s3.close()
+
         # --- version: a client requiring a newer (breaking) major is rejected
         #     at the handshake with ERROR code 8, on a fresh connection. ---
         s2, c2 = connect(sockpath)
@@ -244,14 +525,13 @@ def main():
         expect(typ == ERROR and code == ERR_UNSUPPORTED_VERSION,
                f"client HELLO major 2 -> ERROR code {ERR_UNSUPPORTED_VERSION} (got {code})")
         s2.close()
+        stop_server(proc)
+
+        check_admission(tdkc, os.path.join(d, "l.sock"))
         print("\nKCMCP conformance: PASS")
         return 0
     finally:
-        proc.terminate()
-        try:
-            proc.wait(timeout=5)
-        except subprocess.TimeoutExpired:
-            proc.kill()
+        stop_server(proc)
         shutil.rmtree(d, ignore_errors=True)
 
 
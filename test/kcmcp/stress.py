@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""KCMCP stress benchmark for the tdkc reference server.
+
+Launches `tdkc --kcmcp unix:<sock>` (with any --workers / --queue /
+--max-sessions given), then drives it from N parallel clients, each on its
+own connection-for-life session issuing a stream of `compile` and `wmc`
+requests over chain CNFs.  Every wmc answer is checked against the exact
+value, computed here by dynamic programming; a fraction of the requests can
+be cancelled mid-build (--cancel-every), and problems can be drawn from a
+small pool shared by all clients (--distinct) to exercise the result cache
+and the deduplication of identical builds, and clients can offer zstd
+compression (--compress) to measure its cost.  Reports throughput, latency
+percentiles, how many answers came from the cache or a shared build, and
+how many requests ended busy (admission control), cancelled, or in error.
+
+Usage:  stress.py /path/to/tdkc [--clients N] [--requests N] [--vars N]
+                  [--cancel-every K] [--distinct K] [--workers N]
+                  [--queue N] [--max-sessions N] [--cache-mb N] [--compress]
+Exit code 0 when every answer is correct, 1 otherwise.
+"""
+import argparse
+import os
+import random
+import shutil
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from conformance import (  # noqa: E402
+    CANCEL, ERROR, HELLO, IN_DIMACS, OP_COMPILE, OP_WMC, OUT_DDNNF_NNF,
+    OUT_DECIMAL, PROGRESS, REQUEST, RESULT, ERR_BUSY, ERR_CANCELLED,
+    handshake, request_payload, split_result, start_server, stop_server,
+    zstd_compress)
+
+
+def weighted_chain(nvars, rng):
+    """Clauses (x_i v x_{i+1}) with random weights, and the exact WMC."""
+    w = [rng.uniform(0.05, 0.95) for _ in range(nvars)]
+    lines = ["p cnf %d %d" % (nvars, nvars - 1)]
+    for i in range(nvars):
+        lines.append("c p weight %d %.17g 0" % (i + 1, w[i]))
+        lines.append("c p weight -%d %.17g 0" % (i + 1, 1 - w[i]))
+    lines += ["%d %d 0" % (i, i + 1) for i in range(1, nvars)]
+    # Probability that no two consecutive variables are both false.
+    last_true, last_false = w[0], 1 - w[0]
+    for p in w[1:]:
+        last_true, last_false = (last_true + last_false) * p, last_true * (1 - p)
+    return "\n".join(lines) + "\n", last_true + last_false
+
+
+def percentile(xs, q):
+    if not xs:
+        return float("nan")
+    xs = sorted(xs)
+    return xs[min(len(xs) - 1, int(q * len(xs)))]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.busy = self.cancelled = self.errors = self.wrong = 0
+        self.hit = self.shared = 0
+
+    def add(self, **kw):
+        with self.lock:
+            for k, v in kw.items():
+                if k == "latency":
+                    self.latencies.append(v)
+                else:
+                    setattr(self, k, getattr(self, k) + v)
+
+
+def client(sockpath, idx, args, stats):
+    rng = random.Random(idx)
+    try:
+        s, c, (typ, _, _) = handshake(sockpath, compress=args.compress)
+    except OSError:
+        stats.add(errors=args.requests)
+        return
+    if typ != HELLO:           # refused: over --max-sessions
+        stats.add(busy=args.requests)
+        s.close()
+        return
+    for rid in range(1, args.requests + 1):
+        # With --distinct, all clients draw from the same pool of problems.
+        prng = random.Random(rng.randrange(args.distinct)) if args.distinct else rng
+        cnf, expected = weighted_chain(args.vars + prng.randrange(args.vars), prng)
+        wmc = rng.random() < 0.5
+        payload = request_payload(OP_WMC if wmc else OP_COMPILE, IN_DIMACS,
+                                  OUT_DECIMAL if wmc else OUT_DDNNF_NNF,
+                                  '{"progress_every_ms":100}', cnf)
+        cancel = args.cancel_every and rid % args.cancel_every == 0
+        start = time.perf_counter()
+        c.send(REQUEST, rid, payload)
+        while True:
+            typ, r, body = c.recv()
+            if typ != PROGRESS:
+                break
+            if cancel:
+                c.send(CANCEL, rid)
+                cancel = False
+        if typ == RESULT:
+            stats.add(latency=time.perf_counter() - start)
+            meta, result = split_result(body)
+            if meta.get("cache") in ("hit", "shared"):
+                stats.add(**{meta["cache"]: 1})
+            if wmc:
+                if abs(float(result) - expected) > 1e-9:
+                    stats.add(wrong=1)
+            elif not result.startswith(b"nnf "):
+                stats.add(wrong=1)
+        elif typ == ERROR:
+            code = struct.unpack(">H", body[:2])[0]
+            if code == ERR_BUSY:
+                stats.add(busy=1)
+            elif code == ERR_CANCELLED:
+                stats.add(cancelled=1)
+            else:
+                stats.add(errors=1)
+        else:
+            stats.add(errors=1)
+    s.close()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("tdkc")
+    ap.add_argument("--clients", type=int, default=16)
+    ap.add_argument("--requests", type=int, default=20,
+                    help="requests per client")
+    ap.add_argument("--vars", type=int, default=500,
+                    help="chain length (each CNF has vars to 2*vars variables)")
+    ap.add_argument("--cancel-every", type=int, default=0,
+                    help="cancel every K-th request of each client (0: never)")
+    ap.add_argument("--distinct", type=int, default=0,
+                    help="draw problems from a shared pool of K (0: all distinct)")
+    ap.add_argument("--workers", type=int)
+    ap.add_argument("--queue", type=int)
+    ap.add_argument("--max-sessions", type=int)
+    ap.add_argument("--cache-mb", type=int)
+    ap.add_argument("--compress", action="store_true",
+                    help="offer zstd compression at the handshake")
+    args = ap.parse_args()
+    if args.compress and zstd_compress is None:
+        ap.error("--compress needs a zstd codec (compression.zstd or zstandard)")
+
+    options = []
+    for opt in ("workers", "queue", "max_sessions", "cache_mb"):
+        if getattr(args, opt) is not None:
+            options += ["--" + opt.replace("_", "-"), str(getattr(args, opt))]
+
+    base = "/tmp" if os.path.isdir("/tmp") else None
+    d = tempfile.mkdtemp(prefix="kcmcp_", dir=base)
+    sockpath = os.path.join(d, "s.sock")
+    proc = start_server(args.tdkc, sockpath, *options)
+    try:
+        stats = Stats()
+        threads = [threading.Thread(target=client, args=(sockpath, i, args, stats))
+                   for i in range(args.clients)]
+        start = time.perf_counter()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.perf_counter() - start
+    finally:
+        stop_server(proc)
+        shutil.rmtree(d, ignore_errors=True)
+
+    done = len(stats.latencies)
+    print("clients %d x %d requests, %.2f s" % (args.clients, args.requests, elapsed))
+    print("  completed %d (%.1f req/s), busy %d, cancelled %d, errors %d, wrong %d"
+          % (done, done / elapsed, stats.busy, stats.cancelled, stats.errors,
+             stats.wrong))
+    print("  from the cache %d, from a shared build %d" % (stats.hit, stats.shared))
+    print("  latency ms: p50 %.1f  p95 %.1f  max %.1f"
+          % (1000 * percentile(stats.latencies, .5),
+             1000 * percentile(stats.latencies, .95),
+             1000 * max(stats.latencies, default=float("nan"))))
+    return 1 if stats.wrong or stats.errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
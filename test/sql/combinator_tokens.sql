@@ -0,0 +1,87 @@
+\set ECHO none
+\pset format unaligned
+
+-- The C provenance_times, provenance_plus and provenance_monus mint the
+-- tokens of the PL/pgSQL versions they replaced, which existing stores
+-- reference: uuid_generate_v5(uuid_ns_provsql(), concat(<recipe>)).  The
+-- old recipes are restated here and compared with the C functions, in
+-- both argument orders (the recipe is order-dependent), with neutral
+-- elements and NULLs filtered out, and on the all-zero plus.
+CREATE FUNCTION old_times(VARIADIC tokens uuid[]) RETURNS uuid AS
+$$
+  SELECT public.uuid_generate_v5(uuid_ns_provsql(), concat('times', array_agg(t)))
+  FROM unnest(tokens) t WHERE t IS NOT NULL AND t <> gate_one()
+$$ LANGUAGE sql;
+CREATE FUNCTION old_plus(tokens uuid[]) RETURNS uuid AS
+$$
+  SELECT public.uuid_generate_v5(uuid_ns_provsql(), concat('plus', array_agg(t)))
+  FROM unnest(tokens) t WHERE t IS NOT NULL AND t <> gate_zero()
+$$ LANGUAGE sql;
+CREATE FUNCTION old_monus(token1 uuid, token2 uuid) RETURNS uuid AS
+$$
+  SELECT public.uuid_generate_v5(uuid_ns_provsql(), concat('monus', token1, token2))
+$$ LANGUAGE sql;
+
+CREATE TABLE ct_t(id int);
+INSERT INTO ct_t VALUES (1), (2), (3);
+SELECT add_provenance('ct_t');
+CREATE TABLE ct_tokens(x uuid, y uuid, z uuid);
+DO $$
+DECLARE x uuid; y uuid; z uuid;
+BEGIN
+  SELECT provsql INTO x FROM ct_t WHERE id = 1;
+  SELECT provsql INTO y FROM ct_t WHERE id = 2;
+  SELECT provsql INTO z FROM ct_t WHERE id = 3;
+  INSERT INTO ct_tokens VALUES (x, y, z);
+END $$;
+
+-- Times: ordering, three children, gate_one() and NULL dropped
+SELECT provenance_times(x, y) = old_times(x, y) AS xy,
+       provenance_times(y, x) = old_times(y, x) AS yx,
+       provenance_times(x, y) <> provenance_times(y, x) AS order_matters,
+       provenance_times(x, y, z) = old_times(x, y, z) AS xyz,
+       provenance_times(gate_one(), x, NULL, y) = old_times(x, y) AS filtered,
+       get_children(provenance_times(y, x)) = ARRAY[y, x] AS children
+FROM ct_tokens;
+
+-- Times: the short cuts
+SELECT provenance_times(x, gate_one()) = x AS single,
+       provenance_times(gate_one(), NULL) = gate_one() AS all_one,
+       provenance_times(VARIADIC NULL::uuid[]) = gate_one() AS null_array
+FROM ct_tokens;
+
+-- Plus: ordering, three children, gate_zero() and NULL dropped
+SELECT provenance_plus(ARRAY[x, y]) = old_plus(ARRAY[x, y]) AS xy,
+       provenance_plus(ARRAY[y, x]) = old_plus(ARRAY[y, x]) AS yx,
+       provenance_plus(ARRAY[x, y]) <> provenance_plus(ARRAY[y, x]) AS order_matters,
+       provenance_plus(ARRAY[x, y, z]) = old_plus(ARRAY[x, y, z]) AS xyz,
+       provenance_plus(ARRAY[gate_zero(), x, NULL, y]) = old_plus(ARRAY[x, y]) AS filtered,
+       get_children(provenance_plus(ARRAY[y, x])) = ARRAY[y, x] AS children
+FROM ct_tokens;
+
+-- Plus: a single survivor is returned as is; no survivor at all makes the
+-- childless plus gate at uuid5('plus'), not gate_zero()
+SELECT provenance_plus(ARRAY[gate_zero(), x]) = x AS single,
+       provenance_plus(ARRAY[gate_zero(), NULL]) = old_plus(ARRAY[gate_zero(), NULL]) AS all_zero,
+       provenance_plus(ARRAY[]::uuid[]) = old_plus(ARRAY[]::uuid[]) AS empty,
+       provenance_plus(ARRAY[]::uuid[])
+         = public.uuid_generate_v5(uuid_ns_provsql(), 'plus') AS plus_recipe,
+       get_gate_type(provenance_plus(ARRAY[]::uuid[])) AS gate_type
+FROM ct_tokens;
+
+-- Monus: ordering, and the short cuts
+SELECT provenance_monus(x, y) = old_monus(x, y) AS xy,
+       provenance_monus(y, x) = old_monus(y, x) AS yx,
+       provenance_monus(x, y) <> provenance_monus(y, x) AS order_matters,
+       get_children(provenance_monus(y, x)) = ARRAY[y, x] AS children,
+       provenance_monus(x, x) = gate_zero() AS self,
+       provenance_monus(gate_zero(), x) = gate_zero() AS zero_left,
+       provenance_monus(x, gate_zero()) = x AS zero_right,
+       provenance_monus(x, NULL) = x AS null_right
+FROM ct_tokens;
+
+DROP TABLE ct_tokens;
+DROP TABLE ct_t;
+DROP FUNCTION old_times(uuid[]);
+DROP FUNCTION old_plus(uuid[]);
+DROP FUNCTION old_monus(uuid, uuid);
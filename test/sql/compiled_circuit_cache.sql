@@ -0,0 +1,76 @@
+\set ECHO none
+\pset format unaligned
+
+-- The d-DNNF a tree decomposition builds is kept on disk and read back by
+-- the next evaluation of the same circuit; a circuit whose probabilities
+-- change is compiled again; the least recently used d-DNNFs are removed
+-- past provsql.compiled_circuit_cache, and 0 turns the cache off.  Every
+-- build is stored here, however fast, and verbose_level 20 reports each
+-- d-DNNF stored or read back.  The circuits are made of gates created
+-- directly, so no query below is rewritten (verbose_level 20 would print
+-- the rewritten queries).
+
+-- ccc.a: an OR of the 59 ANDs of consecutive inputs among 60, whose
+-- d-DNNF takes more than 2kB; ccc.b: the AND of two inputs, whose d-DNNF
+-- takes less.
+DO $$
+DECLARE
+  a uuid[];
+  b uuid[];
+  pairs uuid[];
+BEGIN
+  SELECT array_agg(public.uuid_generate_v5(uuid_ns_provsql(), 'ccc-a' || i) ORDER BY i)
+    INTO a FROM generate_series(1, 60) i;
+  SELECT array_agg(public.uuid_generate_v5(uuid_ns_provsql(), 'ccc-b' || i) ORDER BY i)
+    INTO b FROM generate_series(1, 2) i;
+  FOR i IN 1..60 LOOP
+    PERFORM create_gate(a[i], 'input');
+    PERFORM set_prob(a[i], 0.1);
+  END LOOP;
+  FOR i IN 1..2 LOOP
+    PERFORM create_gate(b[i], 'input');
+    PERFORM set_prob(b[i], 0.5);
+  END LOOP;
+  SELECT array_agg(provenance_times(a[i], a[i + 1]) ORDER BY i)
+    INTO pairs FROM generate_series(1, 59) i;
+  PERFORM set_config('ccc.a', provenance_plus(pairs)::text, false);
+  PERFORM set_config('ccc.b', provenance_times(b[1], b[2])::text, false);
+END $$;
+
+SET provsql.compiled_circuit_cache_min_time = 0;
+SET provsql.verbose_level = 20;
+
+-- Compiled and stored, then read back.
+SELECT round(probability_evaluate(current_setting('ccc.a')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS a;
+SELECT round(probability_evaluate(current_setting('ccc.a')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS a;
+
+-- A probability changed: another circuit, compiled and stored anew.
+DO $$ BEGIN
+  PERFORM set_prob(public.uuid_generate_v5(uuid_ns_provsql(), 'ccc-a1'), 0.3);
+END $$;
+SELECT round(probability_evaluate(current_setting('ccc.a')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS a;
+
+-- Storing ccc.b in a 2kB cache evicts the older, larger d-DNNFs of ccc.a,
+-- which is compiled again, and not stored: it would not fit.
+SET provsql.compiled_circuit_cache = '2kB';
+SELECT round(probability_evaluate(current_setting('ccc.b')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS b;
+SELECT round(probability_evaluate(current_setting('ccc.a')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS a;
+RESET provsql.compiled_circuit_cache;
+SELECT round(probability_evaluate(current_setting('ccc.b')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS b;
+
+-- Off: nothing is read back, nothing is stored.
+SET provsql.compiled_circuit_cache = 0;
+SELECT round(probability_evaluate(current_setting('ccc.b')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS b;
+SELECT round(probability_evaluate(current_setting('ccc.a')::uuid,
+                                  'tree-decomposition')::numeric, 4) AS a;
+
+RESET provsql.compiled_circuit_cache;
+RESET provsql.verbose_level;
+RESET provsql.compiled_circuit_cache_min_time;
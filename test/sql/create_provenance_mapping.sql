@@ -31,9 +31,47 @@ SELECT add_provenance('maint_src');
 SELECT create_provenance_mapping('maint_map', 'maint_src', 'lbl', maintained => true);
 INSERT INTO maint_src(id, lbl) VALUES (2, 'two');
 SELECT value FROM maint_map ORDER BY value;
+-- The mapping is extended once per statement: a multi-row INSERT ... SELECT
+-- adds all its rows, and in a statement that mixes minted and supplied
+-- tokens only the rows that got a fresh token are added.
+INSERT INTO maint_src(id, lbl) SELECT i, 'n' || i FROM generate_series(3, 5) i;
+INSERT INTO maint_src(id, lbl, provsql)
+  VALUES (6, 'six', NULL),
+         (7, 'seven', (SELECT provsql FROM maint_src WHERE id = 1));
+SELECT value FROM maint_map ORDER BY value;
+SELECT count(*) FROM maint_src s
+  JOIN maint_map m ON m.provenance = s.provsql AND m.value = s.lbl;
+-- The same in bulk: every other row re-inserted with its token is left out.
+INSERT INTO maint_src(id, lbl, provsql)
+  SELECT id + 100, lbl || '+', CASE WHEN id % 2 = 0 THEN provsql END
+  FROM maint_src WHERE id BETWEEN 1 AND 5;
+SELECT value FROM maint_map WHERE value LIKE '%+' ORDER BY value;
 DROP TABLE maint_map;
+-- Dropping the last maintained mapping drops the statement triggers.
+SELECT tgname FROM pg_trigger
+ WHERE tgrelid = 'maint_src'::regclass AND tgname LIKE 'provenance_mapping%';
 DROP TABLE maint_src;
 
+-- Statements into two tables need not close in the order they opened: in
+-- a data-modifying WITH, the outer INSERT's statement triggers fire
+-- first.  Each table's mapping still gets the rows of its own statement.
+CREATE TABLE maint_a(id int, lbl text);
+CREATE TABLE maint_b(id int, lbl text);
+SELECT add_provenance('maint_a');
+SELECT add_provenance('maint_b');
+SELECT create_provenance_mapping('maint_a_map', 'maint_a', 'lbl', maintained => true);
+SELECT create_provenance_mapping('maint_b_map', 'maint_b', 'lbl', maintained => true);
+WITH x AS (
+  INSERT INTO maint_b(id, lbl) VALUES (1, 'b1'), (2, 'b2'), (3, 'b3')
+  RETURNING id)
+INSERT INTO maint_a(id, lbl) SELECT id, 'a' || id FROM x ORDER BY id LIMIT 1;
+SELECT value FROM maint_a_map ORDER BY value;
+SELECT value FROM maint_b_map ORDER BY value;
+DROP TABLE maint_a_map;
+DROP TABLE maint_b_map;
+DROP TABLE maint_a;
+DROP TABLE maint_b;
+
 -- NULL mapping values: a mapping row whose value is NULL contributes
 -- no entry, leaving the leaf unnamed (the semiring's one() for a proper
 -- semiring, its abbreviated UUID under the rendering sr_formula --
@@ -0,0 +1,51 @@
+\set ECHO none
+\pset format unaligned
+
+-- A lookup is answered from the backend's read-only mapping of the store
+-- when the worker has nothing pending, and by the worker otherwise: the
+-- answers are the same either way, for gates created earlier, for gates
+-- created in the same statement, and for tokens the store does not hold.
+
+SELECT current_setting('provsql.direct_store_reads') AS direct_store_reads_default;
+
+CREATE TABLE dr_t (name text, p float8);
+INSERT INTO dr_t VALUES ('alice', 0.5), ('bob', 0.25), ('carol', 0.75);
+SELECT add_provenance('dr_t');
+DO $$ BEGIN PERFORM set_prob(provenance(), p) FROM dr_t; END $$;
+
+CREATE TABLE dr_tok AS SELECT name, provenance() AS tok FROM dr_t;
+SELECT remove_provenance('dr_tok');
+
+SELECT name, get_gate_type(tok) AS type, get_prob(tok) AS prob,
+       cardinality(get_children(tok)) AS nb_children
+  FROM dr_tok ORDER BY name;
+
+SELECT get_gate_type(t) AS type, cardinality(get_children(t)) AS nb_children,
+       round(probability_evaluate(t)::numeric, 4) AS prob
+  FROM (SELECT provenance_times(a.tok, b.tok) AS t
+          FROM dr_tok a, dr_tok b WHERE a.name = 'alice' AND b.name = 'bob') s;
+
+SELECT get_gate_type(u) AS type, get_prob(u) IS NULL AS no_prob,
+       cardinality(get_children(u)) AS nb_children
+  FROM (SELECT public.uuid_generate_v4() AS u) s;
+
+-- Every lookup through the worker, as before.
+SET provsql.direct_store_reads = off;
+
+SELECT name, get_gate_type(tok) AS type, get_prob(tok) AS prob,
+       cardinality(get_children(tok)) AS nb_children
+  FROM dr_tok ORDER BY name;
+
+SELECT get_gate_type(t) AS type, cardinality(get_children(t)) AS nb_children,
+       round(probability_evaluate(t)::numeric, 4) AS prob
+  FROM (SELECT provenance_times(a.tok, c.tok) AS t
+          FROM dr_tok a, dr_tok c WHERE a.name = 'alice' AND c.name = 'carol') s;
+
+SELECT get_gate_type(u) AS type, get_prob(u) IS NULL AS no_prob,
+       cardinality(get_children(u)) AS nb_children
+  FROM (SELECT public.uuid_generate_v4() AS u) s;
+
+RESET provsql.direct_store_reads;
+
+DROP TABLE dr_tok;
+DROP TABLE dr_t;
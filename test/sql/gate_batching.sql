@@ -0,0 +1,49 @@
+\set ECHO none
+\pset format unaligned
+
+-- Gate creations need no reply, so a backend batches them and sends the
+-- batch at the end of the statement, before commit, or before any other
+-- message -- so a gate can be read back in the statement that created
+-- it, and the circuits built are the same either way.
+
+SELECT current_setting('provsql.batch_gate_creation') AS batch_gate_creation_default;
+
+CREATE TABLE gb_t (name text);
+INSERT INTO gb_t VALUES ('alice'), ('bob'), ('carol');
+SELECT add_provenance('gb_t');
+DO $$ BEGIN PERFORM set_prob(provenance(), 0.5) FROM gb_t; END $$;
+
+CREATE TABLE gb_tok AS SELECT name, provenance() AS tok FROM gb_t;
+SELECT remove_provenance('gb_tok');
+
+-- Created and evaluated in one statement: loading the circuit sends the
+-- pending batch first.
+SELECT round(probability_evaluate(provenance_times(a.tok, b.tok))::numeric, 4)
+         AS created_then_evaluated
+  FROM gb_tok a, gb_tok b WHERE a.name = 'alice' AND b.name = 'bob';
+
+-- A gate too wide for any batch goes on its own, after the batch.
+SELECT round(probability_evaluate(
+         provenance_plus(array_agg(public.uuid_generate_v4())))::numeric, 4)
+         AS wide_plus
+  FROM generate_series(1, 5000);
+
+-- A statement that fails drops its pending batch, and the session does
+-- not go on believing in the gates it held.
+SELECT provenance_times(a.tok, c.tok), 1 / (length(a.name) - 5)
+  FROM gb_tok a, gb_tok c WHERE a.name = 'alice' AND c.name = 'carol';
+SELECT round(probability_evaluate(provenance_times(a.tok, c.tok))::numeric, 4)
+         AS after_abort
+  FROM gb_tok a, gb_tok c WHERE a.name = 'alice' AND c.name = 'carol';
+
+-- One message per gate, as before.
+SET provsql.batch_gate_creation = off;
+SELECT round(probability_evaluate(provenance_plus(array_agg(tok)))::numeric, 4)
+         AS unbatched
+  FROM gb_tok;
+RESET provsql.batch_gate_creation;
+
+SELECT dangling_indices, unreferenced, bad_wires, bad_extra FROM check_store();
+
+DROP TABLE gb_tok;
+DROP TABLE gb_t;
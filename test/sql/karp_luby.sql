@@ -72,6 +72,13 @@ ORDER BY circuit;
 SELECT probability_evaluate(:shared,'karp-luby','100000')
      = probability_evaluate(:shared,'karp-luby','100000') AS reproducible;
 
+-- (vi) ... whatever provsql.sampler_threads: rounds are drawn a block at a
+--      time, each block from its own stream, and merged in block order.
+SELECT probability_evaluate(:shared,'karp-luby','100000') AS one_thread \gset
+SET provsql.sampler_threads = 4;
+SELECT probability_evaluate(:shared,'karp-luby','100000') = :one_thread AS thread_independent;
+RESET provsql.sampler_threads;
+
 -- (vii) the argument forms all resolve to the same DNF and estimate 0.29:
 --       samples=, bare integer, eps=, and eps=,delta=,max_samples=.
 SELECT round(probability_evaluate(:shared,'karp-luby','samples=300000')::numeric,2) AS samples_kw,
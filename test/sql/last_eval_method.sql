@@ -7,7 +7,7 @@
 -- so the expected output stays deterministic (monte-carlo in particular gives
 -- a non-deterministic value but a fixed method label).
 CREATE TABLE lem(id int);
-INSERT INTO lem SELECT generate_series(1,16);
+INSERT INTO lem SELECT generate_series(1,24);
 SELECT add_provenance('lem');
 DO $$ BEGIN PERFORM set_prob(provenance(), 0.5) FROM lem; END $$;
 
@@ -61,14 +61,14 @@ BEGIN
     ELSE acc := provenance_plus(ARRAY[acc, v[i]]); END IF;
   END LOOP;
   PERFORM set_config('lem.indep', acc::text, false);
-  -- (b) non-read-once, non-DNF ladder AND_i (v_i OR v_{i+1}) over 15 inputs
+  -- (b) non-read-once, non-DNF ladder AND_i (v_i OR v_{i+1}) over 24 inputs
   --     (treewidth 2): 'independent' throws, sieve does not apply, and after
   --     acquiring the degeneracy proxy the chooser finds tree-decomposition
-  --     cheaper than enumerating 2^15 worlds.
+  --     cheaper than enumerating 2^24 worlds.
   ors := ARRAY[]::uuid[];
-  FOR i IN 1..14 LOOP ors := ors || provenance_plus(ARRAY[v[i], v[i+1]]); END LOOP;
+  FOR i IN 1..23 LOOP ors := ors || provenance_plus(ARRAY[v[i], v[i+1]]); END LOOP;
   acc := ors[1];
-  FOR i IN 2..14 LOOP acc := provenance_times(acc, ors[i]); END LOOP;
+  FOR i IN 2..23 LOOP acc := provenance_times(acc, ors[i]); END LOOP;
   PERFORM set_config('lem.ladder', acc::text, false);
 END $$;
 RESET provsql.active;
@@ -0,0 +1,69 @@
+\set ECHO none
+\pset format unaligned
+
+-- Within a statement, a backend reuses the circuits it has loaded: a
+-- token evaluated again, and a token inside a circuit already loaded,
+-- get the same answers as with the cache off, and a probability written
+-- in the middle of a statement is seen by the evaluations after it.
+
+SELECT current_setting('provsql.loaded_circuit_cache') AS loaded_circuit_cache_default;
+
+CREATE TABLE lc_t (name text, p float8);
+INSERT INTO lc_t VALUES ('alice', 0.5), ('bob', 0.25), ('carol', 0.75);
+SELECT add_provenance('lc_t');
+DO $$ BEGIN PERFORM set_prob(provenance(), p) FROM lc_t; END $$;
+
+CREATE TABLE lc_tok AS SELECT name, provenance() AS tok FROM lc_t;
+SELECT remove_provenance('lc_tok');
+
+CREATE TABLE lc_pair AS
+  SELECT a.name || '+' || b.name AS name, provenance_times(a.tok, b.tok) AS tok
+    FROM lc_tok a, lc_tok b WHERE a.name < b.name;
+CREATE TABLE lc_any AS
+  SELECT provenance_plus(array_agg(tok ORDER BY name)) AS tok FROM lc_pair;
+
+-- The whole circuit, then each pair inside it, then the whole again.
+SELECT name, round(probability_evaluate(tok)::numeric, 4) AS prob
+  FROM (SELECT 0 AS o, 'any' AS name, tok FROM lc_any
+        UNION ALL SELECT 1, name, tok FROM lc_pair
+        UNION ALL SELECT 2, 'any', tok FROM lc_any) s
+ ORDER BY o, name;
+
+SET provsql.loaded_circuit_cache = 0;
+
+SELECT name, round(probability_evaluate(tok)::numeric, 4) AS prob
+  FROM (SELECT 0 AS o, 'any' AS name, tok FROM lc_any
+        UNION ALL SELECT 1, name, tok FROM lc_pair
+        UNION ALL SELECT 2, 'any', tok FROM lc_any) s
+ ORDER BY o, name;
+
+RESET provsql.loaded_circuit_cache;
+
+-- A gate given its probability between two evaluations of a circuit
+-- containing it.
+CREATE TABLE lc_u (name text);
+INSERT INTO lc_u VALUES ('dave');
+SELECT add_provenance('lc_u');
+CREATE TABLE lc_utok AS SELECT provenance() AS tok FROM lc_u;
+SELECT remove_provenance('lc_utok');
+
+CREATE FUNCTION lc_before_after(u uuid, t uuid, p float8,
+                                OUT before float8, OUT after float8) AS $$
+BEGIN
+  before := probability_evaluate(t);
+  PERFORM set_prob(u, p);
+  after := probability_evaluate(t);
+END
+$$ LANGUAGE plpgsql;
+
+SELECT round(before::numeric, 4) AS before, round(after::numeric, 4) AS after
+  FROM (SELECT (lc_before_after(u.tok, provenance_times(u.tok, a.tok), 0.2)).*
+          FROM lc_utok u, lc_tok a WHERE a.name = 'alice') s;
+
+DROP FUNCTION lc_before_after(uuid, uuid, float8);
+DROP TABLE lc_utok;
+DROP TABLE lc_u;
+DROP TABLE lc_any;
+DROP TABLE lc_pair;
+DROP TABLE lc_tok;
+DROP TABLE lc_t;
@@ -0,0 +1,61 @@
+\set ECHO none
+\pset format unaligned
+
+-- probability_evaluate_all returns, position by position, what
+-- probability_evaluate returns, whether the tokens' circuits are
+-- independent, overlap, repeat, or are missing.
+
+CREATE TABLE pea_t (name text, p float8);
+INSERT INTO pea_t VALUES ('alice', 0.5), ('bob', 0.25), ('carol', 0.75);
+SELECT add_provenance('pea_t');
+DO $$ BEGIN PERFORM set_prob(provenance(), p) FROM pea_t; END $$;
+
+CREATE TABLE pea_tok AS SELECT name, provenance() AS tok FROM pea_t;
+SELECT remove_provenance('pea_tok');
+
+CREATE TABLE pea_pair AS
+  SELECT a.name || '+' || b.name AS name, provenance_times(a.tok, b.tok) AS tok
+    FROM pea_tok a, pea_tok b WHERE a.name < b.name;
+
+-- Pairs sharing a person: these circuits overlap and are not
+-- independent, so they are read off one shared d-DNNF.
+CREATE TABLE pea_or AS
+  SELECT a.name || ' or ' || b.name AS name,
+         provenance_plus(ARRAY[a.tok, b.tok]) AS tok
+    FROM pea_pair a, pea_pair b WHERE a.name < b.name;
+
+CREATE TABLE pea_all AS
+  SELECT 1 AS o, name, tok FROM pea_pair
+  UNION ALL SELECT 2, name, tok FROM pea_or
+  UNION ALL SELECT 3, 'none', NULL
+  UNION ALL SELECT 4, name, tok FROM pea_or WHERE name = 'alice+bob or alice+carol';
+
+SELECT a.name, round(a.prob::numeric, 5) AS prob,
+       a.prob IS NOT DISTINCT FROM probability_evaluate(a.tok) AS same
+  FROM (SELECT unnest(array_agg(o ORDER BY o, name)) AS o,
+               unnest(array_agg(name ORDER BY o, name)) AS name,
+               unnest(array_agg(tok ORDER BY o, name)) AS tok,
+               unnest(probability_evaluate_all(array_agg(tok ORDER BY o, name))) AS prob
+          FROM pea_all) a
+ ORDER BY a.o, a.name;
+
+SELECT probability_evaluate_all(ARRAY[]::uuid[]) AS empty,
+       probability_evaluate_all(NULL) AS null_array,
+       probability_evaluate_all(ARRAY[NULL]::uuid[]) AS null_token;
+
+-- Over query results.
+CREATE TABLE pea_result AS
+  SELECT city, provenance() AS tok FROM personnel GROUP BY city;
+SELECT remove_provenance('pea_result');
+
+SELECT bool_and(abs(p.prob - probability_evaluate(p.tok)) < 1e-9) AS all_same
+  FROM (SELECT unnest(array_agg(tok)) AS tok,
+               unnest(probability_evaluate_all(array_agg(tok))) AS prob
+          FROM pea_result) p;
+
+DROP TABLE pea_result;
+DROP TABLE pea_all;
+DROP TABLE pea_or;
+DROP TABLE pea_pair;
+DROP TABLE pea_tok;
+DROP TABLE pea_t;
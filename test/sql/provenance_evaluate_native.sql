@@ -0,0 +1,136 @@
+\set ECHO none
+\pset format unaligned
+
+-- provenance_evaluate over user-defined semirings, evaluated natively
+-- (the aggregates' transition functions called directly, every gate of
+-- the circuit once) or, for a semiring it cannot call that way, through
+-- the PL/pgSQL version.  Both must agree, with each other and with the
+-- PL/pgSQL version called directly.
+
+CREATE TABLE ne_t(id int, cnt int);
+INSERT INTO ne_t VALUES (1, 2), (2, 3), (3, 5), (4, 7), (5, NULL);
+SELECT add_provenance('ne_t');
+SELECT create_provenance_mapping('ne_map', 'ne_t', 'cnt');
+
+-- A DAG: s = x+y is shared by t1 = s*z, t2 = s*w and d = t1+t2+s; m
+-- subtracts x*z from d.  v is mapped to NULL, which reads as the
+-- semiring's one.  zt and zp have a zero gate as a child.
+CREATE TABLE ne_tok(name text, token uuid);
+DO $$
+DECLARE x uuid; y uuid; z uuid; w uuid; v uuid;
+        s uuid; t1 uuid; t2 uuid; d uuid; zt uuid; zp uuid;
+BEGIN
+  SELECT provsql INTO x FROM ne_t WHERE id = 1;
+  SELECT provsql INTO y FROM ne_t WHERE id = 2;
+  SELECT provsql INTO z FROM ne_t WHERE id = 3;
+  SELECT provsql INTO w FROM ne_t WHERE id = 4;
+  SELECT provsql INTO v FROM ne_t WHERE id = 5;
+  s  := provenance_plus(ARRAY[x, y]);
+  t1 := provenance_times(s, z);
+  t2 := provenance_times(s, w);
+  d  := provenance_plus(ARRAY[t1, t2, s]);
+  zt := public.uuid_generate_v5(uuid_ns_provsql(), concat('ne-zero-times', x));
+  PERFORM create_gate(zt, 'times', ARRAY[x, gate_zero()]);
+  zp := public.uuid_generate_v5(uuid_ns_provsql(), concat('ne-zero-plus', x));
+  PERFORM create_gate(zp, 'plus', ARRAY[x, gate_zero()]);
+  INSERT INTO ne_tok VALUES
+    ('s', s), ('d', d),
+    ('m', provenance_monus(d, provenance_times(x, z))),
+    ('nv', provenance_times(v, z)), ('pv', provenance_plus(ARRAY[v, x])),
+    ('zero', gate_zero()), ('zt', zt), ('zp', zp);
+END $$;
+
+-- Counting, natively: strict transition functions with an initial state
+CREATE AGGREGATE ne_plus(integer) (sfunc = int4pl, stype = integer, initcond = 0);
+CREATE AGGREGATE ne_times(integer) (sfunc = int4mul, stype = integer, initcond = 1);
+CREATE FUNCTION ne_monus(a integer, b integer) RETURNS integer AS
+  $$ SELECT greatest(a - b, 0) $$ LANGUAGE SQL IMMUTABLE STRICT;
+-- Counting again, over aggregates of bigint: not the element type, so
+-- provenance_evaluate falls back to the PL/pgSQL version
+CREATE AGGREGATE ne_plus8(bigint) (sfunc = int8pl, stype = bigint, initcond = 0);
+CREATE AGGREGATE ne_times8(bigint) (sfunc = int8mul, stype = bigint, initcond = 1);
+
+SELECT name,
+       provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus') AS counting,
+       provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus')
+         = provenance_evaluate(token, 'ne_map', 1, 'ne_plus8', 'ne_times8', 'ne_monus') AS same_as_fallback,
+       provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus')
+         = provenance_evaluate(token, 'ne_map', 1, 'integer', 'ne_plus', 'ne_times', 'ne_monus', NULL) AS same_as_plpgsql
+FROM ne_tok WHERE name IN ('s', 'd', 'm', 'nv', 'pv')
+ORDER BY name;
+
+-- Zero gates: the plus aggregate over no value
+SELECT name,
+       provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus') AS counting
+FROM ne_tok WHERE name IN ('zero', 'zt', 'zp')
+ORDER BY name;
+
+-- Max-min: strict transition functions without an initial state, which
+-- take the first value as the state and skip NULLs.  The plus aggregate
+-- over no value, a zero gate, is NULL; the times aggregate then skips it.
+CREATE AGGREGATE ne_max(integer) (sfunc = int4larger, stype = integer);
+CREATE AGGREGATE ne_min(integer) (sfunc = int4smaller, stype = integer);
+
+SELECT name,
+       provenance_evaluate(token, 'ne_map', 1000, 'ne_max', 'ne_min') AS maxmin,
+       provenance_evaluate(token, 'ne_map', 1000, 'ne_max', 'ne_min')
+         = provenance_evaluate(token, 'ne_map', 1000, 'integer', 'ne_max', 'ne_min', NULL, NULL) AS same_as_plpgsql
+FROM ne_tok WHERE name IN ('s', 'd', 'nv', 'pv')
+ORDER BY name;
+
+SELECT name,
+       provenance_evaluate(token, 'ne_map', 1000, 'ne_max', 'ne_min') AS maxmin
+FROM ne_tok WHERE name IN ('zero', 'zt', 'zp')
+ORDER BY name;
+
+-- The operations are called directly, so the EXECUTE privileges a query
+-- calling them would need are checked.  The DO/EXCEPTION wrappers key on
+-- the SQLSTATE, the core message being translated.
+CREATE ROLE provsql_ne_unpriv NOSUPERUSER;
+GRANT USAGE ON SCHEMA provsql_test, provsql TO provsql_ne_unpriv;
+GRANT SELECT ON ne_tok, ne_map TO provsql_ne_unpriv;
+
+REVOKE EXECUTE ON FUNCTION ne_plus(integer) FROM PUBLIC;
+SET ROLE provsql_ne_unpriv;
+DO $$
+BEGIN
+  PERFORM provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus')
+    FROM ne_tok WHERE name = 'd';
+  RAISE NOTICE 'BUG: plus aggregate called without EXECUTE';
+EXCEPTION WHEN insufficient_privilege THEN
+  RAISE NOTICE 'EXECUTE on the plus aggregate refused';
+END $$;
+RESET ROLE;
+GRANT EXECUTE ON FUNCTION ne_plus(integer) TO PUBLIC;
+
+REVOKE EXECUTE ON FUNCTION ne_monus(integer, integer) FROM PUBLIC;
+SET ROLE provsql_ne_unpriv;
+DO $$
+BEGIN
+  PERFORM provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus')
+    FROM ne_tok WHERE name = 'm';
+  RAISE NOTICE 'BUG: monus function called without EXECUTE';
+EXCEPTION WHEN insufficient_privilege THEN
+  RAISE NOTICE 'EXECUTE on the monus function refused';
+END $$;
+RESET ROLE;
+GRANT EXECUTE ON FUNCTION ne_monus(integer, integer) TO PUBLIC;
+
+SET ROLE provsql_ne_unpriv;
+SELECT provenance_evaluate(token, 'ne_map', 1, 'ne_plus', 'ne_times', 'ne_monus') AS counting
+FROM ne_tok WHERE name = 'm';
+RESET ROLE;
+
+DROP OWNED BY provsql_ne_unpriv;
+DROP ROLE provsql_ne_unpriv;
+
+DROP TABLE ne_tok;
+DROP TABLE ne_map;
+DROP TABLE ne_t;
+DROP AGGREGATE ne_plus(integer);
+DROP AGGREGATE ne_times(integer);
+DROP AGGREGATE ne_plus8(bigint);
+DROP AGGREGATE ne_times8(bigint);
+DROP AGGREGATE ne_max(integer);
+DROP AGGREGATE ne_min(integer);
+DROP FUNCTION ne_monus(integer, integer);
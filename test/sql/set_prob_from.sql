@@ -0,0 +1,71 @@
+\set ECHO none
+\pset format unaligned
+
+-- set_prob_from writes the probabilities a relation lists, in batches,
+-- under the same rules as set_prob: written once, re-writable with the
+-- identical value, and cleared by a rollback.
+
+CREATE TABLE spf_t (name text, p double precision);
+INSERT INTO spf_t VALUES ('alice', 0.25), ('bob', 0.5), ('carol', NULL);
+SELECT add_provenance('spf_t');
+
+-- Rows with a NULL probability are skipped.
+SELECT set_prob_from('spf_t', 'p') AS written;
+SET provsql.active = off;
+SELECT name, probability_is_set(provsql) AS is_set, get_prob(provsql) AS prob
+  FROM spf_t ORDER BY name;
+SET provsql.active = on;
+
+-- Re-running is a no-op.
+SELECT set_prob_from('spf_t', 'p') AS written;
+
+-- Tokens can come from any relation: here a mapping table naming its own
+-- token column.  A different value is refused, as set_prob refuses it.
+SET provsql.active = off;
+CREATE TABLE spf_map AS SELECT provsql AS tok, 0.75::float8 AS prob
+  FROM spf_t WHERE name = 'bob';
+SET provsql.active = on;
+DO $$ BEGIN
+  PERFORM set_prob_from('spf_map', 'prob', 'tok');
+  RAISE NOTICE 'rewriting a probability was accepted';
+EXCEPTION WHEN others THEN
+  RAISE NOTICE 'refused: %', regexp_replace(SQLERRM, '[0-9a-f-]{36}', '<token>');
+END $$;
+
+-- Out-of-range values and unknown columns are refused.
+CREATE TABLE spf_bad (tok uuid, p float8);
+INSERT INTO spf_bad VALUES (public.uuid_generate_v4(), 1.5);
+DO $$ BEGIN
+  PERFORM set_prob_from('spf_bad', 'p', 'tok');
+EXCEPTION WHEN others THEN RAISE NOTICE 'refused: %', SQLERRM;
+END $$;
+DO $$ BEGIN
+  PERFORM set_prob_from('spf_t', 'q');
+EXCEPTION WHEN others THEN RAISE NOTICE 'refused: %', SQLERRM;
+END $$;
+
+-- More rows than one batch holds; a rollback clears them all, and the
+-- load can then be made again.
+CREATE TABLE spf_big AS
+  SELECT i, (i % 10) / 10.0 AS p FROM generate_series(1, 20000) AS i;
+SELECT add_provenance('spf_big');
+BEGIN;
+SELECT set_prob_from('spf_big', 'p') AS written;
+SET provsql.active = off;
+SELECT count(*) FILTER (WHERE probability_is_set(provsql)) AS set_inside_txn
+  FROM spf_big;
+SET provsql.active = on;
+ROLLBACK;
+SET provsql.active = off;
+SELECT count(*) FILTER (WHERE probability_is_set(provsql)) AS set_after_rollback
+  FROM spf_big;
+SET provsql.active = on;
+SELECT set_prob_from('spf_big', 'p') AS written;
+SET provsql.active = off;
+SELECT round(sum(get_prob(provsql))::numeric, 6) AS total FROM spf_big;
+SET provsql.active = on;
+
+DROP TABLE spf_t;
+DROP TABLE spf_map;
+DROP TABLE spf_bad;
+DROP TABLE spf_big;
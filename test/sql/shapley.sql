@@ -51,6 +51,33 @@ ORDER BY city, name;
 
 DROP TABLE shapley_result;
 
+-- With every probability 1, shapley_all_vars and banzhaf_all_vars take
+-- the deterministic path of the one-pass computation: each value still
+-- agrees with shapley() or banzhaf() called on its variable alone
+CREATE TABLE shapley_result1 AS
+    SELECT city, provenance() FROM (
+       (SELECT DISTINCT city FROM personnel)
+     EXCEPT
+       (SELECT p1.city
+       FROM personnel p1, personnel p2
+       WHERE p1.city = p2.city AND p1.id < p2.id
+       GROUP BY p1.city
+       ORDER BY p1.city)
+       ) t;
+SELECT remove_provenance('shapley_result1');
+
+SELECT city, COUNT(*) AS variables,
+       COUNT(*) FILTER (WHERE abs(s.value - shapley(provenance, s.variable)) < 1e-9) AS shapley_agree
+FROM shapley_result1, shapley_all_vars(provenance) s
+GROUP BY city ORDER BY city;
+
+SELECT city, COUNT(*) AS variables,
+       COUNT(*) FILTER (WHERE abs(b.value - banzhaf(provenance, b.variable)) < 1e-9) AS banzhaf_agree
+FROM shapley_result1, banzhaf_all_vars(provenance) b
+GROUP BY city ORDER BY city;
+
+DROP TABLE shapley_result1;
+
 -- Put back the original probability values, the same way.
 UPDATE personnel SET provsql = provsql.replace_input(provsql, id*1./10);
 
@@ -71,5 +98,11 @@ CREATE TABLE shapley_result2 AS
 SELECT city, ROUND(value::numeric,3) AS shapley FROM shapley_result2
 ORDER BY city, shapley;
 
+-- shapley_all_vars obtains every value in one pass over the d-DNNF:
+-- each agrees with shapley() called on its variable alone
+SELECT city, COUNT(*) AS agree FROM shapley_result2
+WHERE abs(value - shapley(provenance, variable)) < 1e-9
+GROUP BY city ORDER BY city;
+
 DROP TABLE shapley_result1;
 DROP TABLE shapley_result2;
@@ -73,6 +73,13 @@ ORDER BY circuit;
 SELECT probability_evaluate(:shared,'stopping-rule','eps=0.05,delta=0.01')
      = probability_evaluate(:shared,'stopping-rule','eps=0.05,delta=0.01') AS reproducible;
 
+-- ... and do not depend on provsql.sampler_threads: every block of worlds
+-- draws from its own stream, and blocks are merged in order.
+SELECT probability_evaluate(:shared,'stopping-rule','eps=0.05,delta=0.01') AS one_thread \gset
+SET provsql.sampler_threads = 4;
+SELECT probability_evaluate(:shared,'stopping-rule','eps=0.05,delta=0.01') = :one_thread AS thread_independent;
+RESET provsql.sampler_threads;
+
 -- argument grammar: eps-only and eps+delta+max_samples are accepted and land
 -- in range (0.29); a fixed sample count is rejected (adaptive only).
 SELECT abs(probability_evaluate(:shared,'stopping-rule','eps=0.1') - 0.29) <= 0.05      AS eps_only,
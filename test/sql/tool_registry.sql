@@ -94,6 +94,15 @@ SELECT set_tool_enabled('sharpsat-td', false);
 SELECT set_tool_enabled('weightmc', false);
 SELECT set_tool_enabled('dpmc', false);
 SELECT probability_evaluate(provsql, 'wmc') FROM tr_r;
+-- A template naming {stdin} / {stdout} drives the tool through pipes: this
+-- stand-in counter consumes the CNF on its standard input and prints its
+-- count on its standard output.
+SELECT register_tool('pipe-wmc', executable => 'sh',
+                     operations => ARRAY['wmc'],
+                     input_formats => ARRAY['dimacs-cnf'],
+                     output_format => 'decimal', parser => 'wmc-line',
+                     argtpl => '-c ''wc -l >/dev/null; echo c s exact arb float 0.25'' < {stdin} > {stdout}');
+SELECT probability_evaluate(provsql, 'wmc', 'pipe-wmc') FROM tr_r;
 DROP TABLE tr_r;
 
 -- The mutators are superuser-only: execute is revoked from PUBLIC.